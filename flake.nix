@@ -4,9 +4,14 @@
   inputs = {
     nixpkgs.url = "github:NixOS/nixpkgs/nixpkgs-23.11-darwin";
     flake-utils.url = "github:numtide/flake-utils";
+    # The sources use the COLMAP 3.9 API (colmap/scene, Rigid3d, CreateSiftFeatureExtractor)
+    colmap-src = {
+      url = "github:colmap/colmap/3.9.1";
+      flake = false;
+    };
   };
 
-  outputs = { self, nixpkgs, flake-utils }:
+  outputs = { self, nixpkgs, flake-utils, colmap-src }:
     flake-utils.lib.eachDefaultSystem (system:
       let
         pkgs = import nixpkgs {
@@ -155,14 +160,9 @@
         packages = {
           colmap = pkgs.stdenv.mkDerivation {
             pname = "colmap";
-            version = "3.8";
+            version = "3.9.1";
             
-            src = pkgs.fetchFromGitHub {
-              owner = "colmap";
-              repo = "colmap";
-              rev = "3.8";
-              sha256 = "sha256-FWVyUxrJ2lBP5tgYLBLXOPRV0QxNxv28A96rMsJZduw=";
-            };
+            src = colmap-src;
             
             nativeBuildInputs = with pkgs; [ cmake ninja pkg-config ];
             buildInputs = baseDeps
@@ -0,0 +1,179 @@
+/**
+ * mvsnet.h - Learned multi-view stereo depth estimation
+ *
+ * This file defines a tiled, memory-bounded MVSNet depth engine that runs
+ * on the CPU through ONNX Runtime and writes COLMAP depth and normal maps.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+#include <colmap/mvs/depth_map.h>
+#include <colmap/mvs/normal_map.h>
+#include <colmap/scene/reconstruction.h>
+#include <opencv2/core.hpp>
+
+#include "inference_session.h"
+
+class ModelLoader;
+
+/**
+ * MVSNet - Depth maps of an undistorted COLMAP workspace from a learned MVS network
+ *
+ * The network is an ONNX export with three inputs, in this order:
+ *   imgs           [1, V, 3, H, W]  reference view first, RGB scaled to [0, 1]
+ *   proj_matrices  [1, V, 4, 4]     K [R | t] per view, K in the pixels of that view's input
+ *   depth_values   [1, D]           depth hypotheses
+ * and the regularized cost volume as its first output, before the softmax:
+ *   logits         [1, D, h, w]     h = H / s, w = W / s for the network stride s
+ *
+ * The reference image is processed in overlapping tiles of tile_size, and
+ * every source view is cropped to the region the tile frustum projects to
+ * between the near and far depth, then resampled to the tile size (the
+ * crop and scale are folded into its K). The depth range comes from the
+ * sparse points seen by the reference image and is sampled uniformly in
+ * inverse depth.
+ *
+ * The D hypotheses are evaluated in chunks small enough for max_memory,
+ * in multiples of 8 as the 3D regularization downsamples the depth axis.
+ * Each chunk is run with a halo of half the network's receptive field on
+ * either side, and only the hypotheses it owns enter an online softmax
+ * that gives the depth expectation and the confidence (probability mass
+ * of the four hypotheses around the best one, as in MVSNet). The cost
+ * volume is allocated from the shared inference arena.
+ *
+ * Source views are picked by co-visibility in the sparse model, scored per
+ * shared point by the triangulation angle (MVSNet view selection).
+ *
+ * Not thread-safe; use one instance per concurrently processed image.
+ */
+class MVSNet {
+public:
+    struct Options {
+        // ONNX model
+        std::string model_path;
+        // Longest side of the depth maps, images are downsized like COLMAP's
+        // stereo (set fusion's max_image_size to the same value)
+        int max_image_size = 1600;
+        // Source views per reference view
+        int num_source_views = 4;
+        // Depth hypotheses, rounded up to a multiple of 8
+        int num_depths = 192;
+        // Receptive field of the cost volume regularization along the depth
+        // axis, in hypotheses (61 for MVSNet's 3D U-Net)
+        int depth_receptive_field = 61;
+        // Side of the square reference tiles, a multiple of 32
+        int tile_size = 512;
+        // Pixels shared by neighbouring tiles
+        int tile_overlap = 64;
+        // Bytes one image may use for the cost volume, 0 for all hypotheses at once
+        size_t max_memory = 0;
+        // Depths with a lower confidence are written as 0 (invalid)
+        float min_confidence = 0.3f;
+    };
+
+    /**
+     * Constructor
+     *
+     * @param loader Loader providing the environment and session settings
+     * @param options Model and tiling settings
+     */
+    MVSNet(const ModelLoader& loader, const Options& options);
+
+    /**
+     * Check whether the model was loaded
+     *
+     * @return true if depth maps can be computed
+     */
+    bool IsLoaded() const { return session_.IsLoaded(); }
+
+    /**
+     * Pick the source views of every registered image
+     *
+     * @param reconstruction Sparse model
+     * @param num_source_views Source views per image
+     * @return Source image ids per reference image id, best first
+     */
+    static std::unordered_map<colmap::image_t, std::vector<colmap::image_t>> SelectSourceViews(
+        const colmap::Reconstruction& reconstruction, int num_source_views);
+
+    /**
+     * Estimate the peak memory of one ComputeDepthMap() call
+     *
+     * @param options Model and tiling settings
+     * @return Bytes used by images, tensors and the cost volume
+     */
+    static size_t EstimateMemory(const Options& options);
+
+    /**
+     * Estimate the cost volume part of EstimateMemory(), which the
+     * inference session allocates from its arena
+     *
+     * @param options Model and tiling settings
+     * @return Bytes used by one cost volume chunk and its halos
+     */
+    static size_t EstimateCostVolumeMemory(const Options& options);
+
+    /**
+     * Compute the depth and normal map of one image
+     *
+     * @param reconstruction Undistorted sparse model (pinhole cameras)
+     * @param image_path Folder of the undistorted images
+     * @param image_id Reference image
+     * @param source_ids Source images
+     * @param depth_map Receives the depth map
+     * @param normal_map Receives normals in camera coordinates, facing the camera
+     * @return true on success
+     */
+    bool ComputeDepthMap(const colmap::Reconstruction& reconstruction,
+                         const std::string& image_path,
+                         colmap::image_t image_id,
+                         const std::vector<colmap::image_t>& source_ids,
+                         colmap::mvs::DepthMap* depth_map,
+                         colmap::mvs::NormalMap* normal_map);
+
+private:
+    struct View {
+        cv::Mat image;             // RGB float at the depth map scale
+        Eigen::Matrix3d K;
+        Eigen::Matrix<double, 3, 4> cam_from_world;
+    };
+
+    // Per-pixel online softmax state of a tile, at the network output resolution
+    struct TileVolume {
+        int width = 0;
+        int height = 0;
+        std::vector<float> max_logit;
+        std::vector<float> sum_exp;
+        std::vector<float> sum_depth;
+        std::vector<float> best_logit;
+        std::vector<float> best_window;
+    };
+
+    bool LoadView(const colmap::Reconstruction& reconstruction, const std::string& image_path,
+                  colmap::image_t image_id, View* view) const;
+    bool EstimateDepthRange(const colmap::Reconstruction& reconstruction,
+                            colmap::image_t image_id, const View& reference,
+                            float* depth_min, float* depth_max) const;
+    void PrepareSource(const View& reference, const View& source, int tile_x, int tile_y,
+                       float depth_min, float depth_max, float* pixels,
+                       Eigen::Matrix4f* projection) const;
+    bool RunTile(const std::vector<View>& views, int tile_x, int tile_y,
+                 const std::vector<float>& depths, TileVolume* volume);
+
+    Options options_;
+    InferenceSession session_;
+    std::array<std::string, 3> input_names_;
+
+    // Reused between tiles and chunks
+    std::vector<float> images_;
+    std::vector<float> projections_;
+    std::vector<float> depth_values_;
+};
@@ -0,0 +1,567 @@
+/**
+ * mvsnet.cc - Learned multi-view stereo depth estimation
+ */
+
+#include "mvsnet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <Eigen/Dense>
+#include <colmap/util/misc.h>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "model_loader.h"
+
+namespace {
+
+// Cost volume size model: warped features of every view and the
+// regularization activations, per hypothesis and output pixel
+constexpr size_t kFeatureChannels = 32;
+constexpr size_t kActivationFactor = 3;
+constexpr int kNetworkStride = 4;
+
+// The 3D regularization halves the depth axis three times, so chunks hold
+// multiples of 8 hypotheses and start on multiples of 8
+constexpr int kDepthAlignment = 8;
+
+// MVSNet view selection: preferred triangulation angle and spread in degrees
+constexpr double kPreferredAngle = 5.0;
+constexpr double kSigmaBelow = 1.0;
+constexpr double kSigmaAbove = 10.0;
+
+int NumViews(const MVSNet::Options& options) {
+    return 1 + std::max(1, options.num_source_views);
+}
+
+int AlignDepths(int count) {
+    return (count + kDepthAlignment - 1) / kDepthAlignment * kDepthAlignment;
+}
+
+int NumDepths(const MVSNet::Options& options) {
+    return AlignDepths(std::max(kDepthAlignment, options.num_depths));
+}
+
+// Hypotheses added on either side of a chunk, so the hypotheses it owns see
+// their whole receptive field
+int ChunkHalo(const MVSNet::Options& options) {
+    return AlignDepths(std::max(1, options.depth_receptive_field) / 2);
+}
+
+size_t FixedBytes(const MVSNet::Options& options) {
+    const size_t views = NumViews(options);
+    const size_t image_pixels = static_cast<size_t>(options.max_image_size) * options.max_image_size;
+    const size_t tile_pixels = static_cast<size_t>(options.tile_size) * options.tile_size;
+    // Float RGB views, input tensor, and depth, confidence and border maps
+    return views * image_pixels * 3 * sizeof(float) + views * tile_pixels * 3 * sizeof(float) +
+           image_pixels * 3 * sizeof(float);
+}
+
+size_t BytesPerHypothesis(const MVSNet::Options& options) {
+    const size_t output_side = options.tile_size / kNetworkStride;
+    return NumViews(options) * kFeatureChannels * kActivationFactor * sizeof(float) *
+           output_side * output_side;
+}
+
+int ChunkSize(const MVSNet::Options& options) {
+    const int num_depths = NumDepths(options);
+    const int halo = ChunkHalo(options);
+    if (options.max_memory == 0 ||
+        options.max_memory / BytesPerHypothesis(options) >= static_cast<size_t>(num_depths)) {
+        return num_depths;
+    }
+    const int window = static_cast<int>(options.max_memory / BytesPerHypothesis(options));
+    const int chunk = std::max(kDepthAlignment, (window - 2 * halo) / kDepthAlignment * kDepthAlignment);
+    // A chunk whose halos span the whole range costs as much as a single pass
+    return chunk + 2 * halo >= num_depths ? num_depths : chunk;
+}
+
+// Hypotheses evaluated per chunk: the chunk and its halos, at most all of them
+int ChunkWindow(const MVSNet::Options& options) {
+    return std::min(NumDepths(options), ChunkSize(options) + 2 * ChunkHalo(options));
+}
+
+// Tile origins along one axis: the last tile ends at the image border
+std::vector<int> TileOrigins(int size, int tile_size, int overlap) {
+    std::vector<int> origins;
+    if (size <= tile_size) {
+        origins.push_back(0);
+        return origins;
+    }
+    const int step = std::max(1, tile_size - overlap);
+    for (int origin = 0;; origin += step) {
+        if (origin + tile_size >= size) {
+            origins.push_back(size - tile_size);
+            break;
+        }
+        origins.push_back(origin);
+    }
+    return origins;
+}
+
+// Planar RGB copy of an image region into a zero-filled tensor plane set
+void CopyPlanes(const cv::Mat& rgb, float* planes, int tile_size) {
+    const size_t plane_size = static_cast<size_t>(tile_size) * tile_size;
+    for (int y = 0; y < rgb.rows; ++y) {
+        const cv::Vec3f* row = rgb.ptr<cv::Vec3f>(y);
+        for (int x = 0; x < rgb.cols; ++x) {
+            const size_t offset = static_cast<size_t>(y) * tile_size + x;
+            planes[offset] = row[x][0];
+            planes[plane_size + offset] = row[x][1];
+            planes[2 * plane_size + offset] = row[x][2];
+        }
+    }
+}
+
+// 4x4 projection for the network: pixel centers at integer coordinates
+Eigen::Matrix4f NetworkProjection(const Eigen::Matrix3d& K,
+                                  const Eigen::Matrix<double, 3, 4>& cam_from_world) {
+    Eigen::Matrix3d K_index = K;
+    K_index(0, 2) -= 0.5;
+    K_index(1, 2) -= 0.5;
+    Eigen::Matrix4d projection = Eigen::Matrix4d::Identity();
+    projection.topRows<3>() = K_index * cam_from_world;
+    return projection.cast<float>();
+}
+
+}  // namespace
+
+MVSNet::MVSNet(const ModelLoader& loader, const Options& options)
+    : options_(options),
+      session_(loader, options.model_path, InferenceSession::Options{true, 2}) {
+    options_.tile_size = std::max(32, options_.tile_size / 32 * 32);
+    options_.tile_overlap = std::clamp(options_.tile_overlap, 0, options_.tile_size / 2);
+    options_.num_depths = NumDepths(options_);
+    if (session_.IsLoaded() && session_.GetInputCount() < 3) {
+        std::cerr << "Error: MVSNet model needs images, projections and depth values as inputs"
+                  << std::endl;
+        return;
+    }
+    for (size_t i = 0; session_.IsLoaded() && i < input_names_.size(); ++i) {
+        input_names_[i] = session_.GetInputName(i);
+    }
+}
+
+std::unordered_map<colmap::image_t, std::vector<colmap::image_t>> MVSNet::SelectSourceViews(
+        const colmap::Reconstruction& reconstruction, int num_source_views) {
+    std::unordered_map<colmap::image_t, Eigen::Vector3d> centers;
+    for (const colmap::image_t image_id : reconstruction.RegImageIds()) {
+        centers.emplace(image_id, reconstruction.Image(image_id).ProjectionCenter());
+    }
+
+    std::unordered_map<colmap::image_t, std::unordered_map<colmap::image_t, double>> scores;
+    for (const auto& entry : reconstruction.Points3D()) {
+        const colmap::Point3D& point = entry.second;
+        const auto& elements = point.track.Elements();
+        for (size_t i = 0; i < elements.size(); ++i) {
+            const auto center_i = centers.find(elements[i].image_id);
+            if (center_i == centers.end()) {
+                continue;
+            }
+            const Eigen::Vector3d ray_i = (point.xyz - center_i->second).normalized();
+            for (size_t j = i + 1; j < elements.size(); ++j) {
+                const auto center_j = centers.find(elements[j].image_id);
+                if (center_j == centers.end() || elements[j].image_id == elements[i].image_id) {
+                    continue;
+                }
+                const Eigen::Vector3d ray_j = (point.xyz - center_j->second).normalized();
+                const double angle =
+                    std::acos(std::clamp(ray_i.dot(ray_j), -1.0, 1.0)) * 180.0 / M_PI;
+                const double sigma = angle <= kPreferredAngle ? kSigmaBelow : kSigmaAbove;
+                const double offset = (angle - kPreferredAngle) / sigma;
+                const double score = std::exp(-0.5 * offset * offset);
+                scores[elements[i].image_id][elements[j].image_id] += score;
+                scores[elements[j].image_id][elements[i].image_id] += score;
+            }
+        }
+    }
+
+    std::unordered_map<colmap::image_t, std::vector<colmap::image_t>> sources;
+    for (const auto& entry : scores) {
+        std::vector<std::pair<double, colmap::image_t>> ranked;
+        ranked.reserve(entry.second.size());
+        for (const auto& neighbor : entry.second) {
+            ranked.emplace_back(neighbor.second, neighbor.first);
+        }
+        const size_t count = std::min(ranked.size(), static_cast<size_t>(std::max(1, num_source_views)));
+        std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+                          [](const auto& a, const auto& b) { return a.first > b.first; });
+        std::vector<colmap::image_t>& image_sources = sources[entry.first];
+        for (size_t i = 0; i < count; ++i) {
+            image_sources.push_back(ranked[i].second);
+        }
+    }
+    return sources;
+}
+
+size_t MVSNet::EstimateMemory(const Options& options) {
+    return FixedBytes(options) + EstimateCostVolumeMemory(options);
+}
+
+size_t MVSNet::EstimateCostVolumeMemory(const Options& options) {
+    return ChunkWindow(options) * BytesPerHypothesis(options);
+}
+
+bool MVSNet::ComputeDepthMap(const colmap::Reconstruction& reconstruction,
+                             const std::string& image_path,
+                             colmap::image_t image_id,
+                             const std::vector<colmap::image_t>& source_ids,
+                             colmap::mvs::DepthMap* depth_map,
+                             colmap::mvs::NormalMap* normal_map) {
+    if (!session_.IsLoaded() || input_names_[2].empty()) {
+        return false;
+    }
+
+    std::vector<View> views(1);
+    if (!LoadView(reconstruction, image_path, image_id, &views[0])) {
+        return false;
+    }
+    for (const colmap::image_t source_id : source_ids) {
+        View source;
+        if (static_cast<int>(views.size()) <= options_.num_source_views &&
+            LoadView(reconstruction, image_path, source_id, &source)) {
+            views.push_back(std::move(source));
+        }
+    }
+    if (views.size() < 2) {
+        std::cerr << "Error: no source views for " << reconstruction.Image(image_id).Name()
+                  << std::endl;
+        return false;
+    }
+    // The network expects a fixed number of views; repeat the best source
+    while (static_cast<int>(views.size()) < NumViews(options_)) {
+        views.push_back(views[1]);
+    }
+
+    float depth_min = 0.0f;
+    float depth_max = 0.0f;
+    if (!EstimateDepthRange(reconstruction, image_id, views[0], &depth_min, &depth_max)) {
+        std::cerr << "Error: too few sparse points to bound the depth of "
+                  << reconstruction.Image(image_id).Name() << std::endl;
+        return false;
+    }
+    // Uniform in inverse depth, near to far
+    std::vector<float> depths(options_.num_depths);
+    for (int i = 0; i < options_.num_depths; ++i) {
+        const float t = static_cast<float>(i) / (options_.num_depths - 1);
+        depths[i] = 1.0f / ((1.0f - t) / depth_min + t / depth_max);
+    }
+
+    const int width = views[0].image.cols;
+    const int height = views[0].image.rows;
+    const int tile_size = options_.tile_size;
+    cv::Mat depth(height, width, CV_32F, cv::Scalar(0.0f));
+    cv::Mat confidence(height, width, CV_32F, cv::Scalar(0.0f));
+    cv::Mat border(height, width, CV_32S, cv::Scalar(-1));
+
+    TileVolume volume;
+    for (const int tile_y : TileOrigins(height, tile_size, options_.tile_overlap)) {
+        for (const int tile_x : TileOrigins(width, tile_size, options_.tile_overlap)) {
+            if (!RunTile(views, tile_x, tile_y, depths, &volume)) {
+                return false;
+            }
+
+            cv::Mat tile_depth(volume.height, volume.width, CV_32F);
+            cv::Mat tile_confidence(volume.height, volume.width, CV_32F);
+            float* tile_depth_data = tile_depth.ptr<float>();
+            float* tile_confidence_data = tile_confidence.ptr<float>();
+            for (int i = 0; i < volume.width * volume.height; ++i) {
+                const float sum = volume.sum_exp[i];
+                tile_depth_data[i] = sum > 0.0f ? volume.sum_depth[i] / sum : 0.0f;
+                tile_confidence_data[i] =
+                    sum > 0.0f ? volume.best_window[i] *
+                                     std::exp(volume.best_logit[i] - volume.max_logit[i]) / sum
+                               : 0.0f;
+            }
+            cv::resize(tile_depth, tile_depth, cv::Size(tile_size, tile_size), 0, 0, cv::INTER_LINEAR);
+            cv::resize(tile_confidence, tile_confidence, cv::Size(tile_size, tile_size), 0, 0,
+                       cv::INTER_LINEAR);
+
+            // Keep every pixel from the tile where it lies farthest from a
+            // border shared with another tile
+            const int x_end = std::min(width, tile_x + tile_size);
+            const int y_end = std::min(height, tile_y + tile_size);
+            constexpr int kNoBorder = std::numeric_limits<int>::max();
+            for (int y = tile_y; y < y_end; ++y) {
+                const int border_y = std::min(tile_y > 0 ? y - tile_y : kNoBorder,
+                                              y_end < height ? y_end - 1 - y : kNoBorder);
+                for (int x = tile_x; x < x_end; ++x) {
+                    const int border_x = std::min(tile_x > 0 ? x - tile_x : kNoBorder,
+                                                  x_end < width ? x_end - 1 - x : kNoBorder);
+                    const int distance = std::min(border_x, border_y);
+                    if (distance > border.at<int>(y, x)) {
+                        border.at<int>(y, x) = distance;
+                        depth.at<float>(y, x) = tile_depth.at<float>(y - tile_y, x - tile_x);
+                        confidence.at<float>(y, x) = tile_confidence.at<float>(y - tile_y, x - tile_x);
+                    }
+                }
+            }
+        }
+    }
+
+    *depth_map = colmap::mvs::DepthMap(width, height, depth_min, depth_max);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const bool valid = confidence.at<float>(y, x) >= options_.min_confidence;
+            depth_map->Set(y, x, valid ? depth.at<float>(y, x) : 0.0f);
+        }
+    }
+
+    // Normals from the cross product of neighbouring back-projected points
+    const Eigen::Matrix3d K_inverse = views[0].K.inverse();
+    const auto back_project = [&](int x, int y) {
+        const Eigen::Vector3d ray = K_inverse * Eigen::Vector3d(x + 0.5, y + 0.5, 1.0);
+        return Eigen::Vector3f((ray * depth_map->Get(y, x)).cast<float>());
+    };
+    *normal_map = colmap::mvs::NormalMap(width, height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+            const int dx = x + 1 < width ? 1 : -1;
+            const int dy = y + 1 < height ? 1 : -1;
+            if (width > 1 && height > 1 && depth_map->Get(y, x) > 0.0f &&
+                depth_map->Get(y, x + dx) > 0.0f && depth_map->Get(y + dy, x) > 0.0f) {
+                const Eigen::Vector3f point = back_project(x, y);
+                normal = ((back_project(x + dx, y) - point) * dx)
+                             .cross((back_project(x, y + dy) - point) * dy);
+                if (normal.norm() > 0.0f) {
+                    normal.normalize();
+                    if (normal.dot(point) > 0.0f) {
+                        normal = -normal;
+                    }
+                }
+            }
+            for (int c = 0; c < 3; ++c) {
+                normal_map->Set(y, x, c, normal[c]);
+            }
+        }
+    }
+    return true;
+}
+
+bool MVSNet::LoadView(const colmap::Reconstruction& reconstruction, const std::string& image_path,
+                      colmap::image_t image_id, View* view) const {
+    const colmap::Image& image = reconstruction.Image(image_id);
+    const colmap::Camera& camera = reconstruction.Camera(image.CameraId());
+    // Undistorted images keep the orientation of their cameras, as in COLMAP
+    cv::Mat bgr = cv::imread(colmap::JoinPaths(image_path, image.Name()),
+                             cv::IMREAD_COLOR | cv::IMREAD_IGNORE_ORIENTATION);
+    if (bgr.empty()) {
+        std::cerr << "Error: failed to read " << image.Name() << std::endl;
+        return false;
+    }
+
+    // Same downsizing as COLMAP's stereo, so fusion finds matching image sizes
+    view->K = camera.CalibrationMatrix();
+    if (bgr.cols > options_.max_image_size || bgr.rows > options_.max_image_size) {
+        const double factor = std::min(static_cast<double>(options_.max_image_size) / bgr.cols,
+                                       static_cast<double>(options_.max_image_size) / bgr.rows);
+        const int new_width = static_cast<int>(std::round(bgr.cols * factor));
+        const int new_height = static_cast<int>(std::round(bgr.rows * factor));
+        view->K.row(0) *= static_cast<double>(new_width) / bgr.cols;
+        view->K.row(1) *= static_cast<double>(new_height) / bgr.rows;
+        cv::resize(bgr, bgr, cv::Size(new_width, new_height), 0, 0, cv::INTER_AREA);
+    }
+    cv::cvtColor(bgr, bgr, cv::COLOR_BGR2RGB);
+    bgr.convertTo(view->image, CV_32FC3, 1.0 / 255.0);
+    view->cam_from_world = image.CamFromWorld().ToMatrix();
+    return true;
+}
+
+bool MVSNet::EstimateDepthRange(const colmap::Reconstruction& reconstruction,
+                                colmap::image_t image_id, const View& reference,
+                                float* depth_min, float* depth_max) const {
+    const colmap::Image& image = reconstruction.Image(image_id);
+    std::vector<float> point_depths;
+    for (const auto& point2D : image.Points2D()) {
+        if (!point2D.HasPoint3D()) {
+            continue;
+        }
+        const Eigen::Vector3d& xyz = reconstruction.Point3D(point2D.point3D_id).xyz;
+        const double z = reference.cam_from_world.row(2).dot(xyz.homogeneous());
+        if (z > 0.0) {
+            point_depths.push_back(static_cast<float>(z));
+        }
+    }
+    if (point_depths.size() < 10) {
+        return false;
+    }
+    // Robust to stray points; the margin covers surfaces behind the sparse ones
+    const size_t low = point_depths.size() / 100;
+    const size_t high = point_depths.size() - 1 - point_depths.size() / 100;
+    std::nth_element(point_depths.begin(), point_depths.begin() + low, point_depths.end());
+    *depth_min = 0.8f * point_depths[low];
+    std::nth_element(point_depths.begin(), point_depths.begin() + high, point_depths.end());
+    *depth_max = 1.25f * point_depths[high];
+    return *depth_max > *depth_min;
+}
+
+void MVSNet::PrepareSource(const View& reference, const View& source, int tile_x, int tile_y,
+                           float depth_min, float depth_max, float* pixels,
+                           Eigen::Matrix4f* projection) const {
+    const int tile_size = options_.tile_size;
+    const double x_end = std::min(reference.image.cols, tile_x + tile_size);
+    const double y_end = std::min(reference.image.rows, tile_y + tile_size);
+    const Eigen::Matrix3d K_inverse = reference.K.inverse();
+    const Eigen::Matrix3d R = reference.cam_from_world.leftCols<3>();
+    const Eigen::Vector3d t = reference.cam_from_world.col(3);
+
+    // Bounding box of the tile frustum between the near and far depth
+    double min_x = std::numeric_limits<double>::max();
+    double min_y = std::numeric_limits<double>::max();
+    double max_x = std::numeric_limits<double>::lowest();
+    double max_y = std::numeric_limits<double>::lowest();
+    bool behind = false;
+    for (const double u : {static_cast<double>(tile_x), x_end}) {
+        for (const double v : {static_cast<double>(tile_y), y_end}) {
+            for (const float d : {depth_min, depth_max}) {
+                const Eigen::Vector3d world = R.transpose() * (K_inverse * Eigen::Vector3d(u, v, 1.0) * d - t);
+                const Eigen::Vector3d projected = source.K * (source.cam_from_world * world.homogeneous());
+                if (projected.z() <= 0.0) {
+                    behind = true;
+                    continue;
+                }
+                min_x = std::min(min_x, projected.x() / projected.z());
+                min_y = std::min(min_y, projected.y() / projected.z());
+                max_x = std::max(max_x, projected.x() / projected.z());
+                max_y = std::max(max_y, projected.y() / projected.z());
+            }
+        }
+    }
+    const cv::Rect bounds(0, 0, source.image.cols, source.image.rows);
+    cv::Rect crop = bounds;
+    if (!behind) {
+        crop = cv::Rect(cv::Point(static_cast<int>(std::floor(std::max(0.0, min_x))),
+                                  static_cast<int>(std::floor(std::max(0.0, min_y)))),
+                        cv::Point(static_cast<int>(std::ceil(std::min<double>(bounds.width, max_x))),
+                                  static_cast<int>(std::ceil(std::min<double>(bounds.height, max_y))))) &
+               bounds;
+    }
+
+    // Uniform scale into the tile keeps the features undistorted; the crop
+    // offset and scale go into K
+    Eigen::Matrix3d K = source.K;
+    const size_t plane_size = static_cast<size_t>(tile_size) * tile_size;
+    std::fill(pixels, pixels + 3 * plane_size, 0.0f);
+    if (crop.area() > 0) {
+        const double scale = std::min(static_cast<double>(tile_size) / crop.width,
+                                      static_cast<double>(tile_size) / crop.height);
+        const int scaled_width = std::clamp(static_cast<int>(std::round(crop.width * scale)), 1, tile_size);
+        const int scaled_height = std::clamp(static_cast<int>(std::round(crop.height * scale)), 1, tile_size);
+        cv::Mat scaled;
+        cv::resize(source.image(crop), scaled, cv::Size(scaled_width, scaled_height), 0, 0,
+                   scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+        CopyPlanes(scaled, pixels, tile_size);
+        K(0, 2) -= crop.x;
+        K(1, 2) -= crop.y;
+        K.row(0) *= static_cast<double>(scaled_width) / crop.width;
+        K.row(1) *= static_cast<double>(scaled_height) / crop.height;
+    }
+    *projection = NetworkProjection(K, source.cam_from_world);
+}
+
+bool MVSNet::RunTile(const std::vector<View>& views, int tile_x, int tile_y,
+                     const std::vector<float>& depths, TileVolume* volume) {
+    const int tile_size = options_.tile_size;
+    const int num_views = static_cast<int>(views.size());
+    const size_t view_size = 3 * static_cast<size_t>(tile_size) * tile_size;
+    images_.assign(num_views * view_size, 0.0f);
+    projections_.resize(num_views * 16);
+
+    // Reference tile: a plain crop
+    const View& reference = views[0];
+    const cv::Rect tile = cv::Rect(tile_x, tile_y, tile_size, tile_size) &
+                          cv::Rect(0, 0, reference.image.cols, reference.image.rows);
+    CopyPlanes(reference.image(tile), images_.data(), tile_size);
+    Eigen::Matrix3d K = reference.K;
+    K(0, 2) -= tile_x;
+    K(1, 2) -= tile_y;
+    Eigen::Map<Eigen::Matrix<float, 4, 4, Eigen::RowMajor>>(projections_.data()) =
+        NetworkProjection(K, reference.cam_from_world);
+
+    for (int v = 1; v < num_views; ++v) {
+        Eigen::Matrix4f projection;
+        PrepareSource(reference, views[v], tile_x, tile_y, depths.front(), depths.back(),
+                      images_.data() + v * view_size, &projection);
+        Eigen::Map<Eigen::Matrix<float, 4, 4, Eigen::RowMajor>>(projections_.data() + 16 * v) =
+            projection;
+    }
+
+    const int num_depths = static_cast<int>(depths.size());
+    const int chunk_size = ChunkSize(options_);
+    const int halo = ChunkHalo(options_);
+    const int window = ChunkWindow(options_);
+    const std::vector<int64_t> image_shape = {1, num_views, 3, tile_size, tile_size};
+    const std::vector<int64_t> projection_shape = {1, num_views, 4, 4};
+    for (int chunk_begin = 0; chunk_begin < num_depths; chunk_begin += chunk_size) {
+        const int chunk_end = std::min(num_depths, chunk_begin + chunk_size);
+        // At the ends of the depth range the window moves inward instead of
+        // shrinking, which keeps the input shape and the alignment
+        const int first = std::clamp(chunk_begin - halo, 0, num_depths - window);
+        const int last = first + window;
+        depth_values_.assign(depths.begin() + first, depths.begin() + last);
+
+        if (!session_.BindInput(input_names_[0], images_.data(), image_shape) ||
+            !session_.BindInput(input_names_[1], projections_.data(), projection_shape) ||
+            !session_.BindInput(input_names_[2], depth_values_.data(),
+                                {1, static_cast<int64_t>(depth_values_.size())}) ||
+            !session_.Run()) {
+            return false;
+        }
+        const std::vector<int64_t> shape = session_.GetOutputShape(0);
+        if (shape.size() != 4 || shape[1] != last - first) {
+            std::cerr << "Error: MVSNet output is not a [1, D, h, w] cost volume" << std::endl;
+            return false;
+        }
+        const int out_height = static_cast<int>(shape[2]);
+        const int out_width = static_cast<int>(shape[3]);
+        const size_t num_pixels = static_cast<size_t>(out_width) * out_height;
+        if (chunk_begin == 0) {
+            volume->width = out_width;
+            volume->height = out_height;
+            volume->max_logit.assign(num_pixels, -std::numeric_limits<float>::infinity());
+            volume->sum_exp.assign(num_pixels, 0.0f);
+            volume->sum_depth.assign(num_pixels, 0.0f);
+            volume->best_logit.assign(num_pixels, -std::numeric_limits<float>::infinity());
+            volume->best_window.assign(num_pixels, 0.0f);
+        }
+
+        // Online softmax over the hypotheses this chunk owns
+        const float* logits = session_.GetOutputData(0);
+        const int owned_begin = chunk_begin - first;
+        const int owned_end = chunk_end - first;
+        const int count = last - first;
+        for (size_t p = 0; p < num_pixels; ++p) {
+            int best = owned_begin;
+            for (int j = owned_begin + 1; j < owned_end; ++j) {
+                if (logits[j * num_pixels + p] > logits[best * num_pixels + p]) {
+                    best = j;
+                }
+            }
+            const float chunk_max = logits[best * num_pixels + p];
+            if (chunk_max > volume->max_logit[p]) {
+                const float rescale = std::exp(volume->max_logit[p] - chunk_max);
+                volume->sum_exp[p] *= rescale;
+                volume->sum_depth[p] *= rescale;
+                volume->max_logit[p] = chunk_max;
+            }
+            for (int j = owned_begin; j < owned_end; ++j) {
+                const float weight = std::exp(logits[j * num_pixels + p] - volume->max_logit[p]);
+                volume->sum_exp[p] += weight;
+                volume->sum_depth[p] += weight * depth_values_[j];
+            }
+            if (chunk_max > volume->best_logit[p]) {
+                float window = 0.0f;
+                for (int j = std::max(0, best - 1); j <= std::min(count - 1, best + 2); ++j) {
+                    window += std::exp(logits[j * num_pixels + p] - chunk_max);
+                }
+                volume->best_logit[p] = chunk_max;
+                volume->best_window[p] = window;
+            }
+        }
+    }
+    return true;
+}
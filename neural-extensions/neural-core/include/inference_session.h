@@ -0,0 +1,186 @@
+/**
+ * inference_session.h - ONNX Runtime inference with I/O binding
+ *
+ * This file defines a session wrapper that binds inputs to caller-owned
+ * memory and reuses output tensors between runs.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <onnxruntime_cxx_api.h>
+#include <opencv2/core.hpp>
+
+class ModelLoader;
+
+/**
+ * InferenceSession - Runs one model through Ort::IoBinding
+ *
+ * Inputs are bound to existing buffers (cv::Mat data, Frame tensors) without
+ * copying. Outputs are allocated by ONNX Runtime on the first run with a
+ * given combination of input shapes (a shape bucket) and bound again on later
+ * runs of the same bucket, so steady-state inference does not allocate output
+ * tensors. Outputs whose shape depends on the data (for example after NMS)
+ * are detected on the first mismatch and then left to ONNX Runtime.
+ *
+ * By default the session allocates from the capped arena shared by all
+ * sessions, which is accounted in the job's memory budget. A session may opt
+ * into its own CPU arena instead, so that destroying it when its job ends
+ * returns the arena memory at that point; that arena is not capped and
+ * its owner must account for it.
+ *
+ * Not thread-safe; use one instance per worker.
+ */
+class InferenceSession {
+public:
+    struct Options {
+        // Use the capped arena shared by all sessions; false gives the session
+        // an uncapped arena of its own, freed with it
+        bool shared_arena = true;
+        // Shape buckets with preallocated outputs, least recently used evicted first
+        size_t max_buckets = 4;
+    };
+
+    /**
+     * Constructor
+     *
+     * @param loader Loader providing the environment and session settings
+     * @param model_path Path to the .onnx file
+     * @param options Arena and output caching settings
+     */
+    InferenceSession(const ModelLoader& loader, const std::string& model_path,
+                     const Options& options);
+
+    InferenceSession(const ModelLoader& loader, const std::string& model_path)
+        : InferenceSession(loader, model_path, Options()) {}
+
+    /**
+     * Check whether the model was loaded
+     *
+     * @return true if the session can run
+     */
+    bool IsLoaded() const { return session_ != nullptr; }
+
+    /**
+     * Bind an input to caller-owned float memory
+     *
+     * The memory must stay valid and unchanged in size until Run() returns.
+     *
+     * @param name Input name
+     * @param data Tensor data
+     * @param shape Tensor shape
+     * @return true on success
+     */
+    bool BindInput(const std::string& name, float* data, const std::vector<int64_t>& shape);
+
+    /**
+     * Bind an input to the pixels of a continuous CV_32F matrix
+     *
+     * @param name Input name
+     * @param mat Matrix whose data holds the tensor
+     * @param shape Tensor shape, its element count must match the matrix
+     * @return true on success
+     */
+    bool BindInput(const std::string& name, const cv::Mat& mat, const std::vector<int64_t>& shape);
+
+    /**
+     * Bind an input to an existing tensor, e.g. Frame::onnx_input
+     *
+     * @param name Input name
+     * @param value Tensor to bind
+     * @return true on success
+     */
+    bool BindInput(const std::string& name, const Ort::Value& value);
+
+    /**
+     * Run the model on the bound inputs
+     *
+     * @return true on success
+     */
+    bool Run();
+
+    /**
+     * Get the number of model inputs
+     *
+     * @return The input count
+     */
+    size_t GetInputCount() const { return input_names_.size(); }
+
+    /**
+     * Get the name of a model input
+     *
+     * @param index Input index, in model order
+     * @return The input name
+     */
+    const std::string& GetInputName(size_t index) const { return input_names_[index]; }
+
+    /**
+     * Get the number of model outputs
+     *
+     * @return The output count
+     */
+    size_t GetOutputCount() const { return output_names_.size(); }
+
+    /**
+     * Get an output of the last run
+     *
+     * The tensor is owned by the session and overwritten by the next run
+     * with the same input shapes.
+     *
+     * @param index Output index, in model order
+     * @return The output tensor
+     */
+    const Ort::Value& GetOutput(size_t index) const { return (*outputs_)[index]; }
+
+    /**
+     * Get the data of a float output of the last run
+     *
+     * @param index Output index, in model order
+     * @return Pointer to the tensor data
+     */
+    const float* GetOutputData(size_t index) const;
+
+    /**
+     * Get the shape of an output of the last run
+     *
+     * @param index Output index, in model order
+     * @return The tensor shape
+     */
+    std::vector<int64_t> GetOutputShape(size_t index) const;
+
+private:
+    struct ShapeBucket {
+        std::vector<int64_t> key;
+        std::vector<Ort::Value> outputs;
+        bool dynamic = false;  // Output shapes vary for equal inputs
+    };
+
+    int FindInput(const std::string& name) const;
+    bool BindAt(int index, const Ort::Value& value);
+    ShapeBucket& FindBucket();
+    bool RunAllocating(ShapeBucket& bucket);
+
+    std::unique_ptr<Ort::Session> session_;
+    std::unique_ptr<Ort::IoBinding> binding_;
+    Ort::MemoryInfo memory_info_;
+    Ort::RunOptions run_options_;
+    Options options_;
+
+    std::vector<std::string> input_names_;
+    std::vector<std::string> output_names_;
+
+    // Tensors wrapping caller memory for the bound inputs, in model input
+    // order; empty for inputs bound to an existing Ort::Value
+    std::vector<Ort::Value> inputs_;
+    std::vector<std::vector<int64_t>> input_shapes_;
+
+    std::list<ShapeBucket> buckets_;
+    std::vector<Ort::Value>* outputs_ = nullptr;
+    std::vector<Ort::Value> dynamic_outputs_;
+};
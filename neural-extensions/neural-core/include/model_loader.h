@@ -0,0 +1,119 @@
+/**
+ * model_loader.h - ONNX Runtime model loading
+ *
+ * This file defines the loader that owns the process-wide ONNX Runtime
+ * environment and creates inference sessions for the neural components.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <onnxruntime_cxx_api.h>
+
+/**
+ * ModelLoader - Creates ONNX Runtime sessions for the neural components
+ *
+ * All sessions share one Ort::Env with a global thread pool instead of
+ * per-session pools, so that running several models concurrently does not
+ * multiply the number of inference threads.
+ */
+class ModelLoader {
+public:
+    /**
+     * ThreadingOptions - Layout of the global ONNX Runtime thread pool
+     *
+     * When spawn_thread/join_thread are set, ONNX Runtime creates its pool
+     * threads through them, which lets the application place them on
+     * dedicated cores.
+     */
+    struct ThreadingOptions {
+        // Intra-op threads of the global pool, 0 for the ONNX Runtime default
+        int intra_op_threads = 0;
+        // Inter-op threads of the global pool
+        int inter_op_threads = 1;
+        // Let idle pool threads spin; off to avoid stealing cores from other stages
+        bool allow_spinning = false;
+        // Optional thread factory; returns an opaque handle passed to join_thread
+        std::function<void*(void (*)(void*), void*)> spawn_thread;
+        std::function<void(void*)> join_thread;
+    };
+
+    /**
+     * Set the global thread pool layout
+     *
+     * Must be called before the first ModelLoader is constructed, since
+     * the environment is created only once per process.
+     *
+     * @param options Thread pool layout
+     */
+    static void SetThreadingOptions(const ThreadingOptions& options);
+
+    /**
+     * ArenaOptions - Cap of the CPU arena shared by all sessions
+     *
+     * The arena only exists once the first ModelLoader creates the
+     * environment, so jobs without neural components never hold it.
+     * on_create and on_release let the application account for the cap
+     * while it does.
+     */
+    struct ArenaOptions {
+        // Maximum arena size in bytes, 0 for no shared arena
+        size_t max_bytes = 0;
+        // Called with max_bytes when the arena is created
+        std::function<void(size_t)> on_create;
+        // Called with max_bytes when the environment and its arena are destroyed
+        std::function<void(size_t)> on_release;
+    };
+
+    /**
+     * Set the shared CPU arena
+     *
+     * Like the threading options, this must be set before the first
+     * ModelLoader is constructed.
+     *
+     * @param options Arena cap and accounting callbacks
+     */
+    static void SetArenaOptions(const ArenaOptions& options);
+
+    /**
+     * Get the cap of the shared CPU arena
+     *
+     * @return Maximum arena size in bytes, 0 if the arena is not capped
+     */
+    static size_t GetArenaLimit();
+
+    /**
+     * Constructor
+     *
+     * @param use_metal Request the CoreML execution provider on Apple platforms
+     */
+    explicit ModelLoader(bool use_metal);
+
+    /**
+     * Load an ONNX model
+     *
+     * @param model_path Path to the .onnx file
+     * @param shared_arena Use the capped arena shared by all sessions when one
+     *        is configured; otherwise the session gets its own CPU arena,
+     *        released together with the session
+     * @return The session, or nullptr if the model could not be loaded
+     */
+    std::unique_ptr<Ort::Session> LoadSession(const std::string& model_path,
+                                              bool shared_arena = true) const;
+
+    /**
+     * Get the process-wide ONNX Runtime environment
+     *
+     * @return The environment
+     */
+    static Ort::Env& GetEnv();
+
+    bool UseMetal() const { return use_metal_; }
+
+private:
+    bool use_metal_ = false;
+};
@@ -0,0 +1,184 @@
+/**
+ * inference_session.cc - ONNX Runtime inference with I/O binding
+ */
+
+#include "inference_session.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "model_loader.h"
+
+InferenceSession::InferenceSession(const ModelLoader& loader, const std::string& model_path,
+                                   const Options& options)
+    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+      options_(options) {
+    session_ = loader.LoadSession(model_path, options.shared_arena);
+    if (!session_) {
+        return;
+    }
+
+    Ort::AllocatorWithDefaultOptions allocator;
+    for (size_t i = 0; i < session_->GetInputCount(); ++i) {
+        input_names_.emplace_back(session_->GetInputNameAllocated(i, allocator).get());
+        inputs_.emplace_back(nullptr);
+    }
+    for (size_t i = 0; i < session_->GetOutputCount(); ++i) {
+        output_names_.emplace_back(session_->GetOutputNameAllocated(i, allocator).get());
+    }
+    input_shapes_.resize(input_names_.size());
+    binding_ = std::make_unique<Ort::IoBinding>(*session_);
+}
+
+bool InferenceSession::BindInput(const std::string& name, float* data,
+                                 const std::vector<int64_t>& shape) {
+    const int index = FindInput(name);
+    if (index < 0) {
+        return false;
+    }
+    size_t count = 1;
+    for (const int64_t dim : shape) {
+        count *= static_cast<size_t>(dim);
+    }
+    try {
+        inputs_[index] = Ort::Value::CreateTensor<float>(memory_info_, data, count,
+                                                         shape.data(), shape.size());
+    } catch (const Ort::Exception& e) {
+        std::cerr << "Error creating input tensor " << name << ": " << e.what() << std::endl;
+        return false;
+    }
+    return BindAt(index, inputs_[index]);
+}
+
+bool InferenceSession::BindInput(const std::string& name, const cv::Mat& mat,
+                                 const std::vector<int64_t>& shape) {
+    size_t count = 1;
+    for (const int64_t dim : shape) {
+        count *= static_cast<size_t>(dim);
+    }
+    if (mat.depth() != CV_32F || !mat.isContinuous() ||
+        mat.total() * mat.channels() != count) {
+        std::cerr << "Error binding input " << name
+                  << ": expected a continuous CV_32F matrix with " << count << " elements"
+                  << std::endl;
+        return false;
+    }
+    // ONNX Runtime only reads inputs, the cast does not lead to writes
+    return BindInput(name, const_cast<float*>(mat.ptr<float>()), shape);
+}
+
+bool InferenceSession::BindInput(const std::string& name, const Ort::Value& value) {
+    const int index = FindInput(name);
+    if (index < 0) {
+        return false;
+    }
+    inputs_[index] = Ort::Value(nullptr);
+    return BindAt(index, value);
+}
+
+bool InferenceSession::Run() {
+    if (!session_) {
+        return false;
+    }
+
+    ShapeBucket& bucket = FindBucket();
+    if (bucket.dynamic || bucket.outputs.empty()) {
+        return RunAllocating(bucket);
+    }
+
+    try {
+        for (size_t i = 0; i < output_names_.size(); ++i) {
+            binding_->BindOutput(output_names_[i].c_str(), bucket.outputs[i]);
+        }
+        session_->Run(run_options_, *binding_);
+        outputs_ = &bucket.outputs;
+        return true;
+    } catch (const Ort::Exception&) {
+        // Same input shapes but different output shapes: the outputs depend
+        // on the data, so this bucket is not preallocated any more
+        bucket.dynamic = true;
+        bucket.outputs.clear();
+        return RunAllocating(bucket);
+    }
+}
+
+const float* InferenceSession::GetOutputData(size_t index) const {
+    if (!outputs_ || index >= outputs_->size()) {
+        return nullptr;
+    }
+    return (*outputs_)[index].GetTensorData<float>();
+}
+
+std::vector<int64_t> InferenceSession::GetOutputShape(size_t index) const {
+    if (!outputs_ || index >= outputs_->size()) {
+        return {};
+    }
+    return (*outputs_)[index].GetTensorTypeAndShapeInfo().GetShape();
+}
+
+int InferenceSession::FindInput(const std::string& name) const {
+    const auto it = std::find(input_names_.begin(), input_names_.end(), name);
+    if (it == input_names_.end()) {
+        std::cerr << "Error binding input: model has no input named " << name << std::endl;
+        return -1;
+    }
+    return static_cast<int>(it - input_names_.begin());
+}
+
+bool InferenceSession::BindAt(int index, const Ort::Value& value) {
+    try {
+        input_shapes_[index] = value.GetTensorTypeAndShapeInfo().GetShape();
+        binding_->BindInput(input_names_[index].c_str(), value);
+    } catch (const Ort::Exception& e) {
+        std::cerr << "Error binding input " << input_names_[index] << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+InferenceSession::ShapeBucket& InferenceSession::FindBucket() {
+    std::vector<int64_t> key;
+    for (const auto& shape : input_shapes_) {
+        key.push_back(static_cast<int64_t>(shape.size()));
+        key.insert(key.end(), shape.begin(), shape.end());
+    }
+
+    for (auto it = buckets_.begin(); it != buckets_.end(); ++it) {
+        if (it->key == key) {
+            buckets_.splice(buckets_.begin(), buckets_, it);
+            return buckets_.front();
+        }
+    }
+
+    buckets_.emplace_front();
+    buckets_.front().key = std::move(key);
+    while (buckets_.size() > std::max<size_t>(1, options_.max_buckets)) {
+        if (outputs_ == &buckets_.back().outputs) {
+            outputs_ = nullptr;
+        }
+        buckets_.pop_back();
+    }
+    return buckets_.front();
+}
+
+bool InferenceSession::RunAllocating(ShapeBucket& bucket) {
+    try {
+        for (const auto& name : output_names_) {
+            binding_->BindOutput(name.c_str(), memory_info_);
+        }
+        session_->Run(run_options_, *binding_);
+        std::vector<Ort::Value> values = binding_->GetOutputValues();
+        if (bucket.dynamic) {
+            dynamic_outputs_ = std::move(values);
+            outputs_ = &dynamic_outputs_;
+        } else {
+            bucket.outputs = std::move(values);
+            outputs_ = &bucket.outputs;
+        }
+        return true;
+    } catch (const Ort::Exception& e) {
+        std::cerr << "Error running inference: " << e.what() << std::endl;
+        outputs_ = nullptr;
+        return false;
+    }
+}
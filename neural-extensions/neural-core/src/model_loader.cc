@@ -0,0 +1,131 @@
+/**
+ * model_loader.cc - ONNX Runtime model loading
+ */
+
+#include "model_loader.h"
+
+#include <iostream>
+
+namespace {
+
+ModelLoader::ThreadingOptions& GlobalThreadingOptions() {
+    static ModelLoader::ThreadingOptions options;
+    return options;
+}
+
+// Trampolines between the ONNX Runtime C callbacks and ThreadingOptions
+OrtCustomThreadHandle CreateThread(void* options, OrtThreadWorkerFn worker_fn, void* param) {
+    auto* threading = static_cast<ModelLoader::ThreadingOptions*>(options);
+    return static_cast<OrtCustomThreadHandle>(threading->spawn_thread(worker_fn, param));
+}
+
+ModelLoader::ArenaOptions& GlobalArenaOptions() {
+    static ModelLoader::ArenaOptions options;
+    return options;
+}
+
+size_t GlobalArenaLimit() {
+    return GlobalArenaOptions().max_bytes;
+}
+
+void JoinThread(OrtCustomThreadHandle handle) {
+    GlobalThreadingOptions().join_thread(
+        const_cast<void*>(static_cast<const void*>(handle)));
+}
+
+Ort::Env CreateEnv() {
+    ModelLoader::ThreadingOptions& options = GlobalThreadingOptions();
+    Ort::ThreadingOptions threading;
+    threading.SetGlobalIntraOpNumThreads(options.intra_op_threads);
+    threading.SetGlobalInterOpNumThreads(options.inter_op_threads);
+    threading.SetGlobalSpinControl(options.allow_spinning ? 1 : 0);
+    if (options.spawn_thread && options.join_thread) {
+        threading.SetGlobalCustomCreateThreadFn(&CreateThread);
+        threading.SetGlobalCustomThreadCreationOptions(&options);
+        threading.SetGlobalCustomJoinThreadFn(&JoinThread);
+    }
+    return Ort::Env(threading, ORT_LOGGING_LEVEL_WARNING, "colmap-neural");
+}
+
+// The process-wide environment; the shared arena is accounted while it lives
+class SharedEnv {
+public:
+    SharedEnv() : env(CreateEnv()) {
+        // One capped CPU arena shared by all sessions instead of one
+        // unbounded arena per session
+        if (GlobalArenaLimit() > 0) {
+            Ort::MemoryInfo memory_info("Cpu", OrtArenaAllocator, 0, OrtMemTypeDefault);
+            Ort::ArenaCfg arena_cfg(GlobalArenaLimit(), /*kSameAsRequested*/ 1, -1, -1);
+            env.CreateAndRegisterAllocator(memory_info, arena_cfg);
+            arena_bytes = GlobalArenaLimit();
+            if (GlobalArenaOptions().on_create) {
+                GlobalArenaOptions().on_create(arena_bytes);
+            }
+        }
+    }
+
+    ~SharedEnv() {
+        if (arena_bytes > 0 && GlobalArenaOptions().on_release) {
+            GlobalArenaOptions().on_release(arena_bytes);
+        }
+    }
+
+    SharedEnv(const SharedEnv&) = delete;
+    SharedEnv& operator=(const SharedEnv&) = delete;
+
+    Ort::Env env;
+
+private:
+    size_t arena_bytes = 0;
+};
+
+} // namespace
+
+void ModelLoader::SetThreadingOptions(const ThreadingOptions& options) {
+    GlobalThreadingOptions() = options;
+}
+
+void ModelLoader::SetArenaOptions(const ArenaOptions& options) {
+    GlobalArenaOptions() = options;
+}
+
+size_t ModelLoader::GetArenaLimit() {
+    return GlobalArenaLimit();
+}
+
+Ort::Env& ModelLoader::GetEnv() {
+    static SharedEnv shared;
+    return shared.env;
+}
+
+ModelLoader::ModelLoader(bool use_metal) : use_metal_(use_metal) {
+    GetEnv();
+}
+
+std::unique_ptr<Ort::Session> ModelLoader::LoadSession(const std::string& model_path,
+                                                       bool shared_arena) const {
+    Ort::SessionOptions session_options;
+    // Run on the global pool instead of creating threads for every session
+    session_options.DisablePerSessionThreads();
+    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+    if (shared_arena && GlobalArenaLimit() > 0) {
+        session_options.AddConfigEntry("session.use_env_allocators", "1");
+    } else {
+        session_options.EnableCpuMemArena();
+    }
+
+    if (use_metal_) {
+        try {
+            session_options.AppendExecutionProvider("CoreML");
+        } catch (const Ort::Exception& e) {
+            std::cerr << "Warning: CoreML execution provider unavailable: " << e.what() << std::endl;
+        }
+    }
+
+    try {
+        return std::make_unique<Ort::Session>(GetEnv(), model_path.c_str(), session_options);
+    } catch (const Ort::Exception& e) {
+        std::cerr << "Error loading model " << model_path << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+}
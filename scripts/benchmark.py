@@ -1,110 +1,583 @@
-#!/bin/bash
+#!/usr/bin/env python3
 # scripts/benchmark.py
+#
+# Performance regression harness.
+#
+#   generate  Render a deterministic synthetic scene (textured planes and boxes seen from a
+#             known camera path) into images, a video and ground truth poses.
+#   run       Reconstruct a scene with stage profiling enabled and compare the per-stage time,
+#             throughput and peak memory and the pose accuracy with a golden baseline.
+#   compare   Compare an existing benchmark_results.json with a baseline.
+#
+# Baselines are machine specific: record one on the target machine with
+# 'run --update-baseline' and commit it under scripts/baselines/<scene>.json.
 
-import os
-import sys
 import argparse
-import time
-import csv
-from pathlib import Path
-import subprocess
 import json
+import shutil
+import statistics
+import subprocess
+import sys
+from pathlib import Path
+
+import cv2
+import numpy as np
+
+SCRIPT_DIR = Path(__file__).parent.absolute()
+PROJECT_ROOT = SCRIPT_DIR.parent
+BASELINE_DIR = SCRIPT_DIR / "baselines"
+
+# Default tolerances: relative slack, plus an absolute floor so short stages and small
+# scenes do not fail on timer and allocator noise
+DEFAULT_TOLERANCES = {
+    "time": 0.25,
+    "time_floor_s": 0.5,
+    "throughput": 0.25,
+    "memory": 0.20,
+    "memory_floor_mb": 64.0,
+    "pose": 0.50,
+    "position_floor": 0.01,
+    "rotation_floor_deg": 0.1,
+    "fraction_floor": 0.02,
+}
+
+# Direction of each metric written by the application: +1 higher is better, -1 lower is better
+METRIC_DIRECTIONS = {
+    "registered_fraction": +1,
+    "num_registered": +1,
+    "position_error_median": -1,
+    "position_error_max": -1,
+    "rotation_error_median_deg": -1,
+    "rotation_error_max_deg": -1,
+    "localized_fraction": +1,
+    "latency_p50_ms": -1,
+    "latency_p99_ms": -1,
+}
+
+
+# ---------------------------------------------------------------------------
+# Scene generation
+# ---------------------------------------------------------------------------
+
+def make_texture(rng, size=512):
+    """Multi-scale value noise with random blobs and lines: dense, non-repetitive corners."""
+    texture = np.zeros((size, size, 3), np.float32)
+    for cells, weight in ((4, 0.35), (16, 0.3), (64, 0.2), (size // 2, 0.15)):
+        grid = rng.random((cells, cells, 3)).astype(np.float32)
+        texture += weight * cv2.resize(grid, (size, size), interpolation=cv2.INTER_CUBIC)
+    texture = np.clip(texture, 0.0, 1.0)
+    for _ in range(40):
+        center = tuple(int(v) for v in rng.integers(0, size, 2))
+        color = tuple(float(v) for v in rng.random(3))
+        cv2.circle(texture, center, int(rng.integers(4, size // 12)), color, -1, cv2.LINE_AA)
+    for _ in range(30):
+        p0 = tuple(int(v) for v in rng.integers(0, size, 2))
+        p1 = tuple(int(v) for v in rng.integers(0, size, 2))
+        color = tuple(float(v) for v in rng.random(3))
+        cv2.line(texture, p0, p1, color, int(rng.integers(1, 4)), cv2.LINE_AA)
+    return texture
+
+
+def make_scene(rng, num_boxes):
+    """Ground plane, two walls and boxes standing on the ground, each with its own texture."""
+    surfaces = []
+    # Planes: corner, two edges spanning the rectangle, world units per texture repeat
+    surfaces.append({"type": "plane", "origin": [-10.0, 0.0, -10.0], "u": [20.0, 0.0, 0.0],
+                     "v": [0.0, 0.0, 20.0], "tile": 5.0})
+    surfaces.append({"type": "plane", "origin": [-10.0, 0.0, 8.0], "u": [20.0, 0.0, 0.0],
+                     "v": [0.0, -6.0, 0.0], "tile": 4.0})
+    surfaces.append({"type": "plane", "origin": [8.0, 0.0, -10.0], "u": [0.0, 0.0, 20.0],
+                     "v": [0.0, -6.0, 0.0], "tile": 4.0})
+    # Boxes: axis-aligned, y is down so boxes extend to negative y from the ground
+    for _ in range(num_boxes):
+        size = rng.uniform(0.6, 1.8, 3)
+        center = np.array([rng.uniform(-3.0, 3.0), 0.0, rng.uniform(-3.0, 3.0)])
+        low = center - np.array([size[0] / 2, size[1], size[2] / 2])
+        high = center + np.array([size[0] / 2, 0.0, size[2] / 2])
+        surfaces.append({"type": "box", "low": low.tolist(), "high": high.tolist()})
+    for surface in surfaces:
+        surface["texture"] = make_texture(rng)
+    return surfaces
+
+
+def look_at(center, target):
+    """Camera from world rotation of a camera at center looking at target (x right, y down, z forward)."""
+    forward = target - center
+    forward /= np.linalg.norm(forward)
+    right = np.cross(forward, np.array([0.0, -1.0, 0.0]))
+    if np.linalg.norm(right) < 1e-9:
+        right = np.array([1.0, 0.0, 0.0])
+    right /= np.linalg.norm(right)
+    down = np.cross(forward, right)
+    return np.stack([right, down, forward])
+
+
+def camera_path(kind, num_frames):
+    """Known camera centers and rotations along an orbit or a forward walk."""
+    poses = []
+    for i in range(num_frames):
+        s = i / max(num_frames - 1, 1)
+        if kind == "orbit":
+            angle = 1.5 * np.pi * s - 0.75 * np.pi
+            center = np.array([7.0 * np.sin(angle), -2.5 - 0.5 * np.sin(3 * angle), -7.0 * np.cos(angle)])
+            target = np.array([0.0, -0.5, 0.0])
+        else:
+            center = np.array([-5.0 + 10.0 * s, -1.6 + 0.1 * np.sin(8 * np.pi * s), -6.5])
+            target = center + np.array([0.4, 0.35, 4.0])
+        poses.append((look_at(center, target), center))
+    return poses
+
+
+def sample_texture(texture, u, v):
+    """Bilinear lookup with wrap-around of texture coordinates in texture tiles."""
+    size = texture.shape[0]
+    x = (u % 1.0) * size - 0.5
+    y = (v % 1.0) * size - 0.5
+    x0 = np.floor(x).astype(np.int64)
+    y0 = np.floor(y).astype(np.int64)
+    fx = (x - x0)[:, None]
+    fy = (y - y0)[:, None]
+    x0 %= size
+    y0 %= size
+    x1 = (x0 + 1) % size
+    y1 = (y0 + 1) % size
+    return ((1 - fy) * ((1 - fx) * texture[y0, x0] + fx * texture[y0, x1]) +
+            fy * ((1 - fx) * texture[y1, x0] + fx * texture[y1, x1]))
+
+
+def intersect_plane(surface, origins, directions):
+    p0 = np.array(surface["origin"])
+    u_axis = np.array(surface["u"])
+    v_axis = np.array(surface["v"])
+    normal = np.cross(u_axis, v_axis)
+    denominator = directions @ normal
+    with np.errstate(divide="ignore", invalid="ignore"):
+        t = ((p0 - origins) @ normal) / denominator
+    points = origins + t[:, None] * directions
+    relative = points - p0
+    u = relative @ u_axis / (u_axis @ u_axis)
+    v = relative @ v_axis / (v_axis @ v_axis)
+    valid = (np.abs(denominator) > 1e-9) & (t > 1e-6) & (u >= 0) & (u <= 1) & (v >= 0) & (v <= 1)
+    shade = np.full(len(t), 0.8 + 0.2 * abs(normal[1]) / np.linalg.norm(normal))
+    # One texture repeat per tile of world units, so texels have the same size on both axes
+    tile = surface["tile"]
+    return t, valid, u * np.linalg.norm(u_axis) / tile, v * np.linalg.norm(v_axis) / tile, shade
+
+
+def intersect_box(surface, origins, directions):
+    low = np.array(surface["low"])
+    high = np.array(surface["high"])
+    with np.errstate(divide="ignore", invalid="ignore"):
+        inverse = 1.0 / directions
+        t0 = (low - origins) * inverse
+        t1 = (high - origins) * inverse
+    near = np.minimum(t0, t1)
+    far = np.maximum(t0, t1)
+    near = np.nan_to_num(near, nan=-np.inf)
+    far = np.nan_to_num(far, nan=np.inf)
+    axis = np.argmax(near, axis=1)
+    t_near = near[np.arange(len(axis)), axis]
+    t_far = np.min(far, axis=1)
+    valid = (t_near <= t_far) & (t_near > 1e-6)
+    points = origins + t_near[:, None] * directions
+    # Texture coordinates from the two axes spanning the hit face
+    extent = high - low
+    local = (points - low) / extent
+    u = np.where(axis == 0, local[:, 2], local[:, 0]) + axis
+    v = np.where(axis == 1, local[:, 2], local[:, 1])
+    shade = np.array([0.75, 1.0, 0.9])[axis]
+    return t_near, valid, u, v, shade
+
+
+def render(surfaces, rotation, center, width, height, focal):
+    """Ray-cast one view; returns an 8-bit BGR image."""
+    xs, ys = np.meshgrid(np.arange(width) + 0.5, np.arange(height) + 0.5)
+    rays = np.stack([(xs - width / 2) / focal, (ys - height / 2) / focal, np.ones_like(xs)], -1).reshape(-1, 3)
+    directions = rays @ rotation  # R^T applied to each row
+    directions /= np.linalg.norm(directions, axis=1, keepdims=True)
+    origins = np.broadcast_to(center, directions.shape)
+
+    depth = np.full(len(directions), np.inf)
+    color = np.empty((len(directions), 3), np.float32)
+    # Sky: smooth vertical gradient, deliberately without texture
+    sky = np.clip(0.5 - directions[:, 1:2], 0.0, 1.0)
+    color[:] = (0.55 + 0.35 * sky) * np.array([0.95, 0.85, 0.7], np.float32)
+    for surface in surfaces:
+        intersect = intersect_plane if surface["type"] == "plane" else intersect_box
+        t, valid, u, v, shade = intersect(surface, origins, directions)
+        closer = valid & (t < depth)
+        if not np.any(closer):
+            continue
+        depth[closer] = t[closer]
+        color[closer] = sample_texture(surface["texture"], u[closer], v[closer]) * shade[closer, None]
+    image = np.clip(color.reshape(height, width, 3) * 255.0 + 0.5, 0, 255).astype(np.uint8)
+    return image
+
+
+def rotation_to_quaternion(rotation):
+    """Unit quaternion (w, x, y, z) with w >= 0 of a rotation matrix."""
+    m = rotation
+    trace = np.trace(m)
+    if trace > 0:
+        s = 2.0 * np.sqrt(trace + 1.0)
+        q = [0.25 * s, (m[2, 1] - m[1, 2]) / s, (m[0, 2] - m[2, 0]) / s, (m[1, 0] - m[0, 1]) / s]
+    elif m[0, 0] > m[1, 1] and m[0, 0] > m[2, 2]:
+        s = 2.0 * np.sqrt(1.0 + m[0, 0] - m[1, 1] - m[2, 2])
+        q = [(m[2, 1] - m[1, 2]) / s, 0.25 * s, (m[0, 1] + m[1, 0]) / s, (m[0, 2] + m[2, 0]) / s]
+    elif m[1, 1] > m[2, 2]:
+        s = 2.0 * np.sqrt(1.0 + m[1, 1] - m[0, 0] - m[2, 2])
+        q = [(m[0, 2] - m[2, 0]) / s, (m[0, 1] + m[1, 0]) / s, 0.25 * s, (m[1, 2] + m[2, 1]) / s]
+    else:
+        s = 2.0 * np.sqrt(1.0 + m[2, 2] - m[0, 0] - m[1, 1])
+        q = [(m[1, 0] - m[0, 1]) / s, (m[0, 2] + m[2, 0]) / s, (m[1, 2] + m[2, 1]) / s, 0.25 * s]
+    q = np.array(q)
+    q /= np.linalg.norm(q)
+    return q if q[0] >= 0 else -q
+
+
+def generate(args):
+    output = Path(args.output)
+    name = args.name or f"{args.path}_{args.width}x{args.height}_{args.frames}f_s{args.seed}"
+    rng = np.random.default_rng(args.seed)
+    surfaces = make_scene(rng, args.boxes)
+    focal = args.focal * max(args.width, args.height)
+
+    if output.exists():
+        shutil.rmtree(output)
+    image_dir = output / "images"
+    image_dir.mkdir(parents=True)
+    video_path = output / "video.mp4"
+    video = cv2.VideoWriter(str(video_path), cv2.VideoWriter_fourcc(*"mp4v"), args.fps, (args.width, args.height))
+
+    lines = ["# Synthetic scene ground truth, camera from world", "# NAME QW QX QY QZ TX TY TZ"]
+    for i, (rotation, center) in enumerate(camera_path(args.path, args.frames)):
+        image_name = f"frame_{i:06d}.png"
+        image = render(surfaces, rotation, center, args.width, args.height, focal)
+        cv2.imwrite(str(image_dir / image_name), image)
+        if video.isOpened():
+            video.write(image)
+        q = rotation_to_quaternion(rotation)
+        t = -rotation @ center
+        lines.append(f"{image_name} " + " ".join(f"{value:.9f}" for value in (*q, *t)))
+        print(f"\rRendered {i + 1}/{args.frames}", end="", flush=True)
+    print()
+    video.release()
+    (output / "ground_truth.txt").write_text("\n".join(lines) + "\n")
+
+    scene = {
+        "name": name,
+        "seed": args.seed,
+        "path": args.path,
+        "width": args.width,
+        "height": args.height,
+        "frames": args.frames,
+        "boxes": args.boxes,
+        "focal": focal,
+        "fps": args.fps,
+    }
+    (output / "scene.json").write_text(json.dumps(scene, indent=2) + "\n")
+    print(f"Scene '{name}' written to {output}")
+    return 0
+
+
+# ---------------------------------------------------------------------------
+# Running the pipeline
+# ---------------------------------------------------------------------------
+
+def write_config(base_path, config_path, overrides):
+    """Copy an .ini file, replacing or adding the given {section: {key: value}} entries."""
+    lines = Path(base_path).read_text().splitlines()
+    pending = {section: dict(values) for section, values in overrides.items()}
+    result = []
+    section = None
+
+    def flush(section_name):
+        for key, value in pending.pop(section_name, {}).items():
+            result.append(f"{key} = {value}")
+
+    for line in lines:
+        stripped = line.strip()
+        if stripped.startswith("[") and stripped.endswith("]"):
+            flush(section)
+            section = stripped[1:-1]
+            result.append(line)
+            continue
+        key = stripped.split("=", 1)[0].strip() if "=" in stripped and stripped[0] not in "#;" else None
+        if key is not None and key in pending.get(section, {}):
+            result.append(f"{key} = {pending[section].pop(key)}")
+            continue
+        result.append(line)
+    flush(section)
+    for section_name in list(pending):
+        result.extend(["", f"[{section_name}]"])
+        flush(section_name)
+    Path(config_path).write_text("\n".join(result) + "\n")
+
+
+def find_app(app):
+    if app:
+        return Path(app)
+    for candidate in (PROJECT_ROOT / "build" / "colmap-neural",
+                      PROJECT_ROOT / "build" / "colmap-neural-app" / "colmap-neural"):
+        if candidate.exists():
+            return candidate
+    raise SystemExit("Application not found, build it first or pass --app")
+
+
+def parse_overrides(entries):
+    overrides = {}
+    for entry in entries or []:
+        name, _, value = entry.partition("=")
+        section, _, key = name.partition(".")
+        if not key:
+            raise SystemExit(f"Override '{entry}' is not Section.key=value")
+        overrides.setdefault(section, {})[key] = value
+    return overrides
+
+
+def run_once(app, base_config, scene_dir, workspace, overrides):
+    if workspace.exists():
+        shutil.rmtree(workspace)
+    workspace.mkdir(parents=True)
+    config = {
+        "Input": {"source": "video", "video_path": scene_dir / "video.mp4"},
+        "Colmap": {"image_path": scene_dir / "images", "output_path": workspace, "data_type": "individual"},
+        "Checkpoint": {"enabled": "false"},
+        "Localization": {"enabled": "false"},
+        "Benchmark": {"enabled": "true", "ground_truth": scene_dir / "ground_truth.txt"},
+    }
+    for section, values in overrides.items():
+        config.setdefault(section, {}).update(values)
+    config_path = workspace.parent / f"{workspace.name}.ini"
+    write_config(base_config, config_path, config)
+
+    # Relative paths of the base configuration stay relative to its folder
+    with open(workspace.parent / f"{workspace.name}.log", "w") as log:
+        process = subprocess.run([str(app), str(config_path)], cwd=Path(base_config).parent,
+                                 stdout=log, stderr=subprocess.STDOUT)
+    if process.returncode != 0:
+        raise SystemExit(f"Run failed with exit code {process.returncode}, see {log.name}")
+    results_path = workspace / "benchmark_results.json"
+    if not results_path.exists():
+        raise SystemExit(f"No benchmark results at {results_path}")
+    return json.loads(results_path.read_text())
+
+
+# ---------------------------------------------------------------------------
+# Baseline comparison
+# ---------------------------------------------------------------------------
+
+def summarize(results):
+    """Stages of one run merged by name: summed time and items, highest peak memory."""
+    stages = {}
+    for stage in results.get("stages", []):
+        merged = stages.setdefault(stage["name"], {"time": 0.0, "peak_memory_mb": 0.0, "items": 0})
+        merged["time"] += stage["time"] or 0.0
+        merged["peak_memory_mb"] = max(merged["peak_memory_mb"], stage["peak_memory_mb"] or 0.0)
+        merged["items"] += stage["items"]
+    for merged in stages.values():
+        merged["throughput"] = merged["items"] / merged["time"] if merged["items"] and merged["time"] > 0 else 0.0
+    return {
+        "total_time": results.get("total_time") or 0.0,
+        "peak_memory_mb": results.get("peak_memory_mb") or 0.0,
+        "stages": stages,
+        "metrics": {key: value for key, value in results.get("metrics", {}).items() if value is not None},
+    }
+
+
+def median_summary(summaries):
+    """Median of every number over repeated runs."""
+    if len(summaries) == 1:
+        return summaries[0]
+
+    def median_of(values):
+        return statistics.median(values) if values else 0.0
+
+    merged = {
+        "total_time": median_of([s["total_time"] for s in summaries]),
+        "peak_memory_mb": median_of([s["peak_memory_mb"] for s in summaries]),
+        "stages": {},
+        "metrics": {},
+    }
+    for name in summaries[0]["stages"]:
+        runs = [s["stages"][name] for s in summaries if name in s["stages"]]
+        merged["stages"][name] = {field: median_of([r[field] for r in runs])
+                                  for field in ("time", "peak_memory_mb", "items", "throughput")}
+    for key in summaries[0]["metrics"]:
+        merged["metrics"][key] = median_of([s["metrics"][key] for s in summaries if key in s["metrics"]])
+    return merged
+
+
+def metric_limit(key, baseline, tolerances):
+    """Worst acceptable value of a metric and whether higher values are better."""
+    direction = METRIC_DIRECTIONS.get(key, -1)
+    if key.endswith("_fraction"):
+        return baseline - tolerances["fraction_floor"], True
+    if key == "num_registered":
+        return baseline * (1.0 - tolerances["fraction_floor"]), True
+    if key.startswith("position_error"):
+        return max(baseline * (1.0 + tolerances["pose"]), baseline + tolerances["position_floor"]), False
+    if key.startswith("rotation_error"):
+        return max(baseline * (1.0 + tolerances["pose"]), baseline + tolerances["rotation_floor_deg"]), False
+    if key.startswith("latency"):
+        return baseline * (1.0 + tolerances["time"]), False
+    if direction > 0:
+        return baseline * (1.0 - tolerances["pose"]), True
+    return baseline * (1.0 + tolerances["pose"]), False
+
+
+def compare(current, baseline):
+    """List of (check, baseline, current, limit, passed) rows."""
+    tolerances = dict(DEFAULT_TOLERANCES)
+    tolerances.update(baseline.get("tolerances", {}))
+    rows = []
+
+    def upper(check, base, value, relative, floor):
+        limit = max(base * (1.0 + relative), base + floor)
+        rows.append((check, base, value, limit, value is not None and value <= limit))
+
+    def lower(check, base, value, relative):
+        limit = base * (1.0 - relative)
+        rows.append((check, base, value, limit, value is not None and value >= limit))
+
+    upper("total time (s)", baseline["total_time"], current["total_time"],
+          tolerances["time"], tolerances["time_floor_s"])
+    upper("peak memory (MB)", baseline["peak_memory_mb"], current["peak_memory_mb"],
+          tolerances["memory"], tolerances["memory_floor_mb"])
+    for name, base in baseline["stages"].items():
+        stage = current["stages"].get(name)
+        if stage is None:
+            rows.append((f"{name}: present", 1, 0, 1, False))
+            continue
+        upper(f"{name}: time (s)", base["time"], stage["time"], tolerances["time"], tolerances["time_floor_s"])
+        if base["throughput"] > 0 and base["time"] >= tolerances["time_floor_s"]:
+            lower(f"{name}: throughput (items/s)", base["throughput"], stage["throughput"],
+                  tolerances["throughput"])
+        upper(f"{name}: peak memory (MB)", base["peak_memory_mb"], stage["peak_memory_mb"],
+              tolerances["memory"], tolerances["memory_floor_mb"])
+    for key, base in baseline["metrics"].items():
+        value = current["metrics"].get(key)
+        limit, higher_is_better = metric_limit(key, base, tolerances)
+        passed = value is not None and (value >= limit if higher_is_better else value <= limit)
+        rows.append((key, base, value, limit, passed))
+    return rows
+
+
+def print_report(rows):
+    def number(value):
+        return "-" if value is None else f"{value:.4g}"
+
+    width = max(len(row[0]) for row in rows)
+    print(f"{'check':<{width}}  {'baseline':>10}  {'current':>10}  {'limit':>10}  result")
+    for check, base, value, limit, passed in rows:
+        print(f"{check:<{width}}  {number(base):>10}  {number(value):>10}  {number(limit):>10}  "
+              f"{'PASS' if passed else 'FAIL'}")
+    failures = sum(1 for row in rows if not row[4])
+    print(f"\n{len(rows) - failures}/{len(rows)} checks passed: {'PASS' if failures == 0 else 'FAIL'}")
+    return failures == 0
+
+
+def baseline_path(args, scene):
+    if args.baseline:
+        return Path(args.baseline)
+    return BASELINE_DIR / f"{scene.get('name', 'scene')}.json"
+
+
+def check_against_baseline(summary, path, scene, update, report_path):
+    if update:
+        path.parent.mkdir(parents=True, exist_ok=True)
+        baseline = dict(summary)
+        baseline["scene"] = scene
+        baseline["tolerances"] = DEFAULT_TOLERANCES
+        path.write_text(json.dumps(baseline, indent=2) + "\n")
+        print(f"Baseline written to {path}")
+        return 0
+    if not path.exists():
+        print(f"No baseline at {path}; record one with --update-baseline")
+        return 1
+    baseline = json.loads(path.read_text())
+    if scene and baseline.get("scene") and baseline["scene"] != scene:
+        print(f"Warning: the baseline was recorded for a different scene: {baseline['scene']}")
+    rows = compare(summary, baseline)
+    passed = print_report(rows)
+    if report_path:
+        report = {
+            "passed": passed,
+            "baseline": str(path),
+            "checks": [{"check": r[0], "baseline": r[1], "current": r[2], "limit": r[3], "passed": r[4]}
+                       for r in rows],
+        }
+        Path(report_path).write_text(json.dumps(report, indent=2) + "\n")
+    return 0 if passed else 1
+
+
+def run(args):
+    scene_dir = Path(args.scene).absolute()
+    scene_file = scene_dir / "scene.json"
+    scene = json.loads(scene_file.read_text()) if scene_file.exists() else {}
+    app = find_app(args.app)
+    output = Path(args.output).absolute()
+    output.mkdir(parents=True, exist_ok=True)
+    overrides = parse_overrides(args.set)
+
+    summaries = []
+    for repeat in range(args.repeat):
+        print(f"Run {repeat + 1}/{args.repeat} of {scene.get('name', scene_dir.name)}")
+        results = run_once(app, Path(args.config).absolute(), scene_dir, output / f"run_{repeat}", overrides)
+        summaries.append(summarize(results))
+    summary = median_summary(summaries)
+    (output / "summary.json").write_text(json.dumps(summary, indent=2) + "\n")
+    return check_against_baseline(summary, baseline_path(args, scene), scene, args.update_baseline,
+                                  output / "report.json")
+
+
+def compare_command(args):
+    summary = summarize(json.loads(Path(args.results).read_text()))
+    scene = json.loads(Path(args.scene_info).read_text()) if args.scene_info else {}
+    return check_against_baseline(summary, baseline_path(args, scene), scene, args.update_baseline, args.report)
+
 
 def main():
-    parser = argparse.ArgumentParser(description='Benchmark COLMAP Neural Enhancement')
-    parser.add_argument('--dataset', required=True, help='Path to benchmark dataset')
-    parser.add_argument('--output', required=True, help='Path to output directory')
-    parser.add_argument('--feature-extractors', nargs='+', default=['superpoint', 'netvlad', 'sift'], 
-                        help='Feature extractors to benchmark')
-    parser.add_argument('--matchers', nargs='+', default=['superglue', 'nearest_neighbor'], 
-                        help='Feature matchers to benchmark')
-    parser.add_argument('--mvs', nargs='+', default=['mvsnet', 'patch_match'], 
-                        help='MVS methods to benchmark')
-    parser.add_argument('--cpu-only', action='store_true', help='Use CPU only')
+    parser = argparse.ArgumentParser(description="Benchmark COLMAP Neural Enhancement on synthetic scenes")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    generate_parser = commands.add_parser("generate", help="Render a synthetic scene with known poses")
+    generate_parser.add_argument("--output", required=True, help="Scene folder to create")
+    generate_parser.add_argument("--name", help="Scene name used for the baseline file")
+    generate_parser.add_argument("--seed", type=int, default=0, help="Seed of textures and layout")
+    generate_parser.add_argument("--width", type=int, default=640)
+    generate_parser.add_argument("--height", type=int, default=480)
+    generate_parser.add_argument("--frames", type=int, default=40, help="Images along the camera path")
+    generate_parser.add_argument("--path", choices=["orbit", "walk"], default="orbit", help="Camera path")
+    generate_parser.add_argument("--boxes", type=int, default=6, help="Textured boxes in the scene")
+    generate_parser.add_argument("--focal", type=float, default=0.9, help="Focal length in image sizes")
+    generate_parser.add_argument("--fps", type=float, default=10.0, help="Frame rate of the video")
+    generate_parser.set_defaults(handler=generate)
+
+    run_parser = commands.add_parser("run", help="Reconstruct a scene and compare with its baseline")
+    run_parser.add_argument("--scene", required=True, help="Scene folder written by 'generate'")
+    run_parser.add_argument("--output", required=True, help="Workspace for the runs")
+    run_parser.add_argument("--app", help="Application binary (default: build/colmap-neural)")
+    run_parser.add_argument("--config", default=str(PROJECT_ROOT / "config" / "config.ini"),
+                            help="Base configuration the scene paths are written into")
+    run_parser.add_argument("--set", action="append", metavar="SECTION.KEY=VALUE",
+                            help="Override a configuration value, e.g. Colmap.pipeline=overlapped")
+    run_parser.add_argument("--repeat", type=int, default=1, help="Runs whose median is compared")
+    run_parser.add_argument("--baseline", help="Baseline file (default: scripts/baselines/<scene>.json)")
+    run_parser.add_argument("--update-baseline", action="store_true", help="Record the run as the baseline")
+    run_parser.set_defaults(handler=run)
+
+    compare_parser = commands.add_parser("compare", help="Compare existing results with a baseline")
+    compare_parser.add_argument("--results", required=True, help="benchmark_results.json of a run")
+    compare_parser.add_argument("--baseline", required=True, help="Baseline file")
+    compare_parser.add_argument("--scene-info", help="scene.json of the scene the results belong to")
+    compare_parser.add_argument("--report", help="Write the checks as JSON")
+    compare_parser.add_argument("--update-baseline", action="store_true", help="Record the results as the baseline")
+    compare_parser.set_defaults(handler=compare_command)
+
     args = parser.parse_args()
-    
-    # Get the project root directory
-    script_dir = Path(__file__).parent.absolute()
-    project_root = script_dir.parent
-    build_dir = project_root / "build"
-    app_path = build_dir / "colmap-neural-app" / "colmap-neural"
-    
-    # Create output directory
-    output_dir = Path(args.output)
-    output_dir.mkdir(exist_ok=True, parents=True)
-    
-    # Create results CSV file
-    results_file = output_dir / "benchmark_results.csv"
-    with open(results_file, 'w', newline='') as csvfile:
-        writer = csv.writer(csvfile)
-        writer.writerow([
-            'Feature Extractor', 'Matcher', 'MVS', 'GPU/CPU',
-            'Feature Extraction Time (s)', 'Matching Time (s)', 'MVS Time (s)', 
-            'Total Time (s)', 'Memory Usage (MB)', 'Reconstruction Quality'
-        ])
-    
-    # Run benchmarks for all combinations
-    for extractor in args.feature_extractors:
-        for matcher in args.matchers:
-            for mvs_method in args.mvs:
-                # Skip incompatible combinations
-                if extractor == 'sift' and matcher == 'superglue':
-                    print(f"Skipping incompatible combination: {extractor} + {matcher}")
-                    continue
-                
-                # Create benchmark workspace
-                workspace = output_dir / f"{extractor}_{matcher}_{mvs_method}"
-                workspace.mkdir(exist_ok=True)
-                
-                # Configure command
-                cmd = [
-                    str(app_path),
-                    f"--workspace={workspace}",
-                    f"--images={args.dataset}",
-                    f"--feature-extractor={extractor}",
-                    f"--matcher={matcher}",
-                    f"--mvs={mvs_method}",
-                    "--benchmark=true",
-                    f"--benchmark_dataset={args.dataset}"
-                ]
-                
-                if args.cpu_only:
-                    cmd.append("--cpu")
-                
-                # Run benchmark
-                print(f"Running benchmark: {extractor} + {matcher} + {mvs_method}")
-                try:
-                    start_time = time.time()
-                    process = subprocess.run(cmd, capture_output=True, text=True, check=True)
-                    end_time = time.time()
-                    
-                    # Parse benchmark results from output
-                    benchmark_file = workspace / "benchmark_results.json"
-                    if benchmark_file.exists():
-                        with open(benchmark_file, 'r') as f:
-                            results = json.load(f)
-                            
-                        # Add to CSV
-                        with open(results_file, 'a', newline='') as csvfile:
-                            writer = csv.writer(csvfile)
-                            writer.writerow([
-                                extractor, matcher, mvs_method, 
-                                "CPU" if args.cpu_only else "GPU",
-                                results.get("feature_extraction_time", 0),
-                                results.get("matching_time", 0),
-                                results.get("mvs_time", 0),
-                                results.get("total_time", 0),
-                                results.get("memory_usage", 0),
-                                results.get("reconstruction_quality", 0)
-                            ])
-                    else:
-                        print(f"  ⚠️ No benchmark results file found at {benchmark_file}")
-                        
-                except subprocess.CalledProcessError as e:
-                    print(f"  ❌ Benchmark failed: {e}")
-                    print(f"  Error output: {e.stderr}")
-    
-    print(f"✅ Benchmarks completed. Results saved to {results_file}")
+    return args.handler(args)
+
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    sys.exit(main())
@@ -93,7 +93,7 @@ if [ ! -d "$COLMAP_SOURCE_DIR" ]; then
     
     # Switch to a stable version tag
     cd "$COLMAP_SOURCE_DIR"
-    git checkout 3.8
+    git checkout 3.9.1
     cd "$BUILD_DIR"
     
     echo "✅ COLMAP repository cloned successfully"
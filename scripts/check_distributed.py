@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# scripts/check_distributed.py
+#
+# End-to-end check of distributed matching.
+#
+# Reconstructs a scene twice, once in a single process ('overlapped' pipeline) and once with
+# local matching worker processes ('distributed' pipeline), and compares the two databases:
+# the keypoints of every image, the raw matches of every pair and the verified pairs with
+# their geometry type and inlier count. Images and pairs are compared by name, as the two
+# runs may number them differently.
+#
+#   python3 scripts/benchmark.py generate --output /tmp/orbit --frames 20
+#   python3 scripts/check_distributed.py --scene /tmp/orbit --output /tmp/orbit_distributed
+
+import argparse
+import sqlite3
+import sys
+from pathlib import Path
+
+import numpy as np
+
+from benchmark import PROJECT_ROOT, find_app, parse_overrides, run_once
+
+# COLMAP pair ids: image_id1 * MAX_IMAGE_ID + image_id2 with image_id1 < image_id2
+MAX_IMAGE_ID = 2147483647
+
+
+def read_database(path):
+    """Keypoint counts, raw matches and verified geometries keyed by image names."""
+    connection = sqlite3.connect(f"file:{path}?mode=ro", uri=True)
+    names = dict(connection.execute("SELECT image_id, name FROM images"))
+    keypoints = {names[image_id]: rows
+                 for image_id, rows in connection.execute("SELECT image_id, rows FROM keypoints")}
+
+    def pair_key(pair_id, data, rows):
+        image_id1, image_id2 = divmod(pair_id, MAX_IMAGE_ID)
+        name1, name2 = names[image_id1], names[image_id2]
+        pairs = np.frombuffer(data, dtype=np.uint32).reshape(rows, 2) if rows else np.zeros((0, 2), np.uint32)
+        if name1 > name2:
+            name1, name2 = name2, name1
+            pairs = pairs[:, ::-1]
+        # Matches are compared as sets; their order depends on the matching threads
+        return (name1, name2), {tuple(pair) for pair in pairs.tolist()}
+
+    matches = dict(pair_key(pair_id, data, rows)
+                   for pair_id, rows, data in connection.execute("SELECT pair_id, rows, data FROM matches"))
+    geometries = {}
+    for pair_id, rows, data, config in connection.execute(
+            "SELECT pair_id, rows, data, config FROM two_view_geometries"):
+        key, inliers = pair_key(pair_id, data, rows)
+        geometries[key] = (config, len(inliers))
+    connection.close()
+    return keypoints, matches, geometries
+
+
+def compare_databases(single, distributed, inlier_tolerance):
+    failures = []
+    single_keypoints, single_matches, single_geometries = single
+    keypoints, matches, geometries = distributed
+
+    if keypoints != single_keypoints:
+        failures.append(f"keypoints differ on {len(set(keypoints.items()) ^ set(single_keypoints.items()))} images")
+
+    missing = single_matches.keys() - matches.keys()
+    extra = matches.keys() - single_matches.keys()
+    if missing or extra:
+        failures.append(f"matched pairs differ: {len(missing)} missing, {len(extra)} extra")
+    different = [key for key in single_matches.keys() & matches.keys() if single_matches[key] != matches[key]]
+    if different:
+        failures.append(f"raw matches differ on {len(different)} pairs, e.g. {different[0]}")
+
+    verified = {key for key, (config, _) in geometries.items() if config > 1}
+    single_verified = {key for key, (config, _) in single_geometries.items() if config > 1}
+    if verified != single_verified:
+        failures.append(f"verified pairs differ: {len(single_verified - verified)} missing, "
+                        f"{len(verified - single_verified)} extra")
+    for key in sorted(verified & single_verified):
+        config, inliers = geometries[key]
+        single_config, single_inliers = single_geometries[key]
+        # RANSAC may draw other samples in another process; allow a small spread
+        limit = max(1, inlier_tolerance * single_inliers)
+        if config != single_config or abs(inliers - single_inliers) > limit:
+            failures.append(f"geometry of {key} differs: config {config} vs {single_config}, "
+                            f"{inliers} vs {single_inliers} inliers")
+
+    print(f"Compared {len(single_keypoints)} images, {len(single_matches)} matched and "
+          f"{len(single_verified)} verified pairs")
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check that distributed matching gives the single-process result")
+    parser.add_argument("--scene", required=True, help="Scene folder written by 'benchmark.py generate'")
+    parser.add_argument("--output", required=True, help="Workspace for the two runs")
+    parser.add_argument("--app", help="Application binary (default: build/colmap-neural)")
+    parser.add_argument("--config", default=str(PROJECT_ROOT / "config" / "config.ini"),
+                        help="Base configuration the scene paths are written into")
+    parser.add_argument("--workers", type=int, default=2, help="Local matching worker processes")
+    parser.add_argument("--shards", type=int, default=8, help="Shards the pair list is split into")
+    parser.add_argument("--inlier-tolerance", type=float, default=0.05,
+                        help="Relative difference allowed between the inlier counts of a verified pair")
+    parser.add_argument("--set", action="append", metavar="SECTION.KEY=VALUE",
+                        help="Override a configuration value of both runs, e.g. Colmap.quality=low")
+    args = parser.parse_args()
+
+    scene_dir = Path(args.scene).absolute()
+    app = find_app(args.app)
+    output = Path(args.output).absolute()
+    output.mkdir(parents=True, exist_ok=True)
+    overrides = parse_overrides(args.set)
+    overrides.setdefault("Colmap", {}).setdefault("dense", "false")
+
+    databases = {}
+    for name, pipeline in (("single", {"pipeline": "overlapped"}),
+                           ("distributed", {"pipeline": "distributed"})):
+        run_overrides = {section: dict(values) for section, values in overrides.items()}
+        run_overrides["Colmap"].update(pipeline)
+        run_overrides["Distributed"] = {"workers": args.workers, "shards": args.shards}
+        print(f"Running the {name} reconstruction")
+        run_once(app, Path(args.config).absolute(), scene_dir, output / name, run_overrides)
+        databases[name] = read_database(output / name / "database.db")
+
+    failures = compare_databases(databases["single"], databases["distributed"], args.inlier_tolerance)
+    for failure in failures:
+        print(f"FAIL {failure}")
+    print("Distributed matching matches the single-process run" if not failures else
+          f"{len(failures)} differences")
+    return 0 if not failures else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,445 @@
+#include "checkpoint.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include <unistd.h>
+
+#include <colmap/scene/database.h>
+
+namespace {
+
+// Write a file so that readers see either the old or the new content
+bool writeFileAtomic(const std::filesystem::path& path, const std::string& content) {
+    const std::filesystem::path tmpPath = path.string() + ".tmp";
+    FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const bool written = std::fwrite(content.data(), 1, content.size(), file) == content.size() &&
+                         std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    std::fclose(file);
+    if (!written) {
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    return !error;
+}
+
+// Stages in pipeline order; a stale stage makes every later one stale
+const char* const kStages[] = {Checkpoint::kExtraction, Checkpoint::kMatching, Checkpoint::kMapping,
+                               Checkpoint::kDense};
+constexpr size_t kNumStages = sizeof(kStages) / sizeof(kStages[0]);
+
+// Config settings that change the result of a stage. Everything else
+// (logging, threading, memory, queue sizes, distribution, export, ...)
+// can be edited without losing progress
+struct StageSetting {
+    const char* stage;
+    const char* section;
+    const char* key;
+};
+const StageSetting kStageSettings[] = {
+    {Checkpoint::kExtraction, "Colmap", "data_type"},
+    {Checkpoint::kExtraction, "Colmap", "quality"},
+    {Checkpoint::kExtraction, "Colmap", "coarse_to_fine"},
+    {Checkpoint::kExtraction, "Colmap", "coarse_image_size"},
+    {Checkpoint::kExtraction, "Model", "path"},
+    {Checkpoint::kExtraction, "Model", "confidence_threshold"},
+    {Checkpoint::kExtraction, "Model", "mask_dynamic_objects"},
+    {Checkpoint::kExtraction, "Model", "mask_classes"},
+    {Checkpoint::kMatching, "Colmap", "pipeline"},
+    {Checkpoint::kMatching, "Colmap", "pairing"},
+    {Checkpoint::kMatching, "Colmap", "vocab_tree_path"},
+    {Checkpoint::kMatching, "Colmap", "spatial_neighbors"},
+    {Checkpoint::kMatching, "Colmap", "spatial_radius"},
+    {Checkpoint::kMatching, "Colmap", "verification_prefilter"},
+    {Checkpoint::kMapping, "Colmap", "mapper"},
+    {Checkpoint::kMapping, "Colmap", "cluster_max_images"},
+    {Checkpoint::kMapping, "Colmap", "cluster_overlap"},
+    {Checkpoint::kDense, "Colmap", "dense_method"},
+    {Checkpoint::kDense, "Colmap", "mvsnet_model_path"},
+    {Checkpoint::kDense, "Colmap", "mvsnet_depths"},
+    {Checkpoint::kDense, "Colmap", "mvsnet_tile_size"},
+    {Checkpoint::kDense, "Colmap", "fusion"},
+    {Checkpoint::kDense, "Colmap", "fusion_voxel_size"},
+    {Checkpoint::kDense, "Colmap", "fusion_min_views"},
+};
+
+// Pipeline position of a recorded stage: mapping/cluster/N is part of
+// mapping, undistortion/N and fusion/N of dense
+size_t stageIndex(const std::string& stage) {
+    for (size_t i = 0; i < kNumStages; ++i) {
+        if (stage.compare(0, std::strlen(kStages[i]), kStages[i]) == 0) {
+            return i;
+        }
+    }
+    return kNumStages - 1;
+}
+
+// 64-bit FNV-1a
+void hashBytes(uint64_t& hash, const std::string& bytes) {
+    for (const unsigned char byte : bytes) {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+    hash = (hash ^ 0xff) * 1099511628211ull;
+}
+
+std::string trim(const std::string& text) {
+    const size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
+}
+
+} // namespace
+
+Checkpoint::Checkpoint(const std::string& workspacePath, bool enabled, bool discardStale)
+    : enabled(enabled),
+      discardStale(discardStale),
+      workspace(workspacePath),
+      directory((std::filesystem::path(workspacePath) / "checkpoint").string()) {
+    if (enabled) {
+        std::filesystem::create_directories(directory);
+    }
+}
+
+bool Checkpoint::load(const Fingerprint& jobFingerprint) {
+    if (!enabled) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    doneStages.clear();
+    denseDone.clear();
+    snapshotRegImages = 0;
+    stale = false;
+    fingerprint = jobFingerprint;
+
+    std::ifstream state(path("state.txt"));
+    Fingerprint recorded;
+    std::string line;
+    while (state && std::getline(state, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "fingerprint") {
+            std::string stage, digest;
+            if (fields >> stage >> digest) {
+                recorded[stage] = digest;
+            }
+        } else if (key == "stage") {
+            std::string stage;
+            if (fields >> stage) {
+                doneStages.insert(stage);
+            }
+        } else if (key == "snapshot") {
+            fields >> snapshotRegImages;
+        }
+    }
+
+    // The first stage whose inputs changed, and everything after it, is redone
+    if (state.is_open()) {
+        for (size_t i = 0; i < kNumStages; ++i) {
+            if (recorded[kStages[i]] == fingerprint[kStages[i]]) {
+                continue;
+            }
+            if (!discardStale) {
+                LOG_ERROR("Images or settings of the %s stage changed since the checkpoint in %s",
+                          kStages[i], directory.c_str());
+                for (const auto& output : staleOutputs(i)) {
+                    LOG_ERROR("  Stale output: %s", output.c_str());
+                }
+                if (i == 1) {
+                    LOG_ERROR("  Stale output: the matches in %s/database.db", workspace.c_str());
+                }
+                LOG_ERROR("Move these away or set 'discard_stale_outputs = true' in [Checkpoint]");
+                stale = true;
+                return false;
+            }
+            LOG_WARNING("Images or settings of the %s stage changed since the checkpoint in %s; "
+                        "redoing it and the stages after it", kStages[i], directory.c_str());
+            discardStages(i);
+            break;
+        }
+    }
+
+    // Lines are appended as depth maps finish; a torn last line lacks the
+    // terminating newline and is dropped
+    std::ifstream dense(path("dense_done.txt"));
+    std::string content((std::istreambuf_iterator<char>(dense)), std::istreambuf_iterator<char>());
+    size_t start = 0;
+    for (size_t end = content.find('\n'); end != std::string::npos; end = content.find('\n', start)) {
+        if (end > start) {
+            denseDone.insert(content.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    if (start < content.size()) {
+        writeFileAtomic(path("dense_done.txt"), content.substr(0, start));
+    }
+
+    // A crash between the two renames of commitSparseSnapshot() leaves
+    // only the previous snapshot
+    if (!std::filesystem::exists(path("sparse")) && std::filesystem::exists(path("sparse.old"))) {
+        std::filesystem::rename(path("sparse.old"), path("sparse"));
+    }
+
+    // Record the fingerprint right away, so that a crash before the first
+    // finished stage does not leave state of an unknown job
+    saveState();
+
+    const bool resumable = !doneStages.empty() || !denseDone.empty() || snapshotRegImages > 0;
+    if (resumable) {
+        LOG_INFO("Checkpoint found: %zu stages done, %zu images in sparse snapshot, %zu depth maps done",
+                 doneStages.size(), snapshotRegImages, denseDone.size());
+    }
+    return resumable;
+}
+
+bool Checkpoint::isStageDone(const std::string& stage) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return doneStages.count(stage) > 0;
+}
+
+void Checkpoint::markStageDone(const std::string& stage) {
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    doneStages.insert(stage);
+    saveState();
+}
+
+void Checkpoint::writePairList(const std::vector<std::pair<std::string, std::string>>& pairs) {
+    if (!enabled) {
+        return;
+    }
+    // Same layout as COLMAP's custom match list (one "name1 name2" per line)
+    std::string content;
+    for (const auto& pair : pairs) {
+        content += pair.first + " " + pair.second + "\n";
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!writeFileAtomic(path("pairs.txt"), content)) {
+        LOG_WARNING("Failed to write checkpoint pair list");
+    }
+}
+
+std::vector<std::pair<std::string, std::string>> Checkpoint::readPairList() {
+    std::vector<std::pair<std::string, std::string>> pairs;
+    if (!enabled) {
+        return pairs;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ifstream file(path("pairs.txt"));
+    std::string first, second;
+    while (file >> first >> second) {
+        pairs.emplace_back(first, second);
+    }
+    return pairs;
+}
+
+void Checkpoint::commitSparseSnapshot(const std::function<void(const std::string&)>& writeModels,
+                                      size_t numRegImages) {
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::string tmpPath = path("sparse.tmp");
+    const std::string oldPath = path("sparse.old");
+    const std::string currentPath = path("sparse");
+
+    std::error_code error;
+    std::filesystem::remove_all(tmpPath, error);
+    std::filesystem::create_directories(tmpPath);
+    writeModels(tmpPath);
+
+    std::filesystem::remove_all(oldPath, error);
+    if (std::filesystem::exists(currentPath)) {
+        std::filesystem::rename(currentPath, oldPath);
+    }
+    std::filesystem::rename(tmpPath, currentPath);
+    std::filesystem::remove_all(oldPath, error);
+
+    snapshotRegImages = numRegImages;
+    saveState();
+    LOG_DEBUG("Sparse snapshot saved with %zu registered images", numRegImages);
+}
+
+std::string Checkpoint::getSparseSnapshotPath() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled || snapshotRegImages == 0 || !std::filesystem::exists(path("sparse"))) {
+        return "";
+    }
+    return path("sparse");
+}
+
+size_t Checkpoint::getSnapshotRegImages() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return snapshotRegImages;
+}
+
+bool Checkpoint::isDenseImageDone(const std::string& imageName) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return denseDone.count(imageName) > 0;
+}
+
+void Checkpoint::markDenseImageDone(const std::string& imageName) {
+    if (!enabled) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!denseDone.insert(imageName).second) {
+        return;
+    }
+    // Appending keeps the cost per image constant on large datasets
+    std::ofstream log(path("dense_done.txt"), std::ios::app);
+    log << imageName << '\n';
+}
+
+Checkpoint::Fingerprint Checkpoint::computeFingerprint(const std::string& configPath,
+                                                       const std::string& imagePath) {
+    std::map<std::string, uint64_t> hashes;
+    for (const char* stage : kStages) {
+        hashes[stage] = 14695981039346656037ull;
+    }
+
+    // Only the settings of kStageSettings, so editing others, comments or
+    // blank lines keeps the checkpoint
+    std::ifstream config(configPath);
+    std::string line;
+    std::string section;
+    while (std::getline(config, line)) {
+        line = trim(line.substr(0, line.find(';')));
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (line.front() == '[' && line.back() == ']') {
+            section = line.substr(1, line.size() - 2);
+            continue;
+        }
+        const size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            continue;
+        }
+        const std::string key = trim(line.substr(0, separator));
+        for (const auto& setting : kStageSettings) {
+            if (section == setting.section && key == setting.key) {
+                hashBytes(hashes[setting.stage],
+                          section + "." + key + "=" + trim(line.substr(separator + 1)));
+            }
+        }
+    }
+
+    std::vector<std::string> files;
+    std::error_code error;
+    for (std::filesystem::recursive_directory_iterator it(imagePath, error), end; !error && it != end;
+         it.increment(error)) {
+        if (!it->is_regular_file(error)) {
+            continue;
+        }
+        const auto modified = it->last_write_time(error).time_since_epoch().count();
+        files.push_back(std::filesystem::relative(it->path(), imagePath, error).string() + " " +
+                        std::to_string(it->file_size(error)) + " " + std::to_string(modified));
+    }
+    std::sort(files.begin(), files.end());
+    for (const auto& file : files) {
+        hashBytes(hashes[kExtraction], file);
+    }
+
+    Fingerprint fingerprint;
+    for (const auto& [stage, hash] : hashes) {
+        char digest[17];
+        std::snprintf(digest, sizeof(digest), "%016llx", static_cast<unsigned long long>(hash));
+        fingerprint[stage] = digest;
+    }
+    return fingerprint;
+}
+
+std::vector<std::string> Checkpoint::staleOutputs(size_t firstStage) const {
+    const std::filesystem::path workspacePath(workspace);
+    std::vector<std::filesystem::path> candidates;
+    if (firstStage <= 0) {
+        for (const char* name : {"database.db", "database.db-wal", "database.db-shm"}) {
+            candidates.push_back(workspacePath / name);
+        }
+    }
+    if (firstStage <= 1) {
+        candidates.push_back(path("pairs.txt"));
+    }
+    if (firstStage <= 2) {
+        candidates.push_back(workspacePath / "sparse");
+        candidates.push_back(workspacePath / "clusters");
+        for (const char* name : {"sparse", "sparse.old", "sparse.tmp"}) {
+            candidates.push_back(path(name));
+        }
+    }
+    candidates.push_back(workspacePath / "dense");
+    candidates.push_back(path("dense_done.txt"));
+
+    std::vector<std::string> outputs;
+    std::error_code error;
+    for (const auto& candidate : candidates) {
+        if (std::filesystem::exists(candidate, error)) {
+            outputs.push_back(candidate.string());
+        }
+    }
+    return outputs;
+}
+
+void Checkpoint::discardStages(size_t firstStage) {
+    for (const auto& output : staleOutputs(firstStage)) {
+        std::error_code error;
+        std::filesystem::remove_all(output, error);
+        if (error) {
+            LOG_WARNING("Failed to delete stale %s: %s", output.c_str(), error.message().c_str());
+        } else {
+            LOG_WARNING("Deleted stale %s", output.c_str());
+        }
+    }
+
+    // The features of the database are still valid when only matching changed
+    const std::string databasePath = (std::filesystem::path(workspace) / "database.db").string();
+    if (firstStage == 1 && std::filesystem::exists(databasePath)) {
+        colmap::Database database(databasePath);
+        database.ClearMatches();
+        database.ClearTwoViewGeometries();
+        LOG_WARNING("Deleted the matches and two-view geometries in %s", databasePath.c_str());
+    }
+
+    for (auto it = doneStages.begin(); it != doneStages.end();) {
+        it = stageIndex(*it) >= firstStage ? doneStages.erase(it) : std::next(it);
+    }
+    if (firstStage <= 2) {
+        snapshotRegImages = 0;
+    }
+}
+
+void Checkpoint::saveState() {
+    std::ostringstream content;
+    for (const auto& [stage, digest] : fingerprint) {
+        content << "fingerprint " << stage << ' ' << digest << '\n';
+    }
+    for (const auto& stage : doneStages) {
+        content << "stage " << stage << '\n';
+    }
+    content << "snapshot " << snapshotRegImages << '\n';
+    if (!writeFileAtomic(path("state.txt"), content.str())) {
+        LOG_WARNING("Failed to write checkpoint state to %s", directory.c_str());
+    }
+}
+
+std::string Checkpoint::path(const std::string& name) const {
+    return (std::filesystem::path(directory) / name).string();
+}
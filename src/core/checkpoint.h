@@ -0,0 +1,179 @@
+/**
+ * @file checkpoint.h
+ * @brief Stage-level checkpoints for resuming long reconstructions
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @class Checkpoint
+ * @brief Records which units of a reconstruction job are complete
+ *
+ * State lives in a "checkpoint" folder inside the workspace:
+ *  - state.txt       fingerprint of each stage, completed stages and the size of
+ *                    the last sparse snapshot
+ *  - pairs.txt       the image pair list produced by matching
+ *  - sparse/         latest snapshot of the sparse models during mapping
+ *  - dense_done.txt  append-only log of images with finished depth maps
+ *
+ * Every update is written to a temporary file and renamed into place, so
+ * a crash at any point leaves either the previous or the new state.
+ *
+ * Each stage is tied to a fingerprint of the inputs and settings it depends
+ * on. When one changes, that stage and every later one are stale: their
+ * records and their outputs in the workspace (database, matches, sparse
+ * models, clusters, depth maps) are deleted, each with a log line, so they
+ * are rebuilt. With discarding disabled the job stops instead.
+ * Extracted features and verified matches are not duplicated here: the
+ * COLMAP database is transactional and already serves as their record.
+ */
+class Checkpoint {
+public:
+    static constexpr const char* kExtraction = "extraction"; /**< All images extracted */
+    static constexpr const char* kMatching = "matching";     /**< All pairs matched and verified */
+    static constexpr const char* kMapping = "mapping";       /**< Sparse models written to the workspace */
+    static constexpr const char* kDense = "dense";           /**< Depth maps and fused clouds */
+
+    /** Hex digest of the inputs of each stage, keyed by stage name */
+    using Fingerprint = std::map<std::string, std::string>;
+
+    /**
+     * @brief Construct a checkpoint for a workspace
+     * @param workspacePath The reconstruction output folder
+     * @param enabled If false, nothing is read or written and no stage is ever done
+     * @param discardStale If false, stale outputs are kept and load() marks the checkpoint stale
+     */
+    Checkpoint(const std::string& workspacePath, bool enabled, bool discardStale);
+
+    /**
+     * @brief Read the checkpoint state from disk
+     *
+     * Stages whose fingerprint changed are discarded together with every
+     * later stage, see the class description.
+     *
+     * @param fingerprint Fingerprint of the job, see computeFingerprint()
+     * @return true if a previous run of the same job left progress to resume from
+     */
+    bool load(const Fingerprint& fingerprint);
+
+    /**
+     * @brief Fingerprint the inputs of each stage of a job
+     *
+     * Extraction covers the path, size and modification time of every file
+     * below the image folder. Each stage also covers the config settings
+     * that change its result (quality, pairing, mapper, dense method and
+     * the like); all other settings can be edited without losing progress.
+     *
+     * @param configPath Config file of the job
+     * @param imagePath Input image folder
+     * @return Digest per stage
+     */
+    static Fingerprint computeFingerprint(const std::string& configPath, const std::string& imagePath);
+
+    /**
+     * @brief Get whether checkpoints are written
+     * @return true if enabled
+     */
+    bool isEnabled() const { return enabled; }
+
+    /**
+     * @brief Get whether stale outputs are deleted
+     * @return true if load() discards stale stages
+     */
+    bool discardsStale() const { return discardStale; }
+
+    /**
+     * @brief Get whether load() found stale outputs it was not allowed to delete
+     * @return true if the job must not run on this workspace
+     */
+    bool isStale() const { return stale; }
+
+    /**
+     * @brief Get the fingerprint of the job given to load()
+     * @return Digest per stage, empty before load()
+     */
+    const Fingerprint& getFingerprint() const { return fingerprint; }
+
+    /**
+     * @brief Get whether a stage completed in this or a previous run
+     * @param stage Stage name, e.g. Checkpoint::kMatching
+     * @return true if the stage is done
+     */
+    bool isStageDone(const std::string& stage);
+
+    /**
+     * @brief Record a completed stage
+     * @param stage Stage name
+     */
+    void markStageDone(const std::string& stage);
+
+    /**
+     * @brief Store the list of matched image pairs
+     * @param pairs Pairs of image names
+     */
+    void writePairList(const std::vector<std::pair<std::string, std::string>>& pairs);
+
+    /**
+     * @brief Read the stored list of matched image pairs
+     * @return Pairs of image names, empty if none was stored
+     */
+    std::vector<std::pair<std::string, std::string>> readPairList();
+
+    /**
+     * @brief Replace the sparse snapshot
+     * @param writeModels Writes the models into the folder it is given
+     * @param numRegImages Registered images covered by the snapshot
+     */
+    void commitSparseSnapshot(const std::function<void(const std::string&)>& writeModels,
+                              size_t numRegImages);
+
+    /**
+     * @brief Get the folder of the latest sparse snapshot
+     * @return Snapshot folder, empty if there is none
+     */
+    std::string getSparseSnapshotPath();
+
+    /**
+     * @brief Get the number of registered images in the latest snapshot
+     * @return Registered images, 0 if there is no snapshot
+     */
+    size_t getSnapshotRegImages();
+
+    /**
+     * @brief Get whether the depth map of an image was completed
+     * @param imageName Image name
+     * @return true if the image is done
+     */
+    bool isDenseImageDone(const std::string& imageName);
+
+    /**
+     * @brief Record a completed depth map
+     * @param imageName Image name
+     */
+    void markDenseImageDone(const std::string& imageName);
+
+private:
+    void saveState();
+    std::vector<std::string> staleOutputs(size_t firstStage) const;
+    void discardStages(size_t firstStage);
+    std::string path(const std::string& name) const;
+
+    bool enabled;
+    bool discardStale;
+    bool stale = false;
+    std::string workspace;
+    std::string directory;
+    Fingerprint fingerprint;
+    std::mutex mutex;
+    std::set<std::string> doneStages;
+    std::set<std::string> denseDone;
+    size_t snapshotRegImages = 0;
+};
@@ -0,0 +1,978 @@
+#include "colmap_stages.h"
+#include "logger.h"
+#include "model_loader.h"
+#include "stage_profiler.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <colmap/controllers/incremental_mapper.h>
+#include <colmap/estimators/two_view_geometry.h>
+#include <colmap/exe/sfm.h>
+#include <colmap/image/undistortion.h>
+#include <colmap/mvs/fusion.h>
+#include <colmap/mvs/patch_match.h>
+#include <colmap/scene/camera.h>
+#include <colmap/sensor/bitmap.h>
+#include <colmap/util/misc.h>
+#include <colmap/util/ply.h>
+
+namespace {
+
+// Image extensions picked up from the image folder
+bool isImageFile(const std::string& path) {
+    static const char* kExtensions[] = {".jpg", ".jpeg", ".png", ".tif", ".tiff", ".bmp"};
+    for (const char* ext : kExtensions) {
+        if (colmap::HasFileExtension(path, ext)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Cosine similarity of two SIFT descriptors, which COLMAP scales to an L2
+// norm of 512
+float descriptorSimilarity(const colmap::FeatureDescriptors& descriptors1, size_t index1,
+                           const colmap::FeatureDescriptors& descriptors2, size_t index2) {
+    const int dot = descriptors1.row(index1).cast<int>().dot(descriptors2.row(index2).cast<int>());
+    return static_cast<float>(std::min(1.0, dot / (512.0 * 512.0)));
+}
+
+// Remove the keypoints (given in source image pixels) where the mask is 0,
+// together with their descriptors; returns the number removed
+size_t maskKeypoints(const cv::Mat& mask, int width, int height,
+                     colmap::FeatureKeypoints& keypoints,
+                     colmap::FeatureDescriptors& descriptors) {
+    const float scaleX = static_cast<float>(mask.cols) / width;
+    const float scaleY = static_cast<float>(mask.rows) / height;
+    size_t kept = 0;
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+        const int x = std::clamp(static_cast<int>(keypoints[i].x * scaleX), 0, mask.cols - 1);
+        const int y = std::clamp(static_cast<int>(keypoints[i].y * scaleY), 0, mask.rows - 1);
+        if (mask.at<uint8_t>(y, x) == 0) {
+            continue;
+        }
+        if (kept != i) {
+            keypoints[kept] = keypoints[i];
+            descriptors.row(kept) = descriptors.row(i);
+        }
+        ++kept;
+    }
+    const size_t removed = keypoints.size() - kept;
+    keypoints.resize(kept);
+    descriptors.conservativeResize(static_cast<Eigen::Index>(kept), Eigen::NoChange);
+    return removed;
+}
+
+std::vector<Eigen::Vector2d> toPoints(const colmap::FeatureKeypoints& keypoints) {
+    std::vector<Eigen::Vector2d> points(keypoints.size());
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+        points[i] = Eigen::Vector2d(keypoints[i].x, keypoints[i].y);
+    }
+    return points;
+}
+
+// COLMAP writes depth and normal maps as a "width&height&channels&" text
+// header followed by the float data; a file cut short by a crash is smaller
+bool isCompleteMapFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    size_t width = 0;
+    size_t height = 0;
+    size_t channels = 0;
+    char separator = 0;
+    file >> width >> separator >> height >> separator >> channels >> separator;
+    if (!file || width == 0 || height == 0 || channels == 0) {
+        return false;
+    }
+    const auto headerSize = static_cast<size_t>(file.tellg());
+    file.seekg(0, std::ios::end);
+    return static_cast<size_t>(file.tellg()) == headerSize + width * height * channels * sizeof(float);
+}
+
+// Record the depth maps of a model that are complete and delete truncated
+// ones, so that PatchMatch (which skips existing maps) recomputes them
+size_t collectDepthMaps(const colmap::Reconstruction& reconstruction,
+                        const std::string& densePath,
+                        const std::string& outputType,
+                        Checkpoint& checkpoint) {
+    size_t numDone = 0;
+    for (const colmap::image_t imageId : reconstruction.RegImageIds()) {
+        const std::string& name = reconstruction.Image(imageId).Name();
+        const std::string fileName = name + "." + outputType + ".bin";
+        const std::string depthPath = colmap::JoinPaths(densePath, "stereo", "depth_maps", fileName);
+        const std::string normalPath = colmap::JoinPaths(densePath, "stereo", "normal_maps", fileName);
+        if (checkpoint.isDenseImageDone(name) ||
+            (isCompleteMapFile(depthPath) && isCompleteMapFile(normalPath))) {
+            checkpoint.markDenseImageDone(name);
+            ++numDone;
+        } else {
+            std::error_code error;
+            std::filesystem::remove(depthPath, error);
+            std::filesystem::remove(normalPath, error);
+        }
+    }
+    return numDone;
+}
+
+} // namespace
+
+ColmapStages::ColmapStages(colmap::OptionManager& options,
+                           const std::string& workspacePath,
+                           int numWorkers)
+    : options(options),
+      workspacePath(workspacePath),
+      database(*options.database_path),
+      numWorkers(std::max(1, numWorkers)),
+      reconstructionManager(std::make_shared<colmap::ReconstructionManager>()) {
+    const std::filesystem::path root(*options.image_path);
+    for (const auto& file : colmap::GetRecursiveFileList(*options.image_path)) {
+        if (isImageFile(file)) {
+            imageNames.push_back(
+                std::filesystem::path(file).lexically_relative(root).generic_string());
+        }
+    }
+    std::sort(imageNames.begin(), imageNames.end());
+
+    imageIds.assign(imageNames.size(), colmap::kInvalidImageId);
+    cameras.resize(imageNames.size());
+    keypoints.resize(imageNames.size());
+    descriptors.resize(imageNames.size());
+    featureReservations.resize(imageNames.size());
+    lastUsed.assign(imageNames.size(), 0);
+
+    for (int i = 0; i < this->numWorkers; ++i) {
+        extractors.push_back(colmap::CreateSiftFeatureExtractor(*options.sift_extraction));
+        matchers.push_back(colmap::CreateSiftFeatureMatcher(*options.sift_matching));
+    }
+
+    spillHandlerId = MemoryBudget::getInstance().addSpillHandler(
+        [this](size_t bytesNeeded) { return spillFeatures(bytesNeeded); });
+}
+
+ColmapStages::~ColmapStages() {
+    MemoryBudget::getInstance().removeSpillHandler(spillHandlerId);
+}
+
+void ColmapStages::enablePrefetch(size_t readAhead, int decodeThreads) {
+    ImageLoader::Options loaderOptions;
+    loaderOptions.readAhead = readAhead;
+    loaderOptions.decodeThreads = decodeThreads;
+    loaderOptions.maxImageSize = options.sift_extraction->max_image_size;
+    loaderOptions.color = !maskers.empty();
+    imageLoader = std::make_unique<ImageLoader>(*options.image_path, imageNames, loaderOptions);
+
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    for (size_t i = 0; i < imageNames.size(); ++i) {
+        if (database.ExistsImageWithName(imageNames[i]) &&
+            database.ExistsKeypoints(database.ReadImageWithName(imageNames[i]).ImageId())) {
+            imageLoader->skip(i);
+        }
+    }
+}
+
+void ColmapStages::setVerificationPrefilter(bool enabled) {
+    verifiers.clear();
+    if (!enabled) {
+        return;
+    }
+    const colmap::TwoViewGeometryOptions& geometryOptions = *options.two_view_geometry;
+    GeometricVerifier::Options verifierOptions;
+    verifierOptions.maxError = 2.0 * geometryOptions.ransac_options.max_error;
+    verifierOptions.confidence = geometryOptions.ransac_options.confidence;
+    verifierOptions.maxIterations = geometryOptions.ransac_options.max_num_trials;
+    verifierOptions.minInliers = geometryOptions.min_num_inliers;
+    for (int i = 0; i < numWorkers; ++i) {
+        verifiers.push_back(std::make_unique<GeometricVerifier>(verifierOptions));
+    }
+}
+
+bool ColmapStages::setDynamicObjectMasking(const DynamicObjectMasker::Options& maskerOptions) {
+    maskers.clear();
+#if defined(WITH_METAL)
+    modelLoader = std::make_unique<ModelLoader>(true);
+#else
+    modelLoader = std::make_unique<ModelLoader>(false);
+#endif
+    auto masker = std::make_unique<DynamicObjectMasker>(*modelLoader, maskerOptions);
+    if (!masker->isLoaded()) {
+        return false;
+    }
+    this->maskerOptions = maskerOptions;
+    maskers.resize(numWorkers);
+    maskers[0] = std::move(masker);
+    return true;
+}
+
+void ColmapStages::setLearnedDepth(const MVSNet::Options& netOptions) {
+    learnedDepthOptions = std::make_unique<MVSNet::Options>(netOptions);
+}
+
+void ColmapStages::setStreamingFusion(const StreamingFusion::Options& fusionOptions) {
+    streamingFusionOptions = std::make_unique<StreamingFusion::Options>(fusionOptions);
+}
+
+void ColmapStages::setPosePrior(std::shared_ptr<const colmap::Reconstruction> prior,
+                                const GuidedMatcher::Options& matcherOptions) {
+    std::unordered_map<std::string, colmap::image_t> priorIds;
+    for (const colmap::image_t imageId : prior->RegImageIds()) {
+        priorIds.emplace(prior->Image(imageId).Name(), imageId);
+    }
+    priorViews.assign(imageNames.size(), GuidedMatcher::View());
+    priorImageIds.assign(imageNames.size(), colmap::kInvalidImageId);
+    size_t numPosed = 0;
+    for (size_t i = 0; i < imageNames.size(); ++i) {
+        const auto it = priorIds.find(imageNames[i]);
+        if (it != priorIds.end() && GuidedMatcher::makeView(*prior, it->second, priorViews[i])) {
+            priorImageIds[i] = it->second;
+            ++numPosed;
+        }
+    }
+    guidedMatchers.clear();
+    for (int i = 0; i < numWorkers; ++i) {
+        guidedMatchers.push_back(std::make_unique<GuidedMatcher>(matcherOptions));
+    }
+    posePrior = std::move(prior);
+    LOG_INFO("Pose prior covers %zu of %zu images", numPosed, imageNames.size());
+}
+
+std::vector<std::pair<size_t, size_t>> ColmapStages::getPosePriorPairs(size_t minSharedPoints) const {
+    std::vector<std::pair<size_t, size_t>> pairs;
+    if (!posePrior) {
+        return pairs;
+    }
+    std::unordered_map<colmap::image_t, size_t> indices;
+    for (size_t i = 0; i < imageNames.size(); ++i) {
+        if (priorImageIds[i] != colmap::kInvalidImageId) {
+            indices.emplace(priorImageIds[i], i);
+        }
+    }
+
+    // Count the points every pair of images shares
+    std::unordered_map<uint64_t, size_t> shared;
+    std::vector<size_t> trackImages;
+    for (const auto& point : posePrior->Points3D()) {
+        trackImages.clear();
+        for (const auto& element : point.second.track.Elements()) {
+            const auto it = indices.find(element.image_id);
+            if (it != indices.end()) {
+                trackImages.push_back(it->second);
+            }
+        }
+        std::sort(trackImages.begin(), trackImages.end());
+        trackImages.erase(std::unique(trackImages.begin(), trackImages.end()), trackImages.end());
+        for (size_t a = 0; a < trackImages.size(); ++a) {
+            for (size_t b = a + 1; b < trackImages.size(); ++b) {
+                shared[(static_cast<uint64_t>(trackImages[a]) << 32) | trackImages[b]] += 1;
+            }
+        }
+    }
+    for (const auto& entry : shared) {
+        if (entry.second >= minSharedPoints) {
+            pairs.emplace_back(static_cast<size_t>(entry.first >> 32),
+                               static_cast<size_t>(entry.first & 0xFFFFFFFF));
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+void ColmapStages::setPartitionedMapping(const PartitionedMapper::Options& partitionOptions) {
+    partitioned = true;
+    this->partitionOptions = partitionOptions;
+}
+
+void ColmapStages::attach(ReconstructionPipeline& pipeline) {
+    pipeline.setExtractStage([this](size_t imageIndex, int workerIndex) {
+        return extractImage(imageIndex, workerIndex);
+    });
+    pipeline.setMatchStage([this](PairMatches& pair, int workerIndex) {
+        return matchPair(pair, workerIndex);
+    });
+    pipeline.setVerifyStage([this](const PairMatches& pair, int workerIndex) {
+        return verifyPair(pair, workerIndex);
+    });
+}
+
+bool ColmapStages::extractImage(size_t imageIndex, int workerIndex) {
+    const std::string& name = imageNames[imageIndex];
+
+    // Resume: reuse features already present in the database
+    if (loadExtracted(imageIndex)) {
+        return true;
+    }
+
+    colmap::Bitmap bitmap;
+    cv::Mat mask;
+    int width = 0;
+    int height = 0;
+    double focalLength = 0;
+    bool hasPriorFocalLength = false;
+    if (imageLoader || !maskers.empty()) {
+        // The bitmap may be decoded at a reduced scale; the camera and the
+        // keypoints keep the source resolution
+        ImageLoader::Image image;
+        const bool loaded = imageLoader
+            ? imageLoader->load(imageIndex, image)
+            : ImageLoader::decode(colmap::JoinPaths(*options.image_path, name), 0, true, image);
+        if (!loaded) {
+            LOG_WARNING("Failed to read image: %s", name.c_str());
+            return false;
+        }
+        cv::Mat gray = image.pixels;
+        if (image.pixels.channels() == 3) {
+            auto& masker = maskers[workerIndex];
+            if (!masker) {
+                masker = std::make_unique<DynamicObjectMasker>(*modelLoader, maskerOptions);
+            }
+            masker->computeMask(image.pixels, mask);
+            cv::cvtColor(image.pixels, gray, cv::COLOR_BGR2GRAY);
+        }
+        bitmap.ConvertFromRawBits(gray.data, static_cast<int>(gray.step),
+                                  gray.cols, gray.rows, false);
+        width = image.width;
+        height = image.height;
+        focalLength = image.focalLength;
+        hasPriorFocalLength = image.hasFocalLength;
+    } else {
+        if (!bitmap.Read(colmap::JoinPaths(*options.image_path, name), false)) {
+            LOG_WARNING("Failed to read image: %s", name.c_str());
+            return false;
+        }
+        width = bitmap.Width();
+        height = bitmap.Height();
+        hasPriorFocalLength = bitmap.ExifFocalLength(&focalLength);
+    }
+    if (!hasPriorFocalLength) {
+        focalLength = options.image_reader->default_focal_length_factor *
+                      std::max(width, height);
+    }
+    colmap::Camera camera = colmap::Camera::CreateFromModelName(
+        colmap::kInvalidCameraId, options.image_reader->camera_model,
+        focalLength, width, height);
+    camera.has_prior_focal_length = hasPriorFocalLength;
+
+    // Extract on a downscaled copy, as COLMAP's image reader does
+    const int maxSize = options.sift_extraction->max_image_size;
+    double scaleX = 1.0;
+    double scaleY = 1.0;
+    if (maxSize > 0 && std::max(width, height) > maxSize) {
+        const double scale = static_cast<double>(maxSize) / std::max(width, height);
+        const int scaledWidth = std::max(1, static_cast<int>(width * scale));
+        const int scaledHeight = std::max(1, static_cast<int>(height * scale));
+        bitmap.Rescale(scaledWidth, scaledHeight);
+        scaleX = static_cast<double>(width) / scaledWidth;
+        scaleY = static_cast<double>(height) / scaledHeight;
+    }
+
+    auto imageKeypoints = std::make_shared<colmap::FeatureKeypoints>();
+    auto imageDescriptors = std::make_shared<colmap::FeatureDescriptors>();
+    if (!extractors[workerIndex]->Extract(bitmap, imageKeypoints.get(), imageDescriptors.get())) {
+        LOG_WARNING("Feature extraction failed: %s", name.c_str());
+        return false;
+    }
+    if (scaleX != 1.0 || scaleY != 1.0) {
+        for (auto& keypoint : *imageKeypoints) {
+            keypoint.Rescale(scaleX, scaleY);
+        }
+    }
+    if (!mask.empty()) {
+        const size_t numMasked = maskKeypoints(mask, width, height, *imageKeypoints, *imageDescriptors);
+        LOG_DEBUG("Masked %zu keypoints on dynamic objects: %s", numMasked, name.c_str());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(databaseMutex);
+        colmap::DatabaseTransaction transaction(&database);
+        camera.camera_id = database.WriteCamera(camera);
+        colmap::Image image;
+        image.SetName(name);
+        image.SetCameraId(camera.camera_id);
+        imageIds[imageIndex] = database.WriteImage(image);
+        database.WriteKeypoints(imageIds[imageIndex], *imageKeypoints);
+        database.WriteDescriptors(imageIds[imageIndex], *imageDescriptors);
+    }
+
+    cameras[imageIndex] = camera;
+    LOG_DEBUG("Extracted %zu features: %s", imageKeypoints->size(), name.c_str());
+    cacheFeatures(imageIndex, std::move(imageKeypoints), std::move(imageDescriptors));
+    return true;
+}
+
+bool ColmapStages::loadExtracted(size_t imageIndex) {
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    if (!database.ExistsImageWithName(imageNames[imageIndex])) {
+        return false;
+    }
+    const colmap::Image image = database.ReadImageWithName(imageNames[imageIndex]);
+    if (!database.ExistsKeypoints(image.ImageId())) {
+        return false;
+    }
+    imageIds[imageIndex] = image.ImageId();
+    cameras[imageIndex] = database.ReadCamera(image.CameraId());
+    return true;
+}
+
+bool ColmapStages::matchPair(PairMatches& pair, int workerIndex) {
+    const colmap::image_t imageId1 = imageIds[pair.first];
+    const colmap::image_t imageId2 = imageIds[pair.second];
+    {
+        std::lock_guard<std::mutex> lock(databaseMutex);
+        if (database.ExistsInlierMatches(imageId1, imageId2)) {
+            recordMatchedPair(pair.first, pair.second);
+            return false;
+        }
+    }
+
+    colmap::FeatureMatcher::Image image1;
+    image1.image_id = imageId1;
+    getFeatures(pair.first, image1.keypoints, image1.descriptors);
+    colmap::FeatureMatcher::Image image2;
+    image2.image_id = imageId2;
+    getFeatures(pair.second, image2.keypoints, image2.descriptors);
+
+    // Confidences order the PROSAC sampling of the verifier: the ratio-test
+    // margin of guided matches, the descriptor similarity of COLMAP's matches
+    colmap::FeatureMatches matches;
+    if (posePrior && priorImageIds[pair.first] != colmap::kInvalidImageId &&
+        priorImageIds[pair.second] != colmap::kInvalidImageId) {
+        guidedMatchers[workerIndex]->match(priorViews[pair.first], *image1.keypoints, *image1.descriptors,
+                                           priorViews[pair.second], *image2.keypoints, *image2.descriptors,
+                                           matches, pair.scores);
+    } else {
+        matchers[workerIndex]->Match(image1, image2, &matches);
+        pair.scores.clear();
+        pair.scores.reserve(matches.size());
+        for (const auto& match : matches) {
+            pair.scores.push_back(descriptorSimilarity(*image1.descriptors, match.point2D_idx1,
+                                                       *image2.descriptors, match.point2D_idx2));
+        }
+    }
+    if (matches.empty()) {
+        return false;
+    }
+
+    pair.matches.clear();
+    pair.matches.reserve(matches.size());
+    for (const auto& match : matches) {
+        pair.matches.emplace_back(match.point2D_idx1, match.point2D_idx2);
+    }
+    return true;
+}
+
+bool ColmapStages::verifyPair(const PairMatches& pair, int workerIndex) {
+    colmap::FeatureMatches matches;
+    matches.reserve(pair.matches.size());
+    for (const auto& match : pair.matches) {
+        matches.emplace_back(match.first, match.second);
+    }
+
+    std::shared_ptr<const colmap::FeatureKeypoints> keypoints1, keypoints2;
+    std::shared_ptr<const colmap::FeatureDescriptors> descriptors1, descriptors2;
+    getFeatures(pair.first, keypoints1, descriptors1);
+    getFeatures(pair.second, keypoints2, descriptors2);
+
+    colmap::TwoViewGeometry geometry;
+    if (verifiers.empty()) {
+        geometry = colmap::EstimateTwoViewGeometry(
+            cameras[pair.first], toPoints(*keypoints1),
+            cameras[pair.second], toPoints(*keypoints2),
+            matches, *options.two_view_geometry);
+    } else {
+        // Pairs failing the prefilter are stored with an undefined geometry,
+        // like pairs the estimation rejects
+        std::vector<uint32_t> consistent;
+        if (verifiers[workerIndex]->verify(*keypoints1, *keypoints2, pair, consistent)) {
+            colmap::FeatureMatches candidates;
+            candidates.reserve(consistent.size());
+            for (const uint32_t index : consistent) {
+                candidates.push_back(matches[index]);
+            }
+            geometry = colmap::EstimateTwoViewGeometry(
+                cameras[pair.first], toPoints(*keypoints1),
+                cameras[pair.second], toPoints(*keypoints2),
+                candidates, *options.two_view_geometry);
+        }
+    }
+
+    if (resultSink) {
+        resultSink(pair, matches, geometry);
+    } else {
+        storeMatches(pair.first, pair.second, matches, geometry);
+    }
+    return geometry.inlier_matches.size() >=
+           static_cast<size_t>(options.two_view_geometry->min_num_inliers);
+}
+
+void ColmapStages::storeMatches(size_t first, size_t second,
+                                const colmap::FeatureMatches& matches,
+                                const colmap::TwoViewGeometry& geometry) {
+    const colmap::image_t imageId1 = imageIds[first];
+    const colmap::image_t imageId2 = imageIds[second];
+    {
+        std::lock_guard<std::mutex> lock(databaseMutex);
+        colmap::DatabaseTransaction transaction(&database);
+        database.WriteMatches(imageId1, imageId2, matches);
+        database.WriteTwoViewGeometry(imageId1, imageId2, geometry);
+    }
+
+    if (geometry.inlier_matches.size() >=
+        static_cast<size_t>(options.two_view_geometry->min_num_inliers)) {
+        recordMatchedPair(first, second);
+    }
+}
+
+std::vector<std::pair<std::string, std::string>> ColmapStages::getMatchedPairs() {
+    std::lock_guard<std::mutex> lock(pairMutex);
+    std::vector<std::pair<std::string, std::string>> pairs;
+    pairs.reserve(matchedPairs.size());
+    for (const auto& pair : matchedPairs) {
+        pairs.emplace_back(imageNames[pair.first], imageNames[pair.second]);
+    }
+    return pairs;
+}
+
+bool ColmapStages::runMapping(Checkpoint& checkpoint, size_t snapshotInterval) {
+    const std::string sparsePath = colmap::JoinPaths(workspacePath, "sparse");
+    if (checkpoint.isStageDone(Checkpoint::kMapping)) {
+        for (const auto& modelPath : colmap::GetDirList(sparsePath)) {
+            reconstructionManager->Read(modelPath);
+        }
+        if (reconstructionManager->Size() > 0) {
+            LOG_INFO("Mapping already finished, loaded %zu models from %s",
+                     reconstructionManager->Size(), sparsePath.c_str());
+            return true;
+        }
+    }
+    StageProfiler::Scope stage("mapping");
+    stage.setItems(imageNames.size());
+    colmap::CreateDirIfNotExists(sparsePath);
+
+    if (posePrior) {
+        if (!triangulatePosePrior(sparsePath)) {
+            return false;
+        }
+        checkpoint.markStageDone(Checkpoint::kMapping);
+        LOG_INFO("Sparse model written to %s", sparsePath.c_str());
+        return true;
+    }
+
+    if (partitioned && imageNames.size() > partitionOptions.maxClusterImages) {
+        PartitionedMapper mapper(partitionOptions, options, workspacePath);
+        if (!mapper.run(checkpoint, *reconstructionManager)) {
+            return false;
+        }
+        reconstructionManager->Write(sparsePath);
+        checkpoint.markStageDone(Checkpoint::kMapping);
+        LOG_INFO("Sparse models written to %s", sparsePath.c_str());
+        return true;
+    }
+
+    // The mapper can only continue a single model; the last one in the
+    // snapshot is the one that was growing when the previous run stopped.
+    // The models before it are finished and kept aside, and their images are
+    // not offered to the mapper again.
+    auto mapperOptions = std::make_shared<colmap::IncrementalMapperOptions>(*options.mapper);
+    std::vector<std::shared_ptr<colmap::Reconstruction>> finishedModels;
+    const std::string snapshotPath = checkpoint.getSparseSnapshotPath();
+    if (!snapshotPath.empty()) {
+        const size_t numModels = colmap::GetDirList(snapshotPath).size();
+        if (numModels > 0) {
+            const size_t index = reconstructionManager->Read(
+                colmap::JoinPaths(snapshotPath, std::to_string(numModels - 1)));
+            const colmap::Reconstruction& growing = *reconstructionManager->Get(index);
+            std::unordered_set<std::string> finishedImages;
+            for (size_t i = 0; i + 1 < numModels; ++i) {
+                auto model = std::make_shared<colmap::Reconstruction>();
+                model->Read(colmap::JoinPaths(snapshotPath, std::to_string(i)));
+                for (const colmap::image_t imageId : model->RegImageIds()) {
+                    finishedImages.insert(model->Image(imageId).Name());
+                }
+                finishedModels.push_back(std::move(model));
+            }
+            if (!finishedImages.empty()) {
+                for (const auto& name : imageNames) {
+                    if (finishedImages.count(name) == 0) {
+                        mapperOptions->image_names.insert(name);
+                    }
+                }
+                for (const colmap::image_t imageId : growing.RegImageIds()) {
+                    mapperOptions->image_names.insert(growing.Image(imageId).Name());
+                }
+            }
+            LOG_INFO("Resuming mapping with %zu registered images and %zu finished models",
+                     static_cast<size_t>(growing.NumRegImages()), finishedModels.size());
+        }
+    }
+
+    colmap::IncrementalMapperController mapper(
+        mapperOptions, *options.image_path, *options.database_path, reconstructionManager);
+
+    const auto countRegImages = [this, &finishedModels]() {
+        size_t numRegImages = 0;
+        for (const auto& model : finishedModels) {
+            numRegImages += model->NumRegImages();
+        }
+        for (size_t i = 0; i < reconstructionManager->Size(); ++i) {
+            numRegImages += reconstructionManager->Get(i)->NumRegImages();
+        }
+        return numRegImages;
+    };
+    // Finished models first, so that the growing model stays the last one
+    const auto writeModels = [this, &finishedModels](const std::string& path) {
+        size_t index = 0;
+        const auto writeModel = [&path, &index](const colmap::Reconstruction& model) {
+            const std::string modelPath = colmap::JoinPaths(path, std::to_string(index++));
+            colmap::CreateDirIfNotExists(modelPath);
+            model.Write(modelPath);
+        };
+        for (const auto& model : finishedModels) {
+            writeModel(*model);
+        }
+        for (size_t i = 0; i < reconstructionManager->Size(); ++i) {
+            writeModel(*reconstructionManager->Get(i));
+        }
+    };
+    size_t lastSnapshot = countRegImages();
+    if (checkpoint.isEnabled() && snapshotInterval > 0) {
+        // Runs on the mapper thread between registrations, so the models are consistent
+        mapper.AddCallback(colmap::IncrementalMapperController::NEXT_IMAGE_REG_CALLBACK,
+                           [&, snapshotInterval]() {
+            const size_t numRegImages = countRegImages();
+            if (numRegImages < lastSnapshot + snapshotInterval) {
+                return;
+            }
+            checkpoint.commitSparseSnapshot(writeModels, numRegImages);
+            lastSnapshot = numRegImages;
+        });
+    }
+    mapper.Start();
+    mapper.Wait();
+
+    for (const auto& model : finishedModels) {
+        *reconstructionManager->Get(reconstructionManager->Add()) = *model;
+    }
+    if (reconstructionManager->Size() == 0) {
+        LOG_ERROR("Incremental mapping did not produce a model");
+        return false;
+    }
+    reconstructionManager->Write(sparsePath);
+    checkpoint.markStageDone(Checkpoint::kMapping);
+    LOG_INFO("Sparse models written to %s", sparsePath.c_str());
+    return true;
+}
+
+bool ColmapStages::triangulatePosePrior(const std::string& sparsePath) {
+    // The prior was built from another database, while the triangulator pairs
+    // the model with this one by image id: rebuild the posed images with the
+    // ids of this database, matched by name, each with its prior camera
+    // under the camera id of this database. Points are triangulated anew.
+    auto reconstruction = std::make_shared<colmap::Reconstruction>();
+    {
+        std::lock_guard<std::mutex> lock(databaseMutex);
+        for (const colmap::image_t priorId : posePrior->RegImageIds()) {
+            const colmap::Image& priorImage = posePrior->Image(priorId);
+            if (!database.ExistsImageWithName(priorImage.Name())) {
+                continue;
+            }
+            colmap::Image image = database.ReadImageWithName(priorImage.Name());
+            if (!reconstruction->ExistsCamera(image.CameraId())) {
+                colmap::Camera camera = posePrior->Camera(priorImage.CameraId());
+                camera.camera_id = image.CameraId();
+                reconstruction->AddCamera(std::move(camera));
+            }
+            image.CamFromWorld() = priorImage.CamFromWorld();
+            const colmap::image_t imageId = image.ImageId();
+            reconstruction->AddImage(std::move(image));
+            reconstruction->RegisterImage(imageId);
+        }
+    }
+    if (reconstruction->NumRegImages() < 2) {
+        LOG_ERROR("The pose prior shares fewer than two images with the database");
+        return false;
+    }
+    const std::string modelPath = colmap::JoinPaths(sparsePath, "0");
+    colmap::CreateDirIfNotExists(modelPath);
+    LOG_INFO("Triangulating %zu posed images at full resolution",
+             static_cast<size_t>(reconstruction->NumRegImages()));
+    colmap::RunPointTriangulatorImpl(reconstruction, *options.database_path, *options.image_path,
+                                     modelPath, *options.mapper,
+                                     /*clear_points=*/true, /*refine_intrinsics=*/true);
+    if (reconstruction->NumPoints3D() == 0) {
+        LOG_ERROR("No points triangulated with the pose prior");
+        return false;
+    }
+    reconstructionManager->Read(modelPath);
+    return true;
+}
+
+bool ColmapStages::runDense(Checkpoint& checkpoint) {
+    if (reconstructionManager->Size() == 0) {
+        const std::string sparsePath = colmap::JoinPaths(workspacePath, "sparse");
+        for (const auto& modelPath : colmap::GetDirList(sparsePath)) {
+            reconstructionManager->Read(modelPath);
+        }
+    }
+
+    StageProfiler::Scope stage("dense");
+    size_t numRegImages = 0;
+    for (size_t i = 0; i < reconstructionManager->Size(); ++i) {
+        numRegImages += reconstructionManager->Get(i)->NumRegImages();
+    }
+    stage.setItems(numRegImages);
+
+    // COLMAP's stereo caches default to 32 GB each; keep both well inside the budget
+    const size_t memoryLimit = MemoryBudget::getInstance().getLimit();
+    if (memoryLimit > 0) {
+        const double cacheGB = 0.25 * static_cast<double>(memoryLimit) / (1024.0 * 1024.0 * 1024.0);
+        options.patch_match_stereo->cache_size =
+            std::min(options.patch_match_stereo->cache_size, cacheGB);
+        options.stereo_fusion->cache_size =
+            std::min(options.stereo_fusion->cache_size, cacheGB);
+        LOG_INFO("Dense caches limited to %.1f GB", cacheGB);
+    }
+
+    const std::string outputType =
+        options.patch_match_stereo->geom_consistency ? "geometric" : "photometric";
+
+    for (size_t i = 0; i < reconstructionManager->Size(); ++i) {
+        const std::string fusionStage = "fusion/" + std::to_string(i);
+        if (checkpoint.isStageDone(fusionStage)) {
+            LOG_INFO("Dense model %zu already fused, skipping", i);
+            continue;
+        }
+
+        const auto reconstruction = reconstructionManager->Get(i);
+        const std::string densePath =
+            colmap::JoinPaths(workspacePath, "dense", std::to_string(i));
+        colmap::CreateDirIfNotExists(densePath, true);
+
+        const std::string undistortionStage = "undistortion/" + std::to_string(i);
+        if (!checkpoint.isStageDone(undistortionStage)) {
+            colmap::UndistortCameraOptions undistortionOptions;
+            undistortionOptions.max_image_size = options.patch_match_stereo->max_image_size;
+            colmap::COLMAPUndistorter undistorter(undistortionOptions, *reconstruction,
+                                                  *options.image_path, densePath);
+            undistorter.Start();
+            undistorter.Wait();
+            checkpoint.markStageDone(undistortionStage);
+        }
+
+        const size_t numImages = reconstruction->NumRegImages();
+        const size_t numDone = collectDepthMaps(*reconstruction, densePath, outputType, checkpoint);
+        if (numDone > 0) {
+            LOG_INFO("Model %zu: resuming dense stereo, %zu of %zu depth maps done",
+                     i, numDone, numImages);
+        }
+        if (learnedDepthOptions) {
+            // Fuse at the size of the learned depth maps, also when an
+            // earlier run computed all of them
+            options.stereo_fusion->max_image_size = learnedDepthOptions->max_image_size;
+        }
+        if (numDone < numImages && learnedDepthOptions) {
+            if (!computeLearnedDepthMaps(densePath, outputType, checkpoint)) {
+                return false;
+            }
+        } else if (numDone < numImages) {
+#if defined(COLMAP_CUDA_ENABLED)
+            colmap::mvs::PatchMatchController patchMatch(
+                *options.patch_match_stereo, densePath, "COLMAP", "");
+            patchMatch.Start();
+            patchMatch.Wait();
+            collectDepthMaps(*reconstruction, densePath, outputType, checkpoint);
+#else
+            LOG_WARNING("Dense stereo requires CUDA, skipping depth estimation for model %zu", i);
+            return false;
+#endif
+        }
+
+        const std::string fusedPath = colmap::JoinPaths(densePath, "fused.ply");
+        if (streamingFusionOptions) {
+            StreamingFusion::Options fusionOptions = *streamingFusionOptions;
+            fusionOptions.maxImageSize = options.stereo_fusion->max_image_size;
+            if (fusionOptions.maxActiveBytes == 0) {
+                fusionOptions.maxActiveBytes = memoryLimit / 4;
+            }
+            colmap::Reconstruction undistorted;
+            undistorted.Read(colmap::JoinPaths(densePath, "sparse"));
+            StreamingFusion fusion(fusionOptions);
+            if (!fusion.run(undistorted, densePath, outputType, fusedPath)) {
+                return false;
+            }
+        } else {
+            colmap::mvs::StereoFusion fuser(
+                *options.stereo_fusion, densePath, "COLMAP", "", outputType);
+            fuser.Start();
+            fuser.Wait();
+            colmap::WriteBinaryPlyPoints(fusedPath, fuser.GetFusedPoints());
+        }
+        checkpoint.markStageDone(fusionStage);
+        LOG_INFO("Fused point cloud written to %s", fusedPath.c_str());
+    }
+    return true;
+}
+
+bool ColmapStages::computeLearnedDepthMaps(const std::string& densePath,
+                                           const std::string& outputType,
+                                           Checkpoint& checkpoint) {
+    if (!modelLoader) {
+#if defined(WITH_METAL)
+        modelLoader = std::make_unique<ModelLoader>(true);
+#else
+        modelLoader = std::make_unique<ModelLoader>(false);
+#endif
+    }
+
+    // The network works on the undistorted model written next to the images
+    colmap::Reconstruction undistorted;
+    undistorted.Read(colmap::JoinPaths(densePath, "sparse"));
+    const std::string imagePath = colmap::JoinPaths(densePath, "images");
+    const auto sourceViews = MVSNet::SelectSourceViews(undistorted, learnedDepthOptions->num_source_views);
+    std::vector<colmap::image_t> pending;
+    for (const colmap::image_t imageId : undistorted.RegImageIds()) {
+        if (!checkpoint.isDenseImageDone(undistorted.Image(imageId).Name())) {
+            pending.push_back(imageId);
+        }
+    }
+
+    // The cost volumes come from the capped inference arena, which the budget
+    // already holds: split it between the images in flight, keeping room for
+    // chunks of a useful size, and reserve only the rest of each image
+    TaskScheduler& scheduler = TaskScheduler::getInstance();
+    MVSNet::Options netOptions = *learnedDepthOptions;
+    size_t numConcurrent = std::min(pending.size(), static_cast<size_t>(std::max(1, scheduler.getNumWorkers())));
+    const size_t arenaLimit = ModelLoader::GetArenaLimit();
+    if (arenaLimit > 0) {
+        MVSNet::Options smallest = netOptions;
+        smallest.max_memory = 1;
+        numConcurrent = std::clamp<size_t>(arenaLimit / (4 * MVSNet::EstimateCostVolumeMemory(smallest)),
+                                           1, std::max<size_t>(1, numConcurrent));
+        const size_t share = arenaLimit / numConcurrent;
+        netOptions.max_memory = netOptions.max_memory > 0 ? std::min(netOptions.max_memory, share) : share;
+    }
+    const size_t imageBytes = MVSNet::EstimateMemory(netOptions) -
+                              (arenaLimit > 0 ? MVSNet::EstimateCostVolumeMemory(netOptions) : 0);
+    LOG_INFO("Learned depth for %zu images, %zu at a time with %.1f GB each",
+             pending.size(), numConcurrent,
+             MVSNet::EstimateMemory(netOptions) / (1024.0 * 1024.0 * 1024.0));
+
+    const std::string depthPath = colmap::JoinPaths(densePath, "stereo", "depth_maps");
+    const std::string normalPath = colmap::JoinPaths(densePath, "stereo", "normal_maps");
+    colmap::CreateDirIfNotExists(depthPath, true);
+    colmap::CreateDirIfNotExists(normalPath, true);
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> numFailed{0};
+    scheduler.parallelFor(0, numConcurrent, [&](size_t) {
+        MVSNet net(*modelLoader, netOptions);
+        if (!net.IsLoaded()) {
+            numFailed += 1;
+            return;
+        }
+        for (size_t k = next++; k < pending.size(); k = next++) {
+            const colmap::image_t imageId = pending[k];
+            const std::string& name = undistorted.Image(imageId).Name();
+            const auto sources = sourceViews.find(imageId);
+            if (sources == sourceViews.end()) {
+                LOG_WARNING("No source views for %s, skipping its depth map", name.c_str());
+                continue;
+            }
+
+            MemoryReservation reservation(MemoryBudget::Category::DEPTH_MAPS, imageBytes);
+            colmap::mvs::DepthMap depthMap;
+            colmap::mvs::NormalMap normalMap;
+            if (!net.ComputeDepthMap(undistorted, imagePath, imageId, sources->second,
+                                     &depthMap, &normalMap)) {
+                LOG_WARNING("Learned depth failed: %s", name.c_str());
+                numFailed += 1;
+                continue;
+            }
+            const std::string fileName = name + "." + outputType + ".bin";
+            colmap::CreateDirIfNotExists(
+                std::filesystem::path(colmap::JoinPaths(depthPath, fileName)).parent_path().string(), true);
+            colmap::CreateDirIfNotExists(
+                std::filesystem::path(colmap::JoinPaths(normalPath, fileName)).parent_path().string(), true);
+            depthMap.Write(colmap::JoinPaths(depthPath, fileName));
+            normalMap.Write(colmap::JoinPaths(normalPath, fileName));
+            checkpoint.markDenseImageDone(name);
+            LOG_DEBUG("Learned depth map written: %s", name.c_str());
+        }
+    });
+
+    if (numFailed > 0) {
+        LOG_WARNING("%zu learned depth maps failed", numFailed.load());
+    }
+    return numFailed < pending.size() || pending.empty();
+}
+
+void ColmapStages::cacheFeatures(size_t imageIndex,
+                                 std::shared_ptr<const colmap::FeatureKeypoints> imageKeypoints,
+                                 std::shared_ptr<const colmap::FeatureDescriptors> imageDescriptors) {
+    // Reserve before taking the lock: the reservation may spill this cache
+    MemoryReservation reservation(
+        MemoryBudget::Category::DESCRIPTORS,
+        imageKeypoints->size() * sizeof(colmap::FeatureKeypoint) + imageDescriptors->size());
+
+    std::lock_guard<std::mutex> lock(featureMutex);
+    keypoints[imageIndex] = std::move(imageKeypoints);
+    descriptors[imageIndex] = std::move(imageDescriptors);
+    featureReservations[imageIndex] = std::move(reservation);
+    lastUsed[imageIndex] = ++useClock;
+}
+
+void ColmapStages::getFeatures(size_t imageIndex,
+                               std::shared_ptr<const colmap::FeatureKeypoints>& imageKeypoints,
+                               std::shared_ptr<const colmap::FeatureDescriptors>& imageDescriptors) {
+    {
+        std::lock_guard<std::mutex> lock(featureMutex);
+        if (keypoints[imageIndex] && descriptors[imageIndex]) {
+            imageKeypoints = keypoints[imageIndex];
+            imageDescriptors = descriptors[imageIndex];
+            lastUsed[imageIndex] = ++useClock;
+            return;
+        }
+    }
+
+    // Spilled or extracted in an earlier run: the database holds the features
+    {
+        std::lock_guard<std::mutex> lock(databaseMutex);
+        imageKeypoints = std::make_shared<colmap::FeatureKeypoints>(
+            database.ReadKeypoints(imageIds[imageIndex]));
+        imageDescriptors = std::make_shared<colmap::FeatureDescriptors>(
+            database.ReadDescriptors(imageIds[imageIndex]));
+    }
+    cacheFeatures(imageIndex, imageKeypoints, imageDescriptors);
+}
+
+void ColmapStages::recordMatchedPair(size_t first, size_t second) {
+    std::lock_guard<std::mutex> lock(pairMutex);
+    matchedPairs.emplace_back(first, second);
+}
+
+size_t ColmapStages::spillFeatures(size_t bytesNeeded) {
+    std::lock_guard<std::mutex> lock(featureMutex);
+    std::vector<size_t> cached;
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+        if (featureReservations[i].size() > 0) {
+            cached.push_back(i);
+        }
+    }
+    std::sort(cached.begin(), cached.end(),
+              [this](size_t a, size_t b) { return lastUsed[a] < lastUsed[b]; });
+
+    size_t freed = 0;
+    for (size_t i : cached) {
+        if (freed >= bytesNeeded) {
+            break;
+        }
+        freed += featureReservations[i].size();
+        featureReservations[i].reset();
+        keypoints[i].reset();
+        descriptors[i].reset();
+    }
+    return freed;
+}
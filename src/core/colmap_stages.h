@@ -0,0 +1,304 @@
+/**
+ * @file colmap_stages.h
+ * @brief COLMAP-backed implementations of the reconstruction pipeline stages
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <colmap/controllers/option_manager.h>
+#include <colmap/estimators/two_view_geometry.h>
+#include <colmap/feature/sift.h>
+#include <colmap/scene/camera.h>
+#include <colmap/scene/database.h>
+#include <colmap/scene/reconstruction_manager.h>
+
+#include "checkpoint.h"
+#include "dynamic_object_masker.h"
+#include "geometric_verifier.h"
+#include "guided_matcher.h"
+#include "image_loader.h"
+#include "memory_budget.h"
+#include "mvsnet.h"
+#include "partitioned_mapper.h"
+#include "reconstruction_pipeline.h"
+#include "streaming_fusion.h"
+
+/**
+ * @class ColmapStages
+ * @brief Binds SIFT extraction, matching, two-view verification, mapping and
+ *        dense reconstruction to a COLMAP workspace
+ *
+ * One extractor and one matcher are created per scheduler worker since the
+ * COLMAP implementations are not thread-safe. Database writes are
+ * serialized internally.
+ *
+ * Keypoints and descriptors are cached in memory and accounted against the
+ * MemoryBudget. Under memory pressure the least recently used entries are
+ * dropped and reloaded from the database when a pair needs them again.
+ */
+class ColmapStages {
+public:
+    /// Receives verified pairs instead of the database, e.g. to write them to a shard file
+    using ResultSink = std::function<void(const PairMatches& pair,
+                                          const colmap::FeatureMatches& matches,
+                                          const colmap::TwoViewGeometry& geometry)>;
+
+    /**
+     * @brief Construct the stages for a workspace
+     * @param options COLMAP options (paths and quality presets already applied)
+     * @param workspacePath Output folder for sparse and dense results
+     * @param numWorkers Number of scheduler workers, used to size the per-worker state
+     */
+    ColmapStages(colmap::OptionManager& options,
+                 const std::string& workspacePath,
+                 int numWorkers);
+
+    ~ColmapStages();
+
+    /**
+     * @brief Get the image names found in the image folder
+     * @return Image names relative to the image folder, sorted
+     */
+    const std::vector<std::string>& getImageNames() const { return imageNames; }
+
+    /**
+     * @brief Decode images ahead of extraction instead of reading them on demand
+     *
+     * Images whose features are already in the database are left out of the
+     * read-ahead. JPEGs larger than the SIFT max_image_size are decoded at a
+     * reduced scale.
+     *
+     * @param readAhead Images decoded ahead of the one being extracted
+     * @param decodeThreads Decodes in flight on the task scheduler
+     */
+    void enablePrefetch(size_t readAhead, int decodeThreads);
+
+    /**
+     * @brief Connect the stages to a pipeline
+     * @param pipeline The pipeline to configure
+     */
+    void attach(ReconstructionPipeline& pipeline);
+
+    /**
+     * @brief Extract features for one image and store them in the database
+     * @param imageIndex Index into getImageNames()
+     * @param workerIndex Index of the calling extraction worker
+     * @return true if features are available for the image
+     */
+    bool extractImage(size_t imageIndex, int workerIndex);
+
+    /**
+     * @brief Look up an image whose features are already in the database
+     * @param imageIndex Index into getImageNames()
+     * @return true if the image and its keypoints were found
+     */
+    bool loadExtracted(size_t imageIndex);
+
+    /**
+     * @brief Compute putative matches for a pair
+     * @param pair The pair, filled with matches on success
+     * @param workerIndex Index of the calling matching worker
+     * @return true if the pair needs verification
+     */
+    bool matchPair(PairMatches& pair, int workerIndex);
+
+    /**
+     * @brief Estimate two-view geometry and store matches in the database
+     * @param pair The pair with putative matches
+     * @param workerIndex Index of the calling verification worker
+     * @return true if the pair has a valid two-view geometry
+     */
+    bool verifyPair(const PairMatches& pair, int workerIndex);
+
+    /**
+     * @brief Prefilter putative matches before the two-view estimation
+     *
+     * Pairs without enough matches consistent with a fundamental matrix are
+     * rejected by a GeometricVerifier, and the two-view estimation only sees
+     * the consistent matches. The prefilter threshold is twice the RANSAC
+     * max_error so the estimation still decides the final inliers.
+     *
+     * @param enabled Whether to prefilter
+     */
+    void setVerificationPrefilter(bool enabled);
+
+    /**
+     * @brief Drop keypoints on people, vehicles and other dynamic objects
+     *
+     * Every extracted image is run through a DynamicObjectMasker (one per
+     * worker, created on first use) and keypoints inside the masked boxes
+     * are removed together with their descriptors before they are stored
+     * or matched. Images are then decoded in color; call this before
+     * enablePrefetch().
+     *
+     * @param maskerOptions Detector model and dynamic classes
+     * @return false if the model could not be loaded; masking stays off
+     */
+    bool setDynamicObjectMasking(const DynamicObjectMasker::Options& maskerOptions);
+
+    /**
+     * @brief Send verified pairs to a sink instead of writing them to the database
+     * @param sink The sink, or nullptr to write to the database again
+     */
+    void setResultSink(ResultSink sink) { resultSink = std::move(sink); }
+
+    /**
+     * @brief Write the matches and two-view geometry of a pair to the database
+     * @param first Index of the first image
+     * @param second Index of the second image
+     * @param matches Putative matches
+     * @param geometry Verified two-view geometry
+     */
+    void storeMatches(size_t first, size_t second,
+                      const colmap::FeatureMatches& matches,
+                      const colmap::TwoViewGeometry& geometry);
+
+    /**
+     * @brief Get the pairs matched so far, including pairs found in the database
+     * @return Pairs of image names with a valid two-view geometry
+     */
+    std::vector<std::pair<std::string, std::string>> getMatchedPairs();
+
+    /**
+     * @brief Map image sets larger than one cluster with a PartitionedMapper
+     * @param partitionOptions Cluster layout
+     */
+    void setPartitionedMapping(const PartitionedMapper::Options& partitionOptions);
+
+    /**
+     * @brief Match and map with the camera poses of an existing model
+     *
+     * Pairs of images registered in the prior are matched by a
+     * GuidedMatcher along their epipolar segments; other pairs are matched
+     * exhaustively as before. runMapping() then keeps the prior's poses,
+     * triangulates the points from the database and refines poses,
+     * intrinsics and points with a global bundle adjustment instead of
+     * incremental mapping. Meant for a coarse model of the same images
+     * whose cameras are in full resolution pixels, as COLMAP stores them.
+     *
+     * @param prior Model with the poses
+     * @param matcherOptions Search band and descriptor tests
+     */
+    void setPosePrior(std::shared_ptr<const colmap::Reconstruction> prior,
+                      const GuidedMatcher::Options& matcherOptions);
+
+    /**
+     * @brief Get the pairs that see common points of the pose prior
+     * @param minSharedPoints Points two images must share
+     * @return Pairs of image indices, first < second
+     */
+    std::vector<std::pair<size_t, size_t>> getPosePriorPairs(size_t minSharedPoints) const;
+
+    /**
+     * @brief Run incremental mapping over the database
+     *
+     * Continues from the latest sparse snapshot of the checkpoint and
+     * snapshots the models every snapshotInterval registered images. With
+     * partitioned mapping enabled and more images than fit in one cluster,
+     * the clusters are reconstructed and merged instead, and resume per
+     * cluster. If mapping already finished, the models are read from the
+     * workspace.
+     *
+     * @param checkpoint Checkpoint of the workspace
+     * @param snapshotInterval Registered images between snapshots, 0 for none
+     * @return true if at least one model was reconstructed
+     */
+    bool runMapping(Checkpoint& checkpoint, size_t snapshotInterval);
+
+    /**
+     * @brief Compute depth maps with a learned MVSNet instead of PatchMatch stereo
+     *
+     * Depth estimation then runs on the CPU: several images at a time on
+     * the task scheduler, each with its own network instance and a
+     * DEPTH_MAPS reservation. With a memory limit, half of it is split
+     * between the concurrent images and bounds their cost volumes.
+     *
+     * @param netOptions Model, resolution and tiling
+     */
+    void setLearnedDepth(const MVSNet::Options& netOptions);
+
+    /**
+     * @brief Fuse depth maps with the streaming voxel fusion instead of COLMAP's
+     *
+     * With a memory limit and no cap in the options, the active voxel
+     * blocks are capped at a quarter of the limit.
+     *
+     * @param fusionOptions Voxel resolution, consistency and memory cap
+     */
+    void setStreamingFusion(const StreamingFusion::Options& fusionOptions);
+
+    /**
+     * @brief Undistort, compute depth maps and fuse every reconstructed model
+     *
+     * Uses the models of runMapping(), or reads them from the workspace if
+     * mapping ran elsewhere. Undistorted models and complete depth maps of
+     * an earlier run are kept; only missing or truncated ones are recomputed.
+     *
+     * @param checkpoint Checkpoint of the workspace
+     * @return true if the dense stages completed
+     */
+    bool runDense(Checkpoint& checkpoint);
+
+private:
+    void cacheFeatures(size_t imageIndex,
+                       std::shared_ptr<const colmap::FeatureKeypoints> imageKeypoints,
+                       std::shared_ptr<const colmap::FeatureDescriptors> imageDescriptors);
+    void getFeatures(size_t imageIndex,
+                     std::shared_ptr<const colmap::FeatureKeypoints>& imageKeypoints,
+                     std::shared_ptr<const colmap::FeatureDescriptors>& imageDescriptors);
+    size_t spillFeatures(size_t bytesNeeded);
+    void recordMatchedPair(size_t first, size_t second);
+    bool triangulatePosePrior(const std::string& sparsePath);
+    bool computeLearnedDepthMaps(const std::string& densePath, const std::string& outputType,
+                                 Checkpoint& checkpoint);
+
+    colmap::OptionManager& options;
+    std::string workspacePath;
+    colmap::Database database;
+    std::mutex databaseMutex;
+
+    std::vector<std::string> imageNames;
+    std::vector<colmap::image_t> imageIds;
+    std::vector<colmap::Camera> cameras;
+    std::unique_ptr<ImageLoader> imageLoader;
+
+    std::mutex pairMutex;
+    std::vector<std::pair<size_t, size_t>> matchedPairs;
+
+    std::mutex featureMutex;
+    std::vector<std::shared_ptr<const colmap::FeatureKeypoints>> keypoints;
+    std::vector<std::shared_ptr<const colmap::FeatureDescriptors>> descriptors;
+    std::vector<MemoryReservation> featureReservations;
+    std::vector<uint64_t> lastUsed;
+    uint64_t useClock = 0;
+    int spillHandlerId = -1;
+
+    std::vector<std::unique_ptr<colmap::FeatureExtractor>> extractors;
+    std::vector<std::unique_ptr<colmap::FeatureMatcher>> matchers;
+    std::vector<std::unique_ptr<GeometricVerifier>> verifiers;
+    std::unique_ptr<ModelLoader> modelLoader;
+    std::vector<std::unique_ptr<DynamicObjectMasker>> maskers;
+    DynamicObjectMasker::Options maskerOptions;
+    std::unique_ptr<MVSNet::Options> learnedDepthOptions;
+    std::unique_ptr<StreamingFusion::Options> streamingFusionOptions;
+    int numWorkers;
+
+    bool partitioned = false;
+    PartitionedMapper::Options partitionOptions;
+
+    std::shared_ptr<const colmap::Reconstruction> posePrior;
+    std::vector<GuidedMatcher::View> priorViews;
+    std::vector<colmap::image_t> priorImageIds; /**< kInvalidImageId where the prior has no view */
+    std::vector<std::unique_ptr<GuidedMatcher>> guidedMatchers;
+
+    ResultSink resultSink;
+
+    std::shared_ptr<colmap::ReconstructionManager> reconstructionManager;
+};
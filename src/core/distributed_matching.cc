@@ -0,0 +1,657 @@
+#include "distributed_matching.h"
+#include "logger.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+
+constexpr char kShardMagic[4] = {'C', 'N', 'M', 'S'};
+constexpr char kShardEndMagic[4] = {'C', 'N', 'M', 'E'};
+constexpr uint32_t kShardVersion = 2;
+constexpr long kShardHeaderSize = sizeof(kShardMagic) + sizeof(uint32_t);
+constexpr long kShardTrailerSize = 2 * sizeof(uint64_t) + sizeof(kShardEndMagic);
+
+// Workers and the coordinator only poll the shared folder, which also
+// works when it is mounted over the network
+constexpr auto kPollInterval = std::chrono::seconds(1);
+constexpr int kWaitLogInterval = 30;
+
+// Owners renew their lease this often; a lease not renewed for the timeout
+// is expired. The timeout allows for NFS attribute caching (up to 60 s).
+constexpr auto kLeaseRenewInterval = std::chrono::seconds(15);
+constexpr auto kLeaseTimeout = std::chrono::minutes(3);
+
+std::string hostName() {
+    char name[256] = {};
+    gethostname(name, sizeof(name) - 1);
+    return name;
+}
+
+// Owner line written to the lock files of this process
+std::string ownerId() {
+    return hostName() + " " + std::to_string(getpid());
+}
+
+std::string readOwner(const std::string& lockPath) {
+    std::ifstream lock(lockPath);
+    std::string owner;
+    std::getline(lock, owner);
+    return owner;
+}
+
+// 64-bit FNV-1a as hex
+std::string hashText(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char byte : text) {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+    char digest[17];
+    std::snprintf(digest, sizeof(digest), "%016llx", static_cast<unsigned long long>(hash));
+    return digest;
+}
+
+/**
+ * Renews the lease on a shard lock by touching it until destroyed
+ */
+class LeaseRenewer {
+public:
+    explicit LeaseRenewer(const std::string& lockPath)
+        : thread([this, lockPath] {
+              std::unique_lock<std::mutex> lock(mutex);
+              while (!wake.wait_for(lock, kLeaseRenewInterval, [this] { return stopping; })) {
+                  utimensat(AT_FDCWD, lockPath.c_str(), nullptr, 0);
+              }
+          }) {}
+
+    ~LeaseRenewer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+};
+
+template <typename T>
+void writeValue(FILE* file, const T& value) {
+    std::fwrite(&value, sizeof(T), 1, file);
+}
+
+template <typename T>
+bool readValue(FILE* file, T& value) {
+    return std::fread(&value, sizeof(T), 1, file) == 1;
+}
+
+void writeString(FILE* file, const std::string& value) {
+    writeValue(file, static_cast<uint32_t>(value.size()));
+    std::fwrite(value.data(), 1, value.size(), file);
+}
+
+bool readString(FILE* file, std::string& value) {
+    uint32_t size = 0;
+    if (!readValue(file, size)) {
+        return false;
+    }
+    value.resize(size);
+    return std::fread(&value[0], 1, size, file) == size;
+}
+
+void writeMatches(FILE* file, const colmap::FeatureMatches& matches) {
+    writeValue(file, static_cast<uint32_t>(matches.size()));
+    for (const auto& match : matches) {
+        writeValue(file, static_cast<uint32_t>(match.point2D_idx1));
+        writeValue(file, static_cast<uint32_t>(match.point2D_idx2));
+    }
+}
+
+bool readMatches(FILE* file, colmap::FeatureMatches& matches) {
+    uint32_t size = 0;
+    if (!readValue(file, size)) {
+        return false;
+    }
+    matches.resize(size);
+    for (auto& match : matches) {
+        uint32_t idx1 = 0;
+        uint32_t idx2 = 0;
+        if (!readValue(file, idx1) || !readValue(file, idx2)) {
+            return false;
+        }
+        match.point2D_idx1 = idx1;
+        match.point2D_idx2 = idx2;
+    }
+    return true;
+}
+
+void writeMatrix(FILE* file, const Eigen::Matrix3d& matrix) {
+    std::fwrite(matrix.data(), sizeof(double), 9, file);
+}
+
+bool readMatrix(FILE* file, Eigen::Matrix3d& matrix) {
+    return std::fread(matrix.data(), sizeof(double), 9, file) == 9;
+}
+
+/*
+ * Shard record layout, all values in host byte order:
+ *   name1, name2             uint32 length + bytes
+ *   config                   int32
+ *   E, F, H                  9 doubles each, column-major
+ *   cam2_from_cam1           quaternion (x, y, z, w) + translation, 7 doubles
+ *   tri_angle                double
+ *   matches, inlier_matches  uint32 count + (uint32, uint32) per match
+ */
+void writeRecord(FILE* file, const std::string& name1, const std::string& name2,
+                 const colmap::FeatureMatches& matches,
+                 const colmap::TwoViewGeometry& geometry) {
+    writeString(file, name1);
+    writeString(file, name2);
+    writeValue(file, static_cast<int32_t>(geometry.config));
+    writeMatrix(file, geometry.E);
+    writeMatrix(file, geometry.F);
+    writeMatrix(file, geometry.H);
+    std::fwrite(geometry.cam2_from_cam1.rotation.coeffs().data(), sizeof(double), 4, file);
+    std::fwrite(geometry.cam2_from_cam1.translation.data(), sizeof(double), 3, file);
+    writeValue(file, geometry.tri_angle);
+    writeMatches(file, matches);
+    writeMatches(file, geometry.inlier_matches);
+}
+
+bool readRecord(FILE* file, std::string& name1, std::string& name2,
+                colmap::FeatureMatches& matches, colmap::TwoViewGeometry& geometry) {
+    int32_t config = 0;
+    if (!readString(file, name1) || !readString(file, name2) || !readValue(file, config) ||
+        !readMatrix(file, geometry.E) || !readMatrix(file, geometry.F) ||
+        !readMatrix(file, geometry.H)) {
+        return false;
+    }
+    geometry.config = config;
+    if (std::fread(geometry.cam2_from_cam1.rotation.coeffs().data(), sizeof(double), 4, file) != 4 ||
+        std::fread(geometry.cam2_from_cam1.translation.data(), sizeof(double), 3, file) != 3) {
+        return false;
+    }
+    return readValue(file, geometry.tri_angle) && readMatches(file, matches) &&
+           readMatches(file, geometry.inlier_matches);
+}
+
+/*
+ * Shard file layout:
+ *   header                   kShardMagic, uint32 kShardVersion
+ *   records                  see writeRecord()
+ *   trailer                  uint64 record count, uint64 record bytes, kShardEndMagic
+ *
+ * Check the header and the trailer of a shard file and leave it at the
+ * first record. A file cut short anywhere fails, as the trailer is then
+ * missing or disagrees with the file size.
+ */
+bool readShardBounds(FILE* file, uint64_t& numRecords) {
+    char magic[sizeof(kShardMagic)] = {};
+    uint32_t version = 0;
+    if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        !std::equal(magic, magic + sizeof(magic), kShardMagic) ||
+        !readValue(file, version) || version != kShardVersion) {
+        return false;
+    }
+    if (std::fseek(file, -kShardTrailerSize, SEEK_END) != 0) {
+        return false;
+    }
+    const long trailerOffset = std::ftell(file);
+    uint64_t recordBytes = 0;
+    char endMagic[sizeof(kShardEndMagic)] = {};
+    if (trailerOffset < kShardHeaderSize || !readValue(file, numRecords) ||
+        !readValue(file, recordBytes) ||
+        std::fread(endMagic, 1, sizeof(endMagic), file) != sizeof(endMagic) ||
+        !std::equal(endMagic, endMagic + sizeof(endMagic), kShardEndMagic) ||
+        static_cast<uint64_t>(trailerOffset - kShardHeaderSize) != recordBytes) {
+        return false;
+    }
+    return std::fseek(file, kShardHeaderSize, SEEK_SET) == 0;
+}
+
+// Write a small text file so that readers never see it half-written
+bool writeTextAtomic(const std::string& path, const std::string& content) {
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        file << content;
+        if (!file) {
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    return !error;
+}
+
+} // namespace
+
+DistributedMatcher::DistributedMatcher(const Options& options, ColmapStages& stages)
+    : options(options), stages(stages) {
+    const auto& names = stages.getImageNames();
+    for (size_t i = 0; i < names.size(); ++i) {
+        imageIndices.emplace(names[i], i);
+    }
+}
+
+bool DistributedMatcher::run(const std::vector<std::pair<size_t, size_t>>& pairs) {
+    std::filesystem::create_directories(options.shardPath);
+
+    // Workers start on the manifest, so it is replaced last; locks left by
+    // an earlier run are stale, while finished results of the same pair
+    // lists are kept
+    std::error_code error;
+    std::filesystem::remove(manifestPath(), error);
+    if (!writeShardLists(pairs)) {
+        LOG_ERROR("Failed to write shard lists to %s", options.shardPath.c_str());
+        return false;
+    }
+    removeStaleFiles();
+    if (!writeManifest()) {
+        LOG_ERROR("Failed to write the shard manifest to %s", options.shardPath.c_str());
+        return false;
+    }
+
+    const int numShards = static_cast<int>(shardKeys.size());
+    int numPending = 0;
+    for (int shard = 0; shard < numShards; ++shard) {
+        numPending += isResultComplete(shard) ? 0 : 1;
+    }
+    LOG_INFO("Distributed matching: %zu pairs in %d shards, %d pending",
+             pairs.size(), numShards, numPending);
+
+    std::vector<int> workers;
+    for (int i = 0; i < std::min(options.localWorkers, numPending); ++i) {
+        const int pid = spawnWorker();
+        if (pid > 0) {
+            workers.push_back(pid);
+        } else {
+            LOG_WARNING("Failed to start matching worker process");
+        }
+    }
+    for (const int pid : workers) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            LOG_WARNING("Matching worker %d failed, its shards will be matched again", pid);
+        }
+    }
+
+    // Whatever the workers did not get to, including shards of failed
+    // workers, is matched here; shards owned by other hosts are awaited
+    bool succeeded = true;
+    for (int waited = 0;; ++waited) {
+        int numMissing = 0;
+        for (int shard = 0; shard < numShards; ++shard) {
+            if (std::filesystem::exists(resultPath(shard)) && !isResultComplete(shard)) {
+                LOG_WARNING("Match shard %d is truncated, deleting %s to match it again",
+                            shard, resultPath(shard).c_str());
+                std::filesystem::remove(resultPath(shard), error);
+            }
+            if (claimShard(shard)) {
+                succeeded = matchShard(shard) && succeeded;
+            }
+            numMissing += std::filesystem::exists(resultPath(shard)) ? 0 : 1;
+        }
+        if (numMissing == 0 || !succeeded) {
+            break;
+        }
+        if (waited % kWaitLogInterval == 0) {
+            LOG_INFO("Waiting for %d shards matched on other hosts", numMissing);
+        }
+        std::this_thread::sleep_for(kPollInterval);
+    }
+    if (!succeeded) {
+        return false;
+    }
+
+    for (int shard = 0; shard < numShards; ++shard) {
+        if (!mergeShard(shard)) {
+            LOG_ERROR("Failed to merge match shard %d", shard);
+            return false;
+        }
+    }
+    std::filesystem::remove_all(options.shardPath, error);
+    return true;
+}
+
+bool DistributedMatcher::runWorker() {
+    int numShards = readManifest();
+    if (numShards <= 0) {
+        LOG_INFO("Waiting for the coordinator to publish shards in %s", options.shardPath.c_str());
+        while ((numShards = readManifest()) <= 0) {
+            std::this_thread::sleep_for(kPollInterval);
+        }
+    }
+
+    bool succeeded = true;
+    for (int shard = 0; shard < numShards; ++shard) {
+        if (claimShard(shard)) {
+            succeeded = matchShard(shard) && succeeded;
+        }
+    }
+    return succeeded;
+}
+
+bool DistributedMatcher::writeShardLists(const std::vector<std::pair<size_t, size_t>>& pairs) {
+    // Contiguous ranges keep the images of a shard close together, so each
+    // worker touches fewer images than with a round-robin split
+    const auto& names = stages.getImageNames();
+    const size_t numShards = static_cast<size_t>(std::max(1, options.numShards));
+    const size_t shardSize = (pairs.size() + numShards - 1) / numShards;
+    shardKeys.clear();
+    for (size_t shard = 0; shard < numShards; ++shard) {
+        std::ostringstream list;
+        const size_t begin = std::min(pairs.size(), shard * shardSize);
+        const size_t end = std::min(pairs.size(), begin + shardSize);
+        for (size_t i = begin; i < end; ++i) {
+            list << names[pairs[i].first] << ' ' << names[pairs[i].second] << '\n';
+        }
+        shardKeys.push_back(std::to_string(shard) + "_" + hashText(list.str()));
+        if (!writeTextAtomic(listPath(static_cast<int>(shard)), list.str())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DistributedMatcher::writeManifest() {
+    // Shard count, then the key of every shard
+    std::string content = std::to_string(shardKeys.size()) + "\n";
+    for (const auto& key : shardKeys) {
+        content += key + "\n";
+    }
+    return writeTextAtomic(manifestPath(), content);
+}
+
+int DistributedMatcher::readManifest() {
+    std::ifstream manifest(manifestPath());
+    int numShards = 0;
+    if (!(manifest >> numShards) || numShards <= 0) {
+        return 0;
+    }
+    std::vector<std::string> keys(numShards);
+    for (auto& key : keys) {
+        if (!(manifest >> key)) {
+            return 0;
+        }
+    }
+    shardKeys = std::move(keys);
+    return numShards;
+}
+
+void DistributedMatcher::removeStaleFiles() {
+    std::set<std::string> current;
+    for (int shard = 0; shard < static_cast<int>(shardKeys.size()); ++shard) {
+        current.insert(std::filesystem::path(resultPath(shard)).filename().string());
+    }
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(options.shardPath, error)) {
+        const std::string extension = entry.path().extension().string();
+        const bool staleResult = extension == ".bin" && current.count(entry.path().filename().string()) == 0;
+        if (extension == ".lock" || extension == ".tmp" || staleResult) {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+}
+
+bool DistributedMatcher::claimShard(int shard) {
+    if (std::filesystem::exists(resultPath(shard))) {
+        return false;
+    }
+
+    const std::string path = lockPath(shard);
+    int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd < 0) {
+        if (!isLeaseExpired(shard)) {
+            return false;
+        }
+        // Two reclaimers may both end up owning the shard; their results are
+        // written to private temporary files and are interchangeable
+        std::remove(path.c_str());
+        leases.erase(shard);
+        fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0) {
+            return false;
+        }
+    }
+    const std::string owner = ownerId() + "\n";
+    const bool written = write(fd, owner.data(), owner.size()) == static_cast<ssize_t>(owner.size());
+    close(fd);
+
+    // Another worker may have finished the shard between the checks
+    if (!written || std::filesystem::exists(resultPath(shard))) {
+        std::remove(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool DistributedMatcher::isLeaseExpired(int shard) {
+    const std::string path = lockPath(shard);
+    const std::string owner = readOwner(path);
+    std::istringstream fields(owner);
+    std::string host;
+    int pid = 0;
+    if (fields >> host >> pid && host == hostName()) {
+        // Owner on this host: the kernel knows whether it is alive
+        if (kill(pid, 0) == 0 || errno != ESRCH) {
+            return false;
+        }
+        LOG_WARNING("Reclaiming match shard %d from exited worker %d", shard, pid);
+        return true;
+    }
+
+    // Owner elsewhere, or one that died before writing its name: only a
+    // change of the lock's modification time counts, measured locally
+    std::error_code error;
+    const auto modified = std::filesystem::last_write_time(path, error);
+    if (error) {
+        return false;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const auto it = leases.find(shard);
+    if (it == leases.end() || it->second.owner != owner || it->second.modified != modified) {
+        leases[shard] = {owner, modified, now};
+        return false;
+    }
+    if (now - it->second.observed < kLeaseTimeout) {
+        return false;
+    }
+    LOG_WARNING("Reclaiming match shard %d from %s, its lease expired", shard,
+                owner.empty() ? "an unknown owner" : owner.c_str());
+    return true;
+}
+
+bool DistributedMatcher::matchShard(int shard) {
+    const LeaseRenewer renewer(lockPath(shard));
+    std::vector<PairMatches> pairs;
+    std::set<size_t> images;
+    {
+        std::ifstream list(listPath(shard));
+        std::string name1, name2;
+        while (list >> name1 >> name2) {
+            const auto it1 = imageIndices.find(name1);
+            const auto it2 = imageIndices.find(name2);
+            if (it1 == imageIndices.end() || it2 == imageIndices.end()) {
+                LOG_WARNING("Skipping pair with unknown image: %s %s", name1.c_str(), name2.c_str());
+                continue;
+            }
+            PairMatches pair;
+            pair.first = it1->second;
+            pair.second = it2->second;
+            pairs.push_back(std::move(pair));
+            images.insert(it1->second);
+            images.insert(it2->second);
+        }
+    }
+    LOG_INFO("Matching shard %d (%zu pairs)", shard, pairs.size());
+
+    bool succeeded = true;
+    for (const size_t image : images) {
+        if (!stages.loadExtracted(image)) {
+            LOG_ERROR("Features of %s are missing from the database",
+                      stages.getImageNames()[image].c_str());
+            succeeded = false;
+        }
+    }
+
+    const std::string tmpPath = resultPath(shard) + "." + hostName() + "." + std::to_string(getpid()) + ".tmp";
+    FILE* file = succeeded ? std::fopen(tmpPath.c_str(), "wb") : nullptr;
+    if (file) {
+        std::fwrite(kShardMagic, 1, sizeof(kShardMagic), file);
+        writeValue(file, kShardVersion);
+
+        const auto& names = stages.getImageNames();
+        std::mutex fileMutex;
+        uint64_t numRecords = 0;
+        stages.setResultSink([&](const PairMatches& pair,
+                                 const colmap::FeatureMatches& matches,
+                                 const colmap::TwoViewGeometry& geometry) {
+            std::lock_guard<std::mutex> lock(fileMutex);
+            writeRecord(file, names[pair.first], names[pair.second], matches, geometry);
+            ++numRecords;
+        });
+        TaskScheduler::getInstance().parallelFor(0, pairs.size(), [&](size_t i) {
+            const int workerIndex = std::max(0, TaskScheduler::getCurrentWorkerIndex());
+            if (stages.matchPair(pairs[i], workerIndex)) {
+                stages.verifyPair(pairs[i], workerIndex);
+            }
+        });
+        stages.setResultSink(nullptr);
+
+        const long recordsEnd = std::ftell(file);
+        writeValue(file, numRecords);
+        writeValue(file, static_cast<uint64_t>(recordsEnd - kShardHeaderSize));
+        std::fwrite(kShardEndMagic, 1, sizeof(kShardEndMagic), file);
+
+        succeeded = recordsEnd >= kShardHeaderSize && std::ferror(file) == 0 &&
+                    std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        std::fclose(file);
+    } else {
+        succeeded = false;
+    }
+
+    std::error_code error;
+    if (succeeded) {
+        std::filesystem::rename(tmpPath, resultPath(shard), error);
+        succeeded = !error;
+    }
+    if (!succeeded) {
+        LOG_ERROR("Failed to match shard %d", shard);
+        std::filesystem::remove(tmpPath, error);
+    }
+    // The shard may have been reclaimed meanwhile; leave the new owner's lock
+    if (readOwner(lockPath(shard)) == ownerId()) {
+        std::filesystem::remove(lockPath(shard), error);
+    }
+    return succeeded;
+}
+
+bool DistributedMatcher::isResultComplete(int shard) const {
+    FILE* file = std::fopen(resultPath(shard).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    uint64_t numRecords = 0;
+    const bool complete = readShardBounds(file, numRecords);
+    std::fclose(file);
+    return complete;
+}
+
+bool DistributedMatcher::mergeShard(int shard) {
+    FILE* file = std::fopen(resultPath(shard).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    uint64_t numRecords = 0;
+    if (!readShardBounds(file, numRecords)) {
+        std::fclose(file);
+        return false;
+    }
+
+    size_t numPairs = 0;
+    uint64_t numRead = 0;
+    std::string name1, name2;
+    colmap::FeatureMatches matches;
+    colmap::TwoViewGeometry geometry;
+    while (numRead < numRecords && readRecord(file, name1, name2, matches, geometry)) {
+        ++numRead;
+        const auto it1 = imageIndices.find(name1);
+        const auto it2 = imageIndices.find(name2);
+        if (it1 != imageIndices.end() && it2 != imageIndices.end()) {
+            stages.storeMatches(it1->second, it2->second, matches, geometry);
+            ++numPairs;
+        }
+    }
+    // The records must end exactly at the trailer
+    const long recordsEnd = std::ftell(file);
+    std::fseek(file, 0, SEEK_END);
+    const bool complete = numRead == numRecords &&
+                          recordsEnd == std::ftell(file) - kShardTrailerSize;
+    std::fclose(file);
+    LOG_DEBUG("Merged %zu pairs from shard %d", numPairs, shard);
+    return complete;
+}
+
+int DistributedMatcher::spawnWorker() {
+    std::string executable = options.executable;
+#if defined(__linux__)
+    // argv[0] may be relative to a directory the worker is not started from
+    std::error_code error;
+    const auto self = std::filesystem::read_symlink("/proc/self/exe", error);
+    if (!error) {
+        executable = self.string();
+    }
+#endif
+    std::string configPath = options.configPath;
+    std::string flag = "--match-worker";
+    char* argv[] = {&executable[0], &configPath[0], &flag[0], nullptr};
+
+    pid_t pid = 0;
+    if (posix_spawnp(&pid, executable.c_str(), nullptr, nullptr, argv, environ) != 0) {
+        return -1;
+    }
+    return pid;
+}
+
+std::string DistributedMatcher::manifestPath() const {
+    return (std::filesystem::path(options.shardPath) / "shards.txt").string();
+}
+
+std::string DistributedMatcher::listPath(int shard) const {
+    return (std::filesystem::path(options.shardPath) / ("pairs_" + std::to_string(shard) + ".txt")).string();
+}
+
+std::string DistributedMatcher::lockPath(int shard) const {
+    return (std::filesystem::path(options.shardPath) / ("shard_" + shardKeys[shard] + ".lock")).string();
+}
+
+std::string DistributedMatcher::resultPath(int shard) const {
+    return (std::filesystem::path(options.shardPath) / ("shard_" + shardKeys[shard] + ".bin")).string();
+}
@@ -0,0 +1,112 @@
+/**
+ * @file distributed_matching.h
+ * @brief Pair matching sharded across worker processes
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "colmap_stages.h"
+
+/**
+ * @class DistributedMatcher
+ * @brief Splits the image pair list into shards matched by separate processes
+ *
+ * The coordinator extracts all features into the database, writes one pair
+ * list per shard into a shared folder and starts local worker processes.
+ * Workers, local or started by hand on other hosts that mount the same
+ * workspace, claim shards one at a time, read features from the database,
+ * and write matches and two-view geometries to their own shard file. Once
+ * every shard is done the coordinator merges the files into the database,
+ * which is the only step that writes to it.
+ *
+ * Shards are claimed with an exclusively created lock file holding the
+ * host and pid of the owner. The owner renews the lock's modification time
+ * while it matches, as a lease. A shard is claimed again when its owner on
+ * the same host has exited, or when the lease of an owner elsewhere has not
+ * been renewed for a while; staleness is timed on the local clock, so the
+ * clocks of the hosts need not agree. Results are written to a temporary
+ * file private to the owner and renamed into place when complete, so two
+ * owners of a reclaimed shard cannot interleave their output. Each file
+ * ends in a trailer with its record count and size; a result cut short
+ * is deleted and matched again rather than merged.
+ *
+ * Lock and result files are named after a hash of the shard's pair list,
+ * so results of an earlier run with other pairs are never reused.
+ * Shards left unclaimed when the local workers exit are matched by the
+ * coordinator.
+ */
+class DistributedMatcher {
+public:
+    /**
+     * @struct Options
+     * @brief Layout of the distributed matching job
+     */
+    struct Options {
+        int numShards = 8;      /**< Shards the pair list is split into */
+        int localWorkers = 2;   /**< Worker processes started by the coordinator */
+        std::string shardPath;  /**< Folder shared by the coordinator and all workers */
+        std::string executable; /**< Binary started for local workers */
+        std::string configPath; /**< Config file passed to local workers */
+    };
+
+    /**
+     * @brief Construct a matcher on top of the COLMAP stages
+     * @param options Job layout
+     * @param stages Stages providing features, matching and verification
+     */
+    DistributedMatcher(const Options& options, ColmapStages& stages);
+
+    /**
+     * @brief Coordinator: match all pairs through the workers and merge the results
+     * @param pairs Pairs of image indices (into ColmapStages::getImageNames())
+     * @return true if every shard was matched and merged into the database
+     */
+    bool run(const std::vector<std::pair<size_t, size_t>>& pairs);
+
+    /**
+     * @brief Worker: claim and match shards until none is left
+     * @return true if every claimed shard was completed
+     */
+    bool runWorker();
+
+private:
+    /**
+     * @struct Lease
+     * @brief Last observed state of another owner's shard lock
+     */
+    struct Lease {
+        std::string owner;
+        std::filesystem::file_time_type modified;
+        std::chrono::steady_clock::time_point observed;
+    };
+
+    bool writeShardLists(const std::vector<std::pair<size_t, size_t>>& pairs);
+    bool writeManifest();
+    int readManifest();
+    void removeStaleFiles();
+    bool claimShard(int shard);
+    bool isLeaseExpired(int shard);
+    bool matchShard(int shard);
+    bool isResultComplete(int shard) const;
+    bool mergeShard(int shard);
+    int spawnWorker();
+
+    std::string manifestPath() const;
+    std::string listPath(int shard) const;
+    std::string lockPath(int shard) const;
+    std::string resultPath(int shard) const;
+
+    Options options;
+    ColmapStages& stages;
+    std::unordered_map<std::string, size_t> imageIndices;
+    std::vector<std::string> shardKeys;           /**< Shard index and pair list hash, e.g. "3_9f2c..." */
+    std::unordered_map<int, Lease> leases;
+};
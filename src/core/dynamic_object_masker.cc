@@ -0,0 +1,167 @@
+#include "dynamic_object_masker.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+FramePreprocessor::Options preprocessorOptions(int inputSize) {
+    FramePreprocessor::Options options;
+    options.width = inputSize;
+    options.height = inputSize;
+    options.colorFormat = FramePreprocessor::ColorFormat::RGB;
+    return options;
+}
+
+InferenceSession::Options sessionOptions() {
+    // One session per worker for the whole job, in the default capped arena
+    InferenceSession::Options options;
+    options.max_buckets = 1;
+    return options;
+}
+
+float intersectionOverUnion(const cv::Rect2f& a, const cv::Rect2f& b) {
+    const float intersection = (a & b).area();
+    const float sum = a.area() + b.area() - intersection;
+    return sum > 0.0f ? intersection / sum : 0.0f;
+}
+
+} // namespace
+
+DynamicObjectMasker::DynamicObjectMasker(const ModelLoader& loader, const Options& options)
+    : options(options),
+      preprocessor(preprocessorOptions(options.inputSize)),
+      session(loader, options.modelPath, sessionOptions()) {
+    for (const int classId : options.classes) {
+        if (classId >= 0) {
+            if (dynamicClasses.size() <= static_cast<size_t>(classId)) {
+                dynamicClasses.resize(classId + 1, false);
+            }
+            dynamicClasses[classId] = true;
+        }
+    }
+}
+
+bool DynamicObjectMasker::detect(Frame& frame) {
+    frame.detections.clear();
+    if (!session.IsLoaded() || !preprocessor.process(frame)) {
+        return false;
+    }
+    if (!session.BindInput(session.GetInputName(0), *frame.onnx_input) || !session.Run()) {
+        LOG_WARNING("Dynamic object detection failed");
+        return false;
+    }
+
+    std::vector<cv::Rect2f> boxes;
+    std::vector<float> scores;
+    decode(static_cast<float>(frame.original.cols) / options.inputSize,
+           static_cast<float>(frame.original.rows) / options.inputSize, boxes, scores);
+
+    // Greedy non-maximum suppression, strongest first
+    std::vector<size_t> order(boxes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a] > scores[b]; });
+    std::vector<cv::Rect2f> kept;
+    for (const size_t i : order) {
+        const bool suppressed = std::any_of(kept.begin(), kept.end(), [&](const cv::Rect2f& box) {
+            return intersectionOverUnion(box, boxes[i]) > options.nmsThreshold;
+        });
+        if (!suppressed) {
+            kept.push_back(boxes[i]);
+        }
+    }
+
+    const cv::Rect bounds(0, 0, frame.original.cols, frame.original.rows);
+    for (const auto& box : kept) {
+        const cv::Rect rect = cv::Rect(box) & bounds;
+        if (rect.area() > 0) {
+            frame.detections.push_back(rect);
+        }
+    }
+    return true;
+}
+
+bool DynamicObjectMasker::computeMask(const cv::Mat& image, cv::Mat& mask) {
+    frame.original = image;
+    const bool detected = detect(frame);
+    if (detected) {
+        mask = createMask(frame);
+    }
+    frame.original.release();
+    return detected;
+}
+
+cv::Mat DynamicObjectMasker::createMask(const Frame& frame) const {
+    cv::Mat mask(frame.original.size(), CV_8U, cv::Scalar(255));
+    const cv::Rect bounds(0, 0, mask.cols, mask.rows);
+    for (const auto& detection : frame.detections) {
+        const int marginX = static_cast<int>(options.margin * detection.width);
+        const int marginY = static_cast<int>(options.margin * detection.height);
+        const cv::Rect rect(detection.x - marginX, detection.y - marginY,
+                            detection.width + 2 * marginX, detection.height + 2 * marginY);
+        cv::rectangle(mask, rect & bounds, cv::Scalar(0), cv::FILLED);
+    }
+    return mask;
+}
+
+void DynamicObjectMasker::decode(float scaleX, float scaleY, std::vector<cv::Rect2f>& boxes,
+                                 std::vector<float>& scores) const {
+    const float* data = session.GetOutputData(0);
+    const std::vector<int64_t> shape = session.GetOutputShape(0);
+
+    // End-to-end export: corner boxes that already went through NMS
+    if (shape.size() == 2 && shape[1] == 7) {
+        for (int64_t i = 0; i < shape[0]; ++i) {
+            const float* row = data + 7 * i;
+            if (row[6] >= options.confidenceThreshold && isDynamic(static_cast<int>(row[5]))) {
+                boxes.emplace_back(row[1] * scaleX, row[2] * scaleY,
+                                   (row[3] - row[1]) * scaleX, (row[4] - row[2]) * scaleY);
+                scores.push_back(row[6]);
+            }
+        }
+        return;
+    }
+    if (shape.size() != 3) {
+        LOG_WARNING("Unsupported detector output rank %zu", shape.size());
+        return;
+    }
+
+    // Raw head: boxes along the longer axis; YOLOv8 puts the attributes first
+    // and has no objectness score
+    const bool transposed = shape[1] < shape[2];
+    const int64_t numBoxes = transposed ? shape[2] : shape[1];
+    const int64_t numAttributes = transposed ? shape[1] : shape[2];
+    const int64_t classOffset = transposed ? 4 : 5;
+    const int64_t numClasses = std::min<int64_t>(numAttributes - classOffset,
+                                                 static_cast<int64_t>(dynamicClasses.size()));
+    const auto at = [&](int64_t box, int64_t attribute) {
+        return transposed ? data[attribute * numBoxes + box] : data[box * numAttributes + attribute];
+    };
+
+    for (int64_t i = 0; i < numBoxes; ++i) {
+        const float objectness = transposed ? 1.0f : at(i, 4);
+        if (objectness < options.confidenceThreshold) {
+            continue;
+        }
+        float score = 0.0f;
+        for (int64_t c = 0; c < numClasses; ++c) {
+            if (dynamicClasses[c]) {
+                score = std::max(score, objectness * at(i, classOffset + c));
+            }
+        }
+        if (score < options.confidenceThreshold) {
+            continue;
+        }
+        const float width = at(i, 2);
+        const float height = at(i, 3);
+        boxes.emplace_back((at(i, 0) - 0.5f * width) * scaleX, (at(i, 1) - 0.5f * height) * scaleY,
+                           width * scaleX, height * scaleY);
+        scores.push_back(score);
+    }
+}
+
+bool DynamicObjectMasker::isDynamic(int classId) const {
+    return classId >= 0 && static_cast<size_t>(classId) < dynamicClasses.size() &&
+           dynamicClasses[classId];
+}
@@ -0,0 +1,101 @@
+/**
+ * @file dynamic_object_masker.h
+ * @brief Masks of moving objects from a YOLO detector
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "frame.h"
+#include "frame_preprocessor.h"
+#include "inference_session.h"
+
+class ModelLoader;
+
+/**
+ * @class DynamicObjectMasker
+ * @brief Detects people, vehicles and other movable objects and masks them out
+ *
+ * Frames are converted into the network input by a FramePreprocessor and
+ * run through an InferenceSession, so steady-state detection reuses the
+ * input tensor and the bound outputs. The raw YOLO head is decoded in any
+ * of the common export layouts:
+ *  - [1, boxes, 5 + classes]: YOLOv5/v7, center box, objectness, class scores
+ *  - [1, 4 + classes, boxes]: YOLOv8, center box, class scores
+ *  - [detections, 7]: end-to-end exports with NMS, (batch, x0, y0, x1, y1, class, score)
+ *
+ * Only the configured classes are kept. Masks are 0 on the detected boxes,
+ * enlarged by a margin, and 255 elsewhere.
+ *
+ * Not thread-safe; use one instance per worker.
+ */
+class DynamicObjectMasker {
+public:
+    /**
+     * @struct Options
+     * @brief Detector model and the classes treated as dynamic
+     */
+    struct Options {
+        std::string modelPath;                  /**< YOLO ONNX model */
+        int inputSize = 640;                    /**< Square network input size */
+        float confidenceThreshold = 0.5f;       /**< Minimum detection score */
+        float nmsThreshold = 0.45f;             /**< IoU above which weaker detections are dropped */
+        float margin = 0.1f;                    /**< Mask border around a box, relative to its size */
+        std::vector<int> classes = {0, 1, 2, 3, 5, 7}; /**< COCO person, bicycle, car, motorcycle, bus, truck */
+    };
+
+    /**
+     * @brief Load the detector
+     * @param loader Loader providing the ONNX Runtime environment
+     * @param options Model and classes
+     */
+    DynamicObjectMasker(const ModelLoader& loader, const Options& options);
+
+    /**
+     * @brief Check whether the model was loaded
+     * @return true if the masker can run
+     */
+    bool isLoaded() const { return session.IsLoaded(); }
+
+    /**
+     * @brief Detect dynamic objects in a frame
+     *
+     * Fills frame.onnx_input and replaces frame.detections with the boxes
+     * of dynamic objects in frame.original pixel coordinates.
+     *
+     * @param frame Frame with an 8-bit BGR or grayscale image
+     * @return true if the detector ran
+     */
+    bool detect(Frame& frame);
+
+    /**
+     * @brief Compute the keypoint mask of an image
+     * @param image 8-bit BGR or grayscale image
+     * @param mask Receives a CV_8U mask of the image size, 0 on dynamic objects
+     * @return true if the detector ran
+     */
+    bool computeMask(const cv::Mat& image, cv::Mat& mask);
+
+    /**
+     * @brief Rasterize the detections of a frame into a mask
+     * @param frame Frame with detections
+     * @return CV_8U mask of the frame size, 0 on dynamic objects
+     */
+    cv::Mat createMask(const Frame& frame) const;
+
+private:
+    void decode(float scaleX, float scaleY, std::vector<cv::Rect2f>& boxes,
+                std::vector<float>& scores) const;
+    bool isDynamic(int classId) const;
+
+    Options options;
+    FramePreprocessor preprocessor;
+    InferenceSession session;
+    std::vector<bool> dynamicClasses;
+    Frame frame; /**< Keeps the input tensor of computeMask() between images */
+};
@@ -1,7 +1,7 @@
 #pragma once
 #include <opencv2/opencv.hpp>
 #include <vector>
-// #include <onnxruntime_cxx_api.h>
+#include <onnxruntime_cxx_api.h>
 #include <optional>
 
 struct Frame {
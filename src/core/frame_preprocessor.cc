@@ -0,0 +1,332 @@
+#include "frame_preprocessor.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#if defined(FRAME_PREPROCESSOR_AVX2)
+#include <immintrin.h>
+#endif
+#if defined(FRAME_PREPROCESSOR_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// ITU-R BT.601 luma weights, as used by cv::cvtColor
+constexpr float kLumaB = 0.114f;
+constexpr float kLumaG = 0.587f;
+constexpr float kLumaR = 0.299f;
+
+// Source sample positions of cv::resize INTER_LINEAR (pixel centers aligned)
+void buildAxis(int sourceSize, int targetSize,
+               std::vector<int32_t>& index0, std::vector<int32_t>& index1,
+               std::vector<float>& weight) {
+    index0.resize(targetSize);
+    index1.resize(targetSize);
+    weight.resize(targetSize);
+    const double step = static_cast<double>(sourceSize) / targetSize;
+    for (int i = 0; i < targetSize; ++i) {
+        const double position = (i + 0.5) * step - 0.5;
+        int first = static_cast<int>(std::floor(position));
+        float fraction = static_cast<float>(position - first);
+        if (first < 0) {
+            first = 0;
+            fraction = 0.0f;
+        } else if (first >= sourceSize - 1) {
+            first = sourceSize - 1;
+            fraction = 0.0f;
+        }
+        index0[i] = first;
+        index1[i] = std::min(first + 1, sourceSize - 1);
+        weight[i] = fraction;
+    }
+}
+
+} // namespace
+
+FramePreprocessor::FramePreprocessor(const Options& options) : options(options) {
+    // (p / 255 - mean) / std folded into one multiply-add
+    for (int c = 0; c < 3; ++c) {
+        scale[c] = 1.0f / (255.0f * options.std[c]);
+        bias[c] = -options.mean[c] / options.std[c];
+    }
+#if defined(FRAME_PREPROCESSOR_AVX2)
+    useAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+bool FramePreprocessor::process(Frame& frame) {
+    const cv::Mat& image = frame.original;
+    const int channels = image.channels();
+    if (image.empty() || image.depth() != CV_8U ||
+        (channels != 1 && channels != 3 && channels != 4)) {
+        LOG_WARNING("Unsupported frame format for preprocessing (type %d)", image.type());
+        return false;
+    }
+
+    const std::array<int64_t, 4> shape = getShape();
+    if (!frame.onnx_input ||
+        frame.onnx_input->GetTensorTypeAndShapeInfo().GetShape() !=
+            std::vector<int64_t>(shape.begin(), shape.end())) {
+        Ort::AllocatorWithDefaultOptions allocator;
+        frame.onnx_input = Ort::Value::CreateTensor<float>(allocator, shape.data(), shape.size());
+    }
+    run(image, frame.onnx_input->GetTensorMutableData<float>());
+    return true;
+}
+
+void FramePreprocessor::run(const cv::Mat& image, float* tensor) {
+    convert(image, tensor, true);
+}
+
+void FramePreprocessor::runScalar(const cv::Mat& image, float* tensor) {
+    convert(image, tensor, false);
+}
+
+void FramePreprocessor::prepareTables(const cv::Mat& image) {
+    if (image.cols == sourceWidth && image.rows == sourceHeight &&
+        image.channels() == sourceChannels) {
+        return;
+    }
+    sourceWidth = image.cols;
+    sourceHeight = image.rows;
+    sourceChannels = image.channels();
+    channelOffset = sourceChannels == 1 ? std::array<int, 3>{0, 0, 0}
+                                        : std::array<int, 3>{0, 1, 2};
+
+    buildAxis(sourceWidth, options.width, xOffset0, xOffset1, xWeight);
+    for (int x = 0; x < options.width; ++x) {
+        xOffset0[x] *= sourceChannels;
+        xOffset1[x] *= sourceChannels;
+    }
+    buildAxis(sourceHeight, options.height, yIndex0, yIndex1, yWeight);
+
+    // Gathers load 4 bytes per pixel; near the right border that would
+    // read past the end of the last row, so those columns stay scalar
+    const int rowBytes = sourceWidth * sourceChannels;
+    gatherEnd = 0;
+    while (gatherEnd < options.width && xOffset1[gatherEnd] + 4 <= rowBytes) {
+        ++gatherEnd;
+    }
+
+    rowBuffer.assign(static_cast<size_t>(6) * options.width, 0.0f);
+}
+
+void FramePreprocessor::convert(const cv::Mat& image, float* tensor, bool vectorized) {
+    prepareTables(image);
+
+    const int width = options.width;
+    float* slots[2] = {rowBuffer.data(), rowBuffer.data() + 3 * width};
+    int cached[2] = {-1, -1};
+
+    const auto resampleRow = [&](int sourceRow, float* planes) {
+#if defined(FRAME_PREPROCESSOR_AVX2)
+        if (vectorized && useAvx2) {
+            horizontalAvx2(image.ptr<uint8_t>(sourceRow), planes);
+            return;
+        }
+#endif
+        horizontalScalar(image.ptr<uint8_t>(sourceRow), planes, 0, width);
+    };
+
+    for (int y = 0; y < options.height; ++y) {
+        // When upscaling, consecutive output rows share source rows
+        if (cached[0] != yIndex0[y]) {
+            if (cached[1] == yIndex0[y]) {
+                std::swap(slots[0], slots[1]);
+                std::swap(cached[0], cached[1]);
+            } else {
+                resampleRow(yIndex0[y], slots[0]);
+                cached[0] = yIndex0[y];
+            }
+        }
+        if (cached[1] != yIndex1[y]) {
+            resampleRow(yIndex1[y], slots[1]);
+            cached[1] = yIndex1[y];
+        }
+
+#if defined(FRAME_PREPROCESSOR_AVX2)
+        if (vectorized && useAvx2) {
+            verticalAvx2(slots[0], slots[1], yWeight[y], tensor, y);
+            continue;
+        }
+#elif defined(FRAME_PREPROCESSOR_NEON)
+        if (vectorized) {
+            verticalNeon(slots[0], slots[1], yWeight[y], tensor, y);
+            continue;
+        }
+#endif
+        verticalScalar(slots[0], slots[1], yWeight[y], tensor, y, 0, width);
+    }
+}
+
+void FramePreprocessor::horizontalScalar(const uint8_t* row, float* planes,
+                                         int begin, int end) const {
+    const int width = options.width;
+    for (int c = 0; c < 3; ++c) {
+        const uint8_t* source = row + channelOffset[c];
+        float* plane = planes + c * width;
+        for (int x = begin; x < end; ++x) {
+            const float left = source[xOffset0[x]];
+            const float right = source[xOffset1[x]];
+            plane[x] = left + xWeight[x] * (right - left);
+        }
+    }
+}
+
+void FramePreprocessor::verticalScalar(const float* upper, const float* lower, float weight,
+                                       float* tensor, int y, int begin, int end) const {
+    const int width = options.width;
+    const size_t planeSize = static_cast<size_t>(width) * options.height;
+    float* output = tensor + static_cast<size_t>(y) * width;
+
+    if (options.colorFormat == ColorFormat::GRAY) {
+        for (int x = begin; x < end; ++x) {
+            const float b = upper[x] + weight * (lower[x] - upper[x]);
+            const float g = upper[width + x] + weight * (lower[width + x] - upper[width + x]);
+            const float r = upper[2 * width + x] + weight * (lower[2 * width + x] - upper[2 * width + x]);
+            output[x] = (kLumaB * b + kLumaG * g + kLumaR * r) * scale[0] + bias[0];
+        }
+        return;
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        // Row planes are stored B, G, R
+        const int plane = options.colorFormat == ColorFormat::RGB ? 2 - c : c;
+        const float* top = upper + plane * width;
+        const float* bottom = lower + plane * width;
+        float* out = output + c * planeSize;
+        for (int x = begin; x < end; ++x) {
+            const float value = top[x] + weight * (bottom[x] - top[x]);
+            out[x] = value * scale[c] + bias[c];
+        }
+    }
+}
+
+#if defined(FRAME_PREPROCESSOR_AVX2)
+
+__attribute__((target("avx2,fma")))
+void FramePreprocessor::horizontalAvx2(const uint8_t* row, float* planes) const {
+    const int width = options.width;
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const int* base = reinterpret_cast<const int*>(row);
+    int x = 0;
+    for (; x + 8 <= gatherEnd; x += 8) {
+        // One dword per pixel holds all of its channels; they are split with shifts
+        const __m256i left = _mm256_i32gather_epi32(
+            base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&xOffset0[x])), 1);
+        const __m256i right = _mm256_i32gather_epi32(
+            base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&xOffset1[x])), 1);
+        const __m256 weight = _mm256_loadu_ps(&xWeight[x]);
+        for (int c = 0; c < 3; ++c) {
+            const __m128i shift = _mm_cvtsi32_si128(8 * channelOffset[c]);
+            const __m256 p0 = _mm256_cvtepi32_ps(
+                _mm256_and_si256(_mm256_srl_epi32(left, shift), byteMask));
+            const __m256 p1 = _mm256_cvtepi32_ps(
+                _mm256_and_si256(_mm256_srl_epi32(right, shift), byteMask));
+            _mm256_storeu_ps(planes + c * width + x,
+                             _mm256_fmadd_ps(weight, _mm256_sub_ps(p1, p0), p0));
+        }
+    }
+    horizontalScalar(row, planes, x, width);
+}
+
+__attribute__((target("avx2,fma")))
+void FramePreprocessor::verticalAvx2(const float* upper, const float* lower, float weight,
+                                     float* tensor, int y) const {
+    const int width = options.width;
+    const size_t planeSize = static_cast<size_t>(width) * options.height;
+    float* output = tensor + static_cast<size_t>(y) * width;
+    const __m256 w = _mm256_set1_ps(weight);
+    int x = 0;
+
+    if (options.colorFormat == ColorFormat::GRAY) {
+        const __m256 lumaB = _mm256_set1_ps(kLumaB);
+        const __m256 lumaG = _mm256_set1_ps(kLumaG);
+        const __m256 lumaR = _mm256_set1_ps(kLumaR);
+        const __m256 s = _mm256_set1_ps(scale[0]);
+        const __m256 o = _mm256_set1_ps(bias[0]);
+        for (; x + 8 <= width; x += 8) {
+            __m256 channel[3];
+            for (int c = 0; c < 3; ++c) {
+                const __m256 top = _mm256_loadu_ps(upper + c * width + x);
+                const __m256 bottom = _mm256_loadu_ps(lower + c * width + x);
+                channel[c] = _mm256_fmadd_ps(w, _mm256_sub_ps(bottom, top), top);
+            }
+            __m256 luma = _mm256_mul_ps(lumaB, channel[0]);
+            luma = _mm256_fmadd_ps(lumaG, channel[1], luma);
+            luma = _mm256_fmadd_ps(lumaR, channel[2], luma);
+            _mm256_storeu_ps(output + x, _mm256_fmadd_ps(luma, s, o));
+        }
+        verticalScalar(upper, lower, weight, tensor, y, x, width);
+        return;
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        const int plane = options.colorFormat == ColorFormat::RGB ? 2 - c : c;
+        const float* top = upper + plane * width;
+        const float* bottom = lower + plane * width;
+        float* out = output + c * planeSize;
+        const __m256 s = _mm256_set1_ps(scale[c]);
+        const __m256 o = _mm256_set1_ps(bias[c]);
+        for (x = 0; x + 8 <= width; x += 8) {
+            const __m256 t = _mm256_loadu_ps(top + x);
+            const __m256 b = _mm256_loadu_ps(bottom + x);
+            const __m256 value = _mm256_fmadd_ps(w, _mm256_sub_ps(b, t), t);
+            _mm256_storeu_ps(out + x, _mm256_fmadd_ps(value, s, o));
+        }
+    }
+    verticalScalar(upper, lower, weight, tensor, y, x, width);
+}
+
+#endif
+
+#if defined(FRAME_PREPROCESSOR_NEON)
+
+void FramePreprocessor::verticalNeon(const float* upper, const float* lower, float weight,
+                                     float* tensor, int y) const {
+    const int width = options.width;
+    const size_t planeSize = static_cast<size_t>(width) * options.height;
+    float* output = tensor + static_cast<size_t>(y) * width;
+    const float32x4_t w = vdupq_n_f32(weight);
+    int x = 0;
+
+    if (options.colorFormat == ColorFormat::GRAY) {
+        const float32x4_t s = vdupq_n_f32(scale[0]);
+        const float32x4_t o = vdupq_n_f32(bias[0]);
+        for (; x + 4 <= width; x += 4) {
+            float32x4_t channel[3];
+            for (int c = 0; c < 3; ++c) {
+                const float32x4_t top = vld1q_f32(upper + c * width + x);
+                const float32x4_t bottom = vld1q_f32(lower + c * width + x);
+                channel[c] = vfmaq_f32(top, w, vsubq_f32(bottom, top));
+            }
+            float32x4_t luma = vmulq_n_f32(channel[0], kLumaB);
+            luma = vfmaq_n_f32(luma, channel[1], kLumaG);
+            luma = vfmaq_n_f32(luma, channel[2], kLumaR);
+            vst1q_f32(output + x, vfmaq_f32(o, luma, s));
+        }
+        verticalScalar(upper, lower, weight, tensor, y, x, width);
+        return;
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        const int plane = options.colorFormat == ColorFormat::RGB ? 2 - c : c;
+        const float* top = upper + plane * width;
+        const float* bottom = lower + plane * width;
+        float* out = output + c * planeSize;
+        const float32x4_t s = vdupq_n_f32(scale[c]);
+        const float32x4_t o = vdupq_n_f32(bias[c]);
+        for (x = 0; x + 4 <= width; x += 4) {
+            const float32x4_t t = vld1q_f32(top + x);
+            const float32x4_t b = vld1q_f32(bottom + x);
+            const float32x4_t value = vfmaq_f32(t, w, vsubq_f32(b, t));
+            vst1q_f32(out + x, vfmaq_f32(o, value, s));
+        }
+    }
+    verticalScalar(upper, lower, weight, tensor, y, x, width);
+}
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ * @file frame_preprocessor.h
+ * @brief Fused resize, color conversion and normalization into ONNX input tensors
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include "frame.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FRAME_PREPROCESSOR_AVX2 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define FRAME_PREPROCESSOR_NEON 1
+#endif
+
+/**
+ * @class FramePreprocessor
+ * @brief Converts 8-bit frames into normalized NCHW float tensors in one pass
+ *
+ * Bilinear resize (same sampling as cv::resize with INTER_LINEAR), channel
+ * reordering or grayscale conversion, normalization and the HWC to NCHW
+ * transpose are done per output row: the two source rows are resampled
+ * horizontally into a small planar buffer, blended vertically and written
+ * straight into the tensor. Resampling tables are kept between frames of
+ * the same size, so steady-state processing does not allocate.
+ *
+ * The vertical pass (and the horizontal gather on AVX2) is vectorized with
+ * AVX2/FMA on x86-64, selected at runtime, and with NEON on ARM. runScalar()
+ * computes the same result without SIMD and serves as the reference;
+ * tests/frame_preprocessor_test.cc checks both against each other.
+ */
+class FramePreprocessor {
+public:
+    /**
+     * @enum ColorFormat
+     * @brief Channel layout expected by the network
+     */
+    enum class ColorFormat {
+        RGB,  /**< Three planes, red first */
+        BGR,  /**< Three planes, blue first */
+        GRAY  /**< One luminance plane */
+    };
+
+    /**
+     * @struct Options
+     * @brief Network input layout and normalization
+     *
+     * Output values are (pixel / 255 - mean) / std per output channel.
+     */
+    struct Options {
+        int width = 640;                              /**< Network input width */
+        int height = 640;                             /**< Network input height */
+        ColorFormat colorFormat = ColorFormat::RGB;   /**< Output channel layout */
+        std::array<float, 3> mean = {0.0f, 0.0f, 0.0f}; /**< Per-channel mean in [0, 1] units */
+        std::array<float, 3> std = {1.0f, 1.0f, 1.0f};  /**< Per-channel standard deviation */
+    };
+
+    /**
+     * @brief Construct a preprocessor for one network input
+     * @param options Input layout and normalization
+     */
+    explicit FramePreprocessor(const Options& options);
+
+    /**
+     * @brief Convert frame.original into frame.onnx_input
+     *
+     * The tensor of the frame is reused when it already has the right shape.
+     *
+     * @param frame Frame with an 8-bit BGR, BGRA or grayscale image
+     * @return true on success, false if the image format is not supported
+     */
+    bool process(Frame& frame);
+
+    /**
+     * @brief Convert an image with the fastest kernel available
+     * @param image 8-bit image with 1, 3 (BGR) or 4 (BGRA) channels
+     * @param tensor Output of getChannels() * height * width floats
+     */
+    void run(const cv::Mat& image, float* tensor);
+
+    /**
+     * @brief Convert an image with the scalar reference kernel
+     * @param image 8-bit image with 1, 3 (BGR) or 4 (BGRA) channels
+     * @param tensor Output of getChannels() * height * width floats
+     */
+    void runScalar(const cv::Mat& image, float* tensor);
+
+    /**
+     * @brief Get the number of output planes
+     * @return 1 for grayscale, 3 otherwise
+     */
+    int getChannels() const { return options.colorFormat == ColorFormat::GRAY ? 1 : 3; }
+
+    /**
+     * @brief Get the NCHW shape of the output tensor
+     * @return {1, channels, height, width}
+     */
+    std::array<int64_t, 4> getShape() const {
+        return {1, getChannels(), options.height, options.width};
+    }
+
+private:
+    void prepareTables(const cv::Mat& image);
+    void horizontalScalar(const uint8_t* row, float* planes, int begin, int end) const;
+    void verticalScalar(const float* upper, const float* lower, float weight,
+                        float* tensor, int y, int begin, int end) const;
+    void convert(const cv::Mat& image, float* tensor, bool vectorized);
+
+#if defined(FRAME_PREPROCESSOR_AVX2)
+    void horizontalAvx2(const uint8_t* row, float* planes) const;
+    void verticalAvx2(const float* upper, const float* lower, float weight,
+                      float* tensor, int y) const;
+#endif
+#if defined(FRAME_PREPROCESSOR_NEON)
+    void verticalNeon(const float* upper, const float* lower, float weight,
+                      float* tensor, int y) const;
+#endif
+
+    Options options;
+    std::array<float, 3> scale{};
+    std::array<float, 3> bias{};
+    bool useAvx2 = false;
+
+    // Resampling tables, rebuilt when the source size or layout changes
+    int sourceWidth = 0;
+    int sourceHeight = 0;
+    int sourceChannels = 0;
+    std::array<int, 3> channelOffset{}; /**< Byte offset of B, G, R within a pixel */
+    std::vector<int32_t> xOffset0;      /**< Byte offset of the left source pixel */
+    std::vector<int32_t> xOffset1;      /**< Byte offset of the right source pixel */
+    std::vector<float> xWeight;
+    std::vector<int32_t> yIndex0;
+    std::vector<int32_t> yIndex1;
+    std::vector<float> yWeight;
+    int gatherEnd = 0;                  /**< Columns whose 4-byte gathers stay inside the row */
+
+    // Two horizontally resampled source rows, each as B, G, R planes
+    std::vector<float> rowBuffer;
+};
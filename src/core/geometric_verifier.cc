@@ -0,0 +1,397 @@
+#include "geometric_verifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include <Eigen/Dense>
+
+#if defined(GEOMETRIC_VERIFIER_AVX2)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Matches scored between two SPRT decisions
+constexpr size_t kBlockSize = 64;
+
+// Cost of generating a hypothesis, in Sampson distance evaluations
+constexpr double kModelCost = 200.0;
+
+// Local optimization rounds after a new best model
+constexpr int kRefineRounds = 10;
+
+} // namespace
+
+GeometricVerifier::GeometricVerifier(const Options& options)
+    : options(options) {
+#if defined(GEOMETRIC_VERIFIER_AVX2)
+    useAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+bool GeometricVerifier::verify(const colmap::FeatureKeypoints& keypoints1,
+                               const colmap::FeatureKeypoints& keypoints2,
+                               const PairMatches& pair,
+                               std::vector<uint32_t>& inliers) {
+    inliers.clear();
+    numIterations = 0;
+    const size_t minInliers = static_cast<size_t>(std::max(options.minInliers, kSampleSize));
+    if (pair.matches.size() < minInliers) {
+        return false;
+    }
+
+    prepare(keypoints1, keypoints2, pair);
+    random.seed(static_cast<uint32_t>(pair.first * 2654435761u + pair.second));
+    delta = 0.05;
+    updateSprt(static_cast<double>(minInliers) / numPoints);
+
+    // PROSAC grows the sampling pool from the most confident matches; without
+    // confidences every sample is drawn from all matches, as in RANSAC
+    const size_t numTotal = numPoints;
+    size_t poolSize = pair.scores.size() == numTotal ? kSampleSize : numTotal;
+    double averageSamples = options.maxIterations;
+    for (int i = 0; i < kSampleSize; ++i) {
+        averageSamples *= static_cast<double>(kSampleSize - i) / (numTotal - i);
+    }
+    double poolGrowth = 1.0;
+
+    Eigen::Matrix3d bestModel;
+    size_t bestInliers = 0;
+    size_t maxIterations = static_cast<size_t>(options.maxIterations);
+    uint32_t sample[kSampleSize];
+
+    for (size_t t = 1; t <= maxIterations; ++t) {
+        numIterations = static_cast<int>(t);
+        while (t > poolGrowth && poolSize < numTotal) {
+            const double nextSamples = averageSamples * (poolSize + 1) / (poolSize + 1 - kSampleSize);
+            poolGrowth += std::ceil(nextSamples - averageSamples);
+            averageSamples = nextSamples;
+            ++poolSize;
+        }
+        drawSample(poolSize, poolSize < numTotal && t <= poolGrowth, sample);
+
+        Eigen::Matrix3d model;
+        if (!fit(sample, kSampleSize, model)) {
+            continue;
+        }
+
+        bool rejected = false;
+        const size_t numInliers = score(model, mask, true, rejected);
+        if (rejected) {
+            // Consistent matches of a rejected model estimate delta
+            const double observed = static_cast<double>(numInliers) / std::max<size_t>(1, numEvaluated);
+            delta = std::clamp(0.95 * delta + 0.05 * observed, 0.001, 0.5);
+            updateSprt(epsilon);
+            continue;
+        }
+        if (numInliers <= bestInliers) {
+            continue;
+        }
+
+        bestModel = model;
+        mask.swap(bestMask);
+        bestInliers = refine(bestModel, numInliers);
+        updateSprt(static_cast<double>(bestInliers) / numTotal);
+
+        // Stop once the samples drawn so far are likely to have hit an
+        // all-inlier sample within some pool of the most confident matches
+        // (PROSAC); without confidences only the full set is considered
+        double needed = std::numeric_limits<double>::infinity();
+        size_t prefixInliers = 0;
+        for (size_t n = 0; n < numTotal; ++n) {
+            prefixInliers += bestMask[n];
+            // Non-randomness: more inliers than a wrong model would explain
+            const double expected = delta * (n + 1);
+            const double spread = 1.64 * std::sqrt(expected * (1.0 - delta));
+            if (n + 1 < poolSize || prefixInliers < minInliers ||
+                prefixInliers < expected + spread + kSampleSize) {
+                continue;
+            }
+            const double inlierRatio = static_cast<double>(prefixInliers) / (n + 1);
+            const double sampleInlierProbability = std::pow(inlierRatio, kSampleSize);
+            needed = std::min(needed, sampleInlierProbability >= 1.0
+                                          ? 0.0
+                                          : std::log(1.0 - options.confidence) /
+                                                std::log(1.0 - sampleInlierProbability));
+        }
+        if (std::isfinite(needed)) {
+            maxIterations = std::min(maxIterations, std::max(t, static_cast<size_t>(std::ceil(needed))));
+        }
+    }
+
+    if (bestInliers < minInliers) {
+        return false;
+    }
+    inliers.reserve(bestInliers);
+    for (size_t i = 0; i < numPoints; ++i) {
+        if (bestMask[i]) {
+            inliers.push_back(order[i]);
+        }
+    }
+    std::sort(inliers.begin(), inliers.end());
+    return true;
+}
+
+void GeometricVerifier::prepare(const colmap::FeatureKeypoints& keypoints1,
+                                const colmap::FeatureKeypoints& keypoints2,
+                                const PairMatches& pair) {
+    numPoints = pair.matches.size();
+    order.resize(numPoints);
+    std::iota(order.begin(), order.end(), 0);
+    if (pair.scores.size() == numPoints) {
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return pair.scores[a] > pair.scores[b];
+        });
+    }
+
+    // Hartley normalization with one scale for both images, so a distance
+    // threshold in pixels maps to a single threshold in normalized units
+    Eigen::Vector2d centroid1 = Eigen::Vector2d::Zero();
+    Eigen::Vector2d centroid2 = Eigen::Vector2d::Zero();
+    for (const auto& match : pair.matches) {
+        centroid1 += Eigen::Vector2d(keypoints1[match.first].x, keypoints1[match.first].y);
+        centroid2 += Eigen::Vector2d(keypoints2[match.second].x, keypoints2[match.second].y);
+    }
+    centroid1 /= numPoints;
+    centroid2 /= numPoints;
+    double meanDistance = 0.0;
+    for (const auto& match : pair.matches) {
+        meanDistance += (Eigen::Vector2d(keypoints1[match.first].x, keypoints1[match.first].y) -
+                         centroid1).norm();
+        meanDistance += (Eigen::Vector2d(keypoints2[match.second].x, keypoints2[match.second].y) -
+                         centroid2).norm();
+    }
+    meanDistance /= 2.0 * numPoints;
+    const double scale = meanDistance > 0.0 ? std::sqrt(2.0) / meanDistance : 1.0;
+    threshold = static_cast<float>(options.maxError * scale);
+
+    const size_t padded = (numPoints + 7) & ~size_t(7);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    x1.assign(padded, nan);
+    y1.assign(padded, nan);
+    x2.assign(padded, nan);
+    y2.assign(padded, nan);
+    for (size_t i = 0; i < numPoints; ++i) {
+        const auto& match = pair.matches[order[i]];
+        x1[i] = static_cast<float>((keypoints1[match.first].x - centroid1.x()) * scale);
+        y1[i] = static_cast<float>((keypoints1[match.first].y - centroid1.y()) * scale);
+        x2[i] = static_cast<float>((keypoints2[match.second].x - centroid2.x()) * scale);
+        y2[i] = static_cast<float>((keypoints2[match.second].y - centroid2.y()) * scale);
+    }
+    mask.assign(padded, 0);
+    bestMask.assign(padded, 0);
+}
+
+bool GeometricVerifier::fit(const uint32_t* indices, size_t count, Eigen::Matrix3d& model) const {
+    // Eight-point algorithm: x2^T F x1 = 0 for every match
+    auto row = [&](size_t i) {
+        const double u1 = x1[indices[i]];
+        const double v1 = y1[indices[i]];
+        const double u2 = x2[indices[i]];
+        const double v2 = y2[indices[i]];
+        Eigen::Matrix<double, 9, 1> coefficients;
+        coefficients << u2 * u1, u2 * v1, u2, v2 * u1, v2 * v1, v2, u1, v1, 1.0;
+        return coefficients;
+    };
+
+    Eigen::Matrix<double, 9, 1> f;
+    if (count == kSampleSize) {
+        // Minimal sample: the null vector is the last column of the
+        // Householder Q of the transposed system, much cheaper than an
+        // eigendecomposition
+        Eigen::Matrix<double, 9, kSampleSize> system;
+        for (size_t i = 0; i < count; ++i) {
+            system.col(i) = row(i);
+        }
+        const Eigen::HouseholderQR<Eigen::Matrix<double, 9, kSampleSize>> qr(system);
+        const auto& r = qr.matrixQR();
+        if (std::abs(r(kSampleSize - 1, kSampleSize - 1)) <= 1e-10 * std::abs(r(0, 0))) {
+            return false;  // Degenerate sample, e.g. collinear or repeated points
+        }
+        f = qr.householderQ() * Eigen::Matrix<double, 9, 1>::Unit(8);
+    } else {
+        // Least squares through the normal equations
+        Eigen::Matrix<double, 9, 9> normal = Eigen::Matrix<double, 9, 9>::Zero();
+        for (size_t i = 0; i < count; ++i) {
+            normal.selfadjointView<Eigen::Lower>().rankUpdate(row(i));
+        }
+        // The solver only reads the lower triangle
+        const Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> solver(normal);
+        if (solver.info() != Eigen::Success) {
+            return false;
+        }
+        f = solver.eigenvectors().col(0);
+    }
+
+    const Eigen::Matrix3d unconstrained =
+        Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(f.data());
+    const Eigen::JacobiSVD<Eigen::Matrix3d> svd(unconstrained, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Vector3d singular = svd.singularValues();
+    singular(2) = 0.0;
+    model = svd.matrixU() * singular.asDiagonal() * svd.matrixV().transpose();
+    return model.allFinite();
+}
+
+size_t GeometricVerifier::score(const Eigen::Matrix3d& model, std::vector<uint8_t>& modelMask,
+                                bool sprt, bool& rejected) {
+    float f[9];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            f[3 * r + c] = static_cast<float>(model(r, c));
+        }
+    }
+
+    rejected = false;
+    size_t numInliers = 0;
+    double logLikelihood = 0.0;
+    const size_t padded = x1.size();
+    for (size_t begin = 0; begin < padded; begin += kBlockSize) {
+        const size_t end = std::min(begin + kBlockSize, padded);
+#if defined(GEOMETRIC_VERIFIER_AVX2)
+        const size_t blockInliers = useAvx2 ? scoreAvx2(f, begin, end, modelMask.data())
+                                            : scoreScalar(f, begin, end, modelMask.data());
+#else
+        const size_t blockInliers = scoreScalar(f, begin, end, modelMask.data());
+#endif
+        numInliers += blockInliers;
+        numEvaluated = std::min(end, numPoints);
+        if (sprt) {
+            const size_t blockOutliers = std::min(end, numPoints) - begin - blockInliers;
+            logLikelihood += blockInliers * logInlierRatio + blockOutliers * logOutlierRatio;
+            if (logLikelihood > logDecisionThreshold) {
+                rejected = true;
+                return numInliers;
+            }
+        }
+    }
+    return numInliers;
+}
+
+size_t GeometricVerifier::scoreScalar(const float* f, size_t begin, size_t end,
+                                      uint8_t* modelMask) const {
+    const float threshold2 = threshold * threshold;
+    size_t numInliers = 0;
+    for (size_t i = begin; i < end; ++i) {
+        // Sampson distance: (x2^T F x1)^2 / (|(F x1)_12|^2 + |(F^T x2)_12|^2)
+        const float a = f[0] * x1[i] + f[1] * y1[i] + f[2];
+        const float b = f[3] * x1[i] + f[4] * y1[i] + f[5];
+        const float c = f[6] * x1[i] + f[7] * y1[i] + f[8];
+        const float d = f[0] * x2[i] + f[3] * y2[i] + f[6];
+        const float e = f[1] * x2[i] + f[4] * y2[i] + f[7];
+        const float residual = x2[i] * a + y2[i] * b + c;
+        const float norm = a * a + b * b + d * d + e * e;
+        const bool inlier = residual * residual <= threshold2 * norm;
+        modelMask[i] = inlier;
+        numInliers += inlier;
+    }
+    return numInliers;
+}
+
+#if defined(GEOMETRIC_VERIFIER_AVX2)
+
+__attribute__((target("avx2,fma")))
+size_t GeometricVerifier::scoreAvx2(const float* f, size_t begin, size_t end,
+                                    uint8_t* modelMask) const {
+    const __m256 f0 = _mm256_set1_ps(f[0]);
+    const __m256 f1 = _mm256_set1_ps(f[1]);
+    const __m256 f2 = _mm256_set1_ps(f[2]);
+    const __m256 f3 = _mm256_set1_ps(f[3]);
+    const __m256 f4 = _mm256_set1_ps(f[4]);
+    const __m256 f5 = _mm256_set1_ps(f[5]);
+    const __m256 f6 = _mm256_set1_ps(f[6]);
+    const __m256 f7 = _mm256_set1_ps(f[7]);
+    const __m256 f8 = _mm256_set1_ps(f[8]);
+    const __m256 threshold2 = _mm256_set1_ps(threshold * threshold);
+
+    size_t numInliers = 0;
+    for (size_t i = begin; i < end; i += 8) {
+        const __m256 u1 = _mm256_loadu_ps(&x1[i]);
+        const __m256 v1 = _mm256_loadu_ps(&y1[i]);
+        const __m256 u2 = _mm256_loadu_ps(&x2[i]);
+        const __m256 v2 = _mm256_loadu_ps(&y2[i]);
+        const __m256 a = _mm256_fmadd_ps(f0, u1, _mm256_fmadd_ps(f1, v1, f2));
+        const __m256 b = _mm256_fmadd_ps(f3, u1, _mm256_fmadd_ps(f4, v1, f5));
+        const __m256 c = _mm256_fmadd_ps(f6, u1, _mm256_fmadd_ps(f7, v1, f8));
+        const __m256 d = _mm256_fmadd_ps(f0, u2, _mm256_fmadd_ps(f3, v2, f6));
+        const __m256 e = _mm256_fmadd_ps(f1, u2, _mm256_fmadd_ps(f4, v2, f7));
+        const __m256 residual = _mm256_fmadd_ps(u2, a, _mm256_fmadd_ps(v2, b, c));
+        const __m256 norm = _mm256_fmadd_ps(a, a, _mm256_fmadd_ps(b, b,
+                            _mm256_fmadd_ps(d, d, _mm256_mul_ps(e, e))));
+        // Ordered comparison: the NaN padding never counts as an inlier
+        const __m256 inlier = _mm256_cmp_ps(_mm256_mul_ps(residual, residual),
+                                            _mm256_mul_ps(threshold2, norm), _CMP_LE_OQ);
+        const int bits = _mm256_movemask_ps(inlier);
+        numInliers += __builtin_popcount(bits);
+        for (int k = 0; k < 8; ++k) {
+            modelMask[i + k] = (bits >> k) & 1;
+        }
+    }
+    return numInliers;
+}
+
+#endif
+
+size_t GeometricVerifier::refine(Eigen::Matrix3d& model, size_t numInliers) {
+    for (int round = 0; round < kRefineRounds; ++round) {
+        inlierIndices.clear();
+        for (size_t i = 0; i < numPoints; ++i) {
+            if (bestMask[i]) {
+                inlierIndices.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        Eigen::Matrix3d refined;
+        if (!fit(inlierIndices.data(), inlierIndices.size(), refined)) {
+            break;
+        }
+        bool rejected = false;
+        const size_t refinedInliers = score(refined, mask, false, rejected);
+        if (refinedInliers <= numInliers) {
+            break;
+        }
+        model = refined;
+        numInliers = refinedInliers;
+        mask.swap(bestMask);
+    }
+    return numInliers;
+}
+
+void GeometricVerifier::drawSample(size_t poolSize, bool includeLast, uint32_t* sample) {
+    // PROSAC draws the newest match of the pool plus m - 1 others from the
+    // rest of the pool until the pool has grown as far as its schedule allows
+    const size_t drawFrom = includeLast ? poolSize - 1 : poolSize;
+    const int numDrawn = includeLast ? kSampleSize - 1 : kSampleSize;
+    std::uniform_int_distribution<uint32_t> distribution(0, static_cast<uint32_t>(drawFrom - 1));
+    for (int i = 0; i < numDrawn; ++i) {
+        uint32_t index;
+        do {
+            index = distribution(random);
+        } while (std::find(sample, sample + i, index) != sample + i);
+        sample[i] = index;
+    }
+    if (includeLast) {
+        sample[kSampleSize - 1] = static_cast<uint32_t>(poolSize - 1);
+    }
+}
+
+void GeometricVerifier::updateSprt(double inlierRatio) {
+    epsilon = std::clamp(inlierRatio, 1e-3, 0.999);
+    if (delta >= epsilon) {
+        // A wrong model explains as many matches as a good one: no early exit
+        logDecisionThreshold = std::numeric_limits<double>::infinity();
+        return;
+    }
+    logInlierRatio = std::log(delta / epsilon);
+    logOutlierRatio = std::log((1.0 - delta) / (1.0 - epsilon));
+
+    // Optimal decision threshold A of Matas and Chum, by fixed-point iteration
+    const double information = (1.0 - delta) * std::log((1.0 - delta) / (1.0 - epsilon)) +
+                               delta * std::log(delta / epsilon);
+    const double base = kModelCost * information + 1.0;
+    double decision = base;
+    for (int i = 0; i < 10; ++i) {
+        decision = base + std::log(decision);
+    }
+    logDecisionThreshold = std::log(decision);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file geometric_verifier.h
+ * @brief Fast epipolar prefilter for putative matches of an image pair
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <Eigen/Core>
+#include <colmap/feature/types.h>
+
+#include "reconstruction_pipeline.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GEOMETRIC_VERIFIER_AVX2 1
+#endif
+
+/**
+ * @class GeometricVerifier
+ * @brief Finds the matches consistent with a fundamental matrix using
+ *        PROSAC sampling and SPRT model evaluation
+ *
+ * Matches are copied into struct-of-arrays buffers in the order of their
+ * confidence (PairMatches::scores, filled in by the matching stage), so that
+ * PROSAC draws its first samples from the most confident matches. Every
+ * hypothesis is scored with the Sampson distance, eight matches at a time
+ * with AVX2 where available, and abandoned by the sequential probability
+ * ratio test as soon as it is unlikely to beat the best model. New best
+ * models are refined by a least-squares fit on their inliers.
+ *
+ * The verifier is meant as a prefilter: pairs without enough consistent
+ * matches are rejected outright, and the full two-view estimation only
+ * sees the surviving matches, on which its RANSAC terminates quickly.
+ * Buffers are kept between pairs; use one instance per worker.
+ */
+class GeometricVerifier {
+public:
+    /**
+     * @struct Options
+     * @brief Robust estimation settings
+     */
+    struct Options {
+        double maxError = 8.0;     /**< Sampson distance threshold in pixels */
+        double confidence = 0.999; /**< Confidence for the adaptive stopping criterion */
+        int maxIterations = 10000; /**< Upper bound on the number of hypotheses */
+        int minInliers = 15;       /**< Inliers needed to accept the pair */
+    };
+
+    /**
+     * @brief Construct a verifier
+     * @param options Robust estimation settings
+     */
+    explicit GeometricVerifier(const Options& options);
+
+    /**
+     * @brief Find the matches consistent with the epipolar geometry of a pair
+     * @param keypoints1 Keypoints of the first image
+     * @param keypoints2 Keypoints of the second image
+     * @param pair Putative matches, with optional per-match confidences
+     * @param inliers Receives the indices into pair.matches of the consistent matches
+     * @return true if at least minInliers matches are consistent
+     */
+    bool verify(const colmap::FeatureKeypoints& keypoints1,
+                const colmap::FeatureKeypoints& keypoints2,
+                const PairMatches& pair,
+                std::vector<uint32_t>& inliers);
+
+    /**
+     * @brief Get the number of hypotheses generated for the last pair
+     * @return The iteration count
+     */
+    int getNumIterations() const { return numIterations; }
+
+private:
+    static constexpr int kSampleSize = 8;
+
+    void prepare(const colmap::FeatureKeypoints& keypoints1,
+                 const colmap::FeatureKeypoints& keypoints2,
+                 const PairMatches& pair);
+    bool fit(const uint32_t* indices, size_t count, Eigen::Matrix3d& model) const;
+    size_t score(const Eigen::Matrix3d& model, std::vector<uint8_t>& modelMask,
+                 bool sprt, bool& rejected);
+    size_t scoreScalar(const float* model, size_t begin, size_t end, uint8_t* modelMask) const;
+#if defined(GEOMETRIC_VERIFIER_AVX2)
+    size_t scoreAvx2(const float* model, size_t begin, size_t end, uint8_t* modelMask) const;
+#endif
+    size_t refine(Eigen::Matrix3d& model, size_t numInliers);
+    void drawSample(size_t poolSize, bool includeLast, uint32_t* sample);
+    void updateSprt(double inlierRatio);
+
+    Options options;
+    bool useAvx2 = false;
+    std::mt19937 random;
+
+    // Normalized coordinates in confidence order, padded with NaN to a
+    // multiple of the SIMD width
+    size_t numPoints = 0;
+    std::vector<float> x1, y1, x2, y2;
+    std::vector<uint32_t> order;   /**< Buffer position to match index */
+    float threshold = 0.0f;        /**< maxError in normalized units */
+
+    std::vector<uint8_t> mask;
+    std::vector<uint8_t> bestMask;
+    std::vector<uint32_t> inlierIndices;
+    int numIterations = 0;
+
+    // SPRT: delta is the fraction of matches consistent with a wrong model,
+    // estimated from the models rejected for the current pair
+    double delta = 0.05;
+    double epsilon = 0.1;
+    double logInlierRatio = 0.0;
+    double logOutlierRatio = 0.0;
+    double logDecisionThreshold = 0.0;
+    size_t numEvaluated = 0;
+};
@@ -0,0 +1,237 @@
+#include "guided_matcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// COLMAP scales SIFT descriptors to an L2 norm of 512 before rounding to bytes
+constexpr double kDescriptorNormSquared = 512.0 * 512.0;
+
+int descriptorDot(const uint8_t* a, const uint8_t* b, int length) {
+    int dot = 0;
+    for (int k = 0; k < length; ++k) {
+        dot += static_cast<int>(a[k]) * static_cast<int>(b[k]);
+    }
+    return dot;
+}
+
+double descriptorAngle(int dot) {
+    return std::acos(std::min(1.0, dot / kDescriptorNormSquared));
+}
+
+// Clip the segment a-b to a rectangle (Liang-Barsky); false if it lies outside
+bool clipSegment(Eigen::Vector2d& a, Eigen::Vector2d& b, double minX, double minY,
+                 double maxX, double maxY) {
+    const Eigen::Vector2d d = b - a;
+    double t0 = 0.0;
+    double t1 = 1.0;
+    const double p[4] = {-d.x(), d.x(), -d.y(), d.y()};
+    const double q[4] = {a.x() - minX, maxX - a.x(), a.y() - minY, maxY - a.y()};
+    for (int k = 0; k < 4; ++k) {
+        if (p[k] == 0.0) {
+            if (q[k] < 0.0) {
+                return false;
+            }
+            continue;
+        }
+        const double t = q[k] / p[k];
+        if (p[k] < 0.0) {
+            t0 = std::max(t0, t);
+        } else {
+            t1 = std::min(t1, t);
+        }
+    }
+    if (t0 > t1) {
+        return false;
+    }
+    const Eigen::Vector2d start = a + t0 * d;
+    b = a + t1 * d;
+    a = start;
+    return true;
+}
+
+double segmentDistance(const Eigen::Vector2d& point, const Eigen::Vector2d& a,
+                       const Eigen::Vector2d& b) {
+    const Eigen::Vector2d d = b - a;
+    const double lengthSquared = d.squaredNorm();
+    const double t = lengthSquared > 0.0 ? std::clamp((point - a).dot(d) / lengthSquared, 0.0, 1.0) : 0.0;
+    return (point - (a + t * d)).norm();
+}
+
+} // namespace
+
+GuidedMatcher::GuidedMatcher(const Options& options) : options(options) {
+}
+
+bool GuidedMatcher::makeView(const colmap::Reconstruction& reconstruction, colmap::image_t imageId,
+                             View& view) {
+    const colmap::Image& image = reconstruction.Image(imageId);
+    const colmap::Camera& camera = reconstruction.Camera(image.CameraId());
+    std::vector<double> depths;
+    for (const auto& point2D : image.Points2D()) {
+        if (point2D.HasPoint3D()) {
+            const double depth =
+                (image.CamFromWorld() * reconstruction.Point3D(point2D.point3D_id).xyz).z();
+            if (depth > 0.0) {
+                depths.push_back(depth);
+            }
+        }
+    }
+    if (depths.empty()) {
+        return false;
+    }
+    std::sort(depths.begin(), depths.end());
+    view.K = camera.CalibrationMatrix();
+    view.camFromWorld = image.CamFromWorld().ToMatrix();
+    view.minDepth = 0.5 * depths[depths.size() * 2 / 100];
+    view.maxDepth = 2.0 * depths[std::min(depths.size() - 1, depths.size() * 98 / 100)];
+    view.width = static_cast<int>(camera.width);
+    view.height = static_cast<int>(camera.height);
+    return true;
+}
+
+void GuidedMatcher::buildGrid(const View& view, const colmap::FeatureKeypoints& keypoints) {
+    gridWidth = std::max(1, (view.width + options.cellSize - 1) / options.cellSize);
+    gridHeight = std::max(1, (view.height + options.cellSize - 1) / options.cellSize);
+    const auto cellOf = [&](const colmap::FeatureKeypoint& keypoint) {
+        const int x = std::clamp(static_cast<int>(keypoint.x) / options.cellSize, 0, gridWidth - 1);
+        const int y = std::clamp(static_cast<int>(keypoint.y) / options.cellSize, 0, gridHeight - 1);
+        return y * gridWidth + x;
+    };
+
+    // Counting sort of the keypoints into their cells
+    cellStart.assign(static_cast<size_t>(gridWidth) * gridHeight + 1, 0);
+    for (const auto& keypoint : keypoints) {
+        cellStart[cellOf(keypoint) + 1] += 1;
+    }
+    for (size_t c = 1; c < cellStart.size(); ++c) {
+        cellStart[c] += cellStart[c - 1];
+    }
+    cellKeypoints.resize(keypoints.size());
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (size_t j = 0; j < keypoints.size(); ++j) {
+        cellKeypoints[fill[cellOf(keypoints[j])]++] = static_cast<uint32_t>(j);
+    }
+    visitedCell.assign(static_cast<size_t>(gridWidth) * gridHeight, -1);
+}
+
+void GuidedMatcher::match(const View& view1, const colmap::FeatureKeypoints& keypoints1,
+                          const colmap::FeatureDescriptors& descriptors1,
+                          const View& view2, const colmap::FeatureKeypoints& keypoints2,
+                          const colmap::FeatureDescriptors& descriptors2,
+                          colmap::FeatureMatches& matches, std::vector<float>& scores) {
+    matches.clear();
+    scores.clear();
+    if (keypoints1.empty() || keypoints2.empty()) {
+        return;
+    }
+    buildGrid(view2, keypoints2);
+    bestSimilarity.assign(keypoints2.size(), -1);
+    bestMatch.assign(keypoints2.size(), std::numeric_limits<uint32_t>::max());
+    bestScore.assign(keypoints2.size(), 0.0f);
+
+    // Rays of the first view in world coordinates, X(d) = center + d * direction
+    const Eigen::Matrix3d rotation1 = view1.camFromWorld.leftCols<3>();
+    const Eigen::Vector3d center1 = -rotation1.transpose() * view1.camFromWorld.col(3);
+    const Eigen::Matrix3d rayFromPixel = rotation1.transpose() * view1.K.inverse();
+    const Eigen::Matrix<double, 3, 4> projection2 = view2.K * view2.camFromWorld;
+    const Eigen::Vector3d centerImage2 = projection2.leftCols<3>() * center1 + projection2.col(3);
+
+    const int length = static_cast<int>(descriptors1.cols());
+    const double step = 0.5 * options.cellSize;
+    const double margin = options.maxEpipolarError;
+    const double minDot = std::cos(options.maxDistance) * kDescriptorNormSquared;
+
+    for (size_t i = 0; i < keypoints1.size(); ++i) {
+        const Eigen::Vector3d direction = rayFromPixel * Eigen::Vector3d(keypoints1[i].x, keypoints1[i].y, 1.0);
+        const Eigen::Vector3d directionImage2 = projection2.leftCols<3>() * direction;
+
+        // Keep the part of the ray in front of the second camera
+        double minDepth = view1.minDepth;
+        double maxDepth = view1.maxDepth;
+        constexpr double kMinZ = 1e-6;
+        if (std::abs(directionImage2.z()) > 0.0) {
+            const double limit = (kMinZ - centerImage2.z()) / directionImage2.z();
+            if (directionImage2.z() > 0.0) {
+                minDepth = std::max(minDepth, limit);
+            } else {
+                maxDepth = std::min(maxDepth, limit);
+            }
+        } else if (centerImage2.z() <= kMinZ) {
+            continue;
+        }
+        if (minDepth >= maxDepth) {
+            continue;
+        }
+
+        const Eigen::Vector3d nearPoint = centerImage2 + minDepth * directionImage2;
+        const Eigen::Vector3d farPoint = centerImage2 + maxDepth * directionImage2;
+        Eigen::Vector2d a = nearPoint.hnormalized();
+        Eigen::Vector2d b = farPoint.hnormalized();
+        if (!clipSegment(a, b, -margin, -margin, view2.width + margin, view2.height + margin)) {
+            continue;
+        }
+
+        const uint8_t* descriptor1 = descriptors1.data() + i * length;
+        int best = -1;
+        int secondBest = -1;
+        uint32_t bestIndex = 0;
+        const int numSteps = static_cast<int>(std::ceil((b - a).norm() / step)) + 1;
+        for (int s = 0; s < numSteps; ++s) {
+            const Eigen::Vector2d sample = numSteps > 1 ? a + (b - a) * (static_cast<double>(s) / (numSteps - 1)) : a;
+            const int cx = static_cast<int>(std::floor(sample.x() / options.cellSize));
+            const int cy = static_cast<int>(std::floor(sample.y() / options.cellSize));
+            for (int y = std::max(0, cy - 1); y <= std::min(gridHeight - 1, cy + 1); ++y) {
+                for (int x = std::max(0, cx - 1); x <= std::min(gridWidth - 1, cx + 1); ++x) {
+                    const int cell = y * gridWidth + x;
+                    if (visitedCell[cell] == static_cast<int>(i)) {
+                        continue;
+                    }
+                    visitedCell[cell] = static_cast<int>(i);
+                    for (uint32_t k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+                        const uint32_t j = cellKeypoints[k];
+                        const Eigen::Vector2d point(keypoints2[j].x, keypoints2[j].y);
+                        if (segmentDistance(point, a, b) > options.maxEpipolarError) {
+                            continue;
+                        }
+                        const int dot = descriptorDot(descriptor1, descriptors2.data() + j * length, length);
+                        if (dot > best) {
+                            secondBest = best;
+                            best = dot;
+                            bestIndex = j;
+                        } else if (dot > secondBest) {
+                            secondBest = dot;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (best < minDot) {
+            continue;
+        }
+        float score = 1.0f;
+        if (secondBest >= 0) {
+            const double bestAngle = descriptorAngle(best);
+            const double secondAngle = descriptorAngle(secondBest);
+            if (bestAngle >= options.maxRatio * secondAngle) {
+                continue;
+            }
+            score = static_cast<float>(1.0 - bestAngle / secondAngle);
+        }
+        if (best > bestSimilarity[bestIndex]) {
+            bestSimilarity[bestIndex] = best;
+            bestMatch[bestIndex] = static_cast<uint32_t>(i);
+            bestScore[bestIndex] = score;
+        }
+    }
+
+    for (size_t j = 0; j < keypoints2.size(); ++j) {
+        if (bestMatch[j] != std::numeric_limits<uint32_t>::max()) {
+            matches.emplace_back(bestMatch[j], static_cast<colmap::point2D_t>(j));
+            scores.push_back(bestScore[j]);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+/**
+ * @file guided_matcher.h
+ * @brief Descriptor matching restricted by known camera poses
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+#include <colmap/feature/types.h>
+#include <colmap/scene/reconstruction.h>
+
+/**
+ * @class GuidedMatcher
+ * @brief Matches SIFT features of two posed images along their epipolar segments
+ *
+ * For every keypoint of the first image, the viewing ray between the
+ * near and far depth of the scene seen by that image is projected into
+ * the second image. Only keypoints within maxEpipolarError pixels of
+ * that segment are compared, found through a grid over the second image.
+ * Candidates pass COLMAP's descriptor distance and ratio tests, and each
+ * keypoint of the second image keeps only its best match. The margin by
+ * which a match passed the ratio test is returned as its confidence.
+ *
+ * The search cost follows the length of the segments instead of the
+ * keypoint count, so full resolution features of a posed model can be
+ * matched far faster than by exhaustive matching. Buffers are kept
+ * between pairs; use one instance per worker.
+ */
+class GuidedMatcher {
+public:
+    /**
+     * @struct Options
+     * @brief Search band and descriptor tests
+     */
+    struct Options {
+        double maxEpipolarError = 4.0; /**< Distance to the epipolar segment in pixels */
+        double maxRatio = 0.8;         /**< Best to second best descriptor distance */
+        double maxDistance = 0.7;      /**< Descriptor angle of a match */
+        int cellSize = 32;             /**< Grid cell of the second image in pixels */
+    };
+
+    /**
+     * @struct View
+     * @brief Pose, intrinsics and depth range of an image
+     */
+    struct View {
+        Eigen::Matrix3d K;
+        Eigen::Matrix<double, 3, 4> camFromWorld;
+        double minDepth = 0.0;
+        double maxDepth = 0.0;
+        int width = 0;
+        int height = 0;
+    };
+
+    /**
+     * @brief Construct a matcher
+     * @param options Search band and descriptor tests
+     */
+    explicit GuidedMatcher(const Options& options);
+
+    /**
+     * @brief Describe a registered image of a model
+     *
+     * The depth range spans the 2nd to 98th percentile of the depths of the
+     * model points the image sees, widened by a factor of two.
+     *
+     * @param reconstruction The model
+     * @param imageId A registered image
+     * @param view Receives the view
+     * @return false if the image sees no model points
+     */
+    static bool makeView(const colmap::Reconstruction& reconstruction, colmap::image_t imageId,
+                         View& view);
+
+    /**
+     * @brief Match the features of two views
+     * @param view1 First view
+     * @param keypoints1 Keypoints of the first view
+     * @param descriptors1 Descriptors of the first view
+     * @param view2 Second view
+     * @param keypoints2 Keypoints of the second view
+     * @param descriptors2 Descriptors of the second view
+     * @param matches Receives the matches
+     * @param scores Receives per match 1 - (best / second best descriptor
+     *        angle), 1 if the match had no competitor
+     */
+    void match(const View& view1, const colmap::FeatureKeypoints& keypoints1,
+               const colmap::FeatureDescriptors& descriptors1,
+               const View& view2, const colmap::FeatureKeypoints& keypoints2,
+               const colmap::FeatureDescriptors& descriptors2,
+               colmap::FeatureMatches& matches, std::vector<float>& scores);
+
+private:
+    void buildGrid(const View& view, const colmap::FeatureKeypoints& keypoints);
+
+    Options options;
+    int gridWidth = 0;
+    int gridHeight = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cellKeypoints;
+    std::vector<int> bestSimilarity;
+    std::vector<uint32_t> bestMatch;
+    std::vector<float> bestScore;
+    std::vector<int> visitedCell;
+};
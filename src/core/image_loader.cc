@@ -0,0 +1,241 @@
+#include "image_loader.h"
+#include "image_metadata.h"
+#include "logger.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <colmap/sensor/bitmap.h>
+
+namespace {
+
+// Read the EXIF focal length through colmap::Bitmap, as COLMAP's image reader
+// does, loading only the header and metadata of the JPEG
+bool readExifFocalLength(const std::string& path, double& focalLength) {
+    FIBITMAP* header = FreeImage_Load(FIF_JPEG, path.c_str(), JPEG_DEFAULT | FIF_LOAD_NOPIXELS);
+    if (header == nullptr) {
+        return false;
+    }
+    // colmap::Bitmap converts other layouts (CMYK), which needs pixels
+    const unsigned bitsPerPixel = FreeImage_GetBPP(header);
+    if (bitsPerPixel != 8 && bitsPerPixel != 24) {
+        FreeImage_Unload(header);
+        return false;
+    }
+    const colmap::Bitmap bitmap(header);
+    return bitmap.ExifFocalLength(&focalLength);
+}
+
+// Ask the kernel to start reading a file into the page cache
+void adviseWillNeed(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+#if defined(__linux__)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(__APPLE__)
+    radvisory advisory{};
+    advisory.ra_offset = 0;
+    advisory.ra_count = static_cast<int>(std::min<off_t>(lseek(fd, 0, SEEK_END), INT32_MAX));
+    fcntl(fd, F_RDADVISE, &advisory);
+#endif
+    close(fd);
+}
+
+// Wait for a condition, running queued scheduler tasks meanwhile when called
+// from a worker so that queued decodes cannot wait for the waiting worker
+template <typename Predicate>
+void waitFor(std::unique_lock<std::mutex>& lock, std::condition_variable& condition,
+             Predicate predicate) {
+    if (TaskScheduler::getCurrentWorkerIndex() < 0) {
+        condition.wait(lock, predicate);
+        return;
+    }
+    while (!predicate()) {
+        lock.unlock();
+        if (!TaskScheduler::getInstance().runPendingTask()) {
+            std::this_thread::yield();
+        }
+        lock.lock();
+    }
+}
+
+} // namespace
+
+ImageLoader::ImageLoader(const std::string& root, const std::vector<std::string>& names,
+                         const Options& options)
+    : root(root),
+      names(names),
+      options(options),
+      states(names.size(), State::IDLE),
+      images(names.size()),
+      results(names.size(), false),
+      advised(names.size(), false) {}
+
+ImageLoader::~ImageLoader() {
+    std::unique_lock<std::mutex> lock(mutex);
+    queue.clear();
+    waitFor(lock, decoded, [this] { return inFlight == 0; });
+}
+
+void ImageLoader::skip(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (states[index] == State::IDLE || states[index] == State::QUEUED) {
+        states[index] = State::SKIPPED;
+    }
+}
+
+bool ImageLoader::load(size_t index, Image& image) {
+    prefetch(index);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (states[index] == State::DECODING) {
+        waitFor(lock, decoded, [&] { return states[index] != State::DECODING; });
+    }
+    if (states[index] == State::READY) {
+        states[index] = State::DONE;
+        image = std::move(images[index]);
+        return results[index];
+    }
+
+    // Not prefetched (first image, random access, a skipped or deferred
+    // image): decode here
+    states[index] = State::DONE;
+    lock.unlock();
+    return decode(root + "/" + names[index], options.maxImageSize, options.color, image);
+}
+
+bool ImageLoader::decode(const std::string& path, int maxImageSize, bool color, Image& image) {
+    return decode(path, maxImageSize, color, true, image) == DecodeStatus::DECODED;
+}
+
+ImageLoader::DecodeStatus ImageLoader::decode(const std::string& path, int maxImageSize,
+                                              bool color, bool wait, Image& image) {
+    // Waiting for the budget is fine on the consumer's thread, a prefetch
+    // only proceeds if the frame fits now
+    const auto reserve = [&](size_t bytes) {
+        if (wait) {
+            image.reservation = MemoryReservation(MemoryBudget::Category::FRAMES, bytes);
+            return true;
+        }
+        return image.reservation.tryReserve(MemoryBudget::Category::FRAMES, bytes);
+    };
+
+    ImageMetadata metadata;
+    const bool isJpeg = ImageMetadata::readJpeg(path, metadata);
+
+    // DCT scaling keeps the decoded image at least maxImageSize large, the
+    // consumer resamples the rest of the way
+    int decodeScale = 1;
+    if (isJpeg && maxImageSize > 0) {
+        const int maxSize = std::max(metadata.width, metadata.height);
+        while (decodeScale < 8 && maxSize / (decodeScale * 2) >= maxImageSize) {
+            decodeScale *= 2;
+        }
+    }
+
+    int flags = color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+    switch (decodeScale) {
+        case 2: flags = color ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_REDUCED_GRAYSCALE_2; break;
+        case 4: flags = color ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_GRAYSCALE_4; break;
+        case 8: flags = color ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_REDUCED_GRAYSCALE_8; break;
+        default: break;
+    }
+    if (isJpeg) {
+        const size_t reducedWidth = (metadata.width + decodeScale - 1) / decodeScale;
+        const size_t reducedHeight = (metadata.height + decodeScale - 1) / decodeScale;
+        if (!reserve(reducedWidth * reducedHeight * (color ? 3 : 1))) {
+            return DecodeStatus::DEFERRED;
+        }
+    }
+
+    image.pixels = cv::imread(path, flags | cv::IMREAD_IGNORE_ORIENTATION);
+    if (image.pixels.empty()) {
+        image.reservation.reset();
+        return DecodeStatus::FAILED;
+    }
+    if (!isJpeg) {
+        // The size is only known after decoding
+        metadata.width = image.pixels.cols;
+        metadata.height = image.pixels.rows;
+        if (!reserve(image.pixels.total() * image.pixels.elemSize())) {
+            image.pixels.release();
+            return DecodeStatus::DEFERRED;
+        }
+    }
+
+    image.width = metadata.width;
+    image.height = metadata.height;
+    image.decodeScale = decodeScale;
+    image.hasFocalLength = isJpeg && readExifFocalLength(path, image.focalLength);
+    return DecodeStatus::DECODED;
+}
+
+void ImageLoader::prefetch(size_t index) {
+    const size_t adviseEnd = std::min(names.size(), index + 1 + 2 * options.readAhead);
+    const size_t decodeEnd = std::min(names.size(), index + 1 + options.readAhead);
+
+    std::vector<size_t> toAdvise;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = index + 1; i < adviseEnd; ++i) {
+            if (!advised[i] && states[i] != State::SKIPPED) {
+                advised[i] = true;
+                toAdvise.push_back(i);
+            }
+        }
+        for (size_t i = index + 1; i < decodeEnd; ++i) {
+            if (states[i] == State::IDLE) {
+                states[i] = State::QUEUED;
+                queue.push_back(i);
+            }
+        }
+        schedule();
+    }
+
+    for (const size_t i : toAdvise) {
+        adviseWillNeed(root + "/" + names[i]);
+    }
+}
+
+void ImageLoader::schedule() {
+    while (inFlight < std::max(1, options.decodeThreads) && !queue.empty()) {
+        const size_t index = queue.front();
+        queue.pop_front();
+        if (states[index] != State::QUEUED) {
+            continue;
+        }
+        states[index] = State::DECODING;
+        ++inFlight;
+        TaskScheduler::getInstance().submit([this, index] { decodeTask(index); },
+                                            TaskScheduler::Priority::HIGH);
+    }
+}
+
+void ImageLoader::decodeTask(size_t index) {
+    // Decode tasks run at high priority, so they must not hold a worker
+    // waiting for memory: over the budget the image is left to load()
+    Image image;
+    const DecodeStatus status = decode(root + "/" + names[index], options.maxImageSize,
+                                       options.color, false, image);
+    if (status == DecodeStatus::FAILED) {
+        LOG_WARNING("Failed to decode image: %s", names[index].c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (status == DecodeStatus::DEFERRED) {
+        states[index] = State::DEFERRED;
+    } else {
+        images[index] = std::move(image);
+        results[index] = status == DecodeStatus::DECODED;
+        states[index] = State::READY;
+    }
+    --inFlight;
+    schedule();
+    decoded.notify_all();
+}
@@ -0,0 +1,125 @@
+/**
+ * @file image_loader.h
+ * @brief Read-ahead image loading with reduced-resolution JPEG decoding
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "memory_budget.h"
+
+/**
+ * @class ImageLoader
+ * @brief Decodes the images of a folder ahead of the extraction stage
+ *
+ * Every load(i) hints the kernel to read the files of the next images
+ * (posix_fadvise / F_RDADVISE) and queues decoding of the following
+ * readAhead images as tasks on the TaskScheduler, with at most
+ * decodeThreads decodes in flight. Several consumers walking different
+ * parts of the list each get their own read-ahead. A prefetch that does not
+ * fit the memory budget is not retried; load() decodes that image itself.
+ *
+ * Images are decoded as 8-bit grayscale (or BGR when a detector needs
+ * color) without applying the EXIF orientation, like colmap::Bitmap. When the extraction works at a lower
+ * resolution than the source, JPEGs are decoded at 1/2, 1/4 or 1/8 scale
+ * through libjpeg DCT scaling (cv::IMREAD_REDUCED_*), choosing the
+ * strongest reduction that keeps the image at least maxImageSize large.
+ * The original size comes from the JPEG header and the EXIF focal length
+ * from colmap::Bitmap, so they do not depend on the decode scale.
+ */
+class ImageLoader {
+public:
+    /**
+     * @struct Options
+     * @brief Read-ahead and decode settings
+     */
+    struct Options {
+        size_t readAhead = 8;   /**< Images decoded ahead of the last requested one */
+        int decodeThreads = 2;  /**< Decodes in flight on the task scheduler */
+        int maxImageSize = 0;   /**< Size the consumer works at, 0 to always decode fully */
+        bool color = false;     /**< Decode BGR instead of grayscale */
+    };
+
+    /**
+     * @struct Image
+     * @brief A decoded image and its source metadata
+     */
+    struct Image {
+        cv::Mat pixels;              /**< Grayscale or BGR pixels, possibly reduced */
+        int width = 0;               /**< Width of the source image */
+        int height = 0;              /**< Height of the source image */
+        int decodeScale = 1;         /**< Source size divided by the decoded size */
+        bool hasFocalLength = false; /**< Whether the EXIF data gave a focal length */
+        double focalLength = 0.0;    /**< Focal length in source pixels */
+        MemoryReservation reservation;
+    };
+
+    /**
+     * @brief Construct a loader for a list of images
+     * @param root Image folder
+     * @param names Image names relative to the folder
+     * @param options Read-ahead and decode settings
+     */
+    ImageLoader(const std::string& root, const std::vector<std::string>& names,
+                const Options& options);
+
+    /**
+     * @brief Wait for prefetched decodes to finish
+     */
+    ~ImageLoader();
+
+    /**
+     * @brief Exclude an image from read-ahead, e.g. because it was processed before
+     * @param index Index into the name list
+     */
+    void skip(size_t index);
+
+    /**
+     * @brief Get a decoded image, decoding it now if it was not prefetched
+     * @param index Index into the name list
+     * @param image Receives the image
+     * @return true if the image was decoded
+     */
+    bool load(size_t index, Image& image);
+
+    /**
+     * @brief Decode one image
+     * @param path Image file
+     * @param maxImageSize Size the consumer works at, 0 to decode fully
+     * @param color Decode BGR instead of grayscale
+     * @param image Receives the image
+     * @return true if the image was decoded
+     */
+    static bool decode(const std::string& path, int maxImageSize, bool color, Image& image);
+
+private:
+    enum class State { IDLE, SKIPPED, QUEUED, DECODING, DEFERRED, READY, DONE };
+    enum class DecodeStatus { DECODED, FAILED, DEFERRED };
+
+    static DecodeStatus decode(const std::string& path, int maxImageSize, bool color,
+                               bool wait, Image& image);
+    void prefetch(size_t index);
+    void schedule();
+    void decodeTask(size_t index);
+
+    std::string root;
+    std::vector<std::string> names;
+    Options options;
+
+    std::mutex mutex;
+    std::condition_variable decoded;
+    std::vector<State> states;
+    std::vector<Image> images;
+    std::vector<bool> results;
+    std::vector<bool> advised;
+    std::deque<size_t> queue;
+    int inFlight = 0;
+};
@@ -0,0 +1,231 @@
+#include "image_metadata.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// Byte-order aware reads from a TIFF block, returning 0 outside the block
+class TiffReader {
+public:
+    TiffReader(const uint8_t* data, size_t size)
+        : data(data), size(size), littleEndian(size >= 2 && data[0] == 'I' && data[1] == 'I') {}
+
+    bool isValid() const {
+        return size >= 8 && (littleEndian || (data[0] == 'M' && data[1] == 'M'));
+    }
+
+    uint8_t byte(size_t offset) const {
+        return offset < size ? data[offset] : 0;
+    }
+
+    uint32_t u16(size_t offset) const {
+        if (offset + 2 > size) {
+            return 0;
+        }
+        return littleEndian ? data[offset] | (data[offset + 1] << 8)
+                            : (data[offset] << 8) | data[offset + 1];
+    }
+
+    uint32_t u32(size_t offset) const {
+        if (offset + 4 > size) {
+            return 0;
+        }
+        const uint32_t low = u16(offset + (littleEndian ? 0 : 2));
+        const uint32_t high = u16(offset + (littleEndian ? 2 : 0));
+        return (high << 16) | low;
+    }
+
+    double rational(size_t offset) const {
+        const uint32_t numerator = u32(offset);
+        const uint32_t denominator = u32(offset + 4);
+        return denominator == 0 ? 0.0 : static_cast<double>(numerator) / denominator;
+    }
+
+    // Value of an entry with count elements of elementSize bytes: stored in
+    // the entry itself when it fits in four bytes, elsewhere otherwise
+    size_t valueOffset(size_t entry, size_t elementSize) const {
+        return u32(entry + 4) * elementSize <= 4 ? entry + 8 : u32(entry + 8);
+    }
+
+    std::string ascii(size_t entry) const {
+        const size_t count = u32(entry + 4);
+        const size_t offset = valueOffset(entry, 1);
+        if (offset + count > size) {
+            return "";
+        }
+        const char* text = reinterpret_cast<const char*>(data + offset);
+        return std::string(text, strnlen(text, count));
+    }
+
+    // Call fn(tag, entryOffset) for every entry of the IFD at offset
+    template <typename Fn>
+    void walk(size_t offset, Fn fn) const {
+        if (offset == 0 || offset + 2 > size) {
+            return;
+        }
+        const uint32_t numEntries = u16(offset);
+        for (uint32_t i = 0; i < numEntries; ++i) {
+            const size_t entry = offset + 2 + 12 * static_cast<size_t>(i);
+            if (entry + 12 > size) {
+                break;
+            }
+            fn(u16(entry), entry);
+        }
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    bool littleEndian;
+};
+
+// Degrees from a GPS coordinate stored as degrees, minutes and seconds
+double readDegrees(const TiffReader& tiff, size_t entry) {
+    const size_t offset = tiff.valueOffset(entry, 8);
+    return tiff.rational(offset) + tiff.rational(offset + 8) / 60.0 +
+           tiff.rational(offset + 16) / 3600.0;
+}
+
+// Seconds since 1970-01-01 of an EXIF "YYYY:MM:DD HH:MM:SS" time
+bool parseDateTime(const std::string& text, double& seconds) {
+    int year, month, day, hour, minute, second;
+    if (std::sscanf(text.c_str(), "%d:%d:%d %d:%d:%d",
+                    &year, &month, &day, &hour, &minute, &second) != 6 ||
+        year <= 0 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return false;
+    }
+    // Days from civil date (proleptic Gregorian calendar)
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = year - era * 400;
+    const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    const double days = era * 146097.0 + dayOfEra - 719468.0;
+    seconds = days * 86400.0 + hour * 3600.0 + minute * 60.0 + second;
+    return true;
+}
+
+// Pick the GPS and capture time tags out of an APP1 segment
+void parseExif(const std::vector<uint8_t>& segment, ImageMetadata& metadata) {
+    if (segment.size() < 14 || std::memcmp(segment.data(), "Exif\0\0", 6) != 0) {
+        return;
+    }
+    const TiffReader tiff(segment.data() + 6, segment.size() - 6);
+    if (!tiff.isValid()) {
+        return;
+    }
+
+    size_t exifIfd = 0;
+    size_t gpsIfd = 0;
+    tiff.walk(tiff.u32(4), [&](uint32_t tag, size_t entry) {
+        if (tag == 0x8769) {
+            exifIfd = tiff.u32(entry + 8);
+        } else if (tag == 0x8825) {
+            gpsIfd = tiff.u32(entry + 8);
+        }
+    });
+
+    std::string dateTime;
+    std::string subSeconds;
+    tiff.walk(exifIfd, [&](uint32_t tag, size_t entry) {
+        switch (tag) {
+            case 0x9003: dateTime = tiff.ascii(entry); break;
+            case 0x9291: subSeconds = tiff.ascii(entry); break;
+            default: break;
+        }
+    });
+    if (parseDateTime(dateTime, metadata.timestamp)) {
+        metadata.hasTimestamp = true;
+        if (!subSeconds.empty() && std::all_of(subSeconds.begin(), subSeconds.end(),
+                                                 [](unsigned char c) { return std::isdigit(c); })) {
+            metadata.timestamp += std::stod("0." + subSeconds);
+        }
+    }
+
+    char latitudeRef = 0;
+    char longitudeRef = 0;
+    bool hasLatitude = false;
+    bool hasLongitude = false;
+    bool belowSeaLevel = false;
+    tiff.walk(gpsIfd, [&](uint32_t tag, size_t entry) {
+        switch (tag) {
+            case 1: latitudeRef = static_cast<char>(tiff.byte(entry + 8)); break;
+            case 2: metadata.latitude = readDegrees(tiff, entry); hasLatitude = true; break;
+            case 3: longitudeRef = static_cast<char>(tiff.byte(entry + 8)); break;
+            case 4: metadata.longitude = readDegrees(tiff, entry); hasLongitude = true; break;
+            case 5: belowSeaLevel = tiff.byte(entry + 8) == 1; break;
+            case 6: metadata.altitude = tiff.rational(tiff.valueOffset(entry, 8)); break;
+            default: break;
+        }
+    });
+    metadata.hasGps = hasLatitude && hasLongitude;
+    if (latitudeRef == 'S') {
+        metadata.latitude = -metadata.latitude;
+    }
+    if (longitudeRef == 'W') {
+        metadata.longitude = -metadata.longitude;
+    }
+    if (belowSeaLevel) {
+        metadata.altitude = -metadata.altitude;
+    }
+}
+
+} // namespace
+
+bool ImageMetadata::readJpeg(const std::string& path, ImageMetadata& metadata) {
+    std::ifstream file(path, std::ios::binary);
+    if (file.get() != 0xFF || file.get() != 0xD8) {
+        return false;
+    }
+
+    while (file) {
+        if (file.get() != 0xFF) {
+            return false;
+        }
+        int marker = file.get();
+        while (marker == 0xFF) {
+            marker = file.get();
+        }
+        if (marker == EOF || marker == 0xD9 || marker == 0xDA) {
+            return false;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            continue;
+        }
+
+        const int lengthHigh = file.get();
+        const int lengthLow = file.get();
+        const int length = (lengthHigh << 8) | lengthLow;
+        if (!file || length < 2) {
+            return false;
+        }
+
+        const bool isFrameHeader = marker >= 0xC0 && marker <= 0xCF &&
+                                   marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (isFrameHeader) {
+            uint8_t frame[5];
+            if (!file.read(reinterpret_cast<char*>(frame), sizeof(frame))) {
+                return false;
+            }
+            metadata.height = (frame[1] << 8) | frame[2];
+            metadata.width = (frame[3] << 8) | frame[4];
+            return metadata.width > 0 && metadata.height > 0;
+        }
+        if (marker == 0xE1) {
+            std::vector<uint8_t> segment(length - 2);
+            if (!file.read(reinterpret_cast<char*>(segment.data()), segment.size())) {
+                return false;
+            }
+            parseExif(segment, metadata);
+        } else {
+            file.seekg(length - 2, std::ios::cur);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file image_metadata.h
+ * @brief Image size, GPS position and capture time read from JPEG headers
+ */
+
+#pragma once
+
+#include <string>
+
+/**
+ * @struct ImageMetadata
+ * @brief Metadata available from a JPEG file without decoding its pixels
+ *
+ * Only the markers before the first scan are read: the APP1 EXIF segment
+ * and the frame header.
+ */
+struct ImageMetadata {
+    int width = 0;                      /**< Width from the frame header */
+    int height = 0;                     /**< Height from the frame header */
+
+    bool hasGps = false;                /**< Whether latitude and longitude are set */
+    double latitude = 0.0;              /**< Degrees, north positive */
+    double longitude = 0.0;             /**< Degrees, east positive */
+    double altitude = 0.0;              /**< Meters above sea level, 0 if not recorded */
+
+    bool hasTimestamp = false;          /**< Whether DateTimeOriginal is set */
+    double timestamp = 0.0;             /**< Capture time in seconds, no time zone applied */
+
+    /**
+     * @brief Read the metadata of a JPEG file
+     * @param path Image file
+     * @param metadata Receives the metadata
+     * @return true if the file is a JPEG with a valid frame header
+     */
+    static bool readJpeg(const std::string& path, ImageMetadata& metadata);
+};
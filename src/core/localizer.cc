@@ -0,0 +1,336 @@
+#include "localizer.h"
+#include "logger.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <colmap/estimators/pose.h>
+#include <colmap/feature/sift.h>
+#include <colmap/sensor/bitmap.h>
+
+namespace {
+
+// COLMAP scales SIFT descriptors to an L2 norm of 512 before rounding to bytes
+constexpr double kDescriptorNormSquared = 512.0 * 512.0;
+
+constexpr uint32_t kNoMatch = std::numeric_limits<uint32_t>::max();
+
+// Image size and feature count of each quality level, relative to the best
+constexpr double kLevelScales[] = {1.0, 0.8, 0.64, 0.5};
+
+// Frames in a row under this share of the budget before the quality goes back up
+constexpr double kFastShare = 0.6;
+constexpr int kNumFastFrames = 30;
+
+// Stages dropped when less than this share of the budget is left
+constexpr double kGlobalSearchShare = 0.4;
+constexpr double kRefinementShare = 0.15;
+
+// RANSAC trials per frame; tracked frames have few outliers
+constexpr int kMaxNumTrials = 1000;
+
+int descriptorDot(const uint8_t* a, const uint8_t* b) {
+    int dot = 0;
+    for (int k = 0; k < MapIndex::kDescriptorSize; ++k) {
+        dot += static_cast<int>(a[k]) * static_cast<int>(b[k]);
+    }
+    return dot;
+}
+
+double descriptorAngle(int dot) {
+    return std::acos(std::min(1.0, dot / kDescriptorNormSquared));
+}
+
+} // namespace
+
+Localizer::Localizer(const MapIndex& map, const Options& options) : map(map), options(options) {
+    for (int l = 0; l < kNumLevels; ++l) {
+        colmap::SiftExtractionOptions sift;
+        sift.use_gpu = false;
+        sift.max_image_size = std::max(1, static_cast<int>(options.maxImageSize * kLevelScales[l]));
+        sift.max_num_features = std::max(1, static_cast<int>(options.maxNumFeatures * kLevelScales[l]));
+        // Skip the upsampled octave: four times the pixels for features finer than tracking needs
+        sift.first_octave = 0;
+        extractors[l] = colmap::CreateSiftFeatureExtractor(sift);
+    }
+}
+
+double Localizer::elapsedMs(Clock::time_point start) const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void Localizer::setCamera(int width, int height) {
+    const auto& cameras = map.getReconstruction().Cameras();
+    if (cameras.size() == 1) {
+        camera = cameras.begin()->second;
+        if (camera.width != static_cast<size_t>(width) || camera.height != static_cast<size_t>(height)) {
+            camera.Rescale(width, height);
+        }
+        LOG_INFO("Localizing %dx%d frames with the %s camera of the map", width, height,
+                 camera.ModelName().c_str());
+    } else {
+        camera = colmap::Camera::CreateFromModelName(colmap::kInvalidCameraId, "SIMPLE_RADIAL",
+                                                     1.2 * std::max(width, height), width, height);
+        LOG_WARNING("The map has %zu cameras; localizing %dx%d frames with a default camera",
+                    cameras.size(), width, height);
+    }
+}
+
+bool Localizer::extract(const cv::Mat& frame, int level) {
+    cv::Mat gray = frame;
+    if (frame.channels() == 3) {
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+    }
+
+    // Downscale with OpenCV; the keypoints are moved back to frame pixels
+    const int maxSize = std::max(1, static_cast<int>(options.maxImageSize * kLevelScales[level]));
+    double scaleX = 1.0;
+    double scaleY = 1.0;
+    if (std::max(gray.cols, gray.rows) > maxSize) {
+        const double scale = static_cast<double>(maxSize) / std::max(gray.cols, gray.rows);
+        const int scaledWidth = std::max(1, static_cast<int>(gray.cols * scale));
+        const int scaledHeight = std::max(1, static_cast<int>(gray.rows * scale));
+        cv::Mat scaled;
+        cv::resize(gray, scaled, cv::Size(scaledWidth, scaledHeight), 0, 0, cv::INTER_AREA);
+        scaleX = static_cast<double>(gray.cols) / scaledWidth;
+        scaleY = static_cast<double>(gray.rows) / scaledHeight;
+        gray = scaled;
+    }
+
+    colmap::Bitmap bitmap;
+    bitmap.ConvertFromRawBits(gray.data, static_cast<int>(gray.step), gray.cols, gray.rows, false);
+    if (!extractors[level]->Extract(bitmap, &keypoints, &descriptors)) {
+        return false;
+    }
+    if (scaleX != 1.0 || scaleY != 1.0) {
+        for (auto& keypoint : keypoints) {
+            keypoint.Rescale(scaleX, scaleY);
+        }
+    }
+    return true;
+}
+
+void Localizer::buildGrid() {
+    const int cellSize = std::max(1, static_cast<int>(options.searchRadius));
+    gridWidth = std::max(1, (static_cast<int>(camera.width) + cellSize - 1) / cellSize);
+    gridHeight = std::max(1, (static_cast<int>(camera.height) + cellSize - 1) / cellSize);
+    const auto cellOf = [&](const colmap::FeatureKeypoint& keypoint) {
+        const int x = std::clamp(static_cast<int>(keypoint.x) / cellSize, 0, gridWidth - 1);
+        const int y = std::clamp(static_cast<int>(keypoint.y) / cellSize, 0, gridHeight - 1);
+        return y * gridWidth + x;
+    };
+
+    // Counting sort of the keypoints into their cells
+    cellStart.assign(static_cast<size_t>(gridWidth) * gridHeight + 1, 0);
+    for (const auto& keypoint : keypoints) {
+        cellStart[cellOf(keypoint) + 1] += 1;
+    }
+    for (size_t c = 1; c < cellStart.size(); ++c) {
+        cellStart[c] += cellStart[c - 1];
+    }
+    cellKeypoints.resize(keypoints.size());
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (size_t j = 0; j < keypoints.size(); ++j) {
+        cellKeypoints[fill[cellOf(keypoints[j])]++] = static_cast<uint32_t>(j);
+    }
+}
+
+void Localizer::matchLocal(const colmap::Rigid3d& camFromWorld) {
+    map.getLocalPoints(camFromWorld, options.numLocalImages, localPoints);
+
+    const int cellSize = std::max(1, static_cast<int>(options.searchRadius));
+    const double radiusSquared = options.searchRadius * options.searchRadius;
+    const double minDot = std::cos(options.maxDistance) * kDescriptorNormSquared;
+    const int length = static_cast<int>(descriptors.cols());
+
+    for (const uint32_t point : localPoints) {
+        const Eigen::Vector3d pointInCam = camFromWorld * map.getPosition(point);
+        if (pointInCam.z() <= 0.0) {
+            continue;
+        }
+        const Eigen::Vector2d pixel = camera.ImgFromCam(pointInCam.hnormalized());
+        if (pixel.x() < -options.searchRadius || pixel.y() < -options.searchRadius ||
+            pixel.x() > camera.width + options.searchRadius || pixel.y() > camera.height + options.searchRadius) {
+            continue;
+        }
+
+        const uint8_t* pointDescriptor = map.getDescriptor(point);
+        int best = -1;
+        int secondBest = -1;
+        uint32_t bestIndex = 0;
+        const int cx = static_cast<int>(std::floor(pixel.x() / cellSize));
+        const int cy = static_cast<int>(std::floor(pixel.y() / cellSize));
+        for (int y = std::max(0, cy - 1); y <= std::min(gridHeight - 1, cy + 1); ++y) {
+            for (int x = std::max(0, cx - 1); x <= std::min(gridWidth - 1, cx + 1); ++x) {
+                const int cell = y * gridWidth + x;
+                for (uint32_t k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+                    const uint32_t j = cellKeypoints[k];
+                    const double dx = keypoints[j].x - pixel.x();
+                    const double dy = keypoints[j].y - pixel.y();
+                    if (dx * dx + dy * dy > radiusSquared) {
+                        continue;
+                    }
+                    const int dot = descriptorDot(pointDescriptor, descriptors.data() + j * length);
+                    if (dot > best) {
+                        secondBest = best;
+                        best = dot;
+                        bestIndex = j;
+                    } else if (dot > secondBest) {
+                        secondBest = dot;
+                    }
+                }
+            }
+        }
+
+        if (best < minDot) {
+            continue;
+        }
+        if (secondBest >= 0 && descriptorAngle(best) >= options.maxRatio * descriptorAngle(secondBest)) {
+            continue;
+        }
+        if (best > matchedSimilarity[bestIndex]) {
+            matchedSimilarity[bestIndex] = best;
+            matchedPoint[bestIndex] = point;
+        }
+    }
+}
+
+void Localizer::matchGlobal(Clock::time_point deadline) {
+    const double minDot = std::cos(options.maxDistance) * kDescriptorNormSquared;
+    const int length = static_cast<int>(descriptors.cols());
+    TaskScheduler::getInstance().parallelFor(0, keypoints.size(), [&](size_t j) {
+        if (matchedPoint[j] != kNoMatch || Clock::now() > deadline) {
+            return;
+        }
+        uint32_t point = 0;
+        int best = -1;
+        int secondBest = -1;
+        if (!map.search(descriptors.data() + j * length, point, best, secondBest) || best < minDot) {
+            return;
+        }
+        if (secondBest >= 0 && descriptorAngle(best) >= options.maxRatio * descriptorAngle(secondBest)) {
+            return;
+        }
+        matchedPoint[j] = point;
+        matchedSimilarity[j] = best;
+    });
+}
+
+bool Localizer::estimatePose(bool refine, Result& result) {
+    std::vector<Eigen::Vector2d> points2D;
+    std::vector<Eigen::Vector3d> points3D;
+    for (size_t j = 0; j < keypoints.size(); ++j) {
+        if (matchedPoint[j] != kNoMatch) {
+            points2D.emplace_back(keypoints[j].x, keypoints[j].y);
+            points3D.push_back(map.getPosition(matchedPoint[j]));
+        }
+    }
+    if (points2D.size() < static_cast<size_t>(options.minNumInliers)) {
+        return false;
+    }
+
+    colmap::AbsolutePoseEstimationOptions estimation;
+    estimation.estimate_focal_length = false;
+    estimation.ransac_options.max_error = options.maxReprojError;
+    estimation.ransac_options.max_num_trials = kMaxNumTrials;
+    estimation.ransac_options.min_inlier_ratio = 0.1;
+
+    colmap::Rigid3d camFromWorld;
+    size_t numInliers = 0;
+    std::vector<char> inlierMask;
+    if (!colmap::EstimateAbsolutePose(estimation, points2D, points3D, &camFromWorld, &camera,
+                                      &numInliers, &inlierMask) ||
+        numInliers < static_cast<size_t>(options.minNumInliers)) {
+        return false;
+    }
+
+    if (refine) {
+        colmap::AbsolutePoseRefinementOptions refinement;
+        refinement.refine_focal_length = false;
+        refinement.refine_extra_params = false;
+        refinement.print_summary = false;
+        if (!colmap::RefineAbsolutePose(refinement, inlierMask, points2D, points3D, &camFromWorld, &camera)) {
+            LOG_DEBUG("Pose refinement failed, keeping the RANSAC pose");
+        }
+    }
+
+    result.camFromWorld = camFromWorld;
+    result.numInliers = numInliers;
+    return true;
+}
+
+Localizer::Result Localizer::localize(const cv::Mat& frame) {
+    const Clock::time_point start = Clock::now();
+    const double budget = options.latencyBudgetMs;
+    const Clock::time_point deadline =
+        start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(budget));
+
+    Result result;
+    result.level = level;
+    if (!frame.empty() && (camera.width != static_cast<size_t>(frame.cols) ||
+                           camera.height != static_cast<size_t>(frame.rows))) {
+        setCamera(frame.cols, frame.rows);
+    }
+
+    if (!frame.empty() && extract(frame, level)) {
+        buildGrid();
+        matchedPoint.assign(keypoints.size(), kNoMatch);
+        matchedSimilarity.assign(keypoints.size(), -1);
+
+        size_t numMatches = 0;
+        if (tracking) {
+            matchLocal(lastCamFromWorld);
+            numMatches = std::count_if(matchedPoint.begin(), matchedPoint.end(),
+                                       [](uint32_t point) { return point != kNoMatch; });
+        }
+        // Fall back to the global search while the budget allows it
+        bool global = false;
+        if (numMatches < 2 * static_cast<size_t>(options.minNumInliers) &&
+            elapsedMs(start) < (1.0 - kGlobalSearchShare) * budget) {
+            matchGlobal(deadline);
+            global = true;
+        }
+        const bool refine = elapsedMs(start) < (1.0 - kRefinementShare) * budget;
+        result.localized = estimatePose(refine, result);
+        result.tracked = result.localized && !global;
+    }
+
+    tracking = result.localized;
+    if (result.localized) {
+        lastCamFromWorld = result.camFromWorld;
+        numLocalized += 1;
+    }
+
+    // Adapt the quality level to the budget
+    result.latencyMs = elapsedMs(start);
+    latencies.push_back(result.latencyMs);
+    if (result.latencyMs > budget) {
+        numFastFrames = 0;
+        if (level + 1 < kNumLevels) {
+            level += 1;
+            LOG_DEBUG("Frame took %.1f ms, extraction quality level %d", result.latencyMs, level);
+        }
+    } else if (result.latencyMs < kFastShare * budget && level > 0) {
+        if (++numFastFrames >= kNumFastFrames) {
+            numFastFrames = 0;
+            level -= 1;
+            LOG_DEBUG("Frames under budget, extraction quality level %d", level);
+        }
+    } else {
+        numFastFrames = 0;
+    }
+    return result;
+}
+
+double Localizer::getLatencyPercentile(double percentile) const {
+    if (latencies.empty()) {
+        return 0.0;
+    }
+    std::vector<double> sorted(latencies);
+    const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(
+        std::round(std::clamp(percentile, 0.0, 100.0) / 100.0 * (sorted.size() - 1))));
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
@@ -0,0 +1,144 @@
+/**
+ * @file localizer.h
+ * @brief Real-time camera tracking against a prebuilt sparse map
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+#include <colmap/feature/extractor.h>
+#include <colmap/feature/types.h>
+#include <colmap/geometry/rigid3.h>
+#include <colmap/scene/camera.h>
+#include <opencv2/opencv.hpp>
+
+#include "map_index.h"
+
+/**
+ * @class Localizer
+ * @brief Estimates the pose of every frame of a stream in a MapIndex
+ *
+ * Each frame is converted to gray, downscaled and described by SIFT, the
+ * features the map was built with. While the previous frame is tracked,
+ * the map points seen around its pose are projected into the frame and
+ * matched to the keypoints within searchRadius pixels. Otherwise, or if
+ * tracking finds too few matches, every keypoint is searched in the
+ * inverted file of the map. The pose follows from P3P RANSAC on the
+ * 2D-3D matches and a final refinement of the inliers.
+ *
+ * The stages are scheduled against latencyBudgetMs: the global search is
+ * skipped when less than 40% of the budget is left and the refinement
+ * when less than 15% is left. A frame over budget moves the extraction
+ * one quality level down (smaller image, fewer features); 30 frames in
+ * a row under 60% of the budget move it back up.
+ *
+ * Keeps the tracking state of one stream; use one instance per stream.
+ */
+class Localizer {
+public:
+    /**
+     * @struct Options
+     * @brief Latency budget, extraction and pose thresholds
+     */
+    struct Options {
+        double latencyBudgetMs = 50.0; /**< Target time per frame */
+        int maxImageSize = 640;        /**< Longest side extracted at the best quality level */
+        int maxNumFeatures = 1024;     /**< Features at the best quality level */
+        int minNumInliers = 20;        /**< Inliers of an accepted pose */
+        double maxReprojError = 8.0;   /**< RANSAC threshold in frame pixels */
+        size_t numLocalImages = 10;    /**< Map images whose points are tracked */
+        double searchRadius = 24.0;    /**< Tracking search radius in frame pixels */
+        double maxRatio = 0.8;         /**< Best to second best descriptor distance */
+        double maxDistance = 0.7;      /**< Descriptor angle of a match */
+    };
+
+    /**
+     * @struct Result
+     * @brief Pose and timing of one frame
+     */
+    struct Result {
+        bool localized = false;      /**< A pose was found */
+        bool tracked = false;        /**< Found by tracking rather than global search */
+        colmap::Rigid3d camFromWorld;
+        size_t numInliers = 0;
+        int level = 0;               /**< Quality level the frame was extracted at */
+        double latencyMs = 0.0;
+    };
+
+    /**
+     * @brief Construct a localizer
+     * @param map Loaded map, must outlive the localizer
+     * @param options Budget and thresholds
+     */
+    Localizer(const MapIndex& map, const Options& options);
+
+    /**
+     * @brief Estimate the pose of the next frame
+     * @param frame BGR or gray frame
+     * @return Pose and timing of the frame
+     */
+    Result localize(const cv::Mat& frame);
+
+    /**
+     * @brief Get a percentile of the frame latencies so far
+     * @param percentile Percentile in [0, 100]
+     * @return Latency in milliseconds, 0 before the first frame
+     */
+    double getLatencyPercentile(double percentile) const;
+
+    /**
+     * @brief Get the number of frames processed
+     * @return The frame count
+     */
+    size_t getNumFrames() const { return latencies.size(); }
+
+    /**
+     * @brief Get the number of frames with a pose
+     * @return The localized frame count
+     */
+    size_t getNumLocalized() const { return numLocalized; }
+
+private:
+    static constexpr int kNumLevels = 4;
+    using Clock = std::chrono::steady_clock;
+
+    void setCamera(int width, int height);
+    bool extract(const cv::Mat& frame, int level);
+    void buildGrid();
+    void matchLocal(const colmap::Rigid3d& camFromWorld);
+    void matchGlobal(Clock::time_point deadline);
+    bool estimatePose(bool refine, Result& result);
+    double elapsedMs(Clock::time_point start) const;
+
+    const MapIndex& map;
+    Options options;
+    std::unique_ptr<colmap::FeatureExtractor> extractors[kNumLevels];
+    colmap::Camera camera;
+    int level = 0;
+    int numFastFrames = 0;
+
+    bool tracking = false;
+    colmap::Rigid3d lastCamFromWorld;
+
+    // Features of the current frame in frame pixels, bucketed into a grid
+    colmap::FeatureKeypoints keypoints;
+    colmap::FeatureDescriptors descriptors;
+    int gridWidth = 0;
+    int gridHeight = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cellKeypoints;
+
+    // Best map point of every keypoint
+    std::vector<uint32_t> matchedPoint;
+    std::vector<int> matchedSimilarity;
+    std::vector<uint32_t> localPoints;
+
+    std::vector<double> latencies;
+    size_t numLocalized = 0;
+};
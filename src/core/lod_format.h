@@ -0,0 +1,121 @@
+/**
+ * @file lod_format.h
+ * @brief On-disk layout of level-of-detail point cloud files
+ *
+ * A .lod file holds one model: its cameras and image poses, and its point
+ * cloud in an octree with quantized positions and colors. All values are
+ * little-endian and every section starts at an 8 byte aligned offset, so
+ * the file can be memory-mapped and read in place:
+ *
+ *   LodHeader | LodCamera[numCameras] | LodImage[numImages] | names |
+ *   LodNode[numNodes] | LodPoint[numPoints]
+ *
+ * The cube [origin, origin + extent)^3 is split into an octree of up to 21
+ * levels. Positions are quantized to the 2^21 grid of the cube and sorted
+ * in Morton order. Level l holds, for every cell of depth l + samplingDepth,
+ * the first point of the cell not yet in a coarser level, so each level
+ * halves the point spacing of the ones before it; the last level holds all
+ * remaining points. Level l is split into the octree nodes of depth l, and
+ * a node stores its points relative to its own cube with 16 bits per axis.
+ *
+ * Nodes are sorted by level and then in Morton order, and points follow
+ * the order of their nodes, so any prefix of the node table is a uniform
+ * subsample of the whole cloud: a reader streams the file from the front
+ * and refines the cloud as it goes.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// First bytes of every .lod file
+constexpr char kLodMagic[8] = {'C', 'N', 'A', 'L', 'O', 'D', '\0', '\0'};
+constexpr uint32_t kLodVersion = 1;
+
+/// Bits per axis of the quantized positions
+constexpr int kLodMaxDepth = 21;
+
+/// Largest COLMAP camera parameter count (FULL_OPENCV, THIN_PRISM_FISHEYE)
+constexpr int kLodMaxCameraParams = 12;
+
+/**
+ * @struct LodHeader
+ * @brief Counts, bounds and section offsets of a .lod file
+ */
+struct LodHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numLevels;
+    uint32_t samplingDepth;  /**< Grid depth of level 0 relative to the root */
+    uint32_t reserved;
+    double origin[3];        /**< Minimum corner of the root cube */
+    double extent;           /**< Edge of the root cube */
+    uint64_t numPoints;
+    uint64_t numNodes;
+    uint64_t numCameras;
+    uint64_t numImages;
+    uint64_t camerasOffset;
+    uint64_t imagesOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;      /**< Bytes of the image name blob */
+    uint64_t nodesOffset;
+    uint64_t pointsOffset;
+};
+static_assert(sizeof(LodHeader) == 136, "LodHeader must have no padding");
+
+/**
+ * @struct LodCamera
+ * @brief Intrinsics of one COLMAP camera
+ */
+struct LodCamera {
+    uint32_t cameraId;
+    int32_t modelId;         /**< colmap::CameraModelId */
+    uint32_t width;
+    uint32_t height;
+    uint32_t numParams;
+    uint32_t reserved;
+    double params[kLodMaxCameraParams];
+};
+static_assert(sizeof(LodCamera) == 120, "LodCamera must have no padding");
+
+/**
+ * @struct LodImage
+ * @brief Pose of one registered image
+ */
+struct LodImage {
+    uint32_t imageId;
+    uint32_t cameraId;
+    uint32_t nameOffset;     /**< Start of the name in the name blob */
+    uint32_t nameLength;
+    double rotation[4];      /**< Camera from world quaternion, w x y z */
+    double translation[3];   /**< Camera from world translation */
+};
+static_assert(sizeof(LodImage) == 72, "LodImage must have no padding");
+
+/**
+ * @struct LodNode
+ * @brief One octree node of one level
+ */
+struct LodNode {
+    uint64_t firstPoint;     /**< Index of the first point in the point array */
+    uint32_t numPoints;
+    uint32_t level;          /**< Level, equal to the depth of the node cube */
+    uint32_t x, y, z;        /**< Cell of the node cube at its depth */
+    uint32_t reserved;
+};
+static_assert(sizeof(LodNode) == 32, "LodNode must have no padding");
+
+/**
+ * @struct LodPoint
+ * @brief Quantized point, relative to the cube of its node
+ *
+ * The position is origin + extent * (cell + (q + 0.5) / 65536) / 2^level
+ * per axis, with cell the node cell and q the stored coordinate.
+ */
+struct LodPoint {
+    uint16_t x, y, z;
+    uint8_t r, g, b;
+    uint8_t reserved;
+};
+static_assert(sizeof(LodPoint) == 10, "LodPoint must have no padding");
@@ -0,0 +1,184 @@
+#include "lod_reader.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Point bytes the kernel is asked to read ahead of the stream
+constexpr size_t kPrefetchBytes = size_t(8) << 20;
+
+// A section of count records of the given size fits the file at offset
+bool fitsFile(uint64_t offset, uint64_t count, size_t recordSize, size_t fileSize) {
+    return offset <= fileSize && count <= (fileSize - offset) / recordSize;
+}
+
+} // namespace
+
+bool LodReader::open(const std::string& path) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open %s", path.c_str());
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(LodHeader)) {
+        LOG_ERROR("Not a .lod file: %s", path.c_str());
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(status.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        LOG_ERROR("Failed to map %s", path.c_str());
+        size = 0;
+        close();
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+
+    header = reinterpret_cast<const LodHeader*>(data);
+    if (std::memcmp(header->magic, kLodMagic, sizeof(kLodMagic)) != 0 || header->version != kLodVersion) {
+        LOG_ERROR("Not a version %u .lod file: %s", kLodVersion, path.c_str());
+        close();
+        return false;
+    }
+    if (header->numLevels == 0 || header->numLevels > kLodMaxDepth + 1 ||
+        !fitsFile(header->camerasOffset, header->numCameras, sizeof(LodCamera), size) ||
+        !fitsFile(header->imagesOffset, header->numImages, sizeof(LodImage), size) ||
+        !fitsFile(header->namesOffset, header->namesSize, 1, size) ||
+        !fitsFile(header->nodesOffset, header->numNodes, sizeof(LodNode), size) ||
+        !fitsFile(header->pointsOffset, header->numPoints, sizeof(LodPoint), size) ||
+        header->camerasOffset % 8 != 0 || header->imagesOffset % 8 != 0 || header->nodesOffset % 8 != 0) {
+        LOG_ERROR("Truncated or corrupt .lod file: %s", path.c_str());
+        close();
+        return false;
+    }
+    cameras = reinterpret_cast<const LodCamera*>(data + header->camerasOffset);
+    images = reinterpret_cast<const LodImage*>(data + header->imagesOffset);
+    names = reinterpret_cast<const char*>(data + header->namesOffset);
+    nodes = reinterpret_cast<const LodNode*>(data + header->nodesOffset);
+    points = reinterpret_cast<const LodPoint*>(data + header->pointsOffset);
+
+    // Level ranges of the node table; every node must lie within the point array
+    levelStart.assign(header->numLevels + 1, 0);
+    uint32_t level = 0;
+    for (size_t n = 0; n < header->numNodes; ++n) {
+        const LodNode& node = nodes[n];
+        if (node.level < level || node.level >= header->numLevels ||
+            node.firstPoint > header->numPoints || node.numPoints > header->numPoints - node.firstPoint) {
+            LOG_ERROR("Corrupt node table in %s", path.c_str());
+            close();
+            return false;
+        }
+        while (level < node.level) {
+            levelStart[++level] = n;
+        }
+    }
+    while (level < header->numLevels) {
+        levelStart[++level] = header->numNodes;
+    }
+    for (size_t i = 0; i < header->numImages; ++i) {
+        if (static_cast<uint64_t>(images[i].nameOffset) + images[i].nameLength > header->namesSize) {
+            LOG_ERROR("Corrupt image table in %s", path.c_str());
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void LodReader::close() {
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    cameras = nullptr;
+    images = nullptr;
+    names = nullptr;
+    nodes = nullptr;
+    points = nullptr;
+    levelStart.clear();
+}
+
+void LodReader::getOrigin(double origin[3]) const {
+    std::copy_n(header->origin, 3, origin);
+}
+
+uint64_t LodReader::getNumPoints(int level) const {
+    const size_t end = levelStart[std::clamp(level + 1, 0, getNumLevels())];
+    return end == 0 ? 0 : nodes[end - 1].firstPoint + nodes[end - 1].numPoints;
+}
+
+std::string LodReader::getImageName(const LodImage& image) const {
+    return std::string(names + image.nameOffset, image.nameLength);
+}
+
+void LodReader::decodeNode(size_t node, std::vector<Point>& decoded) const {
+    const LodNode& lodNode = nodes[node];
+    const double nodeExtent = header->extent / static_cast<double>(uint64_t(1) << lodNode.level);
+    const double step = nodeExtent / 65536.0;
+    const double cornerX = lodNode.x * nodeExtent + 0.5 * step;
+    const double cornerY = lodNode.y * nodeExtent + 0.5 * step;
+    const double cornerZ = lodNode.z * nodeExtent + 0.5 * step;
+
+    const LodPoint* first = points + lodNode.firstPoint;
+    decoded.reserve(decoded.size() + lodNode.numPoints);
+    for (uint32_t i = 0; i < lodNode.numPoints; ++i) {
+        const LodPoint& point = first[i];
+        decoded.push_back({static_cast<float>(cornerX + point.x * step),
+                           static_cast<float>(cornerY + point.y * step),
+                           static_cast<float>(cornerZ + point.z * step),
+                           point.r, point.g, point.b});
+    }
+}
+
+void LodReader::prefetch(size_t firstNode, size_t lastNode) const {
+    if (firstNode >= lastNode) {
+        return;
+    }
+    const uint8_t* begin = reinterpret_cast<const uint8_t*>(points + nodes[firstNode].firstPoint);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(
+        points + nodes[lastNode - 1].firstPoint + nodes[lastNode - 1].numPoints);
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t offset = static_cast<size_t>(begin - data) / pageSize * pageSize;
+    madvise(const_cast<uint8_t*>(data) + offset, static_cast<size_t>(end - data) - offset, MADV_WILLNEED);
+}
+
+uint64_t LodReader::stream(int maxLevel, const NodeVisitor& visitor) const {
+    const size_t end = levelStart[std::clamp(maxLevel + 1, 0, getNumLevels())];
+    std::vector<Point> decoded;
+    uint64_t numDecoded = 0;
+    size_t prefetched = 0;
+    for (size_t n = 0; n < end; ++n) {
+        if (n == prefetched) {
+            // Have the kernel read the next window of points ahead of the decoding
+            size_t bytes = 0;
+            while (prefetched < end && bytes < kPrefetchBytes) {
+                bytes += static_cast<size_t>(nodes[prefetched].numPoints) * sizeof(LodPoint);
+                ++prefetched;
+            }
+            prefetch(n, prefetched);
+        }
+        decoded.clear();
+        decodeNode(n, decoded);
+        numDecoded += decoded.size();
+        if (!visitor(nodes[n], decoded)) {
+            break;
+        }
+    }
+    return numDecoded;
+}
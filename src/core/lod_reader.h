@@ -0,0 +1,159 @@
+/**
+ * @file lod_reader.h
+ * @brief Memory-mapped reader of level-of-detail point cloud files
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "lod_format.h"
+
+/**
+ * @class LodReader
+ * @brief Maps a .lod file (see lod_format.h) and decodes it coarse levels first
+ *
+ * Opening a file only maps it and checks the header, so the camera table
+ * and the node table are available at once, whatever the size of the
+ * cloud. Points are decoded node by node; stream() walks the nodes in file
+ * order, which is coarse to fine, and advises the kernel to read ahead of
+ * it, so a viewer can show the first levels after reading a few megabytes
+ * and stop at the level of detail it needs. Pages of the points are only
+ * loaded when touched and can be dropped by the kernel again, so memory
+ * follows what is decoded rather than the file size.
+ *
+ * Const methods do not modify the mapping and may be called from several
+ * threads.
+ */
+class LodReader {
+public:
+    /**
+     * @struct Point
+     * @brief Decoded point, positioned relative to getOrigin()
+     *
+     * Keeping the origin out of the float position preserves the precision
+     * of georeferenced models with large coordinates.
+     */
+    struct Point {
+        float x, y, z;
+        uint8_t r, g, b;
+    };
+
+    /// Receives the points of one node; returning false stops the stream
+    using NodeVisitor = std::function<bool(const LodNode& node, const std::vector<Point>& points)>;
+
+    LodReader() = default;
+    ~LodReader() { close(); }
+
+    LodReader(const LodReader&) = delete;
+    LodReader& operator=(const LodReader&) = delete;
+
+    /**
+     * @brief Map a file and check its header
+     * @param path .lod file
+     * @return true if the file is a valid .lod file
+     */
+    bool open(const std::string& path);
+
+    /**
+     * @brief Unmap the file
+     */
+    void close();
+
+    /**
+     * @brief Get the header of the open file
+     * @return The header
+     */
+    const LodHeader& getHeader() const { return *header; }
+
+    /**
+     * @brief Get the minimum corner of the cloud, the origin of decoded points
+     * @param origin Receives the corner
+     */
+    void getOrigin(double origin[3]) const;
+
+    /**
+     * @brief Get the number of levels
+     * @return The level count
+     */
+    int getNumLevels() const { return static_cast<int>(header->numLevels); }
+
+    /**
+     * @brief Get the nodes, sorted by level
+     * @return Pointer to getNumNodes() nodes
+     */
+    const LodNode* getNodes() const { return nodes; }
+
+    /**
+     * @brief Get the number of nodes
+     * @return The node count
+     */
+    size_t getNumNodes() const { return static_cast<size_t>(header->numNodes); }
+
+    /**
+     * @brief Get the first node of a level
+     * @param level Level in [0, getNumLevels()], getNumLevels() for the end of the table
+     * @return Index into getNodes()
+     */
+    size_t getLevelStart(int level) const { return levelStart[level]; }
+
+    /**
+     * @brief Get the number of points up to and including a level
+     * @param level Level in [0, getNumLevels())
+     * @return The point count
+     */
+    uint64_t getNumPoints(int level) const;
+
+    /**
+     * @brief Get the cameras
+     * @return Pointer to getHeader().numCameras cameras
+     */
+    const LodCamera* getCameras() const { return cameras; }
+
+    /**
+     * @brief Get the registered images and their poses
+     * @return Pointer to getHeader().numImages images
+     */
+    const LodImage* getImages() const { return images; }
+
+    /**
+     * @brief Get the name of an image
+     * @param image An image of getImages()
+     * @return The image name
+     */
+    std::string getImageName(const LodImage& image) const;
+
+    /**
+     * @brief Decode the points of a node
+     * @param node Index into getNodes()
+     * @param points Receives the points, appended
+     */
+    void decodeNode(size_t node, std::vector<Point>& points) const;
+
+    /**
+     * @brief Decode the nodes in file order, coarse levels first
+     * @param maxLevel Last level to decode
+     * @param visitor Receives the points node by node
+     * @return Number of points decoded
+     */
+    uint64_t stream(int maxLevel, const NodeVisitor& visitor) const;
+
+private:
+    void prefetch(size_t firstNode, size_t lastNode) const;
+
+    int fd = -1;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    const LodHeader* header = nullptr;
+    const LodCamera* cameras = nullptr;
+    const LodImage* images = nullptr;
+    const char* names = nullptr;
+    const LodNode* nodes = nullptr;
+    const LodPoint* points = nullptr;
+    std::vector<size_t> levelStart;
+};
@@ -0,0 +1,549 @@
+#include "lod_writer.h"
+#include "logger.h"
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+constexpr size_t kDefaultSortBytes = size_t(256) << 20;
+constexpr size_t kMergeBufferRecords = 1 << 16;
+constexpr size_t kPlyBlockVertices = 1 << 16;
+constexpr uint32_t kGridSize = 1u << kLodMaxDepth;
+
+struct SortRecord {
+    uint64_t code;     /**< Morton code of the quantized position */
+    uint8_t color[3];
+};
+
+// Spread the low 21 bits of v to every third bit
+uint64_t expandBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Inverse of expandBits
+uint32_t compactBits(uint64_t v) {
+    v &= 0x1249249249249249ULL;
+    v = (v | (v >> 2)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v >> 4)) & 0x100f00f00f00f00fULL;
+    v = (v | (v >> 8)) & 0x1f0000ff0000ffULL;
+    v = (v | (v >> 16)) & 0x1f00000000ffffULL;
+    v = (v | (v >> 32)) & 0x1fffff;
+    return static_cast<uint32_t>(v);
+}
+
+// Removes the temporary files of an export on every exit path
+struct TempFiles {
+    std::vector<std::string> paths;
+    ~TempFiles() {
+        for (const auto& path : paths) {
+            std::error_code error;
+            std::filesystem::remove(path, error);
+        }
+    }
+};
+
+// Reads a sorted run back in blocks
+struct RunReader {
+    std::ifstream file;
+    std::vector<SortRecord> buffer;
+    size_t position = 0;
+
+    bool next(SortRecord& record) {
+        if (position == buffer.size()) {
+            buffer.resize(kMergeBufferRecords);
+            file.read(reinterpret_cast<char*>(buffer.data()),
+                      static_cast<std::streamsize>(buffer.size() * sizeof(SortRecord)));
+            buffer.resize(static_cast<size_t>(file.gcount()) / sizeof(SortRecord));
+            position = 0;
+            if (buffer.empty()) {
+                return false;
+            }
+        }
+        record = buffer[position++];
+        return true;
+    }
+};
+
+// Points and nodes of one level, spilled to a file until the final write
+struct LevelWriter {
+    std::ofstream file;
+    std::vector<LodNode> nodes;
+    uint64_t numPoints = 0;
+    uint64_t nodeKey = std::numeric_limits<uint64_t>::max();
+};
+
+size_t plyTypeSize(const std::string& type) {
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32" ||
+        type == "float" || type == "float32") return 4;
+    if (type == "double" || type == "float64") return 8;
+    return 0;
+}
+
+double readPlyValue(const char* data, const std::string& type) {
+    if (type == "float" || type == "float32") {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    if (type == "double" || type == "float64") {
+        double value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    return static_cast<uint8_t>(*data);
+}
+
+// Stream the vertices of a binary little-endian PLY file in blocks
+template <typename Visitor>
+bool forEachPlyVertex(const std::string& path, Visitor&& visitor) {
+    std::ifstream file(path, std::ios::binary);
+    std::string line;
+    if (!file || !std::getline(file, line) || line.rfind("ply", 0) != 0) {
+        LOG_ERROR("Not a PLY file: %s", path.c_str());
+        return false;
+    }
+
+    struct Property {
+        std::string type;
+        size_t offset = 0;
+    };
+    size_t numVertices = 0;
+    size_t vertexSize = 0;
+    bool inVertex = false;
+    Property position[3];
+    Property color[3];
+    bool hasPosition[3] = {false, false, false};
+    bool hasColor = true;
+    bool hasColorChannel[3] = {false, false, false};
+    const char* positionNames[3] = {"x", "y", "z"};
+    const char* colorNames[3] = {"red", "green", "blue"};
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format != "binary_little_endian") {
+                LOG_ERROR("Unsupported PLY format '%s' in %s", format.c_str(), path.c_str());
+                return false;
+            }
+        } else if (keyword == "element") {
+            std::string name;
+            size_t count = 0;
+            tokens >> name >> count;
+            inVertex = name == "vertex";
+            if (inVertex) {
+                numVertices = count;
+            } else if (numVertices == 0 && count > 0) {
+                LOG_ERROR("PLY element '%s' precedes the vertices in %s", name.c_str(), path.c_str());
+                return false;
+            }
+        } else if (keyword == "property" && inVertex) {
+            std::string type;
+            std::string name;
+            tokens >> type >> name;
+            const size_t size = plyTypeSize(type);
+            if (size == 0) {
+                LOG_ERROR("Unsupported PLY vertex property '%s' in %s", line.c_str(), path.c_str());
+                return false;
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                if (name == positionNames[axis] && (type == "float" || type == "float32" ||
+                                                    type == "double" || type == "float64")) {
+                    position[axis] = {type, vertexSize};
+                    hasPosition[axis] = true;
+                }
+                if (name == colorNames[axis] && size == 1) {
+                    color[axis] = {type, vertexSize};
+                    hasColorChannel[axis] = true;
+                }
+            }
+            vertexSize += size;
+        } else if (keyword == "end_header") {
+            break;
+        }
+    }
+    if (!hasPosition[0] || !hasPosition[1] || !hasPosition[2]) {
+        LOG_ERROR("PLY file without float x, y, z vertices: %s", path.c_str());
+        return false;
+    }
+    hasColor = hasColorChannel[0] && hasColorChannel[1] && hasColorChannel[2];
+
+    std::vector<char> block(kPlyBlockVertices * vertexSize);
+    const uint8_t white[3] = {255, 255, 255};
+    size_t numRead = 0;
+    while (numRead < numVertices) {
+        const size_t count = std::min(kPlyBlockVertices, numVertices - numRead);
+        file.read(block.data(), static_cast<std::streamsize>(count * vertexSize));
+        if (static_cast<size_t>(file.gcount()) != count * vertexSize) {
+            LOG_ERROR("PLY file %s ends after %zu of %zu vertices", path.c_str(),
+                      numRead + static_cast<size_t>(file.gcount()) / vertexSize, numVertices);
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const char* vertex = block.data() + i * vertexSize;
+            const Eigen::Vector3d point(readPlyValue(vertex + position[0].offset, position[0].type),
+                                        readPlyValue(vertex + position[1].offset, position[1].type),
+                                        readPlyValue(vertex + position[2].offset, position[2].type));
+            if (hasColor) {
+                const uint8_t rgb[3] = {static_cast<uint8_t>(vertex[color[0].offset]),
+                                        static_cast<uint8_t>(vertex[color[1].offset]),
+                                        static_cast<uint8_t>(vertex[color[2].offset])};
+                visitor(point, rgb);
+            } else {
+                visitor(point, white);
+            }
+        }
+        numRead += count;
+    }
+    return true;
+}
+
+bool writeRun(std::vector<SortRecord>& run, const std::string& path) {
+    std::sort(run.begin(), run.end(),
+              [](const SortRecord& a, const SortRecord& b) { return a.code < b.code; });
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(run.data()),
+               static_cast<std::streamsize>(run.size() * sizeof(SortRecord)));
+    run.clear();
+    return static_cast<bool>(file);
+}
+
+void writePadding(std::ofstream& file) {
+    static const char zeros[8] = {};
+    const auto position = static_cast<size_t>(file.tellp());
+    file.write(zeros, static_cast<std::streamsize>((8 - position % 8) % 8));
+}
+
+} // namespace
+
+LodWriter::LodWriter(const Options& options) : options(options) {
+}
+
+bool LodWriter::writeModel(const colmap::Reconstruction& reconstruction, const std::string& path) {
+    return write(reconstruction, [&](const PointVisitor& visitor) {
+        for (const auto& [pointId, point] : reconstruction.Points3D()) {
+            visitor(point.xyz, point.color.data());
+        }
+        return true;
+    }, path);
+}
+
+bool LodWriter::writeCloud(const colmap::Reconstruction& reconstruction, const std::string& plyPath,
+                           const std::string& path) {
+    return write(reconstruction, [&](const PointVisitor& visitor) {
+        return forEachPlyVertex(plyPath, visitor);
+    }, path);
+}
+
+bool LodWriter::write(const colmap::Reconstruction& reconstruction, const PointSource& source,
+                      const std::string& path) {
+    // Bounds of the cloud
+    Eigen::Vector3d minBound = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+    Eigen::Vector3d maxBound = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+    size_t numPoints = 0;
+    if (!source([&](const Eigen::Vector3d& position, const uint8_t*) {
+            if (position.allFinite()) {
+                minBound = minBound.cwiseMin(position);
+                maxBound = maxBound.cwiseMax(position);
+                ++numPoints;
+            }
+        })) {
+        return false;
+    }
+    if (numPoints == 0) {
+        LOG_WARNING("No points to write to %s", path.c_str());
+        return false;
+    }
+    double extent = (maxBound - minBound).maxCoeff();
+    if (!(extent > 0.0)) {
+        extent = 1.0;
+    }
+
+    const int samplingDepth = std::clamp(options.samplingDepth, 0, kLodMaxDepth - 1);
+    const int numLevels = std::clamp(options.maxNumLevels, 1, kLodMaxDepth - samplingDepth + 1);
+    const int lastLevel = numLevels - 1;
+
+    // Quantize and sort in runs that fit the memory budget
+    size_t sortBytes = options.maxSortBytes;
+    if (sortBytes == 0) {
+        const size_t limit = MemoryBudget::getInstance().getLimit();
+        sortBytes = limit > 0 ? limit / 8 : kDefaultSortBytes;
+    }
+    const size_t runCapacity = std::max<size_t>(kMergeBufferRecords, sortBytes / sizeof(SortRecord));
+    std::vector<SortRecord> run;
+    run.reserve(std::min(runCapacity, numPoints));
+    MemoryReservation runReservation(MemoryBudget::Category::OTHER, run.capacity() * sizeof(SortRecord));
+
+    TempFiles temp;
+    std::vector<std::string> runPaths;
+    bool runsWritten = true;
+    const double scale = kGridSize / extent;
+    const auto quantize = [&](double value, int axis) {
+        const double cell = std::floor((value - minBound[axis]) * scale);
+        return static_cast<uint64_t>(std::clamp(cell, 0.0, static_cast<double>(kGridSize - 1)));
+    };
+    if (!source([&](const Eigen::Vector3d& position, const uint8_t* color) {
+            if (!position.allFinite()) {
+                return;
+            }
+            SortRecord record;
+            record.code = expandBits(quantize(position.x(), 0)) |
+                          (expandBits(quantize(position.y(), 1)) << 1) |
+                          (expandBits(quantize(position.z(), 2)) << 2);
+            std::copy_n(color, 3, record.color);
+            run.push_back(record);
+            if (run.size() == runCapacity && runsWritten) {
+                runPaths.push_back(path + ".run" + std::to_string(runPaths.size()));
+                temp.paths.push_back(runPaths.back());
+                runsWritten = writeRun(run, runPaths.back());
+            }
+        })) {
+        return false;
+    }
+    if (!runPaths.empty() && !run.empty() && runsWritten) {
+        runPaths.push_back(path + ".run" + std::to_string(runPaths.size()));
+        temp.paths.push_back(runPaths.back());
+        runsWritten = writeRun(run, runPaths.back());
+    }
+    if (!runsWritten) {
+        LOG_ERROR("Failed to write the sort runs of %s", path.c_str());
+        return false;
+    }
+    if (runPaths.empty()) {
+        std::sort(run.begin(), run.end(),
+                  [](const SortRecord& a, const SortRecord& b) { return a.code < b.code; });
+    }
+    LOG_INFO("Writing %zu points to %s in %d levels (%zu sort runs)", numPoints, path.c_str(),
+             numLevels, std::max<size_t>(1, runPaths.size()));
+
+    // Assign levels in Morton order and split them into the octree nodes
+    std::vector<LevelWriter> levels(numLevels);
+    bool first = true;
+    uint64_t previous = 0;
+    bool levelsWritten = true;
+    const auto emit = [&](const SortRecord& record) {
+        int level = 0;
+        if (!first) {
+            const uint64_t difference = record.code ^ previous;
+            if (difference == 0) {
+                level = lastLevel;
+            } else {
+                const int highBit = 63 - __builtin_clzll(difference);
+                const int depth = kLodMaxDepth - highBit / 3;
+                level = std::min(lastLevel, std::max(0, depth - samplingDepth));
+            }
+        }
+        first = false;
+        previous = record.code;
+
+        LevelWriter& writer = levels[level];
+        if (!writer.file.is_open()) {
+            temp.paths.push_back(path + ".level" + std::to_string(level));
+            writer.file.open(temp.paths.back(), std::ios::binary | std::ios::trunc);
+        }
+        const int shift = kLodMaxDepth - level;
+        const uint64_t nodeKey = record.code >> (3 * shift);
+        const uint32_t x = compactBits(record.code);
+        const uint32_t y = compactBits(record.code >> 1);
+        const uint32_t z = compactBits(record.code >> 2);
+        if (nodeKey != writer.nodeKey || writer.nodes.back().numPoints == std::numeric_limits<uint32_t>::max()) {
+            LodNode node{};
+            node.firstPoint = writer.numPoints;
+            node.level = static_cast<uint32_t>(level);
+            node.x = x >> shift;
+            node.y = y >> shift;
+            node.z = z >> shift;
+            writer.nodes.push_back(node);
+            writer.nodeKey = nodeKey;
+        }
+
+        // Position within the node cube, rescaled to 16 bits
+        const uint32_t mask = (1u << shift) - 1;
+        const auto local = [&](uint32_t coordinate) {
+            const uint32_t offset = coordinate & mask;
+            return static_cast<uint16_t>(shift >= 16 ? offset >> (shift - 16) : offset << (16 - shift));
+        };
+        LodPoint point{};
+        point.x = local(x);
+        point.y = local(y);
+        point.z = local(z);
+        point.r = record.color[0];
+        point.g = record.color[1];
+        point.b = record.color[2];
+        writer.file.write(reinterpret_cast<const char*>(&point), sizeof(point));
+        writer.nodes.back().numPoints += 1;
+        writer.numPoints += 1;
+    };
+
+    if (runPaths.empty()) {
+        for (const SortRecord& record : run) {
+            emit(record);
+        }
+    } else {
+        // k-way merge of the sorted runs
+        run = std::vector<SortRecord>();
+        runReservation.reset();
+        std::vector<std::unique_ptr<RunReader>> readers;
+        using Head = std::pair<uint64_t, size_t>;
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+        std::vector<SortRecord> current(runPaths.size());
+        for (size_t r = 0; r < runPaths.size(); ++r) {
+            readers.push_back(std::make_unique<RunReader>());
+            readers[r]->file.open(runPaths[r], std::ios::binary);
+            if (readers[r]->next(current[r])) {
+                heads.emplace(current[r].code, r);
+            }
+        }
+        while (!heads.empty()) {
+            const size_t r = heads.top().second;
+            heads.pop();
+            emit(current[r]);
+            if (readers[r]->next(current[r])) {
+                heads.emplace(current[r].code, r);
+            }
+        }
+    }
+    for (auto& level : levels) {
+        if (level.file.is_open()) {
+            level.file.close();
+            levelsWritten = levelsWritten && !level.file.fail();
+        }
+    }
+    if (!levelsWritten) {
+        LOG_ERROR("Failed to write the levels of %s", path.c_str());
+        return false;
+    }
+
+    // Camera and pose table
+    std::vector<colmap::camera_t> cameraIds;
+    for (const auto& [cameraId, camera] : reconstruction.Cameras()) {
+        cameraIds.push_back(cameraId);
+    }
+    std::sort(cameraIds.begin(), cameraIds.end());
+    std::vector<LodCamera> cameras;
+    for (const colmap::camera_t cameraId : cameraIds) {
+        const colmap::Camera& camera = reconstruction.Camera(cameraId);
+        LodCamera record{};
+        record.cameraId = cameraId;
+        record.modelId = static_cast<int32_t>(camera.model_id);
+        record.width = static_cast<uint32_t>(camera.width);
+        record.height = static_cast<uint32_t>(camera.height);
+        record.numParams = static_cast<uint32_t>(std::min<size_t>(camera.params.size(), kLodMaxCameraParams));
+        std::copy_n(camera.params.begin(), record.numParams, record.params);
+        cameras.push_back(record);
+    }
+
+    std::vector<colmap::image_t> imageIds = reconstruction.RegImageIds();
+    std::sort(imageIds.begin(), imageIds.end());
+    std::vector<LodImage> images;
+    std::string names;
+    for (const colmap::image_t imageId : imageIds) {
+        const colmap::Image& image = reconstruction.Image(imageId);
+        const colmap::Rigid3d& camFromWorld = image.CamFromWorld();
+        LodImage record{};
+        record.imageId = imageId;
+        record.cameraId = image.CameraId();
+        record.nameOffset = static_cast<uint32_t>(names.size());
+        record.nameLength = static_cast<uint32_t>(image.Name().size());
+        record.rotation[0] = camFromWorld.rotation.w();
+        record.rotation[1] = camFromWorld.rotation.x();
+        record.rotation[2] = camFromWorld.rotation.y();
+        record.rotation[3] = camFromWorld.rotation.z();
+        for (int axis = 0; axis < 3; ++axis) {
+            record.translation[axis] = camFromWorld.translation[axis];
+        }
+        names += image.Name();
+        images.push_back(record);
+    }
+
+    // Nodes of all levels, pointing into the concatenated point array
+    std::vector<LodNode> nodes;
+    uint64_t levelStart = 0;
+    for (auto& level : levels) {
+        for (LodNode& node : level.nodes) {
+            node.firstPoint += levelStart;
+            nodes.push_back(node);
+        }
+        levelStart += level.numPoints;
+        level.nodes = std::vector<LodNode>();
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        LOG_ERROR("Failed to create %s", path.c_str());
+        return false;
+    }
+    LodHeader header{};
+    std::copy_n(kLodMagic, sizeof(header.magic), header.magic);
+    header.version = kLodVersion;
+    header.numLevels = static_cast<uint32_t>(numLevels);
+    header.samplingDepth = static_cast<uint32_t>(samplingDepth);
+    for (int axis = 0; axis < 3; ++axis) {
+        header.origin[axis] = minBound[axis];
+    }
+    header.extent = extent;
+    header.numPoints = levelStart;
+    header.numNodes = nodes.size();
+    header.numCameras = cameras.size();
+    header.numImages = images.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    header.camerasOffset = static_cast<uint64_t>(file.tellp());
+    file.write(reinterpret_cast<const char*>(cameras.data()),
+               static_cast<std::streamsize>(cameras.size() * sizeof(LodCamera)));
+    header.imagesOffset = static_cast<uint64_t>(file.tellp());
+    file.write(reinterpret_cast<const char*>(images.data()),
+               static_cast<std::streamsize>(images.size() * sizeof(LodImage)));
+    header.namesOffset = static_cast<uint64_t>(file.tellp());
+    header.namesSize = names.size();
+    file.write(names.data(), static_cast<std::streamsize>(names.size()));
+    writePadding(file);
+    header.nodesOffset = static_cast<uint64_t>(file.tellp());
+    file.write(reinterpret_cast<const char*>(nodes.data()),
+               static_cast<std::streamsize>(nodes.size() * sizeof(LodNode)));
+    writePadding(file);
+    header.pointsOffset = static_cast<uint64_t>(file.tellp());
+    for (int level = 0; level < numLevels; ++level) {
+        if (levels[level].numPoints == 0) {
+            continue;
+        }
+        std::ifstream levelFile(path + ".level" + std::to_string(level), std::ios::binary);
+        file << levelFile.rdbuf();
+    }
+
+    // Offsets are only known now
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (file.fail()) {
+        LOG_ERROR("Failed to write %s", path.c_str());
+        return false;
+    }
+    LOG_INFO("Wrote %s: %llu points in %zu nodes, %zu cameras, %zu images", path.c_str(),
+             static_cast<unsigned long long>(header.numPoints), nodes.size(), cameras.size(),
+             images.size());
+    return true;
+}
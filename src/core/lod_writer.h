@@ -0,0 +1,75 @@
+/**
+ * @file lod_writer.h
+ * @brief Export of sparse and dense models to level-of-detail point cloud files
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <Eigen/Core>
+#include <colmap/scene/reconstruction.h>
+
+#include "lod_format.h"
+
+/**
+ * @class LodWriter
+ * @brief Writes a model and its point cloud to a .lod file (see lod_format.h)
+ *
+ * The cloud is read twice: once for its bounds, and once to quantize and
+ * sort the points by Morton code in runs of at most maxSortBytes, which
+ * are spilled next to the output when the cloud does not fit. Merging the
+ * runs yields the points in Morton order; each is assigned its level from
+ * the first octree depth where it differs from the previous point, and
+ * appended to a temporary file per level. The levels are then
+ * concatenated behind the node table. Memory stays at one sort run plus
+ * the node table, whatever the size of the cloud.
+ */
+class LodWriter {
+public:
+    /**
+     * @struct Options
+     * @brief Level layout and memory
+     */
+    struct Options {
+        int samplingDepth = 7;     /**< Level 0 keeps one point per cell of the root cube split 2^samplingDepth times */
+        int maxNumLevels = 12;     /**< Levels including the last one, which takes all remaining points */
+        size_t maxSortBytes = 0;   /**< Size of the in-memory sort runs, 0 for an eighth of the memory limit or 256 MB */
+    };
+
+    /**
+     * @brief Construct a writer
+     * @param options Level layout and memory
+     */
+    explicit LodWriter(const Options& options);
+
+    /**
+     * @brief Write the 3D points of a sparse model
+     * @param reconstruction The model, also the source of the camera table
+     * @param path .lod file to write
+     * @return true if the file was written
+     */
+    bool writeModel(const colmap::Reconstruction& reconstruction, const std::string& path);
+
+    /**
+     * @brief Write a fused point cloud, streamed from a binary PLY file
+     * @param reconstruction Model of the cameras and poses, e.g. the undistorted dense model
+     * @param plyPath Binary little-endian PLY with x, y, z and optionally red, green, blue
+     * @param path .lod file to write
+     * @return true if the file was written
+     */
+    bool writeCloud(const colmap::Reconstruction& reconstruction, const std::string& plyPath,
+                    const std::string& path);
+
+private:
+    using PointVisitor = std::function<void(const Eigen::Vector3d& position, const uint8_t* color)>;
+    using PointSource = std::function<bool(const PointVisitor& visitor)>;
+
+    bool write(const colmap::Reconstruction& reconstruction, const PointSource& source,
+               const std::string& path);
+
+    Options options;
+};
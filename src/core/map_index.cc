@@ -0,0 +1,278 @@
+#include "map_index.h"
+#include "logger.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include <colmap/scene/database.h>
+
+namespace {
+
+// COLMAP scales SIFT descriptors to an L2 norm of 512 before rounding to bytes
+constexpr double kDescriptorNorm = 512.0;
+
+// Points used to fit the clusters, per cluster
+constexpr size_t kSamplesPerCluster = 64;
+
+int descriptorDot(const uint8_t* a, const uint8_t* b) {
+    int dot = 0;
+    for (int k = 0; k < MapIndex::kDescriptorSize; ++k) {
+        dot += static_cast<int>(a[k]) * static_cast<int>(b[k]);
+    }
+    return dot;
+}
+
+// Scale a descriptor sum to the SIFT norm and round it to bytes
+void normalizeDescriptor(const float* sum, uint8_t* descriptor) {
+    double norm = 0.0;
+    for (int k = 0; k < MapIndex::kDescriptorSize; ++k) {
+        norm += static_cast<double>(sum[k]) * sum[k];
+    }
+    const double scale = norm > 0.0 ? kDescriptorNorm / std::sqrt(norm) : 0.0;
+    for (int k = 0; k < MapIndex::kDescriptorSize; ++k) {
+        descriptor[k] = static_cast<uint8_t>(std::min(255.0, std::round(sum[k] * scale)));
+    }
+}
+
+} // namespace
+
+MapIndex::MapIndex(const Options& options) : options(options) {
+}
+
+bool MapIndex::load(const std::string& modelPath, const std::string& databasePath) {
+    positions.clear();
+    descriptors.clear();
+    imageCenters.clear();
+    imageAxes.clear();
+    imagePoints.clear();
+
+    try {
+        reconstruction.Read(modelPath);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to read the map %s: %s", modelPath.c_str(), e.what());
+        return false;
+    }
+
+    std::unordered_map<colmap::point3D_t, uint32_t> pointIndex;
+    for (const auto& [pointId, point] : reconstruction.Points3D()) {
+        pointIndex.emplace(pointId, static_cast<uint32_t>(positions.size()));
+        positions.push_back(point.xyz);
+    }
+    if (positions.empty()) {
+        LOG_ERROR("The map %s has no points", modelPath.c_str());
+        return false;
+    }
+
+    // Sum the track descriptors image by image, so only one image's features are in memory
+    std::vector<float> sums(positions.size() * kDescriptorSize, 0.0f);
+    std::vector<uint32_t> counts(positions.size(), 0);
+    try {
+        colmap::Database database(databasePath);
+        for (const colmap::image_t imageId : reconstruction.RegImageIds()) {
+            const colmap::Image& image = reconstruction.Image(imageId);
+            if (!database.ExistsImageWithName(image.Name())) {
+                LOG_WARNING("Map image %s is not in %s", image.Name().c_str(), databasePath.c_str());
+                continue;
+            }
+            const colmap::FeatureDescriptors imageDescriptors =
+                database.ReadDescriptors(database.ReadImageWithName(image.Name()).ImageId());
+
+            std::vector<uint32_t> points;
+            for (size_t i = 0; i < image.Points2D().size(); ++i) {
+                const colmap::Point2D& point2D = image.Points2D()[i];
+                if (!point2D.HasPoint3D() || i >= static_cast<size_t>(imageDescriptors.rows())) {
+                    continue;
+                }
+                const uint32_t point = pointIndex.at(point2D.point3D_id);
+                const uint8_t* descriptor = imageDescriptors.data() + i * imageDescriptors.cols();
+                float* sum = sums.data() + static_cast<size_t>(point) * kDescriptorSize;
+                for (int k = 0; k < kDescriptorSize; ++k) {
+                    sum[k] += descriptor[k];
+                }
+                counts[point] += 1;
+                points.push_back(point);
+            }
+
+            imageCenters.push_back(image.ProjectionCenter());
+            imageAxes.push_back(image.ViewingDirection());
+            imagePoints.push_back(std::move(points));
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to read the map features from %s: %s", databasePath.c_str(), e.what());
+        return false;
+    }
+
+    // Keep the points that have descriptors and remap the image point lists
+    std::vector<uint32_t> remap(positions.size(), 0);
+    size_t numKept = 0;
+    descriptors.resize(positions.size() * kDescriptorSize);
+    for (size_t point = 0; point < positions.size(); ++point) {
+        if (counts[point] == 0) {
+            continue;
+        }
+        remap[point] = static_cast<uint32_t>(numKept);
+        positions[numKept] = positions[point];
+        normalizeDescriptor(sums.data() + point * kDescriptorSize,
+                            descriptors.data() + numKept * kDescriptorSize);
+        ++numKept;
+    }
+    positions.resize(numKept);
+    descriptors.resize(numKept * kDescriptorSize);
+    for (auto& points : imagePoints) {
+        for (auto& point : points) {
+            point = remap[point];
+        }
+    }
+    if (numKept == 0) {
+        LOG_ERROR("No map point has a descriptor in %s", databasePath.c_str());
+        return false;
+    }
+
+    buildClusters();
+    LOG_INFO("Loaded map with %zu points in %zu clusters from %zu images", numKept,
+             clusterStart.size() - 1, imageCenters.size());
+    return true;
+}
+
+void MapIndex::buildClusters() {
+    const size_t numPoints = positions.size();
+    const size_t numClusters = std::clamp<size_t>(options.numClusters, 1, numPoints);
+    TaskScheduler& scheduler = TaskScheduler::getInstance();
+
+    // Fit the centroids on a fixed random sample of the points
+    std::mt19937 random(0);
+    std::vector<uint32_t> sample(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) {
+        sample[i] = static_cast<uint32_t>(i);
+    }
+    std::shuffle(sample.begin(), sample.end(), random);
+    sample.resize(std::min(numPoints, numClusters * kSamplesPerCluster));
+
+    centroids.resize(numClusters * kDescriptorSize);
+    for (size_t c = 0; c < numClusters; ++c) {
+        std::copy_n(getDescriptor(sample[c]), kDescriptorSize, centroids.data() + c * kDescriptorSize);
+    }
+
+    const auto nearestCluster = [&](const uint8_t* descriptor) {
+        uint32_t nearest = 0;
+        int best = -1;
+        for (size_t c = 0; c < numClusters; ++c) {
+            const int dot = descriptorDot(descriptor, centroids.data() + c * kDescriptorSize);
+            if (dot > best) {
+                best = dot;
+                nearest = static_cast<uint32_t>(c);
+            }
+        }
+        return nearest;
+    };
+
+    std::vector<uint32_t> assignment(sample.size(), 0);
+    std::vector<float> sums(numClusters * kDescriptorSize);
+    std::vector<uint32_t> sizes(numClusters);
+    for (int iteration = 0; iteration < options.numIterations; ++iteration) {
+        scheduler.parallelFor(0, sample.size(), [&](size_t i) {
+            assignment[i] = nearestCluster(getDescriptor(sample[i]));
+        });
+
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        std::fill(sizes.begin(), sizes.end(), 0);
+        for (size_t i = 0; i < sample.size(); ++i) {
+            const uint8_t* descriptor = getDescriptor(sample[i]);
+            float* sum = sums.data() + static_cast<size_t>(assignment[i]) * kDescriptorSize;
+            for (int k = 0; k < kDescriptorSize; ++k) {
+                sum[k] += descriptor[k];
+            }
+            sizes[assignment[i]] += 1;
+        }
+        for (size_t c = 0; c < numClusters; ++c) {
+            uint8_t* centroid = centroids.data() + c * kDescriptorSize;
+            if (sizes[c] == 0) {
+                // Reseed an empty cluster with a random sample
+                std::copy_n(getDescriptor(sample[random() % sample.size()]), kDescriptorSize, centroid);
+            } else {
+                normalizeDescriptor(sums.data() + c * kDescriptorSize, centroid);
+            }
+        }
+    }
+
+    // Assign every point and build the inverted file by counting sort
+    std::vector<uint32_t> cluster(numPoints);
+    scheduler.parallelFor(0, numPoints, [&](size_t i) {
+        cluster[i] = nearestCluster(getDescriptor(static_cast<uint32_t>(i)));
+    });
+    clusterStart.assign(numClusters + 1, 0);
+    for (const uint32_t c : cluster) {
+        clusterStart[c + 1] += 1;
+    }
+    for (size_t c = 1; c < clusterStart.size(); ++c) {
+        clusterStart[c] += clusterStart[c - 1];
+    }
+    clusterPoints.resize(numPoints);
+    std::vector<uint32_t> fill(clusterStart.begin(), clusterStart.end() - 1);
+    for (size_t i = 0; i < numPoints; ++i) {
+        clusterPoints[fill[cluster[i]]++] = static_cast<uint32_t>(i);
+    }
+}
+
+void MapIndex::getLocalPoints(const colmap::Rigid3d& camFromWorld, size_t numImages,
+                              std::vector<uint32_t>& points) const {
+    points.clear();
+    const colmap::Rigid3d worldFromCam = colmap::Inverse(camFromWorld);
+    const Eigen::Vector3d center = worldFromCam.translation;
+    const Eigen::Vector3d axis = worldFromCam.rotation * Eigen::Vector3d::UnitZ();
+
+    // Nearest images that look roughly the same way
+    std::vector<std::pair<double, size_t>> candidates;
+    for (size_t i = 0; i < imageCenters.size(); ++i) {
+        if (imageAxes[i].dot(axis) > 0.0) {
+            candidates.emplace_back((imageCenters[i] - center).squaredNorm(), i);
+        }
+    }
+    const size_t numSelected = std::min(numImages, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + numSelected, candidates.end());
+
+    std::vector<bool> seen(positions.size(), false);
+    for (size_t k = 0; k < numSelected; ++k) {
+        for (const uint32_t point : imagePoints[candidates[k].second]) {
+            if (!seen[point]) {
+                seen[point] = true;
+                points.push_back(point);
+            }
+        }
+    }
+}
+
+bool MapIndex::search(const uint8_t* descriptor, uint32_t& point, int& best, int& secondBest) const {
+    best = -1;
+    secondBest = -1;
+    const size_t numClusters = clusterStart.empty() ? 0 : clusterStart.size() - 1;
+    if (numClusters == 0) {
+        return false;
+    }
+
+    std::vector<std::pair<int, uint32_t>> ranked(numClusters);
+    for (size_t c = 0; c < numClusters; ++c) {
+        ranked[c] = {descriptorDot(descriptor, centroids.data() + c * kDescriptorSize), static_cast<uint32_t>(c)};
+    }
+    const size_t numProbes = std::clamp<size_t>(options.numProbes, 1, numClusters);
+    std::partial_sort(ranked.begin(), ranked.begin() + numProbes, ranked.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    for (size_t p = 0; p < numProbes; ++p) {
+        const uint32_t c = ranked[p].second;
+        for (uint32_t k = clusterStart[c]; k < clusterStart[c + 1]; ++k) {
+            const uint32_t candidate = clusterPoints[k];
+            const int dot = descriptorDot(descriptor, getDescriptor(candidate));
+            if (dot > best) {
+                secondBest = best;
+                best = dot;
+                point = candidate;
+            } else if (dot > secondBest) {
+                secondBest = dot;
+            }
+        }
+    }
+    return best >= 0;
+}
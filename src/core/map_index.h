@@ -0,0 +1,124 @@
+/**
+ * @file map_index.h
+ * @brief In-memory descriptor index of a sparse model for localization
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+#include <colmap/geometry/rigid3.h>
+#include <colmap/scene/reconstruction.h>
+
+/**
+ * @class MapIndex
+ * @brief Holds the 3D points of a sparse model with one SIFT descriptor each
+ *
+ * Every point keeps the mean of its track's descriptors, read from the
+ * database the model was built from and scaled back to SIFT norm. The
+ * descriptors are clustered by k-means into an inverted file: a global
+ * search compares a query with the centroids and then only with the
+ * points of the numProbes nearest clusters. For tracking, the points seen
+ * by the registered images closest to a pose form the local map.
+ *
+ * Read-only after load(), so one index can serve several localizers.
+ */
+class MapIndex {
+public:
+    static constexpr int kDescriptorSize = 128;
+
+    /**
+     * @struct Options
+     * @brief Inverted file layout
+     */
+    struct Options {
+        int numClusters = 256; /**< k-means clusters of the descriptors */
+        int numProbes = 3;     /**< Clusters searched per query */
+        int numIterations = 8; /**< k-means iterations */
+    };
+
+    /**
+     * @brief Construct an empty index
+     * @param options Inverted file layout
+     */
+    explicit MapIndex(const Options& options);
+
+    /**
+     * @brief Load a sparse model and the descriptors of its points
+     * @param modelPath Folder of the sparse model (cameras, images, points3D)
+     * @param databasePath COLMAP database the model was built from
+     * @return true if the model has points with descriptors
+     */
+    bool load(const std::string& modelPath, const std::string& databasePath);
+
+    /**
+     * @brief Get the model
+     * @return The sparse model
+     */
+    const colmap::Reconstruction& getReconstruction() const { return reconstruction; }
+
+    /**
+     * @brief Get the number of indexed points
+     * @return The point count
+     */
+    size_t size() const { return positions.size(); }
+
+    /**
+     * @brief Get the position of a point
+     * @param point Point index
+     * @return Position in model coordinates
+     */
+    const Eigen::Vector3d& getPosition(uint32_t point) const { return positions[point]; }
+
+    /**
+     * @brief Get the descriptor of a point
+     * @param point Point index
+     * @return kDescriptorSize bytes
+     */
+    const uint8_t* getDescriptor(uint32_t point) const {
+        return descriptors.data() + static_cast<size_t>(point) * kDescriptorSize;
+    }
+
+    /**
+     * @brief Find the points seen by the registered images closest to a pose
+     * @param camFromWorld The pose
+     * @param numImages Registered images to take the points of
+     * @param points Receives point indices without duplicates
+     */
+    void getLocalPoints(const colmap::Rigid3d& camFromWorld, size_t numImages,
+                        std::vector<uint32_t>& points) const;
+
+    /**
+     * @brief Find the most similar point descriptor to a query
+     * @param descriptor Query descriptor, kDescriptorSize bytes
+     * @param point Receives the best point
+     * @param best Receives the best dot product
+     * @param secondBest Receives the second best dot product, -1 if none
+     * @return false if no point was compared
+     */
+    bool search(const uint8_t* descriptor, uint32_t& point, int& best, int& secondBest) const;
+
+private:
+    void buildClusters();
+
+    Options options;
+    colmap::Reconstruction reconstruction;
+
+    std::vector<Eigen::Vector3d> positions;
+    std::vector<uint8_t> descriptors;
+
+    // Registered images with their centers, viewing directions and points
+    std::vector<Eigen::Vector3d> imageCenters;
+    std::vector<Eigen::Vector3d> imageAxes;
+    std::vector<std::vector<uint32_t>> imagePoints;
+
+    // Inverted file: cluster c holds clusterPoints[clusterStart[c] .. clusterStart[c + 1])
+    std::vector<uint8_t> centroids;
+    std::vector<uint32_t> clusterStart;
+    std::vector<uint32_t> clusterPoints;
+};
@@ -0,0 +1,193 @@
+#include "pair_selector.h"
+#include "logger.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+
+#include <Eigen/Core>
+
+namespace {
+
+constexpr double kEarthRadius = 6378137.0;
+
+// Balanced k-d tree over a fixed point set, stored implicitly: the node of
+// a range is its middle element, split on the axis of its depth
+class KdTree {
+public:
+    explicit KdTree(const std::vector<Eigen::Vector3d>& points)
+        : points(points), indices(points.size()) {
+        std::iota(indices.begin(), indices.end(), 0);
+        build(0, indices.size(), 0);
+    }
+
+    // Up to k nearest points other than the query point, within radius
+    // (0 for no limit), as (squared distance, index) nearest first
+    std::vector<std::pair<double, size_t>> findNearest(size_t query, size_t k, double radius) const {
+        Search search{points[query], query, k,
+                      radius > 0.0 ? radius * radius : std::numeric_limits<double>::infinity(), {}};
+        find(0, indices.size(), 0, search);
+        std::vector<std::pair<double, size_t>> result;
+        result.reserve(search.heap.size());
+        while (!search.heap.empty()) {
+            result.push_back(search.heap.top());
+            search.heap.pop();
+        }
+        std::reverse(result.begin(), result.end());
+        return result;
+    }
+
+private:
+    struct Search {
+        Eigen::Vector3d point;
+        size_t self;
+        size_t k;
+        double maxDistance2;
+        std::priority_queue<std::pair<double, size_t>> heap; // Farthest on top
+    };
+
+    void build(size_t begin, size_t end, int depth) {
+        if (end - begin <= 1) {
+            return;
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        const int axis = depth % 3;
+        std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+                         [&](size_t a, size_t b) { return points[a][axis] < points[b][axis]; });
+        build(begin, middle, depth + 1);
+        build(middle + 1, end, depth + 1);
+    }
+
+    void find(size_t begin, size_t end, int depth, Search& search) const {
+        if (begin >= end) {
+            return;
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        const size_t index = indices[middle];
+        if (index != search.self) {
+            const double distance2 = (points[index] - search.point).squaredNorm();
+            if (distance2 <= search.maxDistance2 &&
+                (search.heap.size() < search.k || distance2 < search.heap.top().first)) {
+                search.heap.emplace(distance2, index);
+                if (search.heap.size() > search.k) {
+                    search.heap.pop();
+                }
+            }
+        }
+
+        const int axis = depth % 3;
+        const double offset = search.point[axis] - points[index][axis];
+        const bool lowerFirst = offset < 0.0;
+        if (lowerFirst) {
+            find(begin, middle, depth + 1, search);
+        } else {
+            find(middle + 1, end, depth + 1, search);
+        }
+        const double bound = search.heap.size() < search.k ? search.maxDistance2
+                                                           : search.heap.top().first;
+        if (offset * offset <= bound) {
+            if (lowerFirst) {
+                find(middle + 1, end, depth + 1, search);
+            } else {
+                find(begin, middle, depth + 1, search);
+            }
+        }
+    }
+
+    const std::vector<Eigen::Vector3d>& points;
+    std::vector<size_t> indices;
+};
+
+} // namespace
+
+PairSelector::PairSelector(const Options& options)
+    : options(options) {}
+
+std::vector<std::pair<size_t, size_t>> PairSelector::select(
+        const std::string& root, const std::vector<std::string>& names) const {
+    std::vector<ImageMetadata> metadata(names.size());
+    TaskScheduler::getInstance().parallelFor(0, names.size(), [&](size_t i) {
+        ImageMetadata::readJpeg(root + "/" + names[i], metadata[i]);
+    });
+    return select(metadata);
+}
+
+std::vector<std::pair<size_t, size_t>> PairSelector::select(
+        const std::vector<ImageMetadata>& metadata) const {
+    const size_t numImages = metadata.size();
+    const size_t numNeighbors = std::max<size_t>(1, options.numNeighbors);
+    std::vector<std::pair<size_t, size_t>> pairs;
+    auto addPair = [&pairs](size_t a, size_t b) {
+        pairs.emplace_back(std::min(a, b), std::max(a, b));
+    };
+
+    // Nearest neighbours in a local east-north-up frame around the mean position
+    std::vector<size_t> positioned;
+    double latitude0 = 0.0;
+    double longitude0 = 0.0;
+    double altitude0 = 0.0;
+    for (size_t i = 0; i < numImages; ++i) {
+        if (metadata[i].hasGps) {
+            positioned.push_back(i);
+            latitude0 += metadata[i].latitude;
+            longitude0 += metadata[i].longitude;
+            altitude0 += metadata[i].altitude;
+        }
+    }
+    if (!positioned.empty()) {
+        latitude0 /= positioned.size();
+        longitude0 /= positioned.size();
+        altitude0 /= positioned.size();
+        const double metersPerDegree = kEarthRadius * M_PI / 180.0;
+        const double eastScale = metersPerDegree * std::cos(latitude0 * M_PI / 180.0);
+
+        std::vector<Eigen::Vector3d> points;
+        points.reserve(positioned.size());
+        for (const size_t i : positioned) {
+            points.emplace_back((metadata[i].longitude - longitude0) * eastScale,
+                                (metadata[i].latitude - latitude0) * metersPerDegree,
+                                metadata[i].altitude - altitude0);
+        }
+        const KdTree tree(points);
+        for (size_t i = 0; i < positioned.size(); ++i) {
+            for (const auto& neighbor : tree.findNearest(i, numNeighbors, options.radius)) {
+                addPair(positioned[i], positioned[neighbor.second]);
+            }
+        }
+    }
+
+    // Capture order for the images without a position
+    std::vector<size_t> order(numImages);
+    std::iota(order.begin(), order.end(), 0);
+    const bool allTimestamped = std::all_of(metadata.begin(), metadata.end(),
+                                            [](const ImageMetadata& m) { return m.hasTimestamp; });
+    if (allTimestamped) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return metadata[a].timestamp < metadata[b].timestamp;
+        });
+    }
+    const size_t halfWindow = std::max<size_t>(1, numNeighbors / 2);
+    for (size_t rank = 0; rank < numImages; ++rank) {
+        if (metadata[order[rank]].hasGps) {
+            continue;
+        }
+        const size_t first = rank >= halfWindow ? rank - halfWindow : 0;
+        const size_t last = std::min(numImages - 1, rank + halfWindow);
+        for (size_t other = first; other <= last; ++other) {
+            if (other != rank) {
+                addPair(order[rank], order[other]);
+            }
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    const size_t numExhaustivePairs = numImages > 1 ? numImages * (numImages - 1) / 2 : 0;
+    LOG_INFO("Spatial pairing: %zu of %zu images have GPS, %zu pairs instead of %zu",
+             positioned.size(), numImages, pairs.size(), numExhaustivePairs);
+    return pairs;
+}
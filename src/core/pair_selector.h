@@ -0,0 +1,63 @@
+/**
+ * @file pair_selector.h
+ * @brief Spatial image pair selection from EXIF GPS positions and capture times
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "image_metadata.h"
+
+/**
+ * @class PairSelector
+ * @brief Proposes the image pairs worth matching before any descriptor work
+ *
+ * Images with a GPS position are placed in a local east-north-up frame and
+ * indexed by a k-d tree; each is paired with its nearest neighbours,
+ * optionally limited to a radius. Images without a position (e.g. video
+ * frames) are paired with their neighbours in capture order, using the
+ * EXIF capture time when every image has one and the name order otherwise.
+ */
+class PairSelector {
+public:
+    /**
+     * @struct Options
+     * @brief Neighbourhood of an image
+     */
+    struct Options {
+        size_t numNeighbors = 20; /**< Images paired with each image */
+        double radius = 0.0;      /**< Maximum distance in meters, 0 for no limit */
+    };
+
+    /**
+     * @brief Construct a selector
+     * @param options Neighbourhood of an image
+     */
+    explicit PairSelector(const Options& options);
+
+    /**
+     * @brief Read the metadata of the images and select pairs
+     *
+     * Headers are read in parallel on the task scheduler.
+     *
+     * @param root Image folder
+     * @param names Image names relative to the folder
+     * @return Pairs of indices into names, first < second, sorted
+     */
+    std::vector<std::pair<size_t, size_t>> select(const std::string& root,
+                                                  const std::vector<std::string>& names) const;
+
+    /**
+     * @brief Select pairs from metadata that was already read
+     * @param metadata Metadata per image, in image order
+     * @return Pairs of image indices, first < second, sorted
+     */
+    std::vector<std::pair<size_t, size_t>> select(const std::vector<ImageMetadata>& metadata) const;
+
+private:
+    Options options;
+};
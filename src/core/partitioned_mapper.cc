@@ -0,0 +1,217 @@
+#include "partitioned_mapper.h"
+#include "logger.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <colmap/controllers/bundle_adjustment.h>
+#include <colmap/controllers/incremental_mapper.h>
+#include <colmap/estimators/alignment.h>
+#include <colmap/scene/database.h>
+#include <colmap/scene/scene_clustering.h>
+#include <colmap/util/misc.h>
+
+namespace {
+
+size_t countRegImages(const std::vector<std::shared_ptr<colmap::Reconstruction>>& models) {
+    size_t numRegImages = 0;
+    for (const auto& model : models) {
+        numRegImages += model->NumRegImages();
+    }
+    return numRegImages;
+}
+
+} // namespace
+
+PartitionedMapper::PartitionedMapper(const Options& options,
+                                     colmap::OptionManager& colmapOptions,
+                                     const std::string& workspacePath)
+    : options(options),
+      colmapOptions(colmapOptions),
+      clusterPath(colmap::JoinPaths(workspacePath, "clusters")) {}
+
+bool PartitionedMapper::run(Checkpoint& checkpoint,
+                            colmap::ReconstructionManager& reconstructionManager) {
+    const std::vector<std::vector<std::string>> clusters = partition(checkpoint);
+    if (clusters.empty()) {
+        LOG_ERROR("No verified image pairs to partition");
+        return false;
+    }
+    size_t numClusterImages = 0;
+    for (const auto& cluster : clusters) {
+        numClusterImages += cluster.size();
+    }
+    LOG_INFO("Partitioned the view graph into %zu clusters (%zu images including overlap)",
+             clusters.size(), numClusterImages);
+
+    // Each cluster mapper blocks one worker, its bundle adjustments get the
+    // worker's share of the cores
+    TaskScheduler& scheduler = TaskScheduler::getInstance();
+    const int numWorkers = std::max(1, scheduler.getNumWorkers());
+    const size_t numConcurrent = std::min(clusters.size(), static_cast<size_t>(numWorkers));
+    const int threadsPerCluster = std::max(1, numWorkers / static_cast<int>(numConcurrent));
+
+    std::vector<std::vector<std::shared_ptr<colmap::Reconstruction>>> clusterModels(clusters.size());
+    scheduler.parallelFor(0, clusters.size(), [&](size_t i) {
+        clusterModels[i] = mapCluster(i, clusters[i], threadsPerCluster, checkpoint);
+    });
+
+    std::vector<std::shared_ptr<colmap::Reconstruction>> models;
+    for (auto& cluster : clusterModels) {
+        models.insert(models.end(), cluster.begin(), cluster.end());
+    }
+    if (models.empty()) {
+        LOG_ERROR("No cluster produced a model");
+        return false;
+    }
+
+    const size_t numClusterModels = models.size();
+    models = merge(std::move(models));
+    LOG_INFO("Merged %zu cluster models into %zu models", numClusterModels, models.size());
+
+    reconstructionManager.Clear();
+    for (const auto& model : models) {
+        LOG_INFO("Global bundle adjustment of a model with %zu images",
+                 static_cast<size_t>(model->NumRegImages()));
+        colmap::BundleAdjustmentController adjuster(colmapOptions, model);
+        adjuster.Start();
+        adjuster.Wait();
+        *reconstructionManager.Get(reconstructionManager.Add()) = *model;
+    }
+    return true;
+}
+
+std::vector<std::vector<std::string>> PartitionedMapper::partition(Checkpoint& checkpoint) {
+    // The clustering depends on the matches, so a resumed job keeps the
+    // assignment its finished clusters were reconstructed with. Only a
+    // cluster recorded under the current checkpoint vouches for the list;
+    // a list left by another run is recomputed
+    const std::string listPath = colmap::JoinPaths(clusterPath, "clusters.txt");
+    std::vector<std::vector<std::string>> clusters;
+    if (checkpoint.isEnabled()) {
+        std::ifstream file(listPath);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            size_t index = 0;
+            std::string name;
+            if (!(fields >> index) || !std::getline(fields >> std::ws, name)) {
+                continue;
+            }
+            if (clusters.size() <= index) {
+                clusters.resize(index + 1);
+            }
+            clusters[index].push_back(name);
+        }
+        for (size_t i = 0; i < clusters.size(); ++i) {
+            if (checkpoint.isStageDone("mapping/cluster/" + std::to_string(i))) {
+                LOG_INFO("Reusing the cluster assignment in %s", listPath.c_str());
+                return clusters;
+            }
+        }
+        clusters.clear();
+    }
+
+    colmap::SceneClustering::Options clusteringOptions;
+    clusteringOptions.leaf_max_num_images = static_cast<int>(options.maxClusterImages);
+    clusteringOptions.image_overlap = static_cast<int>(options.clusterOverlap);
+    const colmap::Database database(*colmapOptions.database_path);
+    const colmap::SceneClustering clustering =
+        colmap::SceneClustering::Create(clusteringOptions, database);
+    for (const auto* leaf : clustering.GetLeafClusters()) {
+        std::vector<std::string> names;
+        names.reserve(leaf->image_ids.size());
+        for (const colmap::image_t imageId : leaf->image_ids) {
+            names.push_back(database.ReadImage(imageId).Name());
+        }
+        clusters.push_back(std::move(names));
+    }
+    // Largest first so the longest mappers start early
+    std::stable_sort(clusters.begin(), clusters.end(),
+                     [](const auto& a, const auto& b) { return a.size() > b.size(); });
+
+    if (checkpoint.isEnabled()) {
+        colmap::CreateDirIfNotExists(clusterPath, true);
+        const std::string tempPath = listPath + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::trunc);
+            for (size_t i = 0; i < clusters.size(); ++i) {
+                for (const auto& name : clusters[i]) {
+                    file << i << ' ' << name << '\n';
+                }
+            }
+        }
+        std::filesystem::rename(tempPath, listPath);
+    }
+    return clusters;
+}
+
+std::vector<std::shared_ptr<colmap::Reconstruction>> PartitionedMapper::mapCluster(
+        size_t index, const std::vector<std::string>& imageNames, int numThreads,
+        Checkpoint& checkpoint) {
+    const std::string stage = "mapping/cluster/" + std::to_string(index);
+    const std::string modelPath = colmap::JoinPaths(clusterPath, std::to_string(index));
+    auto clusterManager = std::make_shared<colmap::ReconstructionManager>();
+
+    if (checkpoint.isStageDone(stage)) {
+        for (const auto& path : colmap::GetDirList(modelPath)) {
+            clusterManager->Read(path);
+        }
+    } else {
+        auto mapperOptions = std::make_shared<colmap::IncrementalMapperOptions>(*colmapOptions.mapper);
+        mapperOptions->image_names.insert(imageNames.begin(), imageNames.end());
+        mapperOptions->num_threads = numThreads;
+        colmap::IncrementalMapperController mapper(
+            mapperOptions, *colmapOptions.image_path, *colmapOptions.database_path, clusterManager);
+        mapper.Start();
+        mapper.Wait();
+
+        if (checkpoint.isEnabled()) {
+            // A model folder left by an interrupted run may hold more models
+            std::filesystem::remove_all(modelPath);
+            colmap::CreateDirIfNotExists(modelPath, true);
+            clusterManager->Write(modelPath);
+            checkpoint.markStageDone(stage);
+        }
+    }
+
+    std::vector<std::shared_ptr<colmap::Reconstruction>> models;
+    for (size_t i = 0; i < clusterManager->Size(); ++i) {
+        models.push_back(clusterManager->Get(i));
+    }
+    LOG_INFO("Cluster %zu: %zu of %zu images registered in %zu models",
+             index, countRegImages(models), imageNames.size(), models.size());
+    return models;
+}
+
+std::vector<std::shared_ptr<colmap::Reconstruction>> PartitionedMapper::merge(
+        std::vector<std::shared_ptr<colmap::Reconstruction>> models) {
+    std::sort(models.begin(), models.end(), [](const auto& a, const auto& b) {
+        return a->NumRegImages() > b->NumRegImages();
+    });
+
+    // Grow the largest model by every model that aligns with it; models
+    // sharing no images with it seed the next merged model
+    std::vector<std::shared_ptr<colmap::Reconstruction>> merged;
+    while (!models.empty()) {
+        std::shared_ptr<colmap::Reconstruction> target = models.front();
+        models.erase(models.begin());
+        bool grown = true;
+        while (grown) {
+            grown = false;
+            for (auto it = models.begin(); it != models.end();) {
+                if (colmap::MergeReconstructions(options.maxMergeError, **it, *target)) {
+                    it = models.erase(it);
+                    grown = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        merged.push_back(std::move(target));
+    }
+    return merged;
+}
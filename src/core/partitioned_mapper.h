@@ -0,0 +1,78 @@
+/**
+ * @file partitioned_mapper.h
+ * @brief Divide-and-conquer sparse reconstruction of large image sets
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <colmap/controllers/option_manager.h>
+#include <colmap/scene/reconstruction.h>
+#include <colmap/scene/reconstruction_manager.h>
+
+#include "checkpoint.h"
+
+/**
+ * @class PartitionedMapper
+ * @brief Reconstructs overlapping clusters of the view graph in parallel
+ *        and merges them into one model
+ *
+ * The view graph of the database (images connected by verified pairs,
+ * weighted by their inliers) is split by normalized cuts into clusters of
+ * at most maxClusterImages images, each extended by the clusterOverlap
+ * most strongly connected images of its neighbours. Every cluster is
+ * reconstructed by its own incremental mapper on the task scheduler.
+ * The cluster models are then merged greedily, each merge being a
+ * similarity alignment on the images two models share, and the merged
+ * models are refined by a global bundle adjustment.
+ *
+ * With checkpoints enabled the cluster assignment and every finished
+ * cluster model are kept in <workspace>/clusters, so a restarted
+ * job only reconstructs the clusters that were not done.
+ */
+class PartitionedMapper {
+public:
+    /**
+     * @struct Options
+     * @brief Cluster layout and merge tolerance
+     */
+    struct Options {
+        size_t maxClusterImages = 500; /**< Images per cluster before overlap */
+        size_t clusterOverlap = 50;    /**< Images shared with neighbouring clusters */
+        double maxMergeError = 8.0;    /**< Reprojection error in pixels for merge inliers */
+    };
+
+    /**
+     * @brief Construct a mapper for a workspace
+     * @param options Cluster layout
+     * @param colmapOptions COLMAP options providing the database, images and mapper settings
+     * @param workspacePath Output folder of the reconstruction
+     */
+    PartitionedMapper(const Options& options,
+                      colmap::OptionManager& colmapOptions,
+                      const std::string& workspacePath);
+
+    /**
+     * @brief Reconstruct all clusters, merge and refine them
+     * @param checkpoint Checkpoint of the workspace
+     * @param reconstructionManager Receives the merged models, largest first
+     * @return true if at least one model was reconstructed
+     */
+    bool run(Checkpoint& checkpoint, colmap::ReconstructionManager& reconstructionManager);
+
+private:
+    std::vector<std::vector<std::string>> partition(Checkpoint& checkpoint);
+    std::vector<std::shared_ptr<colmap::Reconstruction>> mapCluster(
+        size_t index, const std::vector<std::string>& imageNames, int numThreads,
+        Checkpoint& checkpoint);
+    std::vector<std::shared_ptr<colmap::Reconstruction>> merge(
+        std::vector<std::shared_ptr<colmap::Reconstruction>> models);
+
+    Options options;
+    colmap::OptionManager& colmapOptions;
+    std::string clusterPath;
+};
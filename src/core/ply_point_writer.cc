@@ -0,0 +1,72 @@
+#include "ply_point_writer.h"
+
+#include <cstdio>
+
+namespace {
+
+// Wide enough for any vertex count, and still an integer to PLY parsers
+constexpr int kCountDigits = 15;
+constexpr size_t kBufferPoints = 1 << 16;
+
+std::string formatCount(size_t count) {
+    char digits[kCountDigits + 1];
+    std::snprintf(digits, sizeof(digits), "%0*zu", kCountDigits, count);
+    return digits;
+}
+
+} // namespace
+
+bool PlyPointWriter::open(const std::string& path) {
+    close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    numPoints = 0;
+    buffer.reserve(kBufferPoints);
+
+    file << "ply\n";
+    file << "format binary_little_endian 1.0\n";
+    file << "element vertex ";
+    countPosition = file.tellp();
+    file << formatCount(0) << "\n";
+    file << "property float x\n";
+    file << "property float y\n";
+    file << "property float z\n";
+    file << "property float nx\n";
+    file << "property float ny\n";
+    file << "property float nz\n";
+    file << "property uchar red\n";
+    file << "property uchar green\n";
+    file << "property uchar blue\n";
+    file << "end_header\n";
+    return static_cast<bool>(file);
+}
+
+void PlyPointWriter::write(const Point& point) {
+    buffer.push_back(point);
+    numPoints += 1;
+    if (buffer.size() >= kBufferPoints) {
+        flush();
+    }
+}
+
+bool PlyPointWriter::close() {
+    if (!file.is_open()) {
+        return true;
+    }
+    flush();
+    file.seekp(countPosition);
+    file << formatCount(numPoints);
+    const bool ok = static_cast<bool>(file);
+    file.close();
+    return ok;
+}
+
+void PlyPointWriter::flush() {
+    if (!buffer.empty()) {
+        file.write(reinterpret_cast<const char*>(buffer.data()),
+                   static_cast<std::streamsize>(buffer.size() * sizeof(Point)));
+        buffer.clear();
+    }
+}
@@ -0,0 +1,76 @@
+/**
+ * @file ply_point_writer.h
+ * @brief Incremental writer of binary PLY point clouds
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @class PlyPointWriter
+ * @brief Appends points to a binary PLY file without keeping them in memory
+ *
+ * The file has the layout of COLMAP's fused.ply (position, normal and
+ * color per vertex), so it can be read by COLMAP's meshers and viewers.
+ * The vertex count in the header is a fixed-width placeholder that
+ * close() fills in. Points are buffered in blocks and written as the
+ * buffer fills.
+ */
+class PlyPointWriter {
+public:
+    /**
+     * @struct Point
+     * @brief One vertex, in the binary layout of the file
+     */
+#pragma pack(push, 1)
+    struct Point {
+        float x, y, z;
+        float nx, ny, nz;
+        uint8_t r, g, b;
+    };
+#pragma pack(pop)
+
+    PlyPointWriter() = default;
+    ~PlyPointWriter() { close(); }
+
+    PlyPointWriter(const PlyPointWriter&) = delete;
+    PlyPointWriter& operator=(const PlyPointWriter&) = delete;
+
+    /**
+     * @brief Create the file and write its header
+     * @param path Output file, replaced if it exists
+     * @return true on success
+     */
+    bool open(const std::string& path);
+
+    /**
+     * @brief Append a point
+     * @param point The vertex
+     */
+    void write(const Point& point);
+
+    /**
+     * @brief Flush the buffered points and write the vertex count
+     * @return true if every point reached the file
+     */
+    bool close();
+
+    /**
+     * @brief Get the number of points written so far
+     * @return The vertex count
+     */
+    size_t getNumPoints() const { return numPoints; }
+
+private:
+    void flush();
+
+    std::ofstream file;
+    std::streampos countPosition;
+    std::vector<Point> buffer;
+    size_t numPoints = 0;
+};
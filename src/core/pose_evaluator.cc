@@ -0,0 +1,111 @@
+#include "pose_evaluator.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+namespace {
+
+struct GroundTruthPose {
+    Eigen::Quaterniond rotation;
+    Eigen::Vector3d translation;
+};
+
+double median(std::vector<double> values) {
+    const size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    return values[middle];
+}
+
+} // namespace
+
+bool PoseEvaluator::evaluate(const colmap::Reconstruction& reconstruction,
+                             const std::string& groundTruthPath, Result& result) {
+    result = Result();
+    std::ifstream file(groundTruthPath);
+    if (!file) {
+        LOG_ERROR("Failed to open ground truth poses %s", groundTruthPath.c_str());
+        return false;
+    }
+    std::unordered_map<std::string, GroundTruthPose> groundTruth;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        double qw, qx, qy, qz, tx, ty, tz;
+        if (!(fields >> name >> qw >> qx >> qy >> qz >> tx >> ty >> tz)) {
+            LOG_WARNING("Skipping malformed ground truth line: %s", line.c_str());
+            continue;
+        }
+        groundTruth[name] = {Eigen::Quaterniond(qw, qx, qy, qz).normalized(), Eigen::Vector3d(tx, ty, tz)};
+    }
+    result.numGroundTruth = groundTruth.size();
+
+    // Camera centers and rotations of the images known to both
+    std::vector<Eigen::Vector3d> estimatedCenters;
+    std::vector<Eigen::Vector3d> trueCenters;
+    std::vector<Eigen::Matrix3d> estimatedRotations;
+    std::vector<Eigen::Matrix3d> trueRotations;
+    for (const colmap::image_t imageId : reconstruction.RegImageIds()) {
+        const colmap::Image& image = reconstruction.Image(imageId);
+        const auto it = groundTruth.find(image.Name());
+        if (it == groundTruth.end()) {
+            continue;
+        }
+        const Eigen::Matrix3d trueRotation = it->second.rotation.toRotationMatrix();
+        estimatedCenters.push_back(image.ProjectionCenter());
+        trueCenters.push_back(-trueRotation.transpose() * it->second.translation);
+        estimatedRotations.push_back(image.CamFromWorld().rotation.toRotationMatrix());
+        trueRotations.push_back(trueRotation);
+    }
+    result.numRegistered = estimatedCenters.size();
+    result.registeredFraction = result.numGroundTruth > 0
+        ? static_cast<double>(result.numRegistered) / result.numGroundTruth : 0.0;
+    if (result.numRegistered < 3) {
+        LOG_WARNING("Only %zu of %zu ground truth images are registered, poses not evaluated",
+                    result.numRegistered, result.numGroundTruth);
+        return false;
+    }
+
+    // Similarity from the model to the ground truth frame
+    Eigen::Matrix3Xd source(3, result.numRegistered);
+    Eigen::Matrix3Xd target(3, result.numRegistered);
+    for (size_t i = 0; i < result.numRegistered; ++i) {
+        source.col(i) = estimatedCenters[i];
+        target.col(i) = trueCenters[i];
+    }
+    const Eigen::Matrix4d alignment = Eigen::umeyama(source, target, true);
+    const Eigen::Matrix3d scaledRotation = alignment.topLeftCorner<3, 3>();
+    const double scale = std::cbrt(scaledRotation.determinant());
+    const Eigen::Matrix3d alignmentRotation = scaledRotation / scale;
+
+    std::vector<double> positionErrors;
+    std::vector<double> rotationErrors;
+    for (size_t i = 0; i < result.numRegistered; ++i) {
+        const Eigen::Vector3d aligned = scaledRotation * estimatedCenters[i] + alignment.topRightCorner<3, 1>();
+        positionErrors.push_back((aligned - trueCenters[i]).norm());
+        // The aligned camera from world rotation is R_est * R_align^T
+        const Eigen::Matrix3d difference =
+            trueRotations[i].transpose() * estimatedRotations[i] * alignmentRotation.transpose();
+        const double cosine = std::clamp((difference.trace() - 1.0) / 2.0, -1.0, 1.0);
+        rotationErrors.push_back(std::acos(cosine) * 180.0 / M_PI);
+    }
+    result.positionErrorMedian = median(positionErrors);
+    result.positionErrorMax = *std::max_element(positionErrors.begin(), positionErrors.end());
+    result.rotationErrorMedian = median(rotationErrors);
+    result.rotationErrorMax = *std::max_element(rotationErrors.begin(), rotationErrors.end());
+    LOG_INFO("Pose accuracy: %zu/%zu registered, position error median %.4f max %.4f, "
+             "rotation error median %.3f max %.3f deg", result.numRegistered, result.numGroundTruth,
+             result.positionErrorMedian, result.positionErrorMax, result.rotationErrorMedian,
+             result.rotationErrorMax);
+    return true;
+}
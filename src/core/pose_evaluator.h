@@ -0,0 +1,53 @@
+/**
+ * @file pose_evaluator.h
+ * @brief Accuracy of reconstructed camera poses against ground truth
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <colmap/scene/reconstruction.h>
+
+/**
+ * @class PoseEvaluator
+ * @brief Compares the registered images of a model with known poses
+ *
+ * Ground truth is a text file with one image per line, in the pose
+ * convention of COLMAP's images.txt:
+ *
+ *   NAME QW QX QY QZ TX TY TZ
+ *
+ * with the camera from world rotation and translation; lines starting with
+ * '#' are comments. Images are matched by name. The model is aligned to
+ * the ground truth by the similarity transform (Umeyama) between the
+ * camera centers, since a reconstruction is only defined up to one, and
+ * the errors are measured after the alignment in ground truth units.
+ */
+class PoseEvaluator {
+public:
+    /**
+     * @struct Result
+     * @brief Registration and pose errors
+     */
+    struct Result {
+        size_t numGroundTruth = 0;        /**< Images with a known pose */
+        size_t numRegistered = 0;         /**< Of those, images registered in the model */
+        double registeredFraction = 0.0;
+        double positionErrorMedian = 0.0; /**< Camera center error after alignment */
+        double positionErrorMax = 0.0;
+        double rotationErrorMedian = 0.0; /**< Rotation error in degrees */
+        double rotationErrorMax = 0.0;
+    };
+
+    /**
+     * @brief Evaluate a model
+     * @param reconstruction The model
+     * @param groundTruthPath Ground truth poses
+     * @param result Receives the errors
+     * @return false if the ground truth cannot be read or fewer than three images match
+     */
+    static bool evaluate(const colmap::Reconstruction& reconstruction,
+                         const std::string& groundTruthPath, Result& result);
+};
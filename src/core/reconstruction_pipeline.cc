@@ -0,0 +1,133 @@
+#include "reconstruction_pipeline.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+
+ReconstructionPipeline::ReconstructionPipeline(const Options& options, size_t numImages,
+                                               TaskScheduler& scheduler)
+    : options(options),
+      numImages(numImages),
+      scheduler(scheduler) {
+    this->options.queueCapacity = std::max<size_t>(1, options.queueCapacity);
+}
+
+bool ReconstructionPipeline::run() {
+    if (!extractFn || !matchFn || !verifyFn) {
+        LOG_ERROR("Reconstruction pipeline started without all stages set");
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    extracted.clear();
+    extracted.reserve(numImages);
+    nextImage = 0;
+    extractionsInFlight = 0;
+
+    LOG_INFO("Pipeline: %zu images on %d workers, up to %zu pairs in flight",
+             numImages, std::max(1, scheduler.getNumWorkers()), options.queueCapacity);
+
+    // Every task is added to the group before the task that spawned it
+    // finishes, so the group only drains once all stages are done.
+    TaskGroup tasks(scheduler);
+    group = &tasks;
+    scheduleExtractions();
+    tasks.wait();
+    group = nullptr;
+
+    elapsedSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    LOG_INFO("Pipeline finished in %.2f s: %zu images extracted, %zu pairs matched, %zu verified",
+             elapsedSeconds, extracted.size(), pairsMatched.load(), pairsVerified.load());
+    return true;
+}
+
+ReconstructionPipeline::Stats ReconstructionPipeline::getStats() const {
+    Stats stats;
+    stats.imagesExtracted = extracted.size();
+    stats.pairsMatched = pairsMatched.load();
+    stats.pairsVerified = pairsVerified.load();
+    stats.elapsedSeconds = elapsedSeconds;
+    return stats;
+}
+
+void ReconstructionPipeline::scheduleExtractions() {
+    // Keep at most one extraction per worker in flight, and pause while the
+    // downstream stages are behind. Completing pairs call back in here.
+    const size_t maxExtractions = static_cast<size_t>(std::max(1, scheduler.getNumWorkers()));
+    std::vector<size_t> ready;
+    {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        while (nextImage < numImages &&
+               extractionsInFlight < maxExtractions &&
+               pairsInFlight.load() + ready.size() < options.queueCapacity) {
+            ready.push_back(nextImage++);
+            ++extractionsInFlight;
+        }
+    }
+    for (size_t imageIndex : ready) {
+        group->run([this, imageIndex] { extractImage(imageIndex); },
+                   TaskScheduler::Priority::LOW);
+    }
+}
+
+void ReconstructionPipeline::extractImage(size_t imageIndex) {
+    if (extractFn(imageIndex, workerSlot())) {
+        // Registering the image and snapshotting its partners under one lock
+        // guarantees every pair is emitted exactly once, by whichever of the
+        // two images finishes extraction last.
+        std::vector<size_t> partners;
+        {
+            std::lock_guard<std::mutex> lock(extractedMutex);
+            partners = extracted;
+            extracted.push_back(imageIndex);
+        }
+
+        for (size_t other : partners) {
+            PairMatches pair;
+            pair.first = std::min(other, imageIndex);
+            pair.second = std::max(other, imageIndex);
+            if (pairFilter && !pairFilter(pair.first, pair.second)) {
+                continue;
+            }
+            ++pairsInFlight;
+            group->run([this, pair = std::move(pair)] { matchPair(pair); },
+                       TaskScheduler::Priority::NORMAL);
+        }
+    } else {
+        LOG_WARNING("Pipeline: skipping image %zu after failed extraction", imageIndex);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        --extractionsInFlight;
+    }
+    scheduleExtractions();
+}
+
+void ReconstructionPipeline::matchPair(PairMatches pair) {
+    if (!matchFn(pair, workerSlot())) {
+        finishPair();
+        return;
+    }
+    ++pairsMatched;
+    group->run([this, pair = std::move(pair)] { verifyPair(pair); },
+               TaskScheduler::Priority::HIGH);
+}
+
+void ReconstructionPipeline::verifyPair(const PairMatches& pair) {
+    if (verifyFn(pair, workerSlot())) {
+        ++pairsVerified;
+    }
+    finishPair();
+}
+
+void ReconstructionPipeline::finishPair() {
+    --pairsInFlight;
+    scheduleExtractions();
+}
+
+int ReconstructionPipeline::workerSlot() {
+    return std::max(0, TaskScheduler::getCurrentWorkerIndex());
+}
@@ -0,0 +1,152 @@
+/**
+ * @file reconstruction_pipeline.h
+ * @brief Overlapped extract -> match -> verify scheduler
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "task_scheduler.h"
+
+/**
+ * @struct PairMatches
+ * @brief Putative correspondences between two images of the pipeline
+ *
+ * Image indices refer to the position of the image in the pipeline input
+ * list, not to database ids.
+ */
+struct PairMatches {
+    size_t first = 0;                                   /**< Index of the first image */
+    size_t second = 0;                                  /**< Index of the second image */
+    std::vector<std::pair<uint32_t, uint32_t>> matches; /**< Keypoint index pairs */
+    std::vector<float> scores;                          /**< Per-match confidence, higher is better */
+};
+
+/**
+ * @class ReconstructionPipeline
+ * @brief Runs feature extraction, matching and geometric verification as
+ *        overlapping stages on the shared TaskScheduler
+ *
+ * Matching of a pair (i, j) is scheduled as soon as both images are
+ * extracted, and verification streams behind matching. Downstream stages
+ * run at higher priority than upstream ones, and new extractions are only
+ * started while the number of pairs in flight stays below the configured
+ * capacity, so the backlog between stages remains bounded. The stages
+ * themselves are supplied as callbacks so that the scheduler does not
+ * depend on a particular feature or matcher implementation. Callbacks
+ * receive the index of the scheduler worker running them, which can be
+ * used to address per-worker state.
+ */
+class ReconstructionPipeline {
+public:
+    /**
+     * @struct Options
+     * @brief Back-pressure settings for the pipeline stages
+     */
+    struct Options {
+        size_t queueCapacity = 64; /**< Pairs in flight before extraction is paused */
+    };
+
+    /**
+     * @struct Stats
+     * @brief Counters collected while the pipeline runs
+     */
+    struct Stats {
+        size_t imagesExtracted = 0; /**< Images that passed extraction */
+        size_t pairsMatched = 0;    /**< Pairs handed to verification */
+        size_t pairsVerified = 0;   /**< Pairs that passed verification */
+        double elapsedSeconds = 0;  /**< Wall time of run() */
+    };
+
+    /// Extract features for one image; returns false if the image is unusable
+    using ExtractFn = std::function<bool(size_t imageIndex, int workerIndex)>;
+    /// Match one pair; returns false if the pair should not be verified
+    using MatchFn = std::function<bool(PairMatches& pair, int workerIndex)>;
+    /// Verify one pair; returns false if the pair was rejected
+    using VerifyFn = std::function<bool(const PairMatches& pair, int workerIndex)>;
+    /// Decide whether two extracted images should be matched at all
+    using PairFilter = std::function<bool(size_t first, size_t second)>;
+
+    /**
+     * @brief Construct a pipeline over a fixed list of images
+     * @param options Back-pressure settings
+     * @param numImages Number of images in the input list
+     * @param scheduler Scheduler running the stage tasks
+     */
+    ReconstructionPipeline(const Options& options, size_t numImages,
+                           TaskScheduler& scheduler = TaskScheduler::getInstance());
+
+    /**
+     * @brief Set the extraction stage
+     * @param fn Stage callback
+     */
+    void setExtractStage(ExtractFn fn) { extractFn = std::move(fn); }
+
+    /**
+     * @brief Set the matching stage
+     * @param fn Stage callback
+     */
+    void setMatchStage(MatchFn fn) { matchFn = std::move(fn); }
+
+    /**
+     * @brief Set the verification stage
+     * @param fn Stage callback
+     */
+    void setVerifyStage(VerifyFn fn) { verifyFn = std::move(fn); }
+
+    /**
+     * @brief Restrict which image pairs are matched (default: all pairs)
+     * @param fn Pair filter, called with first < second
+     */
+    void setPairFilter(PairFilter fn) { pairFilter = std::move(fn); }
+
+    /**
+     * @brief Run all stages to completion
+     * @return true if all stage callbacks were set, false otherwise
+     */
+    bool run();
+
+    /**
+     * @brief Get the counters of the last run
+     * @return The pipeline statistics
+     */
+    Stats getStats() const;
+
+private:
+    void scheduleExtractions();
+    void extractImage(size_t imageIndex);
+    void matchPair(PairMatches pair);
+    void verifyPair(const PairMatches& pair);
+    void finishPair();
+
+    static int workerSlot();
+
+    Options options;
+    size_t numImages;
+    TaskScheduler& scheduler;
+    TaskGroup* group = nullptr;
+
+    ExtractFn extractFn;
+    MatchFn matchFn;
+    VerifyFn verifyFn;
+    PairFilter pairFilter;
+
+    std::mutex scheduleMutex;
+    size_t nextImage = 0;
+    size_t extractionsInFlight = 0;
+    std::atomic<size_t> pairsInFlight{0};
+
+    std::mutex extractedMutex;
+    std::vector<size_t> extracted; /**< Images that finished extraction, in completion order */
+
+    std::atomic<size_t> pairsMatched{0};
+    std::atomic<size_t> pairsVerified{0};
+    double elapsedSeconds = 0;
+};
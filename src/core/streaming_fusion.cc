@@ -0,0 +1,434 @@
+#include "streaming_fusion.h"
+#include "logger.h"
+#include "memory_budget.h"
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <unordered_set>
+
+#include <Eigen/Core>
+#include <colmap/geometry/rigid3.h>
+#include <colmap/mvs/depth_map.h>
+#include <colmap/mvs/normal_map.h>
+#include <colmap/util/misc.h>
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+constexpr int64_t kBlockSide = 8;
+constexpr int64_t kRegionBlocks = 4;
+constexpr int kPlanStride = 4;          // Depth pixels sampled per row and column when planning
+constexpr size_t kPlanBatch = 64;       // Depth maps read per planning batch
+constexpr int64_t kKeyRange = 1 << 20;  // Block and region coordinates must stay within +-kKeyRange
+
+// Approximate heap use per voxel and per block, including the hash nodes
+constexpr size_t kVoxelBytes = 64;
+constexpr size_t kBlockBytes = 128;
+
+int64_t floorDiv(int64_t a, int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+bool inKeyRange(int64_t x, int64_t y, int64_t z) {
+    return std::abs(x) < kKeyRange && std::abs(y) < kKeyRange && std::abs(z) < kKeyRange;
+}
+
+uint64_t packKey(int64_t x, int64_t y, int64_t z) {
+    return (static_cast<uint64_t>(x + kKeyRange) << 42) |
+           (static_cast<uint64_t>(y + kKeyRange) << 21) |
+           static_cast<uint64_t>(z + kKeyRange);
+}
+
+void unpackKey(uint64_t key, int64_t& x, int64_t& y, int64_t& z) {
+    constexpr uint64_t mask = (1 << 21) - 1;
+    x = static_cast<int64_t>(key >> 42) - kKeyRange;
+    y = static_cast<int64_t>((key >> 21) & mask) - kKeyRange;
+    z = static_cast<int64_t>(key & mask) - kKeyRange;
+}
+
+// Back-projection of the pixels of a depth map into the model frame
+struct PixelToWorld {
+    Eigen::Matrix3f rotation;
+    Eigen::Vector3f center;
+    float fx, fy, cx, cy;
+
+    PixelToWorld(const colmap::Camera& camera, const colmap::Image& image, int width, int height) {
+        // Depth maps may be downsized from the undistorted images
+        const float scaleX = static_cast<float>(width) / camera.width;
+        const float scaleY = static_cast<float>(height) / camera.height;
+        fx = static_cast<float>(camera.FocalLengthX()) * scaleX;
+        fy = static_cast<float>(camera.FocalLengthY()) * scaleY;
+        cx = static_cast<float>(camera.PrincipalPointX()) * scaleX;
+        cy = static_cast<float>(camera.PrincipalPointY()) * scaleY;
+        const colmap::Rigid3d worldFromCam = colmap::Inverse(image.CamFromWorld());
+        rotation = worldFromCam.rotation.toRotationMatrix().cast<float>();
+        center = worldFromCam.translation.cast<float>();
+    }
+
+    Eigen::Vector3f point(int col, int row, float depth) const {
+        return rotation * Eigen::Vector3f((col - cx) * depth / fx, (row - cy) * depth / fy, depth) + center;
+    }
+};
+
+std::string depthMapPath(const std::string& densePath, const std::string& folder,
+                         const std::string& name, const std::string& outputType) {
+    return colmap::JoinPaths(densePath, "stereo", folder, name + "." + outputType + ".bin");
+}
+
+} // namespace
+
+StreamingFusion::StreamingFusion(const Options& options) : options(options) {
+}
+
+bool StreamingFusion::run(const colmap::Reconstruction& reconstruction, const std::string& densePath,
+                          const std::string& outputType, const std::string& outputPath) {
+    std::vector<colmap::image_t> order;
+    for (const colmap::image_t imageId : reconstruction.RegImageIds()) {
+        const std::string& name = reconstruction.Image(imageId).Name();
+        if (std::filesystem::exists(depthMapPath(densePath, "depth_maps", name, outputType))) {
+            order.push_back(imageId);
+        }
+    }
+    if (order.empty()) {
+        LOG_ERROR("No %s depth maps to fuse in %s", outputType.c_str(), densePath.c_str());
+        return false;
+    }
+    std::sort(order.begin(), order.end(), [&](colmap::image_t a, colmap::image_t b) {
+        return reconstruction.Image(a).Name() < reconstruction.Image(b).Name();
+    });
+
+    voxelSize = options.voxelSize > 0.0 ? options.voxelSize : estimateVoxelSize(reconstruction);
+    LOG_INFO("Streaming fusion of %zu depth maps, voxel size %g", order.size(), voxelSize);
+    planRegions(reconstruction, order, densePath, outputType);
+
+    if (!writer.open(outputPath)) {
+        LOG_ERROR("Failed to create %s", outputPath.c_str());
+        return false;
+    }
+    MemoryReservation reservation;
+    if (options.maxActiveBytes > 0) {
+        reservation = MemoryReservation(MemoryBudget::Category::DEPTH_MAPS, options.maxActiveBytes);
+    }
+
+    std::vector<Sample> samples;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (backProject(reconstruction, order[i], densePath, outputType, samples)) {
+            integrate(static_cast<int>(i), samples);
+        }
+        retire(static_cast<int>(i));
+        enforceCap();
+        if ((i + 1) % 100 == 0) {
+            LOG_INFO("Fused %zu/%zu depth maps, %zu active blocks, %zu points written",
+                     i + 1, order.size(), blocks.size(), writer.getNumPoints());
+        }
+    }
+    retire(std::numeric_limits<int>::max());
+
+    if (numForcedEvictions > 0) {
+        LOG_WARNING("%zu blocks were written early to stay within the fusion memory cap",
+                    numForcedEvictions);
+    }
+    blocks.clear();
+    retirements.clear();
+    regionLastUse.clear();
+    numActiveVoxels = 0;
+    numForcedEvictions = 0;
+
+    if (!writer.close()) {
+        LOG_ERROR("Failed to write %s", outputPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+double StreamingFusion::estimateVoxelSize(const colmap::Reconstruction& reconstruction) const {
+    // Footprint of one depth map pixel at the median depth of each image
+    std::vector<double> footprints;
+    for (const colmap::image_t imageId : reconstruction.RegImageIds()) {
+        const colmap::Image& image = reconstruction.Image(imageId);
+        const colmap::Camera& camera = reconstruction.Camera(image.CameraId());
+        std::vector<double> depths;
+        for (const auto& point2D : image.Points2D()) {
+            if (point2D.HasPoint3D()) {
+                const Eigen::Vector3d xyz = reconstruction.Point3D(point2D.point3D_id).xyz;
+                const double depth = (image.CamFromWorld() * xyz).z();
+                if (depth > 0.0) {
+                    depths.push_back(depth);
+                }
+            }
+        }
+        if (depths.empty()) {
+            continue;
+        }
+        std::nth_element(depths.begin(), depths.begin() + depths.size() / 2, depths.end());
+        const size_t maxSide = std::max(camera.width, camera.height);
+        const double scale = options.maxImageSize > 0 && maxSide > static_cast<size_t>(options.maxImageSize)
+            ? static_cast<double>(options.maxImageSize) / maxSide : 1.0;
+        footprints.push_back(depths[depths.size() / 2] / (camera.FocalLengthX() * scale));
+    }
+    if (footprints.empty()) {
+        LOG_WARNING("No sparse points to derive the voxel size from, using 0.01");
+        return 0.01;
+    }
+    std::nth_element(footprints.begin(), footprints.begin() + footprints.size() / 2, footprints.end());
+    return 2.0 * footprints[footprints.size() / 2];
+}
+
+void StreamingFusion::planRegions(const colmap::Reconstruction& reconstruction,
+                                  const std::vector<colmap::image_t>& order,
+                                  const std::string& densePath, const std::string& outputType) {
+    TaskScheduler& scheduler = TaskScheduler::getInstance();
+    const double regionSize = voxelSize * kBlockSide * kRegionBlocks;
+
+    for (size_t batchBegin = 0; batchBegin < order.size(); batchBegin += kPlanBatch) {
+        const size_t batchEnd = std::min(order.size(), batchBegin + kPlanBatch);
+        std::vector<std::vector<uint64_t>> cells(batchEnd - batchBegin);
+        scheduler.parallelFor(batchBegin, batchEnd, [&](size_t i) {
+            const colmap::Image& image = reconstruction.Image(order[i]);
+            colmap::mvs::DepthMap depthMap;
+            depthMap.Read(depthMapPath(densePath, "depth_maps", image.Name(), outputType));
+            const PixelToWorld toWorld(reconstruction.Camera(image.CameraId()), image,
+                                       static_cast<int>(depthMap.GetWidth()),
+                                       static_cast<int>(depthMap.GetHeight()));
+            std::unordered_set<uint64_t> touched;
+            for (size_t row = 0; row < depthMap.GetHeight(); row += kPlanStride) {
+                for (size_t col = 0; col < depthMap.GetWidth(); col += kPlanStride) {
+                    const float depth = depthMap.Get(row, col);
+                    if (depth <= 0.0f) {
+                        continue;
+                    }
+                    const Eigen::Vector3f p = toWorld.point(static_cast<int>(col), static_cast<int>(row), depth);
+                    const int64_t x = static_cast<int64_t>(std::floor(p.x() / regionSize));
+                    const int64_t y = static_cast<int64_t>(std::floor(p.y() / regionSize));
+                    const int64_t z = static_cast<int64_t>(std::floor(p.z() / regionSize));
+                    if (inKeyRange(x, y, z)) {
+                        touched.insert(packKey(x, y, z));
+                    }
+                }
+            }
+            cells[i - batchBegin].assign(touched.begin(), touched.end());
+        });
+
+        // Images are in fusion order, so later ones overwrite earlier ones. The
+        // neighbouring regions are included to cover the pixels in between samples.
+        for (size_t k = 0; k < cells.size(); ++k) {
+            const int imageIndex = static_cast<int>(batchBegin + k);
+            for (const uint64_t cell : cells[k]) {
+                int64_t x, y, z;
+                unpackKey(cell, x, y, z);
+                for (int64_t dz = -1; dz <= 1; ++dz) {
+                    for (int64_t dy = -1; dy <= 1; ++dy) {
+                        for (int64_t dx = -1; dx <= 1; ++dx) {
+                            if (inKeyRange(x + dx, y + dy, z + dz)) {
+                                regionLastUse[packKey(x + dx, y + dy, z + dz)] = imageIndex;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool StreamingFusion::backProject(const colmap::Reconstruction& reconstruction, colmap::image_t imageId,
+                                  const std::string& densePath, const std::string& outputType,
+                                  std::vector<Sample>& samples) const {
+    samples.clear();
+    const colmap::Image& image = reconstruction.Image(imageId);
+    colmap::mvs::DepthMap depthMap;
+    depthMap.Read(depthMapPath(densePath, "depth_maps", image.Name(), outputType));
+    const int width = static_cast<int>(depthMap.GetWidth());
+    const int height = static_cast<int>(depthMap.GetHeight());
+    if (width == 0 || height == 0) {
+        LOG_WARNING("Empty depth map for %s", image.Name().c_str());
+        return false;
+    }
+
+    colmap::mvs::NormalMap normalMap;
+    const std::string normalPath = depthMapPath(densePath, "normal_maps", image.Name(), outputType);
+    const bool hasNormals = std::filesystem::exists(normalPath);
+    if (hasNormals) {
+        normalMap.Read(normalPath);
+    }
+    cv::Mat color = cv::imread(colmap::JoinPaths(densePath, "images", image.Name()), cv::IMREAD_COLOR);
+    if (color.empty()) {
+        color = cv::Mat(height, width, CV_8UC3, cv::Scalar(128, 128, 128));
+    } else if (color.cols != width || color.rows != height) {
+        cv::resize(color, color, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    }
+
+    const PixelToWorld toWorld(reconstruction.Camera(image.CameraId()), image, width, height);
+    std::vector<std::vector<Sample>> rows(height);
+    TaskScheduler::getInstance().parallelFor(0, height, [&](size_t row) {
+        auto& rowSamples = rows[row];
+        const cv::Vec3b* pixels = color.ptr<cv::Vec3b>(static_cast<int>(row));
+        for (int col = 0; col < width; ++col) {
+            const float depth = depthMap.Get(row, col);
+            if (depth <= 0.0f) {
+                continue;
+            }
+            const Eigen::Vector3f p = toWorld.point(col, static_cast<int>(row), depth);
+            int64_t v[3];
+            int64_t b[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                v[axis] = static_cast<int64_t>(std::floor(p[axis] / voxelSize));
+                b[axis] = floorDiv(v[axis], kBlockSide);
+            }
+            if (!inKeyRange(b[0], b[1], b[2])) {
+                continue;
+            }
+
+            Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+            if (hasNormals) {
+                normal = toWorld.rotation * Eigen::Vector3f(normalMap.Get(row, col, 0),
+                                                            normalMap.Get(row, col, 1),
+                                                            normalMap.Get(row, col, 2));
+            }
+
+            Sample sample;
+            sample.block = packKey(b[0], b[1], b[2]);
+            sample.voxel = static_cast<uint16_t>((v[0] - b[0] * kBlockSide) +
+                                                 kBlockSide * ((v[1] - b[1] * kBlockSide) +
+                                                               kBlockSide * (v[2] - b[2] * kBlockSide)));
+            for (int axis = 0; axis < 3; ++axis) {
+                // Relative to the voxel corner, so the float sums keep their precision
+                sample.position[axis] = static_cast<float>(p[axis] - v[axis] * voxelSize);
+                sample.normal[axis] = normal[axis];
+            }
+            sample.color[0] = pixels[col][2];
+            sample.color[1] = pixels[col][1];
+            sample.color[2] = pixels[col][0];
+            rowSamples.push_back(sample);
+        }
+    });
+
+    for (auto& rowSamples : rows) {
+        samples.insert(samples.end(), rowSamples.begin(), rowSamples.end());
+    }
+    return true;
+}
+
+void StreamingFusion::integrate(int imageIndex, std::vector<Sample>& samples) {
+    std::sort(samples.begin(), samples.end(),
+              [](const Sample& a, const Sample& b) { return a.block < b.block; });
+
+    // Create the missing blocks serially; pointers to hash map elements stay
+    // valid, so the blocks can then be filled in parallel
+    struct Range {
+        Block* block;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Range> ranges;
+    for (size_t begin = 0; begin < samples.size();) {
+        size_t end = begin + 1;
+        while (end < samples.size() && samples[end].block == samples[begin].block) {
+            ++end;
+        }
+        const uint64_t key = samples[begin].block;
+        auto it = blocks.find(key);
+        if (it == blocks.end()) {
+            int64_t x, y, z;
+            unpackKey(key, x, y, z);
+            const auto region = regionLastUse.find(packKey(floorDiv(x, kRegionBlocks),
+                                                           floorDiv(y, kRegionBlocks),
+                                                           floorDiv(z, kRegionBlocks)));
+            it = blocks.emplace(key, Block()).first;
+            it->second.lastUse = region != regionLastUse.end()
+                ? std::max(imageIndex, region->second) : imageIndex;
+            retirements[it->second.lastUse].push_back(key);
+        }
+        ranges.push_back({&it->second, begin, end});
+        begin = end;
+    }
+
+    std::vector<size_t> newVoxels(ranges.size(), 0);
+    TaskScheduler::getInstance().parallelFor(0, ranges.size(), [&](size_t r) {
+        Block& block = *ranges[r].block;
+        const size_t before = block.voxels.size();
+        for (size_t s = ranges[r].begin; s < ranges[r].end; ++s) {
+            const Sample& sample = samples[s];
+            Voxel& voxel = block.voxels[sample.voxel];
+            for (int axis = 0; axis < 3; ++axis) {
+                voxel.position[axis] += sample.position[axis];
+                voxel.normal[axis] += sample.normal[axis];
+                voxel.color[axis] += sample.color[axis];
+            }
+            voxel.numPoints += 1;
+            if (voxel.lastImage != imageIndex) {
+                voxel.lastImage = imageIndex;
+                voxel.numViews += 1;
+            }
+        }
+        newVoxels[r] = block.voxels.size() - before;
+    });
+    for (const size_t count : newVoxels) {
+        numActiveVoxels += count;
+    }
+}
+
+void StreamingFusion::retire(int imageIndex) {
+    while (!retirements.empty() && retirements.begin()->first <= imageIndex) {
+        for (const uint64_t key : retirements.begin()->second) {
+            evict(key);
+        }
+        retirements.erase(retirements.begin());
+    }
+}
+
+void StreamingFusion::enforceCap() {
+    const auto activeBytes = [this]() {
+        return numActiveVoxels * kVoxelBytes + blocks.size() * kBlockBytes;
+    };
+    if (options.maxActiveBytes == 0 || activeBytes() <= options.maxActiveBytes) {
+        return;
+    }
+    // Write the blocks closest to final until a quarter of the cap is free again
+    const size_t target = options.maxActiveBytes / 4 * 3;
+    while (!retirements.empty() && activeBytes() > target) {
+        auto& keys = retirements.begin()->second;
+        evict(keys.back());
+        keys.pop_back();
+        numForcedEvictions += 1;
+        if (keys.empty()) {
+            retirements.erase(retirements.begin());
+        }
+    }
+}
+
+void StreamingFusion::evict(uint64_t blockKey) {
+    const auto it = blocks.find(blockKey);
+    if (it == blocks.end()) {
+        return;
+    }
+    int64_t blockX, blockY, blockZ;
+    unpackKey(blockKey, blockX, blockY, blockZ);
+    for (const auto& entry : it->second.voxels) {
+        const Voxel& voxel = entry.second;
+        if (voxel.numViews < static_cast<uint32_t>(options.minNumViews)) {
+            continue;
+        }
+        const int64_t x = blockX * kBlockSide + entry.first % kBlockSide;
+        const int64_t y = blockY * kBlockSide + entry.first / kBlockSide % kBlockSide;
+        const int64_t z = blockZ * kBlockSide + entry.first / (kBlockSide * kBlockSide);
+        const float weight = 1.0f / voxel.numPoints;
+        const Eigen::Vector3f normal = Eigen::Vector3f(voxel.normal[0], voxel.normal[1], voxel.normal[2])
+                                           .normalized();
+        PlyPointWriter::Point point;
+        point.x = static_cast<float>(x * voxelSize + voxel.position[0] * weight);
+        point.y = static_cast<float>(y * voxelSize + voxel.position[1] * weight);
+        point.z = static_cast<float>(z * voxelSize + voxel.position[2] * weight);
+        point.nx = std::isfinite(normal.x()) ? normal.x() : 0.0f;
+        point.ny = std::isfinite(normal.y()) ? normal.y() : 0.0f;
+        point.nz = std::isfinite(normal.z()) ? normal.z() : 0.0f;
+        point.r = static_cast<uint8_t>(std::clamp(voxel.color[0] * weight + 0.5f, 0.0f, 255.0f));
+        point.g = static_cast<uint8_t>(std::clamp(voxel.color[1] * weight + 0.5f, 0.0f, 255.0f));
+        point.b = static_cast<uint8_t>(std::clamp(voxel.color[2] * weight + 0.5f, 0.0f, 255.0f));
+        writer.write(point);
+    }
+    numActiveVoxels -= it->second.voxels.size();
+    blocks.erase(it);
+}
@@ -0,0 +1,118 @@
+/**
+ * @file streaming_fusion.h
+ * @brief Out-of-core fusion of depth maps in a spatially hashed voxel grid
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <colmap/scene/reconstruction.h>
+
+#include "ply_point_writer.h"
+
+/**
+ * @class StreamingFusion
+ * @brief Fuses the depth maps of a dense workspace one image at a time
+ *
+ * Every depth pixel is back-projected and accumulated into a sparse voxel
+ * grid: the voxel averages the position, normal and color of its points
+ * and counts the distinct images that observed it. A voxel seen by fewer
+ * than minNumViews images is inconsistent and never written.
+ *
+ * Voxels are grouped into hashed blocks of 8^3, and blocks into regions of
+ * 4^3 blocks. A first pass over subsampled depth maps records the last
+ * image that reaches each region, so a block is final once that image is
+ * fused; it is then written to the PLY file and freed. Images are fused
+ * in name order, which is capture order for most datasets and keeps the
+ * active set to the part of the scene the recent images see. Peak memory
+ * therefore follows the working set rather than the scene size. If the
+ * active blocks still exceed maxActiveBytes, the blocks closest to being
+ * final are written early; points of later images in those blocks then
+ * start new voxels.
+ */
+class StreamingFusion {
+public:
+    /**
+     * @struct Options
+     * @brief Voxel resolution, consistency and memory cap
+     */
+    struct Options {
+        double voxelSize = 0.0;    /**< Voxel edge in model units, 0 for two depth map pixels at the median depth */
+        int minNumViews = 3;       /**< Images a voxel must be seen in to be written */
+        int maxImageSize = -1;     /**< Longest side of the depth maps, -1 for the image size */
+        size_t maxActiveBytes = 0; /**< Cap on the active blocks, 0 for no cap */
+    };
+
+    /**
+     * @brief Construct a fusion engine
+     * @param options Resolution, consistency and memory cap
+     */
+    explicit StreamingFusion(const Options& options);
+
+    /**
+     * @brief Fuse all depth maps of a dense workspace into a PLY file
+     * @param reconstruction Undistorted sparse model of the workspace
+     * @param densePath Workspace with images/ and stereo/depth_maps, stereo/normal_maps
+     * @param outputType Depth map type, "geometric" or "photometric"
+     * @param outputPath PLY file to write
+     * @return true if the point cloud was written
+     */
+    bool run(const colmap::Reconstruction& reconstruction, const std::string& densePath,
+             const std::string& outputType, const std::string& outputPath);
+
+    /**
+     * @brief Get the number of fused points of the last run
+     * @return The point count
+     */
+    size_t getNumPoints() const { return writer.getNumPoints(); }
+
+private:
+    struct Voxel {
+        float position[3] = {0.0f, 0.0f, 0.0f}; /**< Sums over the points, relative to the voxel corner */
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float color[3] = {0.0f, 0.0f, 0.0f};
+        uint32_t numPoints = 0;
+        uint32_t numViews = 0;
+        int lastImage = -1;
+    };
+
+    struct Block {
+        std::unordered_map<uint16_t, Voxel> voxels;
+        int lastUse = 0; /**< Index of the last image that can reach the block */
+    };
+
+    struct Sample {
+        uint64_t block;
+        uint16_t voxel;
+        float position[3];
+        float normal[3];
+        float color[3];
+    };
+
+    double estimateVoxelSize(const colmap::Reconstruction& reconstruction) const;
+    void planRegions(const colmap::Reconstruction& reconstruction,
+                     const std::vector<colmap::image_t>& order, const std::string& densePath,
+                     const std::string& outputType);
+    bool backProject(const colmap::Reconstruction& reconstruction, colmap::image_t imageId,
+                     const std::string& densePath, const std::string& outputType,
+                     std::vector<Sample>& samples) const;
+    void integrate(int imageIndex, std::vector<Sample>& samples);
+    void retire(int imageIndex);
+    void enforceCap();
+    void evict(uint64_t blockKey);
+
+    Options options;
+    double voxelSize = 0.0;
+    std::unordered_map<uint64_t, Block> blocks;
+    std::map<int, std::vector<uint64_t>> retirements; /**< Blocks by lastUse */
+    std::unordered_map<uint64_t, int> regionLastUse;
+    size_t numActiveVoxels = 0;
+    size_t numForcedEvictions = 0;
+    PlyPointWriter writer;
+};
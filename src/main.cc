@@ -2,28 +2,752 @@
 #include <colmap/controllers/option_manager.h>
 #include <colmap/util/misc.h>
 #include <colmap/util/logging.h>
-#include <colmap/base/database.h>
+#include <colmap/scene/database.h>
 #include <colmap/feature/extraction.h>
 #include <colmap/feature/matching.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include <unistd.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "checkpoint.h"
+#include "colmap_stages.h"
 #include "config.h"
+#include "distributed_matching.h"
+#include "dynamic_object_masker.h"
 #include "frame_source.h"
+#include "localizer.h"
+#include "lod_writer.h"
 #include "logger.h"
+#include "map_index.h"
+#include "memory_budget.h"
+#include "model_loader.h"
+#include "pair_selector.h"
+#include "pose_evaluator.h"
+#include "reconstruction_pipeline.h"
+#include "stage_profiler.h"
+#include "task_scheduler.h"
+
+/**
+ * @brief Build the COLMAP option set matching the automatic reconstruction settings
+ * @param options Reconstruction settings taken from the config file
+ * @param colmapOptions Option manager to fill
+ */
+static void configureColmapOptions(
+        const colmap::AutomaticReconstructionController::Options& options,
+        colmap::OptionManager& colmapOptions) {
+    colmapOptions.AddAllOptions();
+    *colmapOptions.image_path = options.image_path;
+    *colmapOptions.database_path = options.database_path;
+
+    if (options.data_type == colmap::AutomaticReconstructionController::DataType::VIDEO) {
+        colmapOptions.ModifyForVideoData();
+    } else {
+        colmapOptions.ModifyForIndividualData();
+    }
+    switch (options.quality) {
+        case colmap::AutomaticReconstructionController::Quality::LOW:
+            colmapOptions.ModifyForLowQuality();
+            break;
+        case colmap::AutomaticReconstructionController::Quality::MEDIUM:
+            colmapOptions.ModifyForMediumQuality();
+            break;
+        case colmap::AutomaticReconstructionController::Quality::HIGH:
+            colmapOptions.ModifyForHighQuality();
+            break;
+        case colmap::AutomaticReconstructionController::Quality::EXTREME:
+            colmapOptions.ModifyForExtremeQuality();
+            break;
+    }
+    colmapOptions.sift_extraction->use_gpu = false;
+    colmapOptions.sift_matching->use_gpu = false;
+}
+
+/**
+ * @brief Apply the sparse mapping mode from the config file
+ * @param stages Stages that run the mapping
+ */
+static void configureMapping(ColmapStages& stages) {
+    if (Config::getColmapMapper() == Config::MapperMode::PARTITIONED) {
+        PartitionedMapper::Options partitionOptions;
+        partitionOptions.maxClusterImages = static_cast<size_t>(Config::getColmapClusterMaxImages());
+        partitionOptions.clusterOverlap = static_cast<size_t>(Config::getColmapClusterOverlap());
+        stages.setPartitionedMapping(partitionOptions);
+    }
+}
+
+/**
+ * @brief Apply the dense depth and fusion methods from the config file
+ * @param stages Stages that run the dense reconstruction
+ */
+static void configureDense(ColmapStages& stages) {
+    if (Config::getColmapDenseMethod() == Config::DenseMethod::MVSNET) {
+        MVSNet::Options netOptions;
+        netOptions.model_path = Config::getMvsNetModelPath();
+        netOptions.num_depths = Config::getMvsNetDepths();
+        netOptions.tile_size = Config::getMvsNetTileSize();
+        netOptions.max_memory = Config::getMvsNetImageMemory();
+        stages.setLearnedDepth(netOptions);
+    }
+    if (Config::getColmapFusion() == Config::FusionMethod::STREAMING) {
+        StreamingFusion::Options fusionOptions;
+        fusionOptions.voxelSize = Config::getColmapFusionVoxelSize();
+        fusionOptions.minNumViews = Config::getColmapFusionMinViews();
+        stages.setStreamingFusion(fusionOptions);
+    }
+}
+
+/**
+ * @brief Enable dynamic object masking when the config file asks for it
+ * @param stages Stages that extract the features
+ */
+static void configureMasking(ColmapStages& stages) {
+    if (!Config::getMaskDynamicObjects()) {
+        return;
+    }
+    DynamicObjectMasker::Options maskerOptions;
+    maskerOptions.modelPath = Config::getModelPath();
+    maskerOptions.confidenceThreshold = Config::getConfidenceThreshold();
+    maskerOptions.classes = Config::getMaskClasses();
+    if (stages.setDynamicObjectMasking(maskerOptions)) {
+        LOG_INFO("Masking dynamic objects with %s", maskerOptions.modelPath.c_str());
+    } else {
+        LOG_WARNING("Failed to load %s, dynamic objects are not masked",
+                    maskerOptions.modelPath.c_str());
+    }
+}
+
+/**
+ * @brief Select image pairs by GPS position and capture order
+ * @param options Reconstruction settings taken from the config file
+ * @param imageNames Images of the reconstruction
+ * @return Pairs of image indices, first < second
+ */
+static std::vector<std::pair<size_t, size_t>> selectSpatialPairs(
+        const colmap::AutomaticReconstructionController::Options& options,
+        const std::vector<std::string>& imageNames) {
+    PairSelector::Options selectorOptions;
+    selectorOptions.numNeighbors = static_cast<size_t>(Config::getColmapSpatialNeighbors());
+    selectorOptions.radius = Config::getColmapSpatialRadius();
+    return PairSelector(selectorOptions).select(options.image_path, imageNames);
+}
+
+/**
+ * @brief Build a pair filter that accepts the pairs of a list
+ * @param pairs Pairs of image indices, first < second
+ * @return Filter over pairs of image indices
+ */
+static ReconstructionPipeline::PairFilter pairListFilter(
+        const std::vector<std::pair<size_t, size_t>>& pairs) {
+    auto selected = std::make_shared<std::unordered_set<uint64_t>>();
+    for (const auto& pair : pairs) {
+        selected->insert((static_cast<uint64_t>(pair.first) << 32) | pair.second);
+    }
+    return [selected](size_t first, size_t second) {
+        return selected->count((static_cast<uint64_t>(first) << 32) | second) > 0;
+    };
+}
+
+/**
+ * @brief Build the pair filter of the configured pairing mode
+ * @param options Reconstruction settings taken from the config file
+ * @param colmapOptions COLMAP options of the stages
+ * @param imageNames Images of the reconstruction
+ * @return Filter over pairs of image indices, empty to match all pairs
+ */
+static ReconstructionPipeline::PairFilter selectPairFilter(
+        const colmap::AutomaticReconstructionController::Options& options,
+        colmap::OptionManager& colmapOptions,
+        const std::vector<std::string>& imageNames) {
+    if (Config::getColmapPairing() == Config::PairingMode::SPATIAL) {
+        return pairListFilter(selectSpatialPairs(options, imageNames));
+    }
+    if (options.data_type == colmap::AutomaticReconstructionController::DataType::VIDEO) {
+        // Video frames only overlap with their temporal neighbours
+        const size_t overlap = static_cast<size_t>(colmapOptions.sequential_matching->overlap);
+        return [overlap](size_t first, size_t second) {
+            return second - first <= overlap;
+        };
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Extract and match the images through the overlapped pipeline stages
+ *
+ * Images and pairs already in the database are skipped by the stages, and
+ * nothing runs if the checkpoint has matching done.
+ *
+ * @param stages Stages bound to the workspace
+ * @param checkpoint Checkpoint to resume from and update
+ * @param pairFilter Pairs to match, empty for all pairs
+ * @return true if all pairs were matched
+ */
+static bool runFeatureStages(ColmapStages& stages, Checkpoint& checkpoint,
+                             ReconstructionPipeline::PairFilter pairFilter) {
+    if (checkpoint.isStageDone(Checkpoint::kMatching)) {
+        LOG_INFO("Matching already finished (%zu pairs), skipping to mapping",
+                 checkpoint.readPairList().size());
+        return true;
+    }
+    if (Config::getColmapReadAhead() > 0) {
+        stages.enablePrefetch(Config::getColmapReadAhead(), Config::getColmapDecodeThreads());
+    }
+    ReconstructionPipeline::Options pipelineOptions;
+    pipelineOptions.queueCapacity = Config::getColmapPipelineQueueSize();
+    ReconstructionPipeline pipeline(pipelineOptions, stages.getImageNames().size());
+    stages.attach(pipeline);
+    pipeline.setPairFilter(std::move(pairFilter));
+    StageProfiler::Scope stage("features");
+    stage.setItems(stages.getImageNames().size());
+    if (!pipeline.run()) {
+        return false;
+    }
+    checkpoint.writePairList(stages.getMatchedPairs());
+    checkpoint.markStageDone(Checkpoint::kExtraction);
+    checkpoint.markStageDone(Checkpoint::kMatching);
+    return true;
+}
 
 /**
- * Usage: ./colmap-neural-app <path_to_config_file>
+ * @brief Run extraction, matching and verification as overlapped stages,
+ *        followed by mapping and optional dense reconstruction
+ * @param options Reconstruction settings taken from the config file
+ * @param checkpoint Checkpoint to resume from and update
+ * @return true if a sparse model was reconstructed
+ */
+static bool runOverlappedReconstruction(
+        const colmap::AutomaticReconstructionController::Options& options,
+        Checkpoint& checkpoint) {
+    colmap::OptionManager colmapOptions;
+    configureColmapOptions(options, colmapOptions);
+
+    ColmapStages stages(colmapOptions, options.workspace_path,
+                        TaskScheduler::getInstance().getNumWorkers());
+    stages.setVerificationPrefilter(Config::getColmapVerificationPrefilter());
+    configureMasking(stages);
+    configureMapping(stages);
+    configureDense(stages);
+    if (stages.getImageNames().empty()) {
+        LOG_ERROR("No images found in %s", options.image_path.c_str());
+        return false;
+    }
+
+    if (!runFeatureStages(stages, checkpoint,
+                          selectPairFilter(options, colmapOptions, stages.getImageNames()))) {
+        return false;
+    }
+
+    if (!stages.runMapping(checkpoint, Config::getCheckpointSnapshotInterval())) {
+        return false;
+    }
+    if (options.dense) {
+        stages.runDense(checkpoint);
+    }
+    return true;
+}
+
+/**
+ * @brief Reconstruct from downscaled images first, then refine at full resolution
+ *
+ * The coarse pass extracts, matches and maps images of at most
+ * coarse_image_size pixels in <workspace>/coarse, with its own database and
+ * checkpoint. The full resolution pass then extracts again, matches only
+ * the pairs that share points in the largest coarse model, by guided
+ * epipolar search along the known poses, and triangulates and bundle
+ * adjusts with those poses instead of mapping incrementally. Images the
+ * coarse model did not register are left out.
+ *
+ * @param options Reconstruction settings taken from the config file
+ * @param checkpoint Checkpoint to resume from and update
+ * @return true if a sparse model was reconstructed
+ */
+static bool runCoarseToFineReconstruction(
+        const colmap::AutomaticReconstructionController::Options& options,
+        Checkpoint& checkpoint) {
+    const int numWorkers = TaskScheduler::getInstance().getNumWorkers();
+    const int coarseImageSize = Config::getColmapCoarseImageSize();
+
+    colmap::AutomaticReconstructionController::Options coarseOptions = options;
+    coarseOptions.workspace_path = colmap::JoinPaths(options.workspace_path, "coarse");
+    coarseOptions.database_path = colmap::JoinPaths(coarseOptions.workspace_path, "database.db");
+    colmap::CreateDirIfNotExists(coarseOptions.workspace_path);
+    Checkpoint coarseCheckpoint(coarseOptions.workspace_path, checkpoint.isEnabled(),
+                                checkpoint.discardsStale());
+    coarseCheckpoint.load(checkpoint.getFingerprint());
+    if (coarseCheckpoint.isStale()) {
+        return false;
+    }
+
+    {
+        colmap::OptionManager colmapOptions;
+        configureColmapOptions(coarseOptions, colmapOptions);
+        colmapOptions.sift_extraction->max_image_size =
+            std::min(colmapOptions.sift_extraction->max_image_size, coarseImageSize);
+        ColmapStages stages(colmapOptions, coarseOptions.workspace_path, numWorkers);
+        stages.setVerificationPrefilter(Config::getColmapVerificationPrefilter());
+        configureMasking(stages);
+        configureMapping(stages);
+        if (stages.getImageNames().empty()) {
+            LOG_ERROR("No images found in %s", options.image_path.c_str());
+            return false;
+        }
+        LOG_INFO("Coarse pass at %d pixels", colmapOptions.sift_extraction->max_image_size);
+        if (!runFeatureStages(stages, coarseCheckpoint,
+                              selectPairFilter(coarseOptions, colmapOptions, stages.getImageNames())) ||
+            !stages.runMapping(coarseCheckpoint, Config::getCheckpointSnapshotInterval())) {
+            return false;
+        }
+    }
+
+    // Keypoints are stored in full resolution pixels, so the cameras and
+    // poses of the coarse model hold for the full resolution features
+    colmap::ReconstructionManager coarseModels;
+    for (const auto& modelPath : colmap::GetDirList(colmap::JoinPaths(coarseOptions.workspace_path, "sparse"))) {
+        coarseModels.Read(modelPath);
+    }
+    auto coarseModel = std::make_shared<colmap::Reconstruction>();
+    for (size_t i = 0; i < coarseModels.Size(); ++i) {
+        if (coarseModels.Get(i)->NumRegImages() > coarseModel->NumRegImages()) {
+            *coarseModel = *coarseModels.Get(i);
+        }
+    }
+    if (coarseModel->NumRegImages() == 0) {
+        LOG_ERROR("The coarse pass did not produce a model");
+        return false;
+    }
+
+    colmap::OptionManager colmapOptions;
+    configureColmapOptions(options, colmapOptions);
+    ColmapStages stages(colmapOptions, options.workspace_path, numWorkers);
+    stages.setVerificationPrefilter(Config::getColmapVerificationPrefilter());
+    configureMasking(stages);
+    configureDense(stages);
+
+    // The coarse poses are accurate to about a coarse pixel
+    GuidedMatcher::Options matcherOptions;
+    const double scale = static_cast<double>(colmapOptions.sift_extraction->max_image_size) / coarseImageSize;
+    matcherOptions.maxEpipolarError = std::max(matcherOptions.maxEpipolarError, 2.0 * scale);
+    matcherOptions.maxRatio = colmapOptions.sift_matching->max_ratio;
+    matcherOptions.maxDistance = colmapOptions.sift_matching->max_distance;
+    stages.setPosePrior(coarseModel, matcherOptions);
+    const auto pairs = stages.getPosePriorPairs(
+        static_cast<size_t>(colmapOptions.two_view_geometry->min_num_inliers));
+    LOG_INFO("Refining %zu images of the coarse model over %zu co-visible pairs",
+             static_cast<size_t>(coarseModel->NumRegImages()), pairs.size());
+
+    if (!runFeatureStages(stages, checkpoint, pairListFilter(pairs)) ||
+        !stages.runMapping(checkpoint, 0)) {
+        return false;
+    }
+    if (options.dense) {
+        stages.runDense(checkpoint);
+    }
+    return true;
+}
+
+/**
+ * @brief Run the COLMAP automatic reconstruction stages one after another
+ *
+ * The automatic controller can neither resume mapping, cap the stereo
+ * caches, partition the view graph nor report its stages separately, so
+ * with checkpoints, a memory limit, partitioned mapping or benchmarking it
+ * only extracts and matches (both resume from the database), and mapping
+ * and dense reconstruction run through ColmapStages.
+ *
+ * @param options Reconstruction settings taken from the config file
+ * @param checkpoint Checkpoint to resume from and update
+ * @return true if the reconstruction completed
+ */
+static bool runSequentialReconstruction(
+        const colmap::AutomaticReconstructionController::Options& options,
+        Checkpoint& checkpoint) {
+    const bool boundedDense = options.dense && Config::getMemoryLimit() > 0;
+    const bool partitioned = Config::getColmapMapper() == Config::MapperMode::PARTITIONED;
+    const bool customDense = options.dense &&
+        (Config::getColmapDenseMethod() == Config::DenseMethod::MVSNET ||
+         Config::getColmapFusion() == Config::FusionMethod::STREAMING);
+    if (!checkpoint.isEnabled() && !boundedDense && !partitioned && !customDense &&
+        !Config::getBenchmarkEnabled()) {
+        StageProfiler::Scope stage("reconstruction");
+        colmap::AutomaticReconstructionController reconstruction(options,
+                                                              colmap::ReconstructionManager());
+        reconstruction.Start();
+        reconstruction.Wait();
+        return true;
+    }
+
+    // One controller run per stage, so that each is profiled on its own
+    const auto runController = [&options](bool extraction, bool matching) {
+        colmap::AutomaticReconstructionController::Options controllerOptions = options;
+        controllerOptions.extraction = extraction;
+        controllerOptions.matching = matching;
+        controllerOptions.sparse = false;
+        controllerOptions.dense = false;
+        colmap::AutomaticReconstructionController reconstruction(controllerOptions,
+                                                              colmap::ReconstructionManager());
+        reconstruction.Start();
+        reconstruction.Wait();
+    };
+    if (!checkpoint.isStageDone(Checkpoint::kExtraction)) {
+        StageProfiler::Scope stage("extraction");
+        runController(true, false);
+        stage.setItems(colmap::Database(options.database_path).NumImages());
+        checkpoint.markStageDone(Checkpoint::kExtraction);
+    }
+    if (!checkpoint.isStageDone(Checkpoint::kMatching)) {
+        StageProfiler::Scope stage("matching");
+        runController(false, true);
+        stage.setItems(colmap::Database(options.database_path).NumMatches());
+        checkpoint.markStageDone(Checkpoint::kMatching);
+    } else {
+        LOG_INFO("Matching already finished, skipping to mapping");
+    }
+
+    colmap::OptionManager colmapOptions;
+    configureColmapOptions(options, colmapOptions);
+    ColmapStages stages(colmapOptions, options.workspace_path, 1);
+    configureMapping(stages);
+    configureDense(stages);
+    if (!stages.runMapping(checkpoint, Config::getCheckpointSnapshotInterval())) {
+        return false;
+    }
+    if (options.dense) {
+        stages.runDense(checkpoint);
+    }
+    return true;
+}
+
+/**
+ * @brief Get the distributed matching layout from the config file
+ * @param options Reconstruction settings taken from the config file
+ * @param configPath Path of the config file, passed on to worker processes
+ * @param executable Path of this binary, started for local workers
+ * @return The matcher options
+ */
+static DistributedMatcher::Options distributedOptions(
+        const colmap::AutomaticReconstructionController::Options& options,
+        const std::string& configPath,
+        const std::string& executable) {
+    DistributedMatcher::Options matcherOptions;
+    matcherOptions.localWorkers = Config::getDistributedWorkers();
+    matcherOptions.numShards = Config::getDistributedShards() > 0
+                                   ? Config::getDistributedShards()
+                                   : 4 * std::max(1, matcherOptions.localWorkers);
+    matcherOptions.shardPath = colmap::JoinPaths(options.workspace_path, "shards");
+    matcherOptions.configPath = configPath;
+    matcherOptions.executable = executable;
+    return matcherOptions;
+}
+
+/**
+ * @brief Extract features, match pairs in worker processes and reconstruct
+ * @param options Reconstruction settings taken from the config file
+ * @param checkpoint Checkpoint to resume from and update
+ * @param configPath Path of the config file, passed on to worker processes
+ * @param executable Path of this binary, started for local workers
+ * @return true if a sparse model was reconstructed
+ */
+static bool runDistributedReconstruction(
+        const colmap::AutomaticReconstructionController::Options& options,
+        Checkpoint& checkpoint,
+        const std::string& configPath,
+        const std::string& executable) {
+    colmap::OptionManager colmapOptions;
+    configureColmapOptions(options, colmapOptions);
+
+    TaskScheduler& scheduler = TaskScheduler::getInstance();
+    ColmapStages stages(colmapOptions, options.workspace_path, scheduler.getNumWorkers());
+    stages.setVerificationPrefilter(Config::getColmapVerificationPrefilter());
+    configureMasking(stages);
+    configureMapping(stages);
+    configureDense(stages);
+    const size_t numImages = stages.getImageNames().size();
+    if (numImages == 0) {
+        LOG_ERROR("No images found in %s", options.image_path.c_str());
+        return false;
+    }
+
+    if (checkpoint.isStageDone(Checkpoint::kMatching)) {
+        LOG_INFO("Matching already finished, skipping to mapping");
+    } else {
+        // Workers only read the database, so all features must be in it first
+        if (Config::getColmapReadAhead() > 0) {
+            stages.enablePrefetch(Config::getColmapReadAhead(), Config::getColmapDecodeThreads());
+        }
+        std::atomic<size_t> numFailed{0};
+        {
+            StageProfiler::Scope stage("extraction");
+            stage.setItems(numImages);
+            scheduler.parallelFor(0, numImages, [&](size_t i) {
+                if (!stages.extractImage(i, std::max(0, TaskScheduler::getCurrentWorkerIndex()))) {
+                    ++numFailed;
+                }
+            });
+        }
+        if (numFailed > 0) {
+            LOG_WARNING("Feature extraction failed for %zu images", numFailed.load());
+        }
+        checkpoint.markStageDone(Checkpoint::kExtraction);
+
+        std::vector<std::pair<size_t, size_t>> pairs;
+        if (Config::getColmapPairing() == Config::PairingMode::SPATIAL) {
+            pairs = selectSpatialPairs(options, stages.getImageNames());
+        } else {
+            // Video frames only overlap with their temporal neighbours
+            const bool video =
+                options.data_type == colmap::AutomaticReconstructionController::DataType::VIDEO;
+            const size_t maxDistance = video
+                ? static_cast<size_t>(colmapOptions.sequential_matching->overlap)
+                : numImages;
+            for (size_t first = 0; first < numImages; ++first) {
+                for (size_t second = first + 1; second < numImages && second - first <= maxDistance; ++second) {
+                    pairs.emplace_back(first, second);
+                }
+            }
+        }
+
+        DistributedMatcher matcher(distributedOptions(options, configPath, executable), stages);
+        StageProfiler::Scope stage("matching");
+        stage.setItems(pairs.size());
+        if (!matcher.run(pairs)) {
+            return false;
+        }
+        checkpoint.writePairList(stages.getMatchedPairs());
+        checkpoint.markStageDone(Checkpoint::kMatching);
+    }
+
+    if (!stages.runMapping(checkpoint, Config::getCheckpointSnapshotInterval())) {
+        return false;
+    }
+    if (options.dense) {
+        stages.runDense(checkpoint);
+    }
+    return true;
+}
+
+/**
+ * @brief Write the sparse models and fused clouds of a workspace as .lod files
+ * @param outputPath Workspace with sparse/N and dense/N folders
+ */
+static void exportLodModels(const std::string& outputPath) {
+    LodWriter writer{LodWriter::Options()};
+    const std::string sparsePath = colmap::JoinPaths(outputPath, "sparse");
+    if (colmap::ExistsDir(sparsePath)) {
+        for (const auto& modelPath : colmap::GetDirList(sparsePath)) {
+            colmap::Reconstruction reconstruction;
+            reconstruction.Read(modelPath);
+            if (!writer.writeModel(reconstruction, colmap::JoinPaths(modelPath, "model.lod"))) {
+                LOG_WARNING("Failed to export %s as a .lod file", modelPath.c_str());
+            }
+        }
+    }
+    const std::string densePath = colmap::JoinPaths(outputPath, "dense");
+    if (colmap::ExistsDir(densePath)) {
+        for (const auto& modelPath : colmap::GetDirList(densePath)) {
+            const std::string fusedPath = colmap::JoinPaths(modelPath, "fused.ply");
+            if (!colmap::ExistsFile(fusedPath)) {
+                continue;
+            }
+            colmap::Reconstruction reconstruction;
+            reconstruction.Read(colmap::JoinPaths(modelPath, "sparse"));
+            if (!writer.writeCloud(reconstruction, fusedPath, colmap::JoinPaths(modelPath, "fused.lod"))) {
+                LOG_WARNING("Failed to export %s as a .lod file", fusedPath.c_str());
+            }
+        }
+    }
+}
+
+/**
+ * @brief Write the stage measurements and pose accuracy of the run
+ * @param outputPath Workspace, receives benchmark_results.json
+ * @param metrics Metrics of the run so far; pose accuracy is appended
+ * @param evaluatePoses Compare the reconstructed models with the ground truth poses
+ */
+static void writeBenchmarkResults(const std::string& outputPath,
+                                  std::vector<std::pair<std::string, double>> metrics,
+                                  bool evaluatePoses) {
+    const std::string groundTruthPath = Config::getBenchmarkGroundTruth();
+    const std::string sparsePath = colmap::JoinPaths(outputPath, "sparse");
+    if (evaluatePoses && !groundTruthPath.empty() && colmap::ExistsDir(sparsePath)) {
+        // The largest model stands for the reconstruction
+        colmap::Reconstruction largest;
+        for (const auto& modelPath : colmap::GetDirList(sparsePath)) {
+            colmap::Reconstruction reconstruction;
+            reconstruction.Read(modelPath);
+            if (reconstruction.NumRegImages() > largest.NumRegImages()) {
+                largest = std::move(reconstruction);
+            }
+        }
+        PoseEvaluator::Result accuracy;
+        const bool evaluated = PoseEvaluator::evaluate(largest, groundTruthPath, accuracy);
+        metrics.emplace_back("num_ground_truth", static_cast<double>(accuracy.numGroundTruth));
+        metrics.emplace_back("num_registered", static_cast<double>(accuracy.numRegistered));
+        metrics.emplace_back("registered_fraction", accuracy.registeredFraction);
+        if (evaluated) {
+            metrics.emplace_back("position_error_median", accuracy.positionErrorMedian);
+            metrics.emplace_back("position_error_max", accuracy.positionErrorMax);
+            metrics.emplace_back("rotation_error_median_deg", accuracy.rotationErrorMedian);
+            metrics.emplace_back("rotation_error_max_deg", accuracy.rotationErrorMax);
+        }
+    }
+    const std::string resultsPath = colmap::JoinPaths(outputPath, "benchmark_results.json");
+    if (StageProfiler::getInstance().writeJson(resultsPath, metrics)) {
+        LOG_INFO("Benchmark results written to %s", resultsPath.c_str());
+    }
+}
+
+/**
+ * @brief Track the camera of the frame source in a prebuilt map
+ *
+ * Poses are written to <outputPath>/localization.txt, one line per frame:
+ * frame index, localized flag, qw qx qy qz tx ty tz (camera from world),
+ * inliers and latency in milliseconds.
+ *
+ * @param outputPath Output directory
+ * @param metrics Receives the latency and localized fraction of the stream
+ * @return true if the map was loaded and the stream processed
+ */
+static bool runLocalization(const std::string& outputPath,
+                            std::vector<std::pair<std::string, double>>& metrics) {
+    const std::string databasePath = Config::getLocalizationMapDatabase().empty()
+        ? colmap::JoinPaths(outputPath, "database.db")
+        : Config::getLocalizationMapDatabase();
+    MapIndex map{MapIndex::Options()};
+    if (!map.load(Config::getLocalizationMapPath(), databasePath)) {
+        return false;
+    }
+
+    Localizer::Options localizerOptions;
+    localizerOptions.latencyBudgetMs = Config::getLocalizationLatencyBudget();
+    localizerOptions.maxImageSize = Config::getLocalizationMaxImageSize();
+    localizerOptions.maxNumFeatures = Config::getLocalizationMaxFeatures();
+    Localizer localizer(map, localizerOptions);
+
+    const std::string posesPath = colmap::JoinPaths(outputPath, "localization.txt");
+    std::ofstream poses(posesPath);
+    if (!poses) {
+        LOG_ERROR("Failed to open %s", posesPath.c_str());
+        return false;
+    }
+    poses << "# FRAME LOCALIZED QW QX QY QZ TX TY TZ INLIERS LATENCY_MS\n";
+    poses.precision(9);
+
+    FrameSource& frameSource = FrameSource::getInstance();
+    Frame frame;
+    size_t frameIndex = 0;
+    StageProfiler::Scope stage("localization");
+    while (frameSource.getNextFrame(frame)) {
+        const Localizer::Result result = localizer.localize(frame.original);
+        const Eigen::Quaterniond& rotation = result.camFromWorld.rotation;
+        const Eigen::Vector3d& translation = result.camFromWorld.translation;
+        poses << frameIndex << " " << (result.localized ? 1 : 0) << " "
+              << rotation.w() << " " << rotation.x() << " " << rotation.y() << " " << rotation.z() << " "
+              << translation.x() << " " << translation.y() << " " << translation.z() << " "
+              << result.numInliers << " " << result.latencyMs << "\n";
+        ++frameIndex;
+        if (frameIndex % 100 == 0) {
+            LOG_INFO("Localized %zu/%zu frames, latency p50 %.1f ms, p99 %.1f ms",
+                     localizer.getNumLocalized(), localizer.getNumFrames(),
+                     localizer.getLatencyPercentile(50.0), localizer.getLatencyPercentile(99.0));
+        }
+    }
+
+    LOG_INFO("Localization finished: %zu/%zu frames localized, latency p50 %.1f ms, p99 %.1f ms "
+             "(budget %.1f ms)", localizer.getNumLocalized(), localizer.getNumFrames(),
+             localizer.getLatencyPercentile(50.0), localizer.getLatencyPercentile(99.0),
+             localizerOptions.latencyBudgetMs);
+    LOG_INFO("Poses written to %s", posesPath.c_str());
+    stage.setItems(localizer.getNumFrames());
+    metrics.emplace_back("latency_p50_ms", localizer.getLatencyPercentile(50.0));
+    metrics.emplace_back("latency_p99_ms", localizer.getLatencyPercentile(99.0));
+    metrics.emplace_back("localized_fraction", localizer.getNumFrames() > 0
+        ? static_cast<double>(localizer.getNumLocalized()) / localizer.getNumFrames() : 0.0);
+    return true;
+}
+
+/**
+ * @brief Match shards published by a distributed matching coordinator
+ * @param options Reconstruction settings taken from the config file
+ * @param configPath Path of the config file
+ * @return true if every claimed shard was matched
+ */
+static bool runMatchWorker(const colmap::AutomaticReconstructionController::Options& options,
+                           const std::string& configPath) {
+    colmap::OptionManager colmapOptions;
+    configureColmapOptions(options, colmapOptions);
+    ColmapStages stages(colmapOptions, options.workspace_path,
+                        TaskScheduler::getInstance().getNumWorkers());
+    stages.setVerificationPrefilter(Config::getColmapVerificationPrefilter());
+    DistributedMatcher matcher(distributedOptions(options, configPath, ""), stages);
+    return matcher.runWorker();
+}
+
+/**
+ * @brief Limit COLMAP's OpenMP regions to the scheduler's worker count
+ *
+ * The OpenMP runtime reads OMP_NUM_THREADS when it is loaded and gives
+ * every thread that is not the caller of omp_set_num_threads() that
+ * default, so the process restarts itself once with the variable set. A
+ * value the user exported is left alone; one this program set for its
+ * parent (a coordinator starting match workers) is replaced.
+ *
+ * @param argv Arguments of this process, passed on unchanged
+ * @param numThreads Threads per OpenMP region
+ */
+static void limitOpenMpThreads(char** argv, int numThreads) {
+    static const char* kOwnValue = "COLMAP_NEURAL_OMP_NUM_THREADS";
+    const std::string wanted = std::to_string(numThreads);
+    const char* current = std::getenv("OMP_NUM_THREADS");
+    const char* own = std::getenv(kOwnValue);
+    if (current != nullptr && (own == nullptr || std::string(own) != current)) {
+        return;
+    }
+    if (current == nullptr || wanted != current) {
+        setenv("OMP_NUM_THREADS", wanted.c_str(), 1);
+        setenv(kOwnValue, wanted.c_str(), 1);
+#if defined(__linux__)
+        execv("/proc/self/exe", argv);
+#else
+        execvp(argv[0], argv);
+#endif
+        LOG_WARNING("Could not restart with OMP_NUM_THREADS=%s, OpenMP keeps its default",
+                    wanted.c_str());
+    }
+#if defined(_OPENMP)
+    // Regions started from the main thread, also when the restart failed
+    omp_set_num_threads(numThreads);
+#endif
+}
+
+/**
+ * Usage: ./colmap-neural-app <path_to_config_file> [--match-worker]
+ *
+ * With --match-worker the process matches shards of a distributed matching
+ * job instead of running a reconstruction.
  */
 int main(int argc, char** argv) {
     
     if (argc < 2) {
-        LOG_ERROR("Usage: %s <path_to_config_file>", argv[0]);
+        LOG_ERROR("Usage: %s <path_to_config_file> [--match-worker]", argv[0]);
         return 1;
     }
 
     std::string configPath = argv[1];
+    const bool matchWorker = argc > 2 && std::string(argv[2]) == "--match-worker";
 
     // 1. read config file
     if (!Config::loadFromFile(configPath)) {
@@ -36,15 +760,66 @@ int main(int argc, char** argv) {
     Logger::getInstance().setLogLevel(Config::getLogLevelMask());
     LOG_INFO("Logger initialized with level mask: %d", Config::getLogLevelMask());
 
-    // 3. initialize frame source
-    FrameSource& frameSource = FrameSource::getInstance();
-    if (!frameSource.initialize()) {
-        LOG_ERROR("Failed to initialize frame source");
-        return 1;
+    // 3. start the shared task scheduler and resource limits; ONNX Runtime
+    //    and OpenMP get the remaining cores instead of one pool per stage
+    TaskScheduler::Options schedulerOptions;
+    schedulerOptions.numWorkers = Config::getNumThreads();
+    schedulerOptions.numInferenceThreads = Config::getInferenceThreads();
+    schedulerOptions.pinThreads = Config::getPinThreads();
+    if (matchWorker) {
+        // Local workers run side by side on one host; split the cores between
+        // them and leave placement to the OS
+        if (schedulerOptions.numWorkers == 0) {
+            const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            schedulerOptions.numWorkers = std::max(1, cores / std::max(1, Config::getDistributedWorkers()));
+        }
+        schedulerOptions.pinThreads = false;
     }
-    LOG_INFO("Frame source initialized successfully");
+    TaskScheduler& scheduler = TaskScheduler::getInstance();
+    scheduler.initialize(schedulerOptions);
+
+    ModelLoader::ThreadingOptions inferenceThreading;
+    inferenceThreading.intra_op_threads = std::max(1, scheduler.getNumInferenceThreads());
+    inferenceThreading.spawn_thread = [&scheduler](void (*fn)(void*), void* param) {
+        return scheduler.spawnExternalThread(fn, param);
+    };
+    inferenceThreading.join_thread = [&scheduler](void* handle) {
+        scheduler.joinExternalThread(handle);
+    };
+    ModelLoader::SetThreadingOptions(inferenceThreading);
+
+    // Cap memory for the job; a quarter of it goes to the inference arena,
+    // which ONNX Runtime keeps for the whole job once grown. It is reserved
+    // when the first neural component creates it, so jobs without one keep
+    // the whole budget.
+    MemoryBudget::getInstance().setLimit(Config::getMemoryLimit());
+    if (Config::getMemoryLimit() > 0) {
+        ModelLoader::ArenaOptions arenaOptions;
+        arenaOptions.max_bytes = Config::getMemoryLimit() / 4;
+        arenaOptions.on_create = [](size_t bytes) {
+            MemoryBudget::getInstance().forceReserve(MemoryBudget::Category::INFERENCE, bytes);
+        };
+        arenaOptions.on_release = [](size_t bytes) {
+            MemoryBudget::getInstance().release(MemoryBudget::Category::INFERENCE, bytes);
+        };
+        ModelLoader::SetArenaOptions(arenaOptions);
+    }
+
+    // COLMAP's OpenMP regions (bundle adjustment, triangulation) run after
+    // the pipeline stages, so they may use the worker cores
+    limitOpenMpThreads(argv, scheduler.getNumWorkers());
 
-    // 4. Create the output directories if they don't exist for colmap results
+    // 4. initialize frame source (matching workers only read the database)
+    if (!matchWorker) {
+        FrameSource& frameSource = FrameSource::getInstance();
+        if (!frameSource.initialize()) {
+            LOG_ERROR("Failed to initialize frame source");
+            return 1;
+        }
+        LOG_INFO("Frame source initialized successfully");
+    }
+
+    // 5. Create the output directories if they don't exist for colmap results
     std::string outputPath = Config::getColmapOutputPath();
     if (outputPath.empty()) {
         LOG_ERROR("Output path not specified in config file.");
@@ -57,7 +832,19 @@ int main(int argc, char** argv) {
     }
     LOG_INFO("Output directory created/verified: %s", outputPath.c_str());
 
-    // 5. Configure colmap parameters
+    if (!matchWorker && Config::getLocalizationEnabled()) {
+        LOG_INFO("Localizing frames in map %s", Config::getLocalizationMapPath().c_str());
+        std::vector<std::pair<std::string, double>> metrics;
+        if (!runLocalization(outputPath, metrics)) {
+            return 1;
+        }
+        if (Config::getBenchmarkEnabled()) {
+            writeBenchmarkResults(outputPath, metrics, false);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // 6. Configure colmap parameters
     colmap::AutomaticReconstructionController::Options options;
     
     // Set image path
@@ -72,6 +859,9 @@ int main(int argc, char** argv) {
     options.data_type = Config::getColmapDataType();
     options.quality = Config::getColmapQuality();
     options.dense = Config::getColmapDenseEnabled();
+    if (Config::getColmapPairing() == Config::PairingMode::RETRIEVAL) {
+        options.vocab_tree_path = Config::getColmapVocabTreePath();
+    }
     
     // Create database path within the output directory
     options.database_path = colmap::JoinPaths(outputPath, "database.db");
@@ -82,14 +872,108 @@ int main(int argc, char** argv) {
     LOG_INFO("  Database path: %s", options.database_path.c_str());
     LOG_INFO("  Dense reconstruction: %s", options.dense ? "Enabled" : "Disabled");
     
-    // Initialize the reconstruction controller
-    colmap::AutomaticReconstructionController reconstruction(options,
-                                                          colmap::ReconstructionManager());
-    
-    // 6. Start the reconstruction process
-    LOG_INFO("Starting reconstruction...");
-    reconstruction.Start();
-    reconstruction.Wait();
+    switch (Config::getColmapPipelineMode()) {
+        case Config::PipelineMode::SEQUENTIAL:
+            LOG_INFO("  Pipeline: Sequential");
+            break;
+        case Config::PipelineMode::OVERLAPPED:
+            LOG_INFO("  Pipeline: Overlapped");
+            break;
+        case Config::PipelineMode::DISTRIBUTED:
+            LOG_INFO("  Pipeline: Distributed (%d local workers)", Config::getDistributedWorkers());
+            break;
+    }
+    switch (Config::getColmapPairing()) {
+        case Config::PairingMode::EXHAUSTIVE:
+            LOG_INFO("  Pairing: Exhaustive");
+            break;
+        case Config::PairingMode::RETRIEVAL:
+            LOG_INFO("  Pairing: Retrieval (%s)", options.vocab_tree_path.c_str());
+            if (Config::getColmapPipelineMode() != Config::PipelineMode::SEQUENTIAL) {
+                LOG_WARNING("Retrieval pairing is only available in the sequential pipeline, "
+                            "matching exhaustively");
+            }
+            break;
+        case Config::PairingMode::SPATIAL:
+            LOG_INFO("  Pairing: Spatial (%d neighbours)", Config::getColmapSpatialNeighbors());
+            break;
+    }
+    if (Config::getColmapMapper() == Config::MapperMode::PARTITIONED) {
+        LOG_INFO("  Mapper: Partitioned (clusters of %d images, %d overlap)",
+                 Config::getColmapClusterMaxImages(), Config::getColmapClusterOverlap());
+    } else {
+        LOG_INFO("  Mapper: Incremental");
+    }
+    if (Config::getColmapCoarseToFine()) {
+        if (Config::getColmapPipelineMode() == Config::PipelineMode::DISTRIBUTED) {
+            LOG_WARNING("  Coarse-to-fine is not available in 'distributed' mode, running a single pass");
+        } else {
+            LOG_INFO("  Coarse-to-fine: coarse pass at %d pixels", Config::getColmapCoarseImageSize());
+        }
+    }
+    if (options.dense && Config::getColmapDenseMethod() == Config::DenseMethod::MVSNET) {
+        LOG_INFO("  Dense method: MVSNet (%s, %d depths, %d px tiles)",
+                 Config::getMvsNetModelPath().c_str(), Config::getMvsNetDepths(),
+                 Config::getMvsNetTileSize());
+    } else if (options.dense) {
+        LOG_INFO("  Dense method: PatchMatch");
+    }
+    if (options.dense && Config::getColmapFusion() == Config::FusionMethod::STREAMING) {
+        LOG_INFO("  Fusion: Streaming (at least %d views per voxel)", Config::getColmapFusionMinViews());
+    }
+
+    if (matchWorker) {
+        LOG_INFO("Running as matching worker");
+        return runMatchWorker(options, configPath) ? EXIT_SUCCESS : 1;
+    }
+
+    // 7. Start the reconstruction process, resuming from an earlier run if
+    //    the output folder holds a checkpoint
+    Checkpoint checkpoint(outputPath, Config::getCheckpointEnabled(), Config::getCheckpointDiscardStale());
+    const Checkpoint::Fingerprint fingerprint = checkpoint.isEnabled()
+        ? Checkpoint::computeFingerprint(configPath, options.image_path) : Checkpoint::Fingerprint();
+    if (checkpoint.load(fingerprint)) {
+        LOG_INFO("Resuming reconstruction from checkpoint in %s", outputPath.c_str());
+    } else if (checkpoint.isStale()) {
+        return 1;
+    } else {
+        LOG_INFO("Starting reconstruction...");
+    }
+    bool succeeded = false;
+    switch (Config::getColmapPipelineMode()) {
+        case Config::PipelineMode::SEQUENTIAL:
+            if (Config::getColmapCoarseToFine()) {
+                succeeded = runCoarseToFineReconstruction(options, checkpoint);
+            } else if (Config::getColmapPairing() == Config::PairingMode::SPATIAL ||
+                Config::getMaskDynamicObjects()) {
+                // The automatic controller takes neither a pair list nor keypoint masks
+                LOG_INFO("Spatial pairing and dynamic object masking run through the overlapped pipeline");
+                succeeded = runOverlappedReconstruction(options, checkpoint);
+            } else {
+                succeeded = runSequentialReconstruction(options, checkpoint);
+            }
+            break;
+        case Config::PipelineMode::OVERLAPPED:
+            succeeded = Config::getColmapCoarseToFine()
+                ? runCoarseToFineReconstruction(options, checkpoint)
+                : runOverlappedReconstruction(options, checkpoint);
+            break;
+        case Config::PipelineMode::DISTRIBUTED:
+            succeeded = runDistributedReconstruction(options, checkpoint, configPath, argv[0]);
+            break;
+    }
+    if (!succeeded) {
+        LOG_ERROR("Reconstruction failed.");
+        return 1;
+    }
+    if (Config::getColmapExportLod()) {
+        StageProfiler::Scope stage("export");
+        exportLodModels(outputPath);
+    }
+    if (Config::getBenchmarkEnabled()) {
+        writeBenchmarkResults(outputPath, {}, true);
+    }
+    MemoryBudget::getInstance().logUsage();
     
     LOG_INFO("Reconstruction completed successfully.");
     
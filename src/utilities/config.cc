@@ -4,6 +4,7 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <stdexcept>
 
 // Trim function
 static inline std::string trim(const std::string &s) {
@@ -21,6 +22,24 @@ static inline std::string removeComment(const std::string &s) {
     return s;
 }
 
+// Parse sizes such as "64G", "512MB" or a plain byte count
+static size_t parseByteSize(const std::string &s) {
+    size_t pos = 0;
+    const double number = std::stod(s, &pos);
+    std::string unit = trim(s.substr(pos));
+    std::transform(unit.begin(), unit.end(), unit.begin(),
+                   [](unsigned char c){ return std::toupper(c); });
+    double multiplier = 1.0;
+    if (unit == "K" || unit == "KB") multiplier = 1024.0;
+    else if (unit == "M" || unit == "MB") multiplier = 1024.0 * 1024.0;
+    else if (unit == "G" || unit == "GB") multiplier = 1024.0 * 1024.0 * 1024.0;
+    else if (unit == "T" || unit == "TB") multiplier = 1024.0 * 1024.0 * 1024.0 * 1024.0;
+    else if (!unit.empty() && unit != "B") {
+        throw std::invalid_argument("unknown size unit '" + unit + "'");
+    }
+    return static_cast<size_t>(std::max(0.0, number * multiplier));
+}
+
 bool Config::loadFromFile(const std::string& filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
@@ -68,6 +87,21 @@ bool Config::loadFromFile(const std::string& filename) {
                         }
                     }
                     else if (key == "confidence_threshold") confidenceThreshold = std::stof(value);
+                    else if (key == "mask_dynamic_objects") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        maskDynamicObjects = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    } else if (key == "mask_classes") {
+                        maskClasses.clear();
+                        std::istringstream classes(value);
+                        std::string classId;
+                        while (std::getline(classes, classId, ',')) {
+                            if (!trim(classId).empty()) {
+                                maskClasses.push_back(std::stoi(classId));
+                            }
+                        }
+                    }
                 } else if (section == "Input") {
                     if (key == "source") {
                         sourceSpecified = true;
@@ -100,6 +134,67 @@ bool Config::loadFromFile(const std::string& filename) {
                             logLevelMask &= ~LOG_LV_DEBUG;
                         }
                     }
+                } else if (section == "Threading") {
+                    if (key == "num_threads") numThreads = std::max(0, std::stoi(value));
+                    else if (key == "inference_threads") inferenceThreads = std::max(0, std::stoi(value));
+                    else if (key == "pin_threads") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        pinThreads = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    }
+                } else if (section == "Resources") {
+                    if (key == "memory_limit") {
+                        try {
+                            memoryLimit = parseByteSize(value);
+                        } catch (const std::exception&) {
+                            std::cerr << "Invalid memory limit: '" << value << "'. Using no limit." << std::endl;
+                            memoryLimit = 0;
+                        }
+                    }
+                } else if (section == "Distributed") {
+                    if (key == "workers") distributedWorkers = std::max(0, std::stoi(value));
+                    else if (key == "shards") distributedShards = std::max(0, std::stoi(value));
+                } else if (section == "Checkpoint") {
+                    if (key == "enabled") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        checkpointEnabled = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    } else if (key == "snapshot_interval") {
+                        checkpointSnapshotInterval = std::max(0, std::stoi(value));
+                    } else if (key == "discard_stale_outputs") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        checkpointDiscardStale = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    }
+                } else if (section == "Localization") {
+                    if (key == "enabled") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        localizationEnabled = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    } else if (key == "map_path") {
+                        localizationMapPath = value;
+                    } else if (key == "map_database") {
+                        localizationMapDatabase = value;
+                    } else if (key == "latency_budget_ms") {
+                        localizationLatencyBudget = std::max(1.0, std::stod(value));
+                    } else if (key == "max_image_size") {
+                        localizationMaxImageSize = std::max(64, std::stoi(value));
+                    } else if (key == "max_features") {
+                        localizationMaxFeatures = std::max(64, std::stoi(value));
+                    }
+                } else if (section == "Benchmark") {
+                    if (key == "enabled") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        benchmarkEnabled = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    } else if (key == "ground_truth") {
+                        benchmarkGroundTruth = value;
+                    }
                 } else if (section == "Colmap") {
                     if (key == "image_path") {
                         colmapImagePath = value;
@@ -140,6 +235,121 @@ bool Config::loadFromFile(const std::string& filename) {
                         } else {
                             std::cerr << "Invalid COLMAP quality setting: '" << value << "'. Using default (HIGH)." << std::endl;
                         }
+                    } else if (key == "pipeline") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+
+                        if (lowerValue == "sequential") {
+                            colmapPipelineMode = PipelineMode::SEQUENTIAL;
+                        } else if (lowerValue == "overlapped") {
+                            colmapPipelineMode = PipelineMode::OVERLAPPED;
+                        } else if (lowerValue == "distributed") {
+                            colmapPipelineMode = PipelineMode::DISTRIBUTED;
+                        } else {
+                            std::cerr << "Invalid COLMAP pipeline mode: '" << value << "'. Using default (SEQUENTIAL)." << std::endl;
+                        }
+                    } else if (key == "pipeline_queue_size") {
+                        colmapPipelineQueueSize = std::max(1, std::stoi(value));
+                    } else if (key == "read_ahead") {
+                        colmapReadAhead = std::max(0, std::stoi(value));
+                    } else if (key == "decode_threads") {
+                        colmapDecodeThreads = std::max(1, std::stoi(value));
+                    } else if (key == "verification_prefilter") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        colmapVerificationPrefilter = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    } else if (key == "pairing") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+
+                        if (lowerValue == "exhaustive") {
+                            colmapPairing = PairingMode::EXHAUSTIVE;
+                        } else if (lowerValue == "retrieval") {
+                            colmapPairing = PairingMode::RETRIEVAL;
+                        } else if (lowerValue == "spatial") {
+                            colmapPairing = PairingMode::SPATIAL;
+                        } else {
+                            std::cerr << "Invalid COLMAP pairing mode: '" << value << "'. Using default (EXHAUSTIVE)." << std::endl;
+                        }
+                    } else if (key == "vocab_tree_path") {
+                        colmapVocabTreePath = value;
+                    } else if (key == "spatial_neighbors") {
+                        colmapSpatialNeighbors = std::max(1, std::stoi(value));
+                    } else if (key == "spatial_radius") {
+                        colmapSpatialRadius = std::max(0.0, std::stod(value));
+                    } else if (key == "mapper") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+
+                        if (lowerValue == "incremental") {
+                            colmapMapper = MapperMode::INCREMENTAL;
+                        } else if (lowerValue == "partitioned") {
+                            colmapMapper = MapperMode::PARTITIONED;
+                        } else {
+                            std::cerr << "Invalid COLMAP mapper: '" << value << "'. Using default (INCREMENTAL)." << std::endl;
+                        }
+                    } else if (key == "cluster_max_images") {
+                        colmapClusterMaxImages = std::max(2, std::stoi(value));
+                    } else if (key == "cluster_overlap") {
+                        colmapClusterOverlap = std::max(0, std::stoi(value));
+                    } else if (key == "coarse_to_fine") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        colmapCoarseToFine = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
+                    } else if (key == "coarse_image_size") {
+                        colmapCoarseImageSize = std::max(100, std::stoi(value));
+                    } else if (key == "dense_method") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+
+                        if (lowerValue == "patch_match") {
+                            colmapDenseMethod = DenseMethod::PATCH_MATCH;
+                        } else if (lowerValue == "mvsnet") {
+                            colmapDenseMethod = DenseMethod::MVSNET;
+                        } else {
+                            std::cerr << "Invalid dense method: '" << value << "'. Using default (PATCH_MATCH)." << std::endl;
+                        }
+                    } else if (key == "mvsnet_model_path") {
+                        mvsNetModelPath = value;
+                    } else if (key == "mvsnet_depths") {
+                        mvsNetDepths = std::max(2, std::stoi(value));
+                    } else if (key == "mvsnet_tile_size") {
+                        // The network downsamples by up to 32
+                        mvsNetTileSize = std::max(32, std::stoi(value) / 32 * 32);
+                    } else if (key == "mvsnet_image_memory") {
+                        try {
+                            mvsNetImageMemory = parseByteSize(value);
+                        } catch (const std::exception&) {
+                            std::cerr << "Invalid MVSNet image memory: '" << value << "'. Using default (0)." << std::endl;
+                            mvsNetImageMemory = 0;
+                        }
+                    } else if (key == "fusion") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+
+                        if (lowerValue == "standard") {
+                            colmapFusion = FusionMethod::STANDARD;
+                        } else if (lowerValue == "streaming") {
+                            colmapFusion = FusionMethod::STREAMING;
+                        } else {
+                            std::cerr << "Invalid fusion method: '" << value << "'. Using default (STANDARD)." << std::endl;
+                        }
+                    } else if (key == "fusion_voxel_size") {
+                        colmapFusionVoxelSize = std::max(0.0, std::stod(value));
+                    } else if (key == "fusion_min_views") {
+                        colmapFusionMinViews = std::max(1, std::stoi(value));
+                    } else if (key == "export_lod") {
+                        std::string lowerValue = value;
+                        std::transform(lowerValue.begin(), lowerValue.end(), lowerValue.begin(),
+                                    [](unsigned char c){ return std::tolower(c); });
+                        colmapExportLod = (lowerValue == "true" || lowerValue == "1" || lowerValue == "yes");
                     }
                 }
             }
@@ -167,5 +377,20 @@ bool Config::loadFromFile(const std::string& filename) {
         videoPath = "";
     }
 
+    if (colmapPairing == PairingMode::RETRIEVAL && colmapVocabTreePath.empty()) {
+        std::cerr << "Retrieval pairing selected but no vocab_tree_path provided. Using EXHAUSTIVE." << std::endl;
+        colmapPairing = PairingMode::EXHAUSTIVE;
+    }
+
+    if (colmapDenseMethod == DenseMethod::MVSNET && mvsNetModelPath.empty()) {
+        std::cerr << "MVSNet dense method selected but no mvsnet_model_path provided. Using PATCH_MATCH." << std::endl;
+        colmapDenseMethod = DenseMethod::PATCH_MATCH;
+    }
+
+    if (localizationEnabled && localizationMapPath.empty()) {
+        std::cerr << "Invalid configuration: Localization enabled but no map_path provided." << std::endl;
+        return false;
+    }
+
     return true;
 }
\ No newline at end of file
@@ -5,7 +5,9 @@
 
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <vector>
 #include <colmap/controllers/automatic_reconstruction.h>
 
 /**
@@ -23,6 +25,53 @@ public:
         CAMERA  /**< Input from a camera */
     };
 
+    /**
+     * @enum PipelineMode
+     * @brief Specifies how the COLMAP stages are scheduled
+     */
+    enum class PipelineMode {
+        SEQUENTIAL, /**< Extraction, matching and mapping run one after another */
+        OVERLAPPED, /**< Matching and verification stream behind extraction */
+        DISTRIBUTED /**< Pairs are matched by separate worker processes */
+    };
+
+    /**
+     * @enum PairingMode
+     * @brief Specifies which image pairs are matched
+     */
+    enum class PairingMode {
+        EXHAUSTIVE, /**< All pairs, or temporal neighbours for video data */
+        RETRIEVAL,  /**< COLMAP vocabulary tree retrieval */
+        SPATIAL     /**< Nearest neighbours by EXIF GPS position or capture order */
+    };
+
+    /**
+     * @enum MapperMode
+     * @brief Specifies how the sparse model is reconstructed
+     */
+    enum class MapperMode {
+        INCREMENTAL, /**< One incremental mapper over all images */
+        PARTITIONED  /**< Overlapping clusters mapped in parallel and merged */
+    };
+
+    /**
+     * @enum DenseMethod
+     * @brief Specifies how depth maps are computed for dense reconstruction
+     */
+    enum class DenseMethod {
+        PATCH_MATCH, /**< COLMAP PatchMatch stereo, requires CUDA */
+        MVSNET       /**< Learned MVSNet depth on the CPU */
+    };
+
+    /**
+     * @enum FusionMethod
+     * @brief Specifies how depth maps are fused into the dense point cloud
+     */
+    enum class FusionMethod {
+        STANDARD, /**< COLMAP stereo fusion, all points in memory */
+        STREAMING /**< Voxel hash fusion that writes finished regions as it goes */
+    };
+
     /**
      * @brief Loads configuration from a file
      * @param filename The path to the configuration file
@@ -74,6 +123,18 @@ public:
      */
     static float getConfidenceThreshold() { return confidenceThreshold; }
 
+    /**
+     * @brief Checks whether keypoints on detected dynamic objects are dropped
+     * @return true if masking is enabled
+     */
+    static bool getMaskDynamicObjects() { return maskDynamicObjects; }
+
+    /**
+     * @brief Gets the detector classes treated as dynamic objects
+     * @return Class indices of the model
+     */
+    static const std::vector<int>& getMaskClasses() { return maskClasses; }
+
     /**
      * @brief Gets the IoU threshold
      * @return The IoU threshold
@@ -142,11 +203,253 @@ public:
         return colmapQuality; 
     }
 
+    /**
+     * @brief Gets the COLMAP pipeline scheduling mode
+     * @return The pipeline mode
+     */
+    static PipelineMode getColmapPipelineMode() { return colmapPipelineMode; }
+
+    /**
+     * @brief Gets the capacity of the queues between overlapped pipeline stages
+     * @return The queue capacity
+     */
+    static int getColmapPipelineQueueSize() { return colmapPipelineQueueSize; }
+
+    /**
+     * @brief Gets the number of images decoded ahead of feature extraction
+     * @return The read-ahead window, 0 to read images on demand
+     */
+    static int getColmapReadAhead() { return colmapReadAhead; }
+
+    /**
+     * @brief Gets the number of image decodes run in parallel ahead of extraction
+     * @return The number of decode tasks in flight
+     */
+    static int getColmapDecodeThreads() { return colmapDecodeThreads; }
+
+    /**
+     * @brief Gets the image pair selection mode
+     * @return The pairing mode
+     */
+    static PairingMode getColmapPairing() { return colmapPairing; }
+
+    /**
+     * @brief Gets the vocabulary tree used by retrieval pairing
+     * @return Path to the vocabulary tree file
+     */
+    static std::string getColmapVocabTreePath() { return colmapVocabTreePath; }
+
+    /**
+     * @brief Gets the number of neighbours each image is paired with in spatial pairing
+     * @return The number of neighbours
+     */
+    static int getColmapSpatialNeighbors() { return colmapSpatialNeighbors; }
+
+    /**
+     * @brief Gets the maximum distance between spatially paired images
+     * @return The radius in meters, 0 for no limit
+     */
+    static double getColmapSpatialRadius() { return colmapSpatialRadius; }
+
+    /**
+     * @brief Gets the sparse mapping mode
+     * @return The mapper mode
+     */
+    static MapperMode getColmapMapper() { return colmapMapper; }
+
+    /**
+     * @brief Gets the maximum cluster size of partitioned mapping
+     * @return Images per cluster before overlap
+     */
+    static int getColmapClusterMaxImages() { return colmapClusterMaxImages; }
+
+    /**
+     * @brief Gets the number of images shared by neighbouring clusters
+     * @return Overlap in images
+     */
+    static int getColmapClusterOverlap() { return colmapClusterOverlap; }
+
+    /**
+     * @brief Checks whether a coarse model is built before the full resolution pass
+     * @return true if coarse-to-fine reconstruction is enabled
+     */
+    static bool getColmapCoarseToFine() { return colmapCoarseToFine; }
+
+    /**
+     * @brief Gets the image size of the coarse pass
+     * @return Longest image side in pixels
+     */
+    static int getColmapCoarseImageSize() { return colmapCoarseImageSize; }
+
+    /**
+     * @brief Gets the depth map method of dense reconstruction
+     * @return The dense method
+     */
+    static DenseMethod getColmapDenseMethod() { return colmapDenseMethod; }
+
+    /**
+     * @brief Gets the MVSNet ONNX model used for learned depth
+     * @return The model path
+     */
+    static std::string getMvsNetModelPath() { return mvsNetModelPath; }
+
+    /**
+     * @brief Gets the number of MVSNet depth hypotheses
+     * @return Depth hypotheses per pixel
+     */
+    static int getMvsNetDepths() { return mvsNetDepths; }
+
+    /**
+     * @brief Gets the side of the reference tiles MVSNet runs on
+     * @return Tile size in pixels
+     */
+    static int getMvsNetTileSize() { return mvsNetTileSize; }
+
+    /**
+     * @brief Gets the cost volume memory of one image
+     * @return Bytes per image, 0 to derive it from the memory limit
+     */
+    static size_t getMvsNetImageMemory() { return mvsNetImageMemory; }
+
+    /**
+     * @brief Gets the depth map fusion method
+     * @return The fusion method
+     */
+    static FusionMethod getColmapFusion() { return colmapFusion; }
+
+    /**
+     * @brief Gets the voxel size of streaming fusion
+     * @return Voxel edge in model units, 0 to derive it from the depth maps
+     */
+    static double getColmapFusionVoxelSize() { return colmapFusionVoxelSize; }
+
+    /**
+     * @brief Gets the number of images a fused voxel must be seen in
+     * @return Minimum views per point
+     */
+    static int getColmapFusionMinViews() { return colmapFusionMinViews; }
+
+    /**
+     * @brief Checks whether finished models are also exported as level-of-detail files
+     * @return true if .lod files are written next to the sparse models and fused clouds
+     */
+    static bool getColmapExportLod() { return colmapExportLod; }
+
+    /**
+     * @brief Checks whether putative matches are prefiltered before two-view verification
+     * @return true if the PROSAC/SPRT prefilter is enabled
+     */
+    static bool getColmapVerificationPrefilter() { return colmapVerificationPrefilter; }
+
+    /**
+     * @brief Gets the number of task scheduler workers
+     * @return The number of workers, 0 for all cores not reserved for inference
+     */
+    static int getNumThreads() { return numThreads; }
+
+    /**
+     * @brief Gets the number of cores reserved for ONNX Runtime inference
+     * @return The number of inference threads
+     */
+    static int getInferenceThreads() { return inferenceThreads; }
+
+    /**
+     * @brief Gets whether worker and inference threads are pinned to cores
+     * @return true if threads are pinned, false otherwise
+     */
+    static bool getPinThreads() { return pinThreads; }
+
+    /**
+     * @brief Gets the memory cap for the job
+     * @return The limit in bytes, 0 if unlimited
+     */
+    static size_t getMemoryLimit() { return memoryLimit; }
+
+    /**
+     * @brief Gets the number of matching worker processes started by the coordinator
+     * @return The number of local worker processes
+     */
+    static int getDistributedWorkers() { return distributedWorkers; }
+
+    /**
+     * @brief Gets the number of shards the pair list is split into
+     * @return The number of shards, 0 for four per local worker
+     */
+    static int getDistributedShards() { return distributedShards; }
+
+    /**
+     * @brief Gets whether stage checkpoints are written and resumed from
+     * @return true if checkpointing is enabled, false otherwise
+     */
+    static bool getCheckpointEnabled() { return checkpointEnabled; }
+
+    /**
+     * @brief Gets the number of newly registered images between sparse snapshots
+     * @return The snapshot interval, 0 to disable snapshots during mapping
+     */
+    static int getCheckpointSnapshotInterval() { return checkpointSnapshotInterval; }
+
+    /**
+     * @brief Gets whether outputs of stages whose images or settings changed are deleted
+     * @return true to delete and rebuild them, false to stop the job instead
+     */
+    static bool getCheckpointDiscardStale() { return checkpointDiscardStale; }
+
+    /**
+     * @brief Gets whether input frames are localized in a prebuilt map instead of reconstructed
+     * @return true if localization mode is enabled
+     */
+    static bool getLocalizationEnabled() { return localizationEnabled; }
+
+    /**
+     * @brief Gets the sparse model frames are localized in
+     * @return The model folder
+     */
+    static std::string getLocalizationMapPath() { return localizationMapPath; }
+
+    /**
+     * @brief Gets the database the localization map was built from
+     * @return The database path, empty for <output_path>/database.db
+     */
+    static std::string getLocalizationMapDatabase() { return localizationMapDatabase; }
+
+    /**
+     * @brief Gets the target time per localized frame
+     * @return The latency budget in milliseconds
+     */
+    static double getLocalizationLatencyBudget() { return localizationLatencyBudget; }
+
+    /**
+     * @brief Gets the longest frame side features are extracted at
+     * @return The image size in pixels at the best quality level
+     */
+    static int getLocalizationMaxImageSize() { return localizationMaxImageSize; }
+
+    /**
+     * @brief Gets the number of features extracted per frame
+     * @return The feature count at the best quality level
+     */
+    static int getLocalizationMaxFeatures() { return localizationMaxFeatures; }
+
+    /**
+     * @brief Gets whether stage timings, memory and pose accuracy are written after the run
+     * @return true if <output_path>/benchmark_results.json is written
+     */
+    static bool getBenchmarkEnabled() { return benchmarkEnabled; }
+
+    /**
+     * @brief Gets the ground truth poses the largest model is evaluated against
+     * @return The pose file, empty to skip the accuracy evaluation
+     */
+    static std::string getBenchmarkGroundTruth() { return benchmarkGroundTruth; }
+
 private:
     static inline InputSource inputSource = InputSource::VIDEO;
     static inline std::string videoPath = "";
     static inline std::string modelPath = "";
     static inline float confidenceThreshold = 0.5f;
+    static inline bool maskDynamicObjects = false;
+    static inline std::vector<int> maskClasses = {0, 1, 2, 3, 5, 7};
     static inline float iouThreshold = 0.5f;
     static inline int maxFramesToSkip = 10;
     static inline int logLevelMask = 0;
@@ -159,4 +462,56 @@ private:
         colmap::AutomaticReconstructionController::DataType::INDIVIDUAL;
     static inline colmap::AutomaticReconstructionController::Quality colmapQuality = 
         colmap::AutomaticReconstructionController::Quality::HIGH;
+    static inline PipelineMode colmapPipelineMode = PipelineMode::SEQUENTIAL;
+    static inline int colmapPipelineQueueSize = 64;
+    static inline int colmapReadAhead = 8;
+    static inline int colmapDecodeThreads = 2;
+    static inline bool colmapVerificationPrefilter = true;
+    static inline PairingMode colmapPairing = PairingMode::EXHAUSTIVE;
+    static inline std::string colmapVocabTreePath;
+    static inline int colmapSpatialNeighbors = 20;
+    static inline double colmapSpatialRadius = 0.0;
+    static inline MapperMode colmapMapper = MapperMode::INCREMENTAL;
+    static inline int colmapClusterMaxImages = 500;
+    static inline int colmapClusterOverlap = 50;
+    static inline bool colmapCoarseToFine = false;
+    static inline int colmapCoarseImageSize = 1000;
+    static inline DenseMethod colmapDenseMethod = DenseMethod::PATCH_MATCH;
+    static inline std::string mvsNetModelPath;
+    static inline int mvsNetDepths = 192;
+    static inline int mvsNetTileSize = 512;
+    static inline size_t mvsNetImageMemory = 0;
+    static inline FusionMethod colmapFusion = FusionMethod::STANDARD;
+    static inline double colmapFusionVoxelSize = 0.0;
+    static inline int colmapFusionMinViews = 3;
+    static inline bool colmapExportLod = false;
+
+    // Threading settings
+    static inline int numThreads = 0;
+    static inline int inferenceThreads = 0;
+    static inline bool pinThreads = false;
+
+    // Resource limits
+    static inline size_t memoryLimit = 0;
+
+    // Distributed matching settings
+    static inline int distributedWorkers = 2;
+    static inline int distributedShards = 0;
+
+    // Checkpoint settings
+    static inline bool checkpointEnabled = false;
+    static inline int checkpointSnapshotInterval = 50;
+    static inline bool checkpointDiscardStale = true;
+
+    // Localization settings
+    static inline bool localizationEnabled = false;
+    static inline std::string localizationMapPath;
+    static inline std::string localizationMapDatabase;
+    static inline double localizationLatencyBudget = 50.0;
+    static inline int localizationMaxImageSize = 640;
+    static inline int localizationMaxFeatures = 1024;
+
+    // Benchmark settings
+    static inline bool benchmarkEnabled = false;
+    static inline std::string benchmarkGroundTruth;
 };
\ No newline at end of file
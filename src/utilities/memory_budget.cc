@@ -0,0 +1,268 @@
+#include "memory_budget.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char* kCategoryNames[] = {"frames", "descriptors", "inference", "depth maps", "other"};
+
+// RSS is sampled at most this often; reading /proc on every reservation
+// would dominate small reservations
+constexpr auto kResidentSampleInterval = std::chrono::milliseconds(200);
+
+// Waiters re-check the budget at this interval since RSS changes are not signalled
+constexpr auto kWaitSlice = std::chrono::milliseconds(100);
+
+double toMB(size_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+MemoryBudget& MemoryBudget::getInstance() {
+    static MemoryBudget instance;
+    return instance;
+}
+
+void MemoryBudget::setLimit(size_t limitBytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = limitBytes;
+    }
+    released.notify_all();
+    if (limitBytes > 0) {
+        LOG_INFO("Memory budget: %.0f MB", toMB(limitBytes));
+    }
+}
+
+size_t MemoryBudget::getLimit() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return limit;
+}
+
+bool MemoryBudget::reserve(Category category, size_t bytes, std::chrono::milliseconds timeout) {
+    if (tryReserve(category, bytes)) {
+        return true;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (std::chrono::steady_clock::now() < deadline) {
+        released.wait_for(lock, kWaitSlice);
+        if (fitsLocked(bytes)) {
+            usage[static_cast<int>(category)] += bytes;
+            total += bytes;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MemoryBudget::tryReserve(Category category, size_t bytes) {
+    bool granted = false;
+    size_t overshoot = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fitsLocked(bytes)) {
+            usage[static_cast<int>(category)] += bytes;
+            total += bytes;
+            granted = true;
+            overshoot = residentOvershootLocked(bytes);
+        }
+    }
+    if (granted) {
+        if (overshoot > 0) {
+            // Within the budget, but the process is over the cap in practice:
+            // shed caches to make room for the unaccounted memory
+            spill(overshoot);
+        }
+        return true;
+    }
+
+    // Over budget: give the spill handlers a chance before failing
+    spill(bytes);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fitsLocked(bytes)) {
+        usage[static_cast<int>(category)] += bytes;
+        total += bytes;
+        return true;
+    }
+    return false;
+}
+
+void MemoryBudget::forceReserve(Category category, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    usage[static_cast<int>(category)] += bytes;
+    total += bytes;
+}
+
+void MemoryBudget::release(Category category, size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t& categoryUsage = usage[static_cast<int>(category)];
+        bytes = std::min(bytes, categoryUsage);
+        categoryUsage -= bytes;
+        total -= bytes;
+        // Freed memory should be visible to the next check right away
+        residentSampled = std::chrono::steady_clock::time_point();
+    }
+    released.notify_all();
+}
+
+int MemoryBudget::addSpillHandler(SpillHandler handler) {
+    std::lock_guard<std::mutex> lock(spillMutex);
+    const int id = nextSpillHandlerId++;
+    spillHandlers.emplace_back(id, std::move(handler));
+    return id;
+}
+
+void MemoryBudget::removeSpillHandler(int id) {
+    std::lock_guard<std::mutex> lock(spillMutex);
+    spillHandlers.erase(std::remove_if(spillHandlers.begin(), spillHandlers.end(),
+                                       [id](const auto& entry) { return entry.first == id; }),
+                        spillHandlers.end());
+}
+
+size_t MemoryBudget::getUsage(Category category) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return usage[static_cast<int>(category)];
+}
+
+size_t MemoryBudget::getTotalUsage() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return total;
+}
+
+size_t MemoryBudget::getAvailable() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (limit == 0) {
+        return SIZE_MAX;
+    }
+    return limit > total ? limit - total : 0;
+}
+
+void MemoryBudget::logUsage() {
+    std::lock_guard<std::mutex> lock(mutex);
+    LOG_INFO("Memory: %.0f MB reserved, %.0f MB resident, limit %.0f MB",
+             toMB(total), toMB(getResidentBytes()), toMB(limit));
+    for (int i = 0; i < kNumCategories; ++i) {
+        if (usage[i] > 0) {
+            LOG_INFO("  %s: %.0f MB", kCategoryNames[i], toMB(usage[i]));
+        }
+    }
+}
+
+size_t MemoryBudget::getResidentBytes() {
+#if defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return static_cast<size_t>(info.resident_size);
+#elif defined(__linux__)
+    FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return 0;
+    }
+    unsigned long long pages = 0;
+    unsigned long long residentPages = 0;
+    const int fields = std::fscanf(statm, "%llu %llu", &pages, &residentPages);
+    std::fclose(statm);
+    if (fields != 2) {
+        return 0;
+    }
+    return static_cast<size_t>(residentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+
+bool MemoryBudget::fitsLocked(size_t bytes) {
+    return limit == 0 || total + bytes <= limit;
+}
+
+size_t MemoryBudget::residentOvershootLocked(size_t bytes) {
+    if (limit == 0) {
+        return 0;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now - residentSampled > kResidentSampleInterval) {
+        cachedResident = getResidentBytes();
+        residentSampled = now;
+    }
+    // At most one advisory spill per sample, the RSS needs time to drop
+    if (cachedResident + bytes <= limit || now - lastAdvisorySpill < kResidentSampleInterval) {
+        return 0;
+    }
+    lastAdvisorySpill = now;
+    return cachedResident + bytes - limit;
+}
+
+size_t MemoryBudget::spill(size_t bytesNeeded) {
+    // One spill at a time, otherwise concurrent callers evict far more than needed
+    std::lock_guard<std::mutex> lock(spillMutex);
+    size_t freed = 0;
+    for (auto& entry : spillHandlers) {
+        if (freed >= bytesNeeded) {
+            break;
+        }
+        freed += entry.second(bytesNeeded - freed);
+    }
+    if (freed > 0) {
+        LOG_DEBUG("Memory budget: spilled %.1f MB to disk", toMB(freed));
+    }
+    return freed;
+}
+
+MemoryReservation::MemoryReservation(MemoryBudget::Category category, size_t bytes)
+    : category(category), bytes(bytes) {
+    MemoryBudget& budget = MemoryBudget::getInstance();
+    if (!budget.reserve(category, bytes)) {
+        LOG_WARNING("Memory budget exceeded, proceeding with %.1f MB over the limit", toMB(bytes));
+        budget.forceReserve(category, bytes);
+    }
+}
+
+MemoryReservation::MemoryReservation(MemoryReservation&& other) noexcept
+    : category(other.category), bytes(other.bytes) {
+    other.bytes = 0;
+}
+
+MemoryReservation& MemoryReservation::operator=(MemoryReservation&& other) noexcept {
+    if (this != &other) {
+        reset();
+        category = other.category;
+        bytes = other.bytes;
+        other.bytes = 0;
+    }
+    return *this;
+}
+
+bool MemoryReservation::tryReserve(MemoryBudget::Category category, size_t bytes) {
+    reset();
+    if (!MemoryBudget::getInstance().tryReserve(category, bytes)) {
+        return false;
+    }
+    this->category = category;
+    this->bytes = bytes;
+    return true;
+}
+
+void MemoryReservation::reset() {
+    if (bytes > 0) {
+        MemoryBudget::getInstance().release(category, bytes);
+        bytes = 0;
+    }
+}
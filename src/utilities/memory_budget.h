@@ -0,0 +1,222 @@
+/**
+ * @file memory_budget.h
+ * @brief Process-wide accounting of large allocations against a memory cap
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * @class MemoryBudget
+ * @brief Singleton that caps the memory used by a job
+ *
+ * Stages reserve memory before they make a large allocation (decoded frames,
+ * descriptor caches, inference arenas, depth maps) and release it when the
+ * buffer is freed. When a reservation would exceed the limit, registered
+ * spill handlers are asked to move data to disk first; if that is not
+ * enough the caller waits for other stages to release memory.
+ *
+ * Admission is decided on the accounted total only. Heap that is not
+ * accounted or not yet returned to the OS (allocator arenas, COLMAP,
+ * ONNX Runtime) shows up in the resident set size, which is only used as an
+ * advisory trigger: when it runs over the limit the spill handlers are
+ * asked to free the overshoot, but no reservation waits on it.
+ *
+ * A limit of 0 disables the cap; reservations are then only counted.
+ */
+class MemoryBudget {
+public:
+    /**
+     * @enum Category
+     * @brief Kind of allocation, used for reporting
+     */
+    enum class Category {
+        FRAMES = 0,      /**< Decoded images and frame pools */
+        DESCRIPTORS = 1, /**< Keypoint and descriptor caches */
+        INFERENCE = 2,   /**< ONNX Runtime arenas and tensors */
+        DEPTH_MAPS = 3,  /**< Depth/normal maps and fusion state */
+        OTHER = 4        /**< Anything else */
+    };
+
+    /// Frees up to the requested number of bytes; returns the bytes actually freed
+    using SpillHandler = std::function<size_t(size_t bytesNeeded)>;
+
+    /**
+     * @brief Get the singleton instance of the MemoryBudget
+     * @return Reference to the MemoryBudget instance
+     */
+    static MemoryBudget& getInstance();
+
+    /**
+     * @brief Set the memory cap
+     * @param limitBytes Maximum memory for the job in bytes, 0 for no limit
+     */
+    void setLimit(size_t limitBytes);
+
+    /**
+     * @brief Get the memory cap
+     * @return The limit in bytes, 0 if unlimited
+     */
+    size_t getLimit();
+
+    /**
+     * @brief Reserve memory, spilling and then waiting if the cap is reached
+     * @param category Kind of allocation
+     * @param bytes Size of the allocation
+     * @param timeout Maximum time to wait for other stages to release memory
+     * @return true if the reservation was granted, false on timeout
+     */
+    bool reserve(Category category, size_t bytes,
+                 std::chrono::milliseconds timeout = std::chrono::milliseconds(30000));
+
+    /**
+     * @brief Reserve memory without waiting (spill handlers still run)
+     * @param category Kind of allocation
+     * @param bytes Size of the allocation
+     * @return true if the reservation was granted
+     */
+    bool tryReserve(Category category, size_t bytes);
+
+    /**
+     * @brief Record memory that is used regardless of the cap
+     * @param category Kind of allocation
+     * @param bytes Size of the allocation
+     */
+    void forceReserve(Category category, size_t bytes);
+
+    /**
+     * @brief Release a reservation
+     * @param category Kind of allocation
+     * @param bytes Size of the allocation
+     */
+    void release(Category category, size_t bytes);
+
+    /**
+     * @brief Register a handler that can move data out of memory
+     * @param handler Spill callback, invoked without the budget lock held
+     * @return Id for removeSpillHandler()
+     */
+    int addSpillHandler(SpillHandler handler);
+
+    /**
+     * @brief Unregister a spill handler; waits for a running spill to finish
+     * @param id Id returned by addSpillHandler()
+     */
+    void removeSpillHandler(int id);
+
+    /**
+     * @brief Get the reserved bytes of one category
+     * @param category Kind of allocation
+     * @return The reserved bytes
+     */
+    size_t getUsage(Category category);
+
+    /**
+     * @brief Get the total reserved bytes
+     * @return The reserved bytes of all categories
+     */
+    size_t getTotalUsage();
+
+    /**
+     * @brief Get the bytes that can still be reserved
+     * @return Remaining budget, or SIZE_MAX if unlimited
+     */
+    size_t getAvailable();
+
+    /**
+     * @brief Log the usage per category
+     */
+    void logUsage();
+
+    /**
+     * @brief Get the resident set size of the process
+     * @return RSS in bytes, 0 if unavailable
+     */
+    static size_t getResidentBytes();
+
+private:
+    MemoryBudget() = default;
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    static constexpr int kNumCategories = 5;
+
+    bool fitsLocked(size_t bytes);
+    size_t residentOvershootLocked(size_t bytes);
+    size_t spill(size_t bytesNeeded);
+
+    size_t limit = 0;
+    size_t total = 0;
+    std::array<size_t, kNumCategories> usage{};
+    std::mutex mutex;
+    std::condition_variable released;
+
+    std::mutex spillMutex;
+    std::vector<std::pair<int, SpillHandler>> spillHandlers;
+    int nextSpillHandlerId = 0;
+
+    size_t cachedResident = 0;
+    std::chrono::steady_clock::time_point residentSampled;
+    std::chrono::steady_clock::time_point lastAdvisorySpill;
+};
+
+/**
+ * @class MemoryReservation
+ * @brief RAII handle for a MemoryBudget reservation
+ */
+class MemoryReservation {
+public:
+    MemoryReservation() = default;
+
+    /**
+     * @brief Reserve memory, waiting up to the default timeout
+     *
+     * If the budget cannot be met in time the memory is still recorded,
+     * since the caller needs it to make progress, and a warning is logged.
+     *
+     * @param category Kind of allocation
+     * @param bytes Size of the allocation
+     */
+    MemoryReservation(MemoryBudget::Category category, size_t bytes);
+
+    ~MemoryReservation() { reset(); }
+
+    MemoryReservation(const MemoryReservation&) = delete;
+    MemoryReservation& operator=(const MemoryReservation&) = delete;
+    MemoryReservation(MemoryReservation&& other) noexcept;
+    MemoryReservation& operator=(MemoryReservation&& other) noexcept;
+
+    /**
+     * @brief Reserve memory only if the budget allows it now, never waiting
+     *
+     * Any reservation held before is released first.
+     *
+     * @param category Kind of allocation
+     * @param bytes Size of the allocation
+     * @return true if the reservation was granted
+     */
+    bool tryReserve(MemoryBudget::Category category, size_t bytes);
+
+    /**
+     * @brief Release the reservation early
+     */
+    void reset();
+
+    /**
+     * @brief Get the reserved size
+     * @return The reserved bytes
+     */
+    size_t size() const { return bytes; }
+
+private:
+    MemoryBudget::Category category = MemoryBudget::Category::OTHER;
+    size_t bytes = 0;
+};
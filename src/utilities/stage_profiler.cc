@@ -0,0 +1,156 @@
+#include "stage_profiler.h"
+#include "logger.h"
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+constexpr auto kSampleInterval = std::chrono::milliseconds(10);
+
+double toMB(size_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+// JSON has no NaN or infinity
+std::string formatNumber(double value) {
+    if (!std::isfinite(value)) {
+        return "null";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+} // namespace
+
+StageProfiler::Scope::Scope(const std::string& name)
+    : name(name), start(std::chrono::steady_clock::now()) {
+    slot = StageProfiler::getInstance().beginStage();
+}
+
+StageProfiler::Scope::~Scope() {
+    Stage stage;
+    stage.name = name;
+    stage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stage.numItems = numItems;
+    StageProfiler::getInstance().endStage(slot, std::move(stage));
+}
+
+StageProfiler& StageProfiler::getInstance() {
+    static StageProfiler instance;
+    return instance;
+}
+
+StageProfiler::~StageProfiler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (sampler.joinable()) {
+        sampler.join();
+    }
+}
+
+size_t StageProfiler::beginStage() {
+    const size_t resident = MemoryBudget::getResidentBytes();
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t slot = std::find(activeSlots.begin(), activeSlots.end(), false) - activeSlots.begin();
+    if (slot == activeSlots.size()) {
+        activeSlots.push_back(false);
+        activePeaks.push_back(0);
+    }
+    activeSlots[slot] = true;
+    activePeaks[slot] = resident;
+    overallPeak = std::max(overallPeak, resident);
+    if (firstStart == std::chrono::steady_clock::time_point()) {
+        firstStart = std::chrono::steady_clock::now();
+    }
+    ++numActive;
+    if (!sampler.joinable()) {
+        sampler = std::thread(&StageProfiler::sample, this);
+    }
+    wake.notify_all();
+    return slot;
+}
+
+void StageProfiler::endStage(size_t slot, Stage stage) {
+    const size_t resident = MemoryBudget::getResidentBytes();
+    std::lock_guard<std::mutex> lock(mutex);
+    stage.peakResidentBytes = std::max(activePeaks[slot], resident);
+    overallPeak = std::max(overallPeak, resident);
+    activeSlots[slot] = false;
+    --numActive;
+    lastEnd = std::chrono::steady_clock::now();
+    LOG_INFO("Stage %s: %.2f s, peak %.0f MB", stage.name.c_str(), stage.seconds,
+             toMB(stage.peakResidentBytes));
+    stages.push_back(std::move(stage));
+}
+
+void StageProfiler::sample() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wake.wait_for(lock, kSampleInterval, [this] { return stopping; });
+        if (stopping || numActive == 0) {
+            continue;
+        }
+        lock.unlock();
+        const size_t resident = MemoryBudget::getResidentBytes();
+        lock.lock();
+        for (size_t slot = 0; slot < activeSlots.size(); ++slot) {
+            if (activeSlots[slot]) {
+                activePeaks[slot] = std::max(activePeaks[slot], resident);
+            }
+        }
+        overallPeak = std::max(overallPeak, resident);
+    }
+}
+
+std::vector<StageProfiler::Stage> StageProfiler::getStages() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stages;
+}
+
+size_t StageProfiler::getPeakResidentBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return overallPeak;
+}
+
+bool StageProfiler::writeJson(const std::string& path,
+                              const std::vector<std::pair<std::string, double>>& metrics) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        LOG_ERROR("Failed to write %s", path.c_str());
+        return false;
+    }
+    const double totalSeconds = stages.empty() ? 0.0
+        : std::chrono::duration<double>(lastEnd - firstStart).count();
+    file << "{\n";
+    file << "  \"total_time\": " << formatNumber(totalSeconds) << ",\n";
+    file << "  \"peak_memory_mb\": " << formatNumber(toMB(overallPeak)) << ",\n";
+    file << "  \"stages\": [";
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const Stage& stage = stages[i];
+        const double throughput = stage.numItems > 0 && stage.seconds > 0.0
+            ? stage.numItems / stage.seconds : 0.0;
+        file << (i == 0 ? "\n" : ",\n");
+        file << "    {\"name\": \"" << stage.name << "\", \"time\": " << formatNumber(stage.seconds)
+             << ", \"peak_memory_mb\": " << formatNumber(toMB(stage.peakResidentBytes))
+             << ", \"items\": " << stage.numItems
+             << ", \"throughput\": " << formatNumber(throughput) << "}";
+    }
+    file << (stages.empty() ? "],\n" : "\n  ],\n");
+    file << "  \"metrics\": {";
+    for (size_t i = 0; i < metrics.size(); ++i) {
+        file << (i == 0 ? "\n" : ",\n");
+        file << "    \"" << metrics[i].first << "\": " << formatNumber(metrics[i].second);
+    }
+    file << (metrics.empty() ? "}\n" : "\n  }\n");
+    file << "}\n";
+    return static_cast<bool>(file);
+}
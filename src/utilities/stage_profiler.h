@@ -0,0 +1,119 @@
+/**
+ * @file stage_profiler.h
+ * @brief Wall time, peak memory and throughput of the pipeline stages
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @class StageProfiler
+ * @brief Singleton that records every stage of a run for benchmarking
+ *
+ * A stage is timed by a Scope. While any scope is open, a sampler thread
+ * reads the resident set size of the process every few milliseconds and
+ * keeps the peak of each open stage, so memory that is allocated and
+ * freed within a stage is still seen. A stage may report the items it
+ * processed (images, pairs, points) for its throughput.
+ *
+ * writeJson() writes the stages together with extra metrics, such as pose
+ * accuracy, in the format read by scripts/benchmark.py.
+ */
+class StageProfiler {
+public:
+    /**
+     * @struct Stage
+     * @brief Measurements of one finished stage
+     */
+    struct Stage {
+        std::string name;
+        double seconds = 0.0;
+        size_t peakResidentBytes = 0;
+        size_t numItems = 0;      /**< Items processed, 0 if not reported */
+    };
+
+    /**
+     * @class Scope
+     * @brief Times a stage from construction to destruction
+     */
+    class Scope {
+    public:
+        /**
+         * @brief Start a stage
+         * @param name Stage name, e.g. "features"
+         */
+        explicit Scope(const std::string& name);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        /**
+         * @brief Report the number of items the stage processed
+         * @param numItems Item count
+         */
+        void setItems(size_t numItems) { this->numItems = numItems; }
+
+    private:
+        std::string name;
+        size_t numItems = 0;
+        size_t slot = 0;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    /**
+     * @brief Get the singleton instance of the StageProfiler
+     * @return Reference to the StageProfiler instance
+     */
+    static StageProfiler& getInstance();
+
+    /**
+     * @brief Get the finished stages in the order they finished
+     * @return The stages
+     */
+    std::vector<Stage> getStages();
+
+    /**
+     * @brief Get the peak resident set size seen while any stage ran
+     * @return Peak RSS in bytes
+     */
+    size_t getPeakResidentBytes();
+
+    /**
+     * @brief Write the stages and extra metrics as JSON
+     * @param path Output file
+     * @param metrics Extra top-level numbers, e.g. {"registered_fraction", 0.98}
+     * @return true on success
+     */
+    bool writeJson(const std::string& path, const std::vector<std::pair<std::string, double>>& metrics);
+
+private:
+    StageProfiler() = default;
+    ~StageProfiler();
+    StageProfiler(const StageProfiler&) = delete;
+    StageProfiler& operator=(const StageProfiler&) = delete;
+
+    size_t beginStage();
+    void endStage(size_t slot, Stage stage);
+    void sample();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread sampler;
+    bool stopping = false;
+    std::vector<size_t> activePeaks;  /**< Peak RSS per open scope slot */
+    std::vector<bool> activeSlots;
+    size_t numActive = 0;
+    size_t overallPeak = 0;
+    std::vector<Stage> stages;
+    std::chrono::steady_clock::time_point firstStart;
+    std::chrono::steady_clock::time_point lastEnd;
+};
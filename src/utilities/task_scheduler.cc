@@ -0,0 +1,275 @@
+#include "task_scheduler.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+thread_local int currentWorkerIndex = -1;
+
+// Sleep bounds of a worker waiting on a task group with nothing to run
+constexpr std::chrono::microseconds kMinBackoff(50);
+constexpr std::chrono::microseconds kMaxBackoff(2000);
+
+} // namespace
+
+TaskScheduler& TaskScheduler::getInstance() {
+    static TaskScheduler instance;
+    return instance;
+}
+
+TaskScheduler::~TaskScheduler() {
+    shutdown();
+}
+
+void TaskScheduler::initialize(const Options& requested) {
+    std::lock_guard<std::mutex> lifecycleLock(lifecycleMutex);
+    if (!workers.empty()) {
+        return;
+    }
+
+    const int numCores = std::max(1u, std::thread::hardware_concurrency());
+    options = requested;
+    options.numInferenceThreads = std::clamp(options.numInferenceThreads, 0, numCores - 1);
+    if (options.numWorkers <= 0) {
+        options.numWorkers = std::max(1, numCores - options.numInferenceThreads);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = false;
+    }
+    queues.clear();
+    for (int i = 0; i < options.numWorkers; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int i = 0; i < options.numWorkers; ++i) {
+        workers.emplace_back(&TaskScheduler::workerLoop, this, i);
+    }
+    started.store(true, std::memory_order_release);
+
+    LOG_INFO("Task scheduler: %d workers, %d cores reserved for inference%s",
+             options.numWorkers, options.numInferenceThreads,
+             options.pinThreads ? ", pinned" : "");
+}
+
+void TaskScheduler::shutdown() {
+    std::lock_guard<std::mutex> lifecycleLock(lifecycleMutex);
+    started.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void TaskScheduler::ensureStarted() {
+    if (!started.load(std::memory_order_acquire)) {
+        // Started lazily with one worker per core if nobody configured it;
+        // initialize() serializes concurrent first callers on the lifecycle mutex
+        initialize(Options());
+    }
+}
+
+void TaskScheduler::submit(std::function<void()> task, Priority priority) {
+    ensureStarted();
+
+    const int worker = getCurrentWorkerIndex();
+    const size_t queueIndex = worker >= 0
+        ? static_cast<size_t>(worker)
+        : nextQueue.fetch_add(1) % queues.size();
+
+    // Count the task before it becomes visible so a thief never sees a
+    // queued task while the counter is still zero.
+    pendingTasks.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[queueIndex]->mutex);
+        queues[queueIndex]->tasks[static_cast<int>(priority)].push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+void TaskScheduler::parallelFor(size_t begin, size_t end,
+                                const std::function<void(size_t)>& fn,
+                                Priority priority) {
+    if (begin >= end) {
+        return;
+    }
+    ensureStarted();
+    const size_t count = end - begin;
+    const size_t numChunks = std::min(count, static_cast<size_t>(std::max(1, getNumWorkers()) * 4));
+    const size_t chunkSize = (count + numChunks - 1) / numChunks;
+
+    TaskGroup group(*this);
+    for (size_t chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize) {
+        const size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+        group.run([&fn, chunkBegin, chunkEnd] {
+            for (size_t i = chunkBegin; i < chunkEnd; ++i) {
+                fn(i);
+            }
+        }, priority);
+    }
+    group.wait();
+}
+
+bool TaskScheduler::runPendingTask() {
+    std::function<void()> task;
+    if (!popTask(getCurrentWorkerIndex(), task)) {
+        return false;
+    }
+    try {
+        task();
+    } catch (const std::exception& e) {
+        LOG_ERROR("Unhandled exception in scheduled task: %s", e.what());
+    }
+    return true;
+}
+
+int TaskScheduler::getCurrentWorkerIndex() {
+    return currentWorkerIndex;
+}
+
+void* TaskScheduler::spawnExternalThread(void (*fn)(void*), void* param) {
+    const int core = options.numInferenceThreads > 0
+        ? options.numWorkers + nextInferenceCore.fetch_add(1) % options.numInferenceThreads
+        : -1;
+    const bool pin = options.pinThreads && core >= 0;
+    return new std::thread([fn, param, core, pin] {
+        if (pin) {
+            pinCurrentThread(core);
+        }
+        fn(param);
+    });
+}
+
+void TaskScheduler::joinExternalThread(void* handle) {
+    auto* thread = static_cast<std::thread*>(handle);
+    if (thread->joinable()) {
+        thread->join();
+    }
+    delete thread;
+}
+
+bool TaskScheduler::pinCurrentThread(int core) {
+#if defined(__linux__)
+    const int numCores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core % numCores, &cpuset);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+#else
+    // macOS only offers affinity hints; leave placement to the kernel
+    (void)core;
+    return false;
+#endif
+}
+
+void TaskScheduler::workerLoop(int workerIndex) {
+    currentWorkerIndex = workerIndex;
+    if (options.pinThreads && !pinCurrentThread(workerIndex)) {
+        LOG_DEBUG("Could not pin worker %d", workerIndex);
+    }
+
+    while (true) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || pendingTasks.load() > 0; });
+        if (stopping && pendingTasks.load() == 0) {
+            break;
+        }
+    }
+    currentWorkerIndex = -1;
+}
+
+bool TaskScheduler::popTask(int workerIndex, std::function<void()>& task) {
+    if (queues.empty() || pendingTasks.load() == 0) {
+        return false;
+    }
+    const size_t numQueues = queues.size();
+    for (int priority = 0; priority < kNumPriorities; ++priority) {
+        // Own queue first, newest task first
+        if (workerIndex >= 0) {
+            WorkerQueue& own = *queues[workerIndex];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            auto& tasks = own.tasks[priority];
+            if (!tasks.empty()) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+                pendingTasks.fetch_sub(1);
+                return true;
+            }
+        }
+        // Then steal the oldest task of the same priority from the others
+        const size_t start = workerIndex >= 0 ? static_cast<size_t>(workerIndex) + 1 : 0;
+        for (size_t offset = 0; offset < numQueues; ++offset) {
+            const size_t victim = (start + offset) % numQueues;
+            if (static_cast<int>(victim) == workerIndex) {
+                continue;
+            }
+            WorkerQueue& other = *queues[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            auto& tasks = other.tasks[priority];
+            if (!tasks.empty()) {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                pendingTasks.fetch_sub(1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskGroup::run(std::function<void()> task, TaskScheduler::Priority priority) {
+    outstanding.fetch_add(1);
+    scheduler.submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Unhandled exception in task group: %s", e.what());
+        }
+        // Decrement under the lock so that wait() cannot return, and the
+        // group be destroyed, while this task still touches it.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (outstanding.fetch_sub(1) == 1) {
+            done.notify_all();
+        }
+    }, priority);
+}
+
+void TaskGroup::wait() {
+    if (TaskScheduler::getCurrentWorkerIndex() >= 0) {
+        // Blocking a worker could starve the tasks we wait for; help instead,
+        // and sleep with a growing timeout while the remaining tasks run elsewhere
+        auto backoff = kMinBackoff;
+        while (outstanding.load() > 0) {
+            if (scheduler.runPendingTask()) {
+                backoff = kMinBackoff;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait_for(lock, backoff, [this] { return outstanding.load() == 0; });
+            backoff = std::min(backoff * 2, kMaxBackoff);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return outstanding.load() == 0; });
+}
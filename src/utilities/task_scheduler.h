@@ -0,0 +1,198 @@
+/**
+ * @file task_scheduler.h
+ * @brief Process-wide work-stealing task scheduler
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class TaskScheduler
+ * @brief Singleton pool of worker threads shared by all pipeline stages
+ *
+ * Every worker owns a deque per priority. Tasks submitted from a worker go
+ * to its own deque and are popped LIFO for cache locality; idle workers
+ * steal FIFO from the others. Higher priorities are always drained first,
+ * across all workers, before lower ones are considered.
+ *
+ * The cores not used by the workers are left to ONNX Runtime, whose global
+ * intra-op pool is created through spawnExternalThread() so that it can be
+ * pinned to its own cores instead of competing with the workers.
+ */
+class TaskScheduler {
+public:
+    /**
+     * @enum Priority
+     * @brief Scheduling priority of a task
+     */
+    enum class Priority {
+        HIGH = 0,   /**< Latency sensitive work, e.g. draining downstream stages */
+        NORMAL = 1, /**< Default priority */
+        LOW = 2     /**< Work that only feeds more work, e.g. new extractions */
+    };
+
+    /**
+     * @struct Options
+     * @brief Thread layout of the scheduler
+     */
+    struct Options {
+        int numWorkers = 0;         /**< Worker threads, 0 for all cores minus inference threads */
+        int numInferenceThreads = 0;/**< Cores left to ONNX Runtime */
+        bool pinThreads = false;    /**< Pin workers and inference threads to cores */
+    };
+
+    /**
+     * @brief Get the singleton instance of the TaskScheduler
+     * @return Reference to the TaskScheduler instance
+     */
+    static TaskScheduler& getInstance();
+
+    /**
+     * @brief Start the worker threads; later calls are ignored
+     * @param options Thread layout
+     */
+    void initialize(const Options& options);
+
+    /**
+     * @brief Stop and join all worker threads after draining queued tasks
+     */
+    void shutdown();
+
+    /**
+     * @brief Queue a task, starting the workers with default options if needed
+     * @param task The task to run
+     * @param priority Scheduling priority
+     */
+    void submit(std::function<void()> task, Priority priority = Priority::NORMAL);
+
+    /**
+     * @brief Run fn(i) for every i in [begin, end) and wait for completion
+     * @param begin First index
+     * @param end One past the last index
+     * @param fn Body of the loop
+     * @param priority Scheduling priority of the chunks
+     */
+    void parallelFor(size_t begin, size_t end, const std::function<void(size_t)>& fn,
+                     Priority priority = Priority::NORMAL);
+
+    /**
+     * @brief Run one queued task on the calling worker, if any is available
+     * @return true if a task was run
+     */
+    bool runPendingTask();
+
+    /**
+     * @brief Get the number of worker threads
+     * @return The number of workers, 0 before initialize()
+     */
+    int getNumWorkers() const { return started.load(std::memory_order_acquire) ? options.numWorkers : 0; }
+
+    /**
+     * @brief Get the number of cores reserved for ONNX Runtime
+     * @return The number of inference threads
+     */
+    int getNumInferenceThreads() const { return options.numInferenceThreads; }
+
+    /**
+     * @brief Get the index of the calling worker
+     * @return The worker index, or -1 if not called from a worker
+     */
+    static int getCurrentWorkerIndex();
+
+    /**
+     * @brief Start a thread outside the pool on one of the inference cores
+     * @param fn Thread entry point
+     * @param param Argument passed to fn
+     * @return Opaque handle for joinExternalThread()
+     */
+    void* spawnExternalThread(void (*fn)(void*), void* param);
+
+    /**
+     * @brief Join a thread started with spawnExternalThread()
+     * @param handle Handle returned by spawnExternalThread()
+     */
+    void joinExternalThread(void* handle);
+
+    /**
+     * @brief Pin the calling thread to a core
+     * @param core Index of the core
+     * @return true if the affinity was applied
+     */
+    static bool pinCurrentThread(int core);
+
+private:
+    TaskScheduler() = default;
+    ~TaskScheduler();
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    static constexpr int kNumPriorities = 3;
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks[kNumPriorities];
+    };
+
+    void ensureStarted();
+    void workerLoop(int workerIndex);
+    bool popTask(int workerIndex, std::function<void()>& task);
+
+    Options options;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> pendingTasks{0};
+    std::atomic<int> nextInferenceCore{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::mutex lifecycleMutex;
+    std::atomic<bool> started{false}; /**< Workers and queues are set up, published after initialize() */
+};
+
+/**
+ * @class TaskGroup
+ * @brief Tracks a set of scheduler tasks so they can be waited on together
+ *
+ * Tasks may add more tasks to the group while it is being waited on. A
+ * worker that waits keeps executing queued tasks instead of blocking.
+ */
+class TaskGroup {
+public:
+    /**
+     * @brief Construct a group on a scheduler
+     * @param scheduler The scheduler running the tasks
+     */
+    explicit TaskGroup(TaskScheduler& scheduler = TaskScheduler::getInstance())
+        : scheduler(scheduler) {}
+
+    ~TaskGroup() { wait(); }
+
+    /**
+     * @brief Submit a task belonging to this group
+     * @param task The task to run
+     * @param priority Scheduling priority
+     */
+    void run(std::function<void()> task,
+             TaskScheduler::Priority priority = TaskScheduler::Priority::NORMAL);
+
+    /**
+     * @brief Wait until all tasks of the group have finished
+     */
+    void wait();
+
+private:
+    TaskScheduler& scheduler;
+    std::atomic<size_t> outstanding{0};
+    std::mutex mutex;
+    std::condition_variable done;
+};